@@ -33,6 +33,74 @@ AC_CHECK_LIB(jpeg, jpeg_CreateDecompress, JPEG_LIB="-ljpeg",
 AC_SUBST(JPEG_LIB)
 ])
 
+dnl Usage XFORMS_CHECK_LIB_PNG: Checks for the png library. Sets PNG_LIB
+dnl and defines HAVE_LIBPNG if it's found, otherwise PNG images are read
+dnl and written via the netpbm filter programs.
+AC_DEFUN([XFORMS_CHECK_LIB_PNG],[
+### Check for png library
+AC_CHECK_HEADER(png.h, xforms_have_png_h=yes, xforms_have_png_h=no)
+if test x$xforms_have_png_h = xyes ; then
+  AC_CHECK_LIB(png, png_create_read_struct, [PNG_LIB="-lpng"
+    AC_DEFINE(HAVE_LIBPNG, 1, [Define if the png library can be used])],
+    , [-lz -lm])
+fi
+AC_SUBST(PNG_LIB)
+])
+
+dnl Usage XFORMS_CHECK_LIB_Z: Checks for zlib and a way to put a stdio
+dnl stream on top of it (fopencookie() or funopen()). Sets Z_LIB and
+dnl defines HAVE_ZLIB if it can be used for reading and writing gzip
+dnl compressed images.
+AC_DEFUN([XFORMS_CHECK_LIB_Z],[
+### Check for zlib
+AC_CHECK_FUNCS([fopencookie funopen])
+AC_CHECK_HEADER(zlib.h, xforms_have_zlib_h=yes, xforms_have_zlib_h=no)
+if test x$xforms_have_zlib_h = xyes \
+   && test x$ac_cv_func_fopencookie$ac_cv_func_funopen != xnono ; then
+  AC_CHECK_LIB(z, gzdopen, [Z_LIB="-lz"
+    AC_DEFINE(HAVE_ZLIB, 1, [Define if zlib can be used for gzip'ed images])])
+fi
+AC_SUBST(Z_LIB)
+])
+
+dnl Usage XFORMS_CHECK_XSHM: Checks for the MIT-SHM extension (libXext,
+dnl the XShm.h header and SysV shared memory). Sets XEXT_LIB and defines
+dnl HAVE_XSHM if everything needed is found.
+AC_DEFUN([XFORMS_CHECK_XSHM],[
+### Check for the MIT-SHM extension
+SAVE_LIBS="$LIBS"
+LIBS="$X_PRE_LIBS $LIBS $X_LIBS -lX11 $X_EXTRA_LIBS"
+AC_CHECK_LIB(Xext, XShmAttach, xforms_have_xext=yes, xforms_have_xext=no)
+LIBS="$SAVE_LIBS"
+
+SAVE_CPPFLAGS="$CPPFLAGS"
+CPPFLAGS="$X_CFLAGS $CPPFLAGS"
+AC_CHECK_HEADERS([sys/ipc.h sys/shm.h])
+AC_CHECK_HEADER(X11/extensions/XShm.h, xforms_have_xshm_h=yes,
+	xforms_have_xshm_h=no, [#include <X11/Xlib.h>])
+CPPFLAGS="$SAVE_CPPFLAGS"
+
+if test x$xforms_have_xext = xyes \
+   && test x$xforms_have_xshm_h = xyes \
+   && test x$ac_cv_header_sys_shm_h = xyes ; then
+  XEXT_LIB="-lXext"
+  AC_DEFINE(HAVE_XSHM, 1,
+  [Define if the MIT-SHM extension can be used for displaying images])
+fi
+])
+
+dnl Usage XFORMS_CHECK_PTHREAD: Checks for POSIX threads. Sets PTHREAD_LIB
+dnl and defines HAVE_PTHREAD if they can be used.
+AC_DEFUN([XFORMS_CHECK_PTHREAD],[
+### Check for POSIX threads, used by the image library's worker threads
+AC_CHECK_HEADER(pthread.h, xforms_have_pthread_h=yes, xforms_have_pthread_h=no)
+if test x$xforms_have_pthread_h = xyes ; then
+  AC_CHECK_LIB(pthread, pthread_create, [PTHREAD_LIB="-lpthread"
+    AC_DEFINE(HAVE_PTHREAD, 1,
+    [Define if POSIX threads can be used for image processing])])
+fi
+])
+
 dnl Usage XFORMS_PATH_XPM: Checks for xpm library and header
 AC_DEFUN([XFORMS_PATH_XPM],[
 ### Check for Xpm library
@@ -0,0 +1,242 @@
+/*
+ *  This file is part of XForms.
+ *
+ *  XForms is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1, or
+ *  (at your option) any later version.
+ *
+ *  XForms is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with XForms; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 59 Temple Place - Suite 330, Boston,
+ *  MA 02111-1307, USA.
+ */
+
+
+/*
+ * Measures how fast images get converted between the different image
+ * types, for all the conversions flimage_convert() supports.
+ *
+ *  Usage: convbench [width height [rounds [threads]]]
+ *
+ * The default is a 2048x1536 image, 5 rounds and as many threads as
+ * there are processors. The time given for each conversion is the
+ * best of all rounds. No display is needed.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include "include/forms.h"
+#include "image/flimage.h"
+
+static struct {
+    int from,
+        to;
+} conversions[ ] = {
+    { FL_IMAGE_PACKED, FL_IMAGE_RGB    },
+    { FL_IMAGE_GRAY,   FL_IMAGE_RGB    },
+    { FL_IMAGE_GRAY16, FL_IMAGE_RGB    },
+    { FL_IMAGE_CI,     FL_IMAGE_RGB    },
+    { FL_IMAGE_RGB,    FL_IMAGE_PACKED },
+    { FL_IMAGE_CI,     FL_IMAGE_PACKED },
+    { FL_IMAGE_RGB,    FL_IMAGE_GRAY   },
+    { FL_IMAGE_PACKED, FL_IMAGE_GRAY   },
+    { FL_IMAGE_GRAY16, FL_IMAGE_GRAY   },
+    { FL_IMAGE_CI,     FL_IMAGE_GRAY   },
+    { FL_IMAGE_GRAY,   FL_IMAGE_GRAY16 },
+    { FL_IMAGE_RGB,    FL_IMAGE_CI     },
+    { FL_IMAGE_PACKED, FL_IMAGE_CI     },
+    { FL_IMAGE_GRAY,   FL_IMAGE_CI     },
+    { FL_IMAGE_GRAY16, FL_IMAGE_CI     },
+    { FL_IMAGE_RGB,    FL_IMAGE_MONO   },
+    { FL_IMAGE_PACKED, FL_IMAGE_MONO   },
+    { FL_IMAGE_GRAY,   FL_IMAGE_MONO   },
+    { FL_IMAGE_GRAY16, FL_IMAGE_MONO   },
+    { FL_IMAGE_CI,     FL_IMAGE_MONO   }
+};
+
+#define NCONVERSIONS  ( ( int ) ( sizeof conversions / sizeof *conversions ) )
+
+
+/***************************************
+ ***************************************/
+
+static double
+now( void )
+{
+    long sec,
+         usec;
+
+    fl_gettime( &sec, &usec );
+    return sec + 1.0e-6 * usec;
+}
+
+
+/***************************************
+ * Keeps the library from reporting progress
+ ***************************************/
+
+static int
+quiet( FL_IMAGE   * im   FL_UNUSED_ARG,
+       const char * msg  FL_UNUSED_ARG )
+{
+    return 0;
+}
+
+
+/***************************************
+ * Makes up an image of the requested type with smooth gradients and
+ * some noise
+ ***************************************/
+
+static FL_IMAGE *
+make_image( int type,
+            int w,
+            int h )
+{
+    FL_IMAGE *im = flimage_alloc( );
+    int x,
+        y,
+        r,
+        g,
+        b;
+
+    im->type = type;
+    im->w = w;
+    im->h = h;
+    im->map_len = 256;
+    im->gray_maxval = 4095;
+
+    if ( flimage_getmem( im ) < 0 )
+    {
+        fprintf( stderr, "Can't allocate %dx%d image\n", w, h );
+        exit( 1 );
+    }
+
+    if ( type == FL_IMAGE_CI )
+        for ( x = 0; x < 256; x++ )
+        {
+            im->red_lut[ x ]   = x;
+            im->green_lut[ x ] = ( x * 7 ) & 0xff;
+            im->blue_lut[ x ]  = 255 - x;
+        }
+
+    for ( y = 0; y < h; y++ )
+        for ( x = 0; x < w; x++ )
+        {
+            r = x * 255 / w;
+            g = y * 255 / h;
+            b = ( r + g + ( rand( ) & 0x1f ) ) / 2;
+
+            switch ( type )
+            {
+                case FL_IMAGE_RGB :
+                    im->red[ y ][ x ]   = r;
+                    im->green[ y ][ x ] = g;
+                    im->blue[ y ][ x ]  = b;
+                    im->alpha[ y ][ x ] = 0;
+                    break;
+
+                case FL_IMAGE_PACKED :
+                    im->packed[ y ][ x ] = FL_PACK( r, g, b );
+                    break;
+
+                case FL_IMAGE_GRAY :
+                    im->gray[ y ][ x ] = b;
+                    break;
+
+                case FL_IMAGE_GRAY16 :
+                    im->gray[ y ][ x ] = b * 16;
+                    break;
+
+                case FL_IMAGE_CI :
+                    im->ci[ y ][ x ] = b;
+                    break;
+            }
+        }
+
+    return im;
+}
+
+
+/***************************************
+ ***************************************/
+
+int
+main( int    argc,
+      char * argv[ ] )
+{
+    FLIMAGE_SETUP setup;
+    FL_IMAGE *im;
+    int w = 2048,
+        h = 1536,
+        rounds = 5,
+        i,
+        k;
+    double t,
+           best;
+
+    if ( argc > 2 && ( ( w = atoi( argv[ 1 ] ) ) <= 0
+                       || ( h = atoi( argv[ 2 ] ) ) <= 0 ) )
+    {
+        fprintf( stderr, "Usage: %s [width height [rounds [threads]]]\n",
+                 argv[ 0 ] );
+        return 1;
+    }
+
+    if ( argc > 3 && ( rounds = atoi( argv[ 3 ] ) ) <= 0 )
+        rounds = 5;
+
+    memset( &setup, 0, sizeof setup );
+    setup.visual_cue = quiet;
+    if ( argc > 4 )
+        setup.max_threads = atoi( argv[ 4 ] );
+    flimage_setup( &setup );
+
+    fprintf( stdout, "%dx%d, best of %d round(s)\n", w, h, rounds );
+
+    for ( k = 0; k < NCONVERSIONS; k++ )
+    {
+        for ( best = -1.0, i = 0; i < rounds; i++ )
+        {
+            im = make_image( conversions[ k ].from, w, h );
+
+            t = now( );
+            if ( flimage_convert( im, conversions[ k ].to, 256 ) < 0 )
+            {
+                fprintf( stderr, "Conversion failed\n" );
+                return 1;
+            }
+            t = now( ) - t;
+
+            if ( best < 0.0 || t < best )
+                best = t;
+
+            flimage_free( im );
+        }
+
+        fprintf( stdout, "  %-16s -> %-16s %9.2f ms %8.1f Mpixel/s\n",
+                 flimage_type_name( conversions[ k ].from ),
+                 flimage_type_name( conversions[ k ].to ),
+                 1.0e3 * best, best > 0.0 ? 1.0e-6 * w * h / best : 0.0 );
+    }
+
+    return 0;
+}
+
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
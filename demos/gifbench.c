@@ -0,0 +1,253 @@
+/*
+ *  This file is part of XForms.
+ *
+ *  XForms is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1, or
+ *  (at your option) any later version.
+ *
+ *  XForms is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with XForms; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 59 Temple Place - Suite 330, Boston,
+ *  MA 02111-1307, USA.
+ */
+
+
+/*
+ * Measures how fast (animated) GIF files get written and read, all
+ * frames included.
+ *
+ *  Usage: gifbench [giffile [rounds]]
+ *
+ * Without a file an animation of 24 frames of 640x480 pixels is made up,
+ * written to a temporary file and read back. With a file it just gets
+ * read (and the result written to a temporary file). No display is
+ * needed.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "include/forms.h"
+#include "image/flimage.h"
+
+#define NFRAMES   24
+#define MAXFRAMES 10000
+
+
+/***************************************
+ ***************************************/
+
+static double
+now( void )
+{
+    long sec,
+         usec;
+
+    fl_gettime( &sec, &usec );
+    return sec + 1.0e-6 * usec;
+}
+
+
+/***************************************
+ * Keeps the library from reporting progress
+ ***************************************/
+
+static int
+quiet( FL_IMAGE   * im   FL_UNUSED_ARG,
+       const char * msg  FL_UNUSED_ARG )
+{
+    return 0;
+}
+
+
+/***************************************
+ * Makes up an animation with a smooth background, a moving
+ * (noisy) square and some random dots
+ ***************************************/
+
+static FL_IMAGE *
+make_animation( int w,
+                int h,
+                int nframes )
+{
+    FL_IMAGE *first = NULL,
+             *prev = NULL,
+             *im;
+    int i,
+        x,
+        x0,
+        y;
+
+    for ( i = 0; i < nframes; i++ )
+    {
+        im = flimage_alloc( );
+        im->type = FL_IMAGE_CI;
+        im->w = w;
+        im->h = h;
+        im->map_len = 256;
+
+        if ( flimage_getmem( im ) < 0 )
+        {
+            fprintf( stderr, "Can't allocate %dx%d image\n", w, h );
+            exit( 1 );
+        }
+
+        for ( x = 0; x < 256; x++ )
+        {
+            im->red_lut[ x ]   = x;
+            im->green_lut[ x ] = ( x * 7 ) & 0xff;
+            im->blue_lut[ x ]  = 255 - x;
+        }
+
+        for ( y = 0; y < h; y++ )
+            for ( x = 0; x < w; x++ )
+                im->ci[ y ][ x ] = ( ( x + y + 4 * i ) / 8 ) & 0x7f;
+
+        for ( x0 = i * w / ( 2 * nframes ), y = h / 4; y < h / 2; y++ )
+            for ( x = x0; x < x0 + w / 4; x++ )
+                im->ci[ y ][ x ] = 128 + ( rand( ) & 0x7f );
+
+        for ( x = 0; x < w * h / 64; x++ )
+            im->ci[ rand( ) % h ][ rand( ) % w ] = rand( ) & 0xff;
+
+        im->modified = 1;
+
+        if ( prev )
+            prev->next = im;
+        else
+            first = im;
+        prev = im;
+    }
+
+    return first;
+}
+
+
+/***************************************
+ ***************************************/
+
+static int
+count_frames( FL_IMAGE * im )
+{
+    int n;
+
+    for ( n = 0; im; im = im->next )
+        n++;
+    return n;
+}
+
+
+/***************************************
+ ***************************************/
+
+int
+main( int    argc,
+      char * argv[ ] )
+{
+    FLIMAGE_SETUP setup;
+    FL_IMAGE *im,
+             *in;
+    char tmpname[ ] = "/tmp/gifbenchXXXXXX";
+    const char *file;
+    int rounds = 5,
+        nframes,
+        fd,
+        i;
+    double t,
+           t_write = 0.0,
+           t_read = 0.0,
+           mpix;
+
+    memset( &setup, 0, sizeof setup );
+    setup.max_frames = MAXFRAMES;
+    setup.no_auto_extension = 1;
+    setup.visual_cue = quiet;
+    flimage_setup( &setup );
+    flimage_enable_gif( );
+
+    if ( ( fd = mkstemp( tmpname ) ) < 0 )
+    {
+        fprintf( stderr, "Can't create temporary file\n" );
+        return 1;
+    }
+    close( fd );
+
+    if ( argc > 1 )
+    {
+        if ( ! ( im = flimage_load( argv[ 1 ] ) ) )
+        {
+            fprintf( stderr, "Can't load %s\n", argv[ 1 ] );
+            remove( tmpname );
+            return 1;
+        }
+    }
+    else
+        im = make_animation( 640, 480, NFRAMES );
+
+    if ( argc > 2 && ( rounds = atoi( argv[ 2 ] ) ) <= 0 )
+        rounds = 5;
+
+    nframes = count_frames( im );
+
+    for ( i = 0; i < rounds; i++ )
+    {
+        t = now( );
+        if ( flimage_dump( im, tmpname, "gif" ) < 0 )
+        {
+            fprintf( stderr, "Writing %s failed\n", tmpname );
+            break;
+        }
+        t_write += now( ) - t;
+    }
+
+    file = argc > 1 ? argv[ 1 ] : tmpname;
+
+    for ( i = 0; i < rounds; i++ )
+    {
+        t = now( );
+        if ( ! ( in = flimage_load( file ) ) )
+        {
+            fprintf( stderr, "Reading %s failed\n", file );
+            break;
+        }
+        t_read += now( ) - t;
+
+        if ( count_frames( in ) != nframes )
+            fprintf( stderr, "Got %d frames instead of %d\n",
+                     count_frames( in ), nframes );
+        flimage_free( in );
+    }
+
+    mpix = 1.0e-6 * im->w * im->h * nframes * rounds;
+
+    fprintf( stdout, "%dx%d, %d frame(s), %d round(s)\n", im->w, im->h,
+             nframes, rounds );
+    if ( t_write > 0.0 )
+        fprintf( stdout, "  write: %8.2f frames/s %8.2f Mpixel/s\n",
+                 nframes * rounds / t_write, mpix / t_write );
+    if ( t_read > 0.0 )
+        fprintf( stdout, "  read:  %8.2f frames/s %8.2f Mpixel/s\n",
+                 nframes * rounds / t_read, mpix / t_read );
+
+    flimage_free( im );
+    remove( tmpname );
+    return 0;
+}
+
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
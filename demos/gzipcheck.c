@@ -0,0 +1,325 @@
+/*
+ *  This file is part of XForms.
+ *
+ *  XForms is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1, or
+ *  (at your option) any later version.
+ *
+ *  XForms is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with XForms; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 59 Temple Place - Suite 330, Boston,
+ *  MA 02111-1307, USA.
+ */
+
+
+/*
+ * Checks that images written gzip'ed come back unchanged. A color and
+ * a gray scale image are written with each registered format that can
+ * be written, once plain and once as "name.<extension>.gz", and both
+ * files are read back in. The image read from the compressed file must
+ * be of the same format, type and size and have the same pixels as the
+ * one read from the plain file. Formats whose plain files can't be read
+ * back (e.g. because an external program is missing) and XPM (reading
+ * it needs a display) are skipped.
+ *
+ *  Usage: gzipcheck [-v]
+ *
+ * The files are written to a temporary directory that gets removed
+ * afterwards. Returns 0 if all tests pass, 1 otherwise. No display is
+ * needed.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "include/forms.h"
+#include "image/flimage.h"
+
+static int verbose;
+
+
+/***************************************
+ ***************************************/
+
+static int
+no_cue( FL_IMAGE   * im  FL_UNUSED_ARG,
+        const char * s   FL_UNUSED_ARG )
+{
+    return 0;
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+no_error( FL_IMAGE   * im  FL_UNUSED_ARG,
+          const char * s   FL_UNUSED_ARG )
+{
+}
+
+
+/***************************************
+ * Creates an image with gradients and sharp edges
+ ***************************************/
+
+static FL_IMAGE *
+make_image( int type )
+{
+    FL_IMAGE *im = flimage_alloc( );
+    int x,
+        y;
+
+    im->type = type;
+    im->w = 61;
+    im->h = 37;
+
+    if ( flimage_getmem( im ) < 0 )
+    {
+        fprintf( stderr, "Can't get memory for an image\n" );
+        exit( 1 );
+    }
+
+    for ( y = 0; y < im->h; y++ )
+        for ( x = 0; x < im->w; x++ )
+        {
+            unsigned int v = ( x * 4 + y * 3 ) & 0xff,
+                         e = ( ( x / 4 + y / 3 ) & 1 ) ? 255 : 0;
+
+            if ( type == FL_IMAGE_RGB )
+            {
+                im->red[   y ][ x ] = v;
+                im->green[ y ][ x ] = e;
+                im->blue[  y ][ x ] = ( x * 255 ) / im->w;
+            }
+            else
+                im->gray[ y ][ x ] = ( x + y ) & 1 ? v : e;
+        }
+
+    return im;
+}
+
+
+/***************************************
+ * Returns 0 if both images have the same pixels, 1 otherwise
+ ***************************************/
+
+static int
+differ( FL_IMAGE * a,
+        FL_IMAGE * b )
+{
+    int x,
+        y;
+
+    for ( y = 0; y < a->h; y++ )
+        for ( x = 0; x < a->w; x++ )
+            switch ( a->type )
+            {
+                case FL_IMAGE_RGB :
+                    if (    a->red[   y ][ x ] != b->red[   y ][ x ]
+                         || a->green[ y ][ x ] != b->green[ y ][ x ]
+                         || a->blue[  y ][ x ] != b->blue[  y ][ x ] )
+                        return 1;
+                    break;
+
+                case FL_IMAGE_PACKED :
+                    if ( a->packed[ y ][ x ] != b->packed[ y ][ x ] )
+                        return 1;
+                    break;
+
+                case FL_IMAGE_GRAY :
+                case FL_IMAGE_GRAY16 :
+                    if ( a->gray[ y ][ x ] != b->gray[ y ][ x ] )
+                        return 1;
+                    break;
+
+                default :                        /* CI and MONO */
+                {
+                    int i = a->ci[ y ][ x ],
+                        j = b->ci[ y ][ x ];
+
+                    if (    a->red_lut[ i ]   != b->red_lut[ j ]
+                         || a->green_lut[ i ] != b->green_lut[ j ]
+                         || a->blue_lut[ i ]  != b->blue_lut[ j ] )
+                        return 1;
+                    break;
+                }
+            }
+
+    return 0;
+}
+
+
+/***************************************
+ * Writes the image plain and gzip'ed in the given format and compares
+ * what gets read back. Returns the number of failures (0 or 1), -1 if
+ * the format got skipped.
+ ***************************************/
+
+static int
+check_format( const char                * dir,
+              const char                * what,
+              int                         type,
+              const FLIMAGE_FORMAT_INFO * info )
+{
+    FL_IMAGE *im,
+             *plain = NULL,
+             *zipped = NULL;
+    char pname[ 512 ],
+         zname[ 512 ];
+    const char *err = NULL;
+
+    sprintf( pname, "%s/%s", dir, what );
+    sprintf( zname, "%s/%s.%s.gz", dir, what, info->extension );
+
+    im = make_image( type );
+    if ( flimage_dump( im, pname, info->short_name ) < 0 )
+    {
+        flimage_free( im );
+        return -1;
+    }
+    strcpy( pname, im->outfile );
+    flimage_free( im );
+
+    if ( ! ( plain = flimage_load( pname ) ) )
+    {
+        remove( pname );
+        return -1;
+    }
+
+    im = make_image( type );
+    if ( flimage_dump( im, zname, "gzip" ) < 0 )
+        err = "writing failed";
+    flimage_free( im );
+
+    if ( err )
+        /* empty */ ;
+    else if ( ! ( zipped = flimage_load( zname ) ) )
+        err = "reading failed";
+    else if ( strcmp( plain->fmt_name, zipped->fmt_name ) )
+        err = "written in a different format";
+    else if ( plain->type != zipped->type )
+        err = "type differs";
+    else if ( plain->w != zipped->w || plain->h != zipped->h )
+        err = "size differs";
+    else if ( differ( plain, zipped ) )
+        err = "pixels differ";
+
+    if ( err || verbose )
+        fprintf( stdout, "%-5s %-8s: %s\n", what, info->short_name,
+                 err ? err : "ok" );
+
+    flimage_free( plain );
+    if ( zipped )
+        flimage_free( zipped );
+    remove( pname );
+    remove( zname );
+
+    return err != NULL;
+}
+
+
+/***************************************
+ ***************************************/
+
+int
+main( int    argc,
+      char * argv[ ] )
+{
+    char dir[ ] = "/tmp/gzipcheckXXXXXX";
+    FLIMAGE_SETUP setup;
+    int i,
+        n,
+        status,
+        errors = 0,
+        cases = 0,
+        skipped = 0;
+
+    verbose = argc > 1 && ! strcmp( argv[ 1 ], "-v" );
+
+    if ( ! mkdtemp( dir ) )
+    {
+        fprintf( stderr, "Can't create a temporary directory\n" );
+        return 1;
+    }
+
+    /* Errors are expected for formats that get skipped */
+
+    memset( &setup, 0, sizeof setup );
+    setup.visual_cue    = no_cue;
+    setup.error_message = no_error;
+    flimage_setup( &setup );
+
+    flimage_enable_bmp( );
+    flimage_enable_fits( );
+    flimage_enable_gif( );
+    flimage_enable_jpeg( );
+    flimage_enable_png( );
+    flimage_enable_ps( );
+    flimage_enable_sgi( );
+    flimage_enable_tiff( );
+    flimage_enable_xbm( );
+    flimage_enable_xpm( );
+    flimage_enable_xwd( );
+
+    n = flimage_get_number_of_formats( );
+
+    for ( i = 1; i <= n; i++ )
+    {
+        const FLIMAGE_FORMAT_INFO *info = flimage_get_format_info( i );
+
+        if (    ! info
+             || ! ( info->read_write & FLIMAGE_WRITABLE )
+             || ! strcmp( info->short_name, "gzip" ) )
+            continue;
+
+        /* Reading XPM files needs a display for looking up colors */
+
+        if ( ! strcmp( info->short_name, "xpm" ) )
+        {
+            fprintf( stdout, "%-14s: skipped\n", info->short_name );
+            skipped++;
+            continue;
+        }
+
+        if ( ( status = check_format( dir, "color", FL_IMAGE_RGB,
+                                      info ) ) < 0 )
+        {
+            fprintf( stdout, "%-14s: skipped\n", info->short_name );
+            skipped++;
+            continue;
+        }
+        errors += status;
+
+        if ( ( status = check_format( dir, "gray", FL_IMAGE_GRAY,
+                                      info ) ) > 0 )
+            errors += status;
+
+        cases++;
+    }
+
+    rmdir( dir );
+
+    fprintf( stdout, "%d formats checked, %d skipped, %d failures\n",
+             cases, skipped, errors );
+
+    return errors ? 1 : 0;
+}
+
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,202 @@
+/*
+ *  This file is part of XForms.
+ *
+ *  XForms is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1, or
+ *  (at your option) any later version.
+ *
+ *  XForms is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with XForms; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 59 Temple Place - Suite 330, Boston,
+ *  MA 02111-1307, USA.
+ */
+
+
+/*
+ * Measures how long it takes the main loop to dispatch input on one of
+ * many file descriptors watched with fl_add_io_callback().
+ *
+ *  Usage: iobench [descriptors [rounds]]
+ *
+ * Per default 1000 pipes are watched. In each round a byte gets written
+ * to a randomly picked pipe and fl_check_forms() is called until the
+ * callback for it has read the byte. For comparison the same is done
+ * with just a single watched pipe.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "include/forms.h"
+
+static int *rfd,
+           *wfd;
+static long ncalls;
+
+
+/***************************************
+ ***************************************/
+
+static double
+now( void )
+{
+    long sec,
+         usec;
+
+    fl_gettime( &sec, &usec );
+    return sec + 1.0e-6 * usec;
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+read_cb( int    fd,
+         void * data  FL_UNUSED_ARG )
+{
+    char c;
+
+    if ( read( fd, &c, 1 ) == 1 )
+        ncalls++;
+}
+
+
+/***************************************
+ * Creates the pipes. The write ends get moved to high numbers, so the
+ * watched read ends remain below FD_SETSIZE as long as possible and
+ * the select() fallback can be compared.
+ ***************************************/
+
+static int
+make_pipes( int n )
+{
+    struct rlimit rl;
+    int p[ 2 ],
+        i;
+
+    if ( getrlimit( RLIMIT_NOFILE, &rl ) == 0 && rl.rlim_cur < rl.rlim_max )
+    {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit( RLIMIT_NOFILE, &rl );
+    }
+
+    rfd = fl_malloc( n * sizeof *rfd );
+    wfd = fl_malloc( n * sizeof *wfd );
+
+    for ( i = 0; i < n; i++ )
+    {
+        if ( pipe( p ) < 0 )
+            return i;
+
+        rfd[ i ] = p[ 0 ];
+        if ( ( wfd[ i ] = fcntl( p[ 1 ], F_DUPFD, n + 64 ) ) < 0 )
+            wfd[ i ] = p[ 1 ];
+        else
+            close( p[ 1 ] );
+    }
+
+    return n;
+}
+
+
+/***************************************
+ * Returns the average time per round in micro-seconds
+ ***************************************/
+
+static double
+run_bench( int nwatched,
+           int rounds )
+{
+    double t;
+    long expected;
+    int i,
+        k;
+
+    for ( i = 0; i < nwatched; i++ )
+        fl_add_io_callback( rfd[ i ], FL_READ, read_cb, NULL );
+
+    ncalls = 0;
+    t = now( );
+
+    for ( k = 0; k < rounds; k++ )
+    {
+        if ( write( wfd[ rand( ) % nwatched ], "", 1 ) != 1 )
+            break;
+
+        expected = ncalls + 1;
+        while ( ncalls < expected )
+            fl_check_forms( );
+    }
+
+    t = now( ) - t;
+
+    for ( i = 0; i < nwatched; i++ )
+        fl_remove_io_callback( rfd[ i ], FL_READ, read_cb );
+
+    return 1.0e6 * t / rounds;
+}
+
+
+/***************************************
+ ***************************************/
+
+int
+main( int    argc,
+      char * argv[ ] )
+{
+    FL_FORM *form;
+    int n = 1000,
+        rounds = 20000;
+    double t1,
+           tn;
+
+    fl_initialize( &argc, argv, "FormDemo", 0, 0 );
+
+    if ( argc > 1 && ( n = atoi( argv[ 1 ] ) ) <= 0 )
+        n = 1000;
+    if ( argc > 2 && ( rounds = atoi( argv[ 2 ] ) ) <= 0 )
+        rounds = 20000;
+
+    if ( ( n = make_pipes( n ) ) <= 0 )
+    {
+        fprintf( stderr, "Can't create pipes\n" );
+        return 1;
+    }
+
+    form = fl_bgn_form( FL_UP_BOX, 240, 60 );
+    fl_add_text( FL_NORMAL_TEXT, 10, 10, 220, 40, "Watching pipes..." );
+    fl_end_form( );
+    fl_show_form( form, FL_PLACE_CENTER, FL_FULLBORDER, "iobench" );
+    fl_check_forms( );
+
+    t1 = run_bench( 1, rounds );
+    tn = run_bench( n, rounds );
+
+    fprintf( stdout, "%d round(s)\n", rounds );
+    fprintf( stdout, "  %5d descriptor(s): %8.2f us per dispatch\n", 1, t1 );
+    fprintf( stdout, "  %5d descriptor(s): %8.2f us per dispatch\n", n, tn );
+
+    fl_finish( );
+    return 0;
+}
+
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
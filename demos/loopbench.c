@@ -0,0 +1,349 @@
+/*
+ *  This file is part of XForms.
+ *
+ *  XForms is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1, or
+ *  (at your option) any later version.
+ *
+ *  XForms is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with XForms; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 59 Temple Place - Suite 330, Boston,
+ *  MA 02111-1307, USA.
+ */
+
+
+/*
+ * Measures how much CPU time the main loop uses while waiting, how often
+ * it wakes up and how long it takes until an X event gets handled, once
+ * for an idle application and once for a busy one (with an idle callback
+ * and a timer that fires every 10 ms).
+ *
+ *  Usage: loopbench [seconds]
+ *
+ * During the "idle" and "busy" runs (5 seconds each per default) a
+ * second process sends a ClientMessage to the form every 20 ms over its
+ * own connection to the X server, carrying the time it was sent at. The
+ * "quiet" run that comes first sends nothing, so each wakeup it reports
+ * is one the main loop didn't need.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "include/forms.h"
+
+#define SEND_INTERVAL  20      /* ms */
+#define TIMER_INTERVAL 10      /* ms */
+
+typedef struct {
+    FL_FORM   * form;
+    FL_OBJECT * stop;
+} FD_bench;
+
+static FD_bench * create_form_bench( void );
+
+static Atom bench_atom;
+static int busy;
+static long nevents,
+            nidle,
+            ntimer;
+static double lat_sum,
+              lat_max;
+
+
+/***************************************
+ ***************************************/
+
+static double
+now( void )
+{
+    long sec,
+         usec;
+
+    fl_gettime( &sec, &usec );
+    return sec + 1.0e-6 * usec;
+}
+
+
+/***************************************
+ ***************************************/
+
+static double
+cpu_time( void )
+{
+    struct rusage ru;
+
+    getrusage( RUSAGE_SELF, &ru );
+    return   ru.ru_utime.tv_sec + 1.0e-6 * ru.ru_utime.tv_usec
+           + ru.ru_stime.tv_sec + 1.0e-6 * ru.ru_stime.tv_usec;
+}
+
+
+/***************************************
+ * Returns how often the process went to sleep voluntarily, i.e. how
+ * often the main loop had to wake up again
+ ***************************************/
+
+static long
+wakeups( void )
+{
+    struct rusage ru;
+
+    getrusage( RUSAGE_SELF, &ru );
+    return ru.ru_nvcsw;
+}
+
+
+/***************************************
+ * Runs in the child process: sends the messages until killed
+ ***************************************/
+
+static void
+send_messages( const char * display_name,
+               Window       win )
+{
+    Display *d = XOpenDisplay( display_name );
+    XEvent xev;
+    long sec,
+         usec;
+
+    if ( ! d )
+        _exit( 1 );
+
+    memset( &xev, 0, sizeof xev );
+    xev.xclient.type         = ClientMessage;
+    xev.xclient.window       = win;
+    xev.xclient.message_type = bench_atom;
+    xev.xclient.format       = 32;
+
+    while ( 1 )
+    {
+        fl_msleep( SEND_INTERVAL );
+        fl_gettime( &sec, &usec );
+        xev.xclient.data.l[ 0 ] = sec;
+        xev.xclient.data.l[ 1 ] = usec;
+        XSendEvent( d, win, False, NoEventMask, &xev );
+        XFlush( d );
+    }
+}
+
+
+/***************************************
+ * Raw callback for the form, picks up the messages
+ ***************************************/
+
+static int
+got_event( FL_FORM * form  FL_UNUSED_ARG,
+           void    * ev )
+{
+    XClientMessageEvent *xcm = ev;
+    double lat;
+
+    if ( xcm->type != ClientMessage || xcm->message_type != bench_atom )
+        return 0;
+
+    lat = now( ) - ( xcm->data.l[ 0 ] + 1.0e-6 * xcm->data.l[ 1 ] );
+    lat_sum += lat;
+    if ( lat > lat_max )
+        lat_max = lat;
+    nevents++;
+
+    return FL_PREEMPT;
+}
+
+
+/***************************************
+ * Some work for the busy application
+ ***************************************/
+
+static void
+work( void )
+{
+    volatile double x = 0.0;
+    int i;
+
+    for ( i = 0; i < 20000; i++ )
+        x += i * 0.5;
+}
+
+
+/***************************************
+ ***************************************/
+
+static int
+idle_cb( XEvent * xev  FL_UNUSED_ARG,
+         void   * data FL_UNUSED_ARG )
+{
+    work( );
+    nidle++;
+    return 0;
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+timer_cb( int    id    FL_UNUSED_ARG,
+          void * data  FL_UNUSED_ARG )
+{
+    work( );
+    ntimer++;
+    if ( busy )
+        fl_add_timeout( TIMER_INTERVAL, timer_cb, NULL );
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+stop_cb( int    id    FL_UNUSED_ARG,
+         void * data )
+{
+    fl_trigger_object( data );
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+run_bench( FD_bench   * fd,
+           const char * what,
+           int          send,
+           int          seconds )
+{
+    pid_t pid = 0;
+    double t,
+           cpu;
+    long nwake;
+
+    nevents = nidle = ntimer = 0;
+    lat_sum = lat_max = 0.0;
+
+    if ( busy )
+    {
+        fl_set_idle_callback( idle_cb, NULL );
+        fl_add_timeout( TIMER_INTERVAL, timer_cb, NULL );
+    }
+
+    XSync( fl_get_display( ), False );
+
+    if ( send && ( pid = fork( ) ) < 0 )
+    {
+        fprintf( stderr, "Can't start sending process\n" );
+        exit( 1 );
+    }
+
+    if ( send && pid == 0 )
+        send_messages( DisplayString( fl_get_display( ) ), fd->form->window );
+
+    fl_add_timeout( 1000L * seconds, stop_cb, fd->stop );
+
+    t = now( );
+    cpu = cpu_time( );
+    nwake = wakeups( );
+
+    while ( fl_do_forms( ) != fd->stop )
+        /* empty */ ;
+
+    cpu = cpu_time( ) - cpu;
+    nwake = wakeups( ) - nwake;
+    t = now( ) - t;
+
+    if ( send )
+    {
+        kill( pid, SIGTERM );
+        waitpid( pid, NULL, 0 );
+    }
+
+    busy = 0;
+    fl_set_idle_callback( NULL, NULL );
+
+    fprintf( stdout, "  %-5s CPU %6.2f%%, %6.1f wakeups/s", what,
+             100.0 * cpu / t, nwake / t );
+    if ( send )
+        fprintf( stdout, ", %5ld events, latency mean %7.3f ms, "
+                 "max %7.3f ms", nevents,
+                 nevents ? 1.0e3 * lat_sum / nevents : 0.0,
+                 1.0e3 * lat_max );
+    if ( nidle || ntimer )
+        fprintf( stdout, ", %ld idle callbacks, %ld timeouts", nidle, ntimer );
+    fprintf( stdout, "\n" );
+}
+
+
+/***************************************
+ ***************************************/
+
+int
+main( int    argc,
+      char * argv[ ] )
+{
+    FD_bench *fd;
+    int seconds = 5;
+
+    fl_initialize( &argc, argv, "FormDemo", 0, 0 );
+
+    if ( argc > 1 && ( seconds = atoi( argv[ 1 ] ) ) <= 0 )
+        seconds = 5;
+
+    bench_atom = XInternAtom( fl_get_display( ), "LOOPBENCH", False );
+
+    fd = create_form_bench( );
+    fl_register_raw_callback( fd->form, FL_ALL_EVENT, got_event );
+    fl_show_form( fd->form, FL_PLACE_CENTER, FL_FULLBORDER, "loopbench" );
+
+    fprintf( stdout, "%d s per run, a message every %d ms\n", seconds,
+             SEND_INTERVAL );
+
+    run_bench( fd, "quiet", 0, seconds );
+    run_bench( fd, "idle", 1, seconds );
+    busy = 1;
+    run_bench( fd, "busy", 1, seconds );
+
+    fl_finish( );
+    return 0;
+}
+
+
+/***************************************
+ ***************************************/
+
+static FD_bench *
+create_form_bench( void )
+{
+    FD_bench *fdui = fl_malloc( sizeof *fdui );
+
+    fdui->form = fl_bgn_form( FL_NO_BOX, 320, 80 );
+    fl_add_box( FL_UP_BOX, 0, 0, 320, 80, "" );
+    fl_add_text( FL_NORMAL_TEXT, 10, 10, 300, 30, "Measuring main loop..." );
+    fdui->stop = fl_add_button( FL_HIDDEN_BUTTON, 0, 0, 0, 0, "" );
+    fl_end_form( );
+
+    return fdui;
+}
+
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,240 @@
+/*
+ *  This file is part of XForms.
+ *
+ *  XForms is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1, or
+ *  (at your option) any later version.
+ *
+ *  XForms is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with XForms; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 59 Temple Place - Suite 330, Boston,
+ *  MA 02111-1307, USA.
+ */
+
+
+/*
+ * Measures the cost of redrawing objects of a form with many objects,
+ * once with immediate and once with deferred redrawing (see
+ * fl_set_form_deferred_redraw()).
+ *
+ *  Usage: redrawbench [objects [updates/s [seconds]]]
+ *
+ * Per default the form has 2000 objects and 200 of them get changed per
+ * second (in batches, from a timer), each run lasting 5 seconds. The
+ * objects are free objects that count how often they get drawn.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "include/forms.h"
+
+#define TICK       20      /* ms between batches of updates */
+#define CELL       18      /* pixels per object */
+
+static FL_FORM *form;
+static FL_OBJECT *stop;
+static FL_OBJECT **objs;
+static int nobjs,
+           per_tick;
+static long nupdates,
+            ndraws;
+static int running;
+
+
+/***************************************
+ ***************************************/
+
+static double
+now( void )
+{
+    long sec,
+         usec;
+
+    fl_gettime( &sec, &usec );
+    return sec + 1.0e-6 * usec;
+}
+
+
+/***************************************
+ ***************************************/
+
+static double
+cpu_time( void )
+{
+    struct rusage ru;
+
+    getrusage( RUSAGE_SELF, &ru );
+    return   ru.ru_utime.tv_sec + 1.0e-6 * ru.ru_utime.tv_usec
+           + ru.ru_stime.tv_sec + 1.0e-6 * ru.ru_stime.tv_usec;
+}
+
+
+/***************************************
+ * Handler for the free objects, their color is kept in 'u_ldata'
+ ***************************************/
+
+static int
+cell_handler( FL_OBJECT * ob,
+              int         event,
+              FL_Coord    mx   FL_UNUSED_ARG,
+              FL_Coord    my   FL_UNUSED_ARG,
+              int         key  FL_UNUSED_ARG,
+              void      * xev  FL_UNUSED_ARG )
+{
+    if ( event == FL_DRAW )
+    {
+        fl_rectbound( ob->x, ob->y, ob->w, ob->h, ob->u_ldata );
+        ndraws++;
+    }
+
+    return 0;
+}
+
+
+/***************************************
+ * Changes a batch of randomly picked objects
+ ***************************************/
+
+static void
+update_cb( int    id    FL_UNUSED_ARG,
+           void * data  FL_UNUSED_ARG )
+{
+    int i;
+
+    for ( i = 0; i < per_tick; i++ )
+    {
+        FL_OBJECT *ob = objs[ rand( ) % nobjs ];
+
+        ob->u_ldata = FL_FREE_COL1 + ( ob->u_ldata + 1 - FL_FREE_COL1 ) % 8;
+        fl_redraw_object( ob );
+        nupdates++;
+    }
+
+    if ( running )
+        fl_add_timeout( TICK, update_cb, NULL );
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+stop_cb( int    id    FL_UNUSED_ARG,
+         void * data  FL_UNUSED_ARG )
+{
+    running = 0;
+    fl_trigger_object( stop );
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+run_bench( const char * what,
+           int          seconds )
+{
+    double t,
+           cpu;
+
+    nupdates = ndraws = 0;
+    running = 1;
+
+    fl_add_timeout( TICK, update_cb, NULL );
+    fl_add_timeout( 1000L * seconds, stop_cb, NULL );
+
+    t = now( );
+    cpu = cpu_time( );
+
+    while ( fl_do_forms( ) != stop )
+        /* empty */ ;
+
+    XSync( fl_get_display( ), False );
+
+    cpu = cpu_time( ) - cpu;
+    t = now( ) - t;
+
+    fprintf( stdout, "  %-9s %6ld updates, %6ld draws, CPU %6.2f%%, "
+             "%7.2f us CPU per update\n", what, nupdates, ndraws,
+             100.0 * cpu / t, nupdates ? 1.0e6 * cpu / nupdates : 0.0 );
+}
+
+
+/***************************************
+ ***************************************/
+
+int
+main( int    argc,
+      char * argv[ ] )
+{
+    int rate = 200,
+        seconds = 5;
+    int cols,
+        rows,
+        i;
+
+    fl_initialize( &argc, argv, "FormDemo", 0, 0 );
+
+    if ( argc < 2 || ( nobjs = atoi( argv[ 1 ] ) ) <= 0 )
+        nobjs = 2000;
+    if ( argc > 2 && ( rate = atoi( argv[ 2 ] ) ) <= 0 )
+        rate = 200;
+    if ( argc > 3 && ( seconds = atoi( argv[ 3 ] ) ) <= 0 )
+        seconds = 5;
+
+    if ( ( per_tick = rate * TICK / 1000 ) < 1 )
+        per_tick = 1;
+
+    for ( i = 0; i < 8; i++ )
+        fl_mapcolor( FL_FREE_COL1 + i, 40 + 30 * i, 255 - 25 * i,
+                     ( 90 * i ) % 256 );
+
+    cols = 50;
+    rows = ( nobjs + cols - 1 ) / cols;
+    objs = fl_malloc( nobjs * sizeof *objs );
+
+    form = fl_bgn_form( FL_UP_BOX, cols * CELL + 20, rows * CELL + 20 );
+
+    for ( i = 0; i < nobjs; i++ )
+    {
+        objs[ i ] = fl_add_free( FL_NORMAL_FREE, 10 + ( i % cols ) * CELL,
+                                 10 + ( i / cols ) * CELL, CELL - 2, CELL - 2,
+                                 "", cell_handler );
+        objs[ i ]->u_ldata = FL_FREE_COL1 + i % 8;
+    }
+
+    stop = fl_add_button( FL_HIDDEN_BUTTON, 0, 0, 0, 0, "" );
+    fl_end_form( );
+
+    fl_show_form( form, FL_PLACE_CENTER, FL_FULLBORDER, "redrawbench" );
+    fl_check_forms( );
+
+    fprintf( stdout, "%d objects, %d updates/s, %d s per run\n", nobjs,
+             per_tick * 1000 / TICK, seconds );
+
+    run_bench( "immediate", seconds );
+    fl_set_form_deferred_redraw( form, 1 );
+    run_bench( "deferred", seconds );
+
+    fl_finish( );
+    return 0;
+}
+
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
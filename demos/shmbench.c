@@ -0,0 +1,240 @@
+/*
+ *  This file is part of XForms.
+ *
+ *  XForms is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1, or
+ *  (at your option) any later version.
+ *
+ *  XForms is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with XForms; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 59 Temple Place - Suite 330, Boston,
+ *  MA 02111-1307, USA.
+ */
+
+
+/*
+ * Measures how many frames per second flimage_display() manages with
+ * and without the MIT-SHM extension.
+ *
+ *  Usage: shmbench [imagefile [frames]]
+ *
+ * Without an image file a 1600x1200 RGB test image is used.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include "include/forms.h"
+#include "image/flimage.h"
+
+
+typedef struct {
+    FL_FORM   * form;
+    FL_OBJECT * canvas;
+    FL_OBJECT * report;
+} FD_bench;
+
+static FD_bench * create_form_bench( int,
+                                     int );
+static FL_IMAGE * make_test_image( int,
+                                   int );
+
+
+/***************************************
+ * Displays the image 'frames' times, forcing the XImage to be
+ * regenerated each time as it would be for a live viewer, and
+ * returns the frame rate
+ ***************************************/
+
+static double
+run_bench( FL_IMAGE      * im,
+           Window          win,
+           FLIMAGE_SETUP * setup,
+           int             no_shm,
+           int             frames )
+{
+    long sec0,
+         usec0,
+         sec1,
+         usec1;
+    double dt;
+    int i;
+
+    setup->no_shm = no_shm;
+    flimage_setup( setup );
+
+    /* One untimed round to get GCs, colormaps etc. out of the way */
+
+    im->modified = 1;
+    flimage_display( im, win );
+    XSync( fl_get_display( ), False );
+
+    fl_gettime( &sec0, &usec0 );
+
+    for ( i = 0; i < frames; i++ )
+    {
+        im->modified = 1;
+        flimage_display( im, win );
+    }
+
+    XSync( fl_get_display( ), False );
+    fl_gettime( &sec1, &usec1 );
+
+    dt = sec1 - sec0 + 1.0e-6 * ( usec1 - usec0 );
+    return dt > 0.0 ? frames / dt : 0.0;
+}
+
+
+/***************************************
+ ***************************************/
+
+int
+main( int    argc,
+      char * argv[ ] )
+{
+    FD_bench *fd;
+    FL_IMAGE *im;
+    FLIMAGE_SETUP setup;
+    Window win;
+    int frames = 100;
+    double fps_shm,
+           fps_noshm;
+
+    fl_initialize( &argc, argv, "FormDemo", 0, 0 );
+
+    memset( &setup, 0, sizeof setup );
+    setup.delay = 0;
+    setup.do_not_clear = 1;
+    flimage_setup( &setup );
+    flimage_enable_gif( );
+    flimage_enable_jpeg( );
+    flimage_enable_png( );
+    flimage_enable_tiff( );
+
+    if ( argc > 1 )
+    {
+        if ( ! ( im = flimage_load( argv[ 1 ] ) ) )
+        {
+            fprintf( stderr, "Can't load %s\n", argv[ 1 ] );
+            return 1;
+        }
+    }
+    else
+        im = make_test_image( 1600, 1200 );
+
+    if ( argc > 2 && ( frames = atoi( argv[ 2 ] ) ) <= 0 )
+        frames = 100;
+
+    fd = create_form_bench( FL_min( im->w, 1200 ), FL_min( im->h, 900 ) );
+    fl_show_form( fd->form, FL_PLACE_CENTER, FL_FULLBORDER, "shmbench" );
+    win = fl_get_canvas_id( fd->canvas );
+
+    fps_shm   = run_bench( im, win, &setup, 0, frames );
+    fps_noshm = run_bench( im, win, &setup, 1, frames );
+
+    fprintf( stdout, "%dx%d %s, %d frames\n", im->w, im->h,
+             flimage_type_name( im->type ), frames );
+    fprintf( stdout, "  MIT-SHM on:  %8.2f fps\n", fps_shm );
+    fprintf( stdout, "  MIT-SHM off: %8.2f fps\n", fps_noshm );
+
+    fl_set_object_label_f( fd->report, "%dx%d: %.1f fps with MIT-SHM, "
+                           "%.1f fps without", im->w, im->h,
+                           fps_shm, fps_noshm );
+
+    fl_do_forms( );
+
+    flimage_free( im );
+    fl_finish( );
+    return 0;
+}
+
+
+/***************************************
+ * Creates an RGB image with some gradients in it
+ ***************************************/
+
+static FL_IMAGE *
+make_test_image( int w,
+                 int h )
+{
+    FL_IMAGE *im = flimage_alloc( );
+    int x,
+        y;
+
+    im->type = FL_IMAGE_RGB;
+    im->w = w;
+    im->h = h;
+
+    if ( flimage_getmem( im ) < 0 )
+    {
+        fprintf( stderr, "Can't allocate %dx%d image\n", w, h );
+        exit( 1 );
+    }
+
+    for ( y = 0; y < h; y++ )
+        for ( x = 0; x < w; x++ )
+        {
+            im->red[   y ][ x ] = ( 255 * x ) / w;
+            im->green[ y ][ x ] = ( 255 * y ) / h;
+            im->blue[  y ][ x ] = ( x ^ y ) & 0xff;
+        }
+
+    im->modified = 1;
+    return im;
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+exit_cb( FL_OBJECT * obj  FL_UNUSED_ARG,
+         long        data FL_UNUSED_ARG )
+{
+    fl_finish( );
+    exit( 0 );
+}
+
+
+/***************************************
+ ***************************************/
+
+static FD_bench *
+create_form_bench( int w,
+                   int h )
+{
+    FL_OBJECT *obj;
+    FD_bench *fdui = fl_calloc( 1, sizeof *fdui );
+
+    fdui->form = fl_bgn_form( FL_UP_BOX, w + 20, h + 70 );
+
+    fdui->canvas = fl_add_canvas( FL_NORMAL_CANVAS, 10, 10, w, h, "" );
+
+    fdui->report = obj = fl_add_text( FL_NORMAL_TEXT, 10, h + 25, w - 100, 30,
+                                      "Measuring..." );
+    fl_set_object_lalign( obj, FL_ALIGN_LEFT | FL_ALIGN_INSIDE );
+
+    obj = fl_add_button( FL_NORMAL_BUTTON, w - 80, h + 25, 90, 30, "Done" );
+    fl_set_object_callback( obj, exit_cb, 0 );
+
+    fl_end_form( );
+
+    return fdui;
+}
+
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
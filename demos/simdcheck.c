@@ -0,0 +1,256 @@
+/*
+ *  This file is part of XForms.
+ *
+ *  XForms is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1, or
+ *  (at your option) any later version.
+ *
+ *  XForms is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with XForms; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 59 Temple Place - Suite 330, Boston,
+ *  MA 02111-1307, USA.
+ */
+
+
+/*
+ * Checks that the SSE2 and AVX2 kernels for converting rows of red,
+ * green and blue values into TrueColor pixels produce exactly the same
+ * bytes as the plain C kernel, for all pixel sizes, both byte orders,
+ * a number of different visuals and all row lengths up to 80 pixels
+ * (plus a few longer ones). It also checks that no kernel writes past
+ * the end of the row.
+ *
+ *  Usage: simdcheck
+ *
+ * Kernels the CPU doesn't support are skipped. Returns 0 if all tests
+ * pass, 1 otherwise. No display is needed.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include "include/forms.h"
+#include "image/flimage.h"
+#include "image/flimage_int.h"
+
+#define MAXW    1031
+#define GUARD   64
+#define FILL    0xa5
+
+typedef struct {
+    const char * name;
+    int          bpp;
+    int          rbits,
+                 gbits,
+                 bbits;
+    int          rshift,
+                 gshift,
+                 bshift;
+    unsigned int alpha;
+} VISUAL;
+
+static VISUAL visuals[ ] = {
+    { "8:8:8 RGB",     32,  8,  8,  8, 16,  8,  0, 0          },
+    { "8:8:8 BGR",     32,  8,  8,  8,  0,  8, 16, 0          },
+    { "8:8:8 alpha",   32,  8,  8,  8, 16,  8,  0, 0xff000000 },
+    { "8:8:8 high",    32,  8,  8,  8, 24, 16,  8, 0          },
+    { "10:10:10",      32, 10, 10, 10, 20, 10,  0, 0          },
+    { "8:8:8 RGB",     24,  8,  8,  8, 16,  8,  0, 0          },
+    { "8:8:8 BGR",     24,  8,  8,  8,  0,  8, 16, 0          },
+    { "5:6:5",         16,  5,  6,  5, 11,  5,  0, 0          },
+    { "5:5:5",         16,  5,  5,  5, 10,  5,  0, 0          },
+    { "5:5:5 BGR",     16,  5,  5,  5,  0,  5, 10, 0          },
+    { "4:4:4",         16,  4,  4,  4,  8,  4,  0, 0xf000     },
+    { "3:3:2",          8,  3,  3,  2,  5,  2,  0, 0          },
+    { "2:3:3",          8,  2,  3,  3,  6,  3,  0, 0          }
+};
+
+#define NVISUALS  ( ( int ) ( sizeof visuals / sizeof *visuals ) )
+
+static const char *level_names[ ] = { "C", "SSE2", "AVX2" };
+
+
+/***************************************
+ ***************************************/
+
+static void
+setup_rgb2p( const VISUAL * v,
+             FL_RGB2PIXEL * rgb2p )
+{
+    memset( rgb2p, 0, sizeof *rgb2p );
+
+    rgb2p->rbits  = v->rbits;
+    rgb2p->gbits  = v->gbits;
+    rgb2p->bbits  = v->bbits;
+    rgb2p->rshift = v->rshift;
+    rgb2p->gshift = v->gshift;
+    rgb2p->bshift = v->bshift;
+    rgb2p->rmask  = ( ( 1U << v->rbits ) - 1 ) << v->rshift;
+    rgb2p->gmask  = ( ( 1U << v->gbits ) - 1 ) << v->gshift;
+    rgb2p->bmask  = ( ( 1U << v->bbits ) - 1 ) << v->bshift;
+}
+
+
+/***************************************
+ * Converts a row with all kernels and compares the results, also
+ * when the output doesn't start at an aligned address
+ ***************************************/
+
+static int
+check_row( const VISUAL        * v,
+           int                   byte_order,
+           const unsigned char * r,
+           const unsigned char * g,
+           const unsigned char * b,
+           int                   n )
+{
+    static unsigned char ref[ 4 * MAXW + GUARD ],
+                         buf[ 4 * MAXW + GUARD + 32 ];
+    FL_RGB2PIXEL rgb2p;
+    FLIMAGE_PIXFMT fmt;
+    size_t len = ( size_t ) n * ( v->bpp / 8 );
+    int level,
+        offset,
+        errors = 0;
+
+    setup_rgb2p( v, &rgb2p );
+
+    flimage_init_pixfmt( &fmt, &rgb2p, v->bpp, byte_order, v->alpha,
+                         FLIMAGE_SIMD_NONE );
+    memset( ref, FILL, sizeof ref );
+    fmt.convert( &fmt, r, g, b, ref, n );
+
+    for ( level = FLIMAGE_SIMD_SSE2; level <= flimage_simd_level( ); level++ )
+    {
+        int step = v->bpp == 24 ? 1 : v->bpp / 8;
+
+        flimage_init_pixfmt( &fmt, &rgb2p, v->bpp, byte_order, v->alpha,
+                             level );
+
+        /* Pixels of 16 and 32 bits are always stored at addresses
+           aligned to their size, 24 bit pixels may start anywhere */
+
+        for ( offset = 0; offset < 32; offset += step )
+        {
+            unsigned char *out = buf + offset;
+            size_t i;
+            int outside = 0;
+
+            memset( buf, FILL, sizeof buf );
+            fmt.convert( &fmt, r, g, b, out, n );
+
+            if ( memcmp( out, ref, len ) )
+            {
+                for ( i = 0; out[ i ] == ref[ i ]; i++ )
+                    /* empty */ ;
+
+                fprintf( stderr, "%2d bpp %-11s %s, %s, width %4d, "
+                         "offset %2d: pixel %lu differs\n", v->bpp, v->name,
+                         byte_order == MSBFirst ? "MSBFirst" : "LSBFirst",
+                         level_names[ level ], n, offset,
+                         ( unsigned long ) ( i / ( v->bpp / 8 ) ) );
+                errors++;
+                break;
+            }
+
+            for ( i = 0; i < ( size_t ) offset; i++ )
+                if ( buf[ i ] != FILL )
+                    outside = 1;
+
+            for ( i = len; i < len + GUARD; i++ )
+                if ( out[ i ] != FILL )
+                    outside = 1;
+
+            if ( outside )
+            {
+                fprintf( stderr, "%2d bpp %-11s %s, %s, width %4d, "
+                         "offset %2d: writes outside of the row\n", v->bpp,
+                         v->name,
+                         byte_order == MSBFirst ? "MSBFirst" : "LSBFirst",
+                         level_names[ level ], n, offset );
+                errors++;
+                break;
+            }
+        }
+    }
+
+    return errors;
+}
+
+
+/***************************************
+ ***************************************/
+
+int
+main( int    argc  FL_UNUSED_ARG,
+      char * argv[ ]  FL_UNUSED_ARG )
+{
+    static unsigned char r[ MAXW ],
+                         g[ MAXW ],
+                         b[ MAXW ];
+    static int widths[ ] = { 127, 128, 129, 255, 257, 640, 1023, MAXW };
+    int byte_orders[ ] = { LSBFirst, MSBFirst };
+    int i,
+        j,
+        k,
+        n,
+        errors = 0,
+        rows = 0;
+
+    srand( 1 );
+
+    fprintf( stdout, "Best kernel supported by the CPU: %s\n",
+             level_names[ flimage_simd_level( ) ] );
+
+    for ( i = 0; i < NVISUALS; i++ )
+        for ( j = 0; j < 2; j++ )
+        {
+            int verrors = 0;
+
+            for ( n = 0; n < 80 + ( int ) ( sizeof widths / sizeof *widths );
+                  n++ )
+            {
+                int w = n < 80 ? n + 1 : widths[ n - 80 ];
+
+                /* Random values, but include the extremes */
+
+                for ( k = 0; k < w; k++ )
+                {
+                    r[ k ] = k % 7 == 0 ? 255 : rand( ) & 0xff;
+                    g[ k ] = k % 5 == 0 ? 0   : rand( ) & 0xff;
+                    b[ k ] = k % 3 == 0 ? 128 : rand( ) & 0xff;
+                }
+
+                verrors += check_row( visuals + i, byte_orders[ j ], r, g, b,
+                                      w );
+                rows++;
+            }
+
+            fprintf( stdout, "%2d bpp %-11s %s: %s\n", visuals[ i ].bpp,
+                     visuals[ i ].name,
+                     byte_orders[ j ] == MSBFirst ? "MSBFirst" : "LSBFirst",
+                     verrors ? "FAILED" : "ok" );
+            errors += verrors;
+        }
+
+    fprintf( stdout, "%d rows checked, %d failures\n", rows, errors );
+
+    return errors ? 1 : 0;
+}
+
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,387 @@
+/*
+ *  This file is part of XForms.
+ *
+ *  XForms is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1, or
+ *  (at your option) any later version.
+ *
+ *  XForms is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with XForms; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 59 Temple Place - Suite 330, Boston,
+ *  MA 02111-1307, USA.
+ */
+
+
+/*
+ * Checks the fixed point code of flimage_warp() against the floating
+ * point code still used with FLIMAGE_REFERENCE. Images of 8-bit (RGB)
+ * and 16-bit (gray and color index) pixels are warped with nearest
+ * neighbour and with bilinear (subpixel) sampling, using different
+ * matrices, tiny images where all pixels are at the border and output
+ * sizes larger than the warped image, so that a frame of fill color
+ * is needed.
+ *
+ *  Usage: warpcheck [-v]
+ *
+ * For each case the maximum difference of a pixel value and the number
+ * of pixels that differ is determined. Nearest neighbour sampling may
+ * pick a neighbouring pixel where the source position is within
+ * rounding error of a pixel border, and bilinear sampling may differ by
+ * up to two (8-bit) or 256 (16-bit) in the last bits. Returns
+ * 0 if all cases stay within those limits, 1 otherwise. No display is
+ * needed.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include "include/forms.h"
+#include "image/flimage.h"
+
+typedef struct {
+    const char * name;
+    float        m[ 2 ][ 2 ];
+} MATRIX;
+
+static MATRIX matrices[ ] = {
+    { "identity",     { {  1.0,        0.0       }, {  0.0,       1.0 } } },
+    { "enlarge 2.5",  { {  2.5,        0.0       }, {  0.0,       2.5 } } },
+    { "shrink 0.37",  { {  0.37,       0.0       }, {  0.0,      0.37 } } },
+    { "rotate 30",    { {  0.8660254,  0.5       },
+                        { -0.5,        0.8660254 } } },
+    { "rotate 90",    { {  0.0,        1.0       }, { -1.0,       0.0 } } },
+    { "mirror",       { { -1.0,        0.0       }, {  0.0,       1.0 } } },
+    { "shear",        { {  1.0,        0.45      }, {  0.0,       1.0 } } },
+    { "general",      { {  1.7,        0.3       }, { -0.2,       0.6 } } }
+};
+
+#define NMATRICES  ( ( int ) ( sizeof matrices / sizeof *matrices ) )
+
+static int sizes[ ][ 2 ] = {
+    { 1, 1 }, { 2, 2 }, { 1, 9 }, { 9, 1 }, { 3, 5 }, { 37, 23 }, { 64, 48 }
+};
+
+#define NSIZES  ( ( int ) ( sizeof sizes / sizeof *sizes ) )
+
+/* How the output size is set: the minimum enclosing rectangle, larger
+   than needed and centered, or larger and flush top-left */
+
+enum {
+    AUTO_SIZE,
+    CENTERED,
+    TOP_LEFT,
+    NCANVAS
+};
+
+static const char *canvas_names[ ] = { "auto", "centered", "top-left" };
+
+typedef struct {
+    const char * name;
+    int          type;
+    int          maxval;
+} TYPE;
+
+static TYPE types[ ] = {
+    { "rgb u8",    FL_IMAGE_RGB,    255   },
+    { "gray u16",  FL_IMAGE_GRAY,   255   },
+    { "gray16",    FL_IMAGE_GRAY16, 65535 },
+    { "ci u16",    FL_IMAGE_CI,     15    }
+};
+
+#define NTYPES  ( ( int ) ( sizeof types / sizeof *types ) )
+
+static int verbose;
+
+
+/***************************************
+ ***************************************/
+
+static int
+no_cue( FL_IMAGE   * im  FL_UNUSED_ARG,
+        const char * s   FL_UNUSED_ARG )
+{
+    return 0;
+}
+
+
+/***************************************
+ * Creates an image with a pattern that has gradients as well as sharp
+ * edges, so both kinds of sampling get something to do
+ ***************************************/
+
+static FL_IMAGE *
+make_image( const TYPE * t,
+            int          w,
+            int          h )
+{
+    FL_IMAGE *im = flimage_alloc( );
+    int x,
+        y;
+
+    im->type = t->type;
+    im->w = w;
+    im->h = h;
+    im->visual_cue = no_cue;
+    im->fill_color = FL_PACK( 200, 30, 90 );
+
+    if ( t->type == FL_IMAGE_CI )
+        im->map_len = t->maxval + 1;
+    else if ( t->type == FL_IMAGE_GRAY16 )
+        im->gray_maxval = t->maxval;
+
+    if ( flimage_getmem( im ) < 0 )
+    {
+        fprintf( stderr, "Can't get memory for a %dx%d image\n", w, h );
+        exit( 1 );
+    }
+
+    if ( t->type == FL_IMAGE_CI )
+        for ( x = 0; x < im->map_len; x++ )
+        {
+            im->red_lut[ x ]   = 17 * x;
+            im->green_lut[ x ] = 255 - 17 * x;
+            im->blue_lut[ x ]  = ( 97 * x ) & 0xff;
+        }
+
+    for ( y = 0; y < h; y++ )
+        for ( x = 0; x < w; x++ )
+        {
+            unsigned int v = ( x * 977 + y * 5431 ) % ( t->maxval + 1 ),
+                         e = ( ( x / 4 + y / 3 ) & 1 ) ? t->maxval : 0;
+
+            if ( t->type == FL_IMAGE_RGB )
+            {
+                im->red[   y ][ x ] = v;
+                im->green[ y ][ x ] = e;
+                im->blue[  y ][ x ] = ( x * 255 ) / w;
+            }
+            else if ( t->type == FL_IMAGE_CI )
+                im->ci[ y ][ x ] = ( x + 3 * y ) % im->map_len;
+            else
+                im->gray[ y ][ x ] = ( x + y ) & 1 ? v : e;
+        }
+
+    return im;
+}
+
+
+/***************************************
+ * Compares a plane of both images, updating the maximum difference and
+ * the number of differing pixels
+ ***************************************/
+
+static void
+compare_plane( void ** a,
+               void ** b,
+               int     esize,
+               int     w,
+               int     h,
+               int   * maxdiff,
+               long  * ndiff )
+{
+    int x,
+        y,
+        d;
+
+    for ( y = 0; y < h; y++ )
+        for ( x = 0; x < w; x++ )
+        {
+            if ( esize == 1 )
+                d =   ( ( unsigned char ** ) a )[ y ][ x ]
+                    - ( ( unsigned char ** ) b )[ y ][ x ];
+            else
+                d =   ( ( unsigned short ** ) a )[ y ][ x ]
+                    - ( ( unsigned short ** ) b )[ y ][ x ];
+
+            if ( d )
+            {
+                d = FL_abs( d );
+                if ( d > *maxdiff )
+                    *maxdiff = d;
+                ( *ndiff )++;
+            }
+        }
+}
+
+
+/***************************************
+ * Warps the same image with both implementations and compares the
+ * results. Returns the number of failures (0 or 1).
+ ***************************************/
+
+static int
+check_warp( const TYPE   * t,
+            const MATRIX * mat,
+            int            w,
+            int            h,
+            int            canvas,
+            int            subpixel )
+{
+    FL_IMAGE *fast = make_image( t, w, h ),
+             *ref  = make_image( t, w, h );
+    float m[ 2 ][ 2 ];
+    int option = subpixel ? FLIMAGE_SUBPIXEL : FLIMAGE_NOSUBPIXEL,
+        nw = 0,
+        nh = 0,
+        maxdiff = 0,
+        limit,
+        failed;
+    long ndiff = 0,
+         npix,
+         nlimit;
+
+    memcpy( m, mat->m, sizeof m );
+
+    if ( canvas != AUTO_SIZE )
+    {
+        nw = 3 * w + 7;
+        nh = 3 * h + 5;
+        if ( canvas == TOP_LEFT )
+            option |= FLIMAGE_NOCENTER;
+    }
+
+    if (    flimage_warp( fast, m, nw, nh, option ) < 0
+         || flimage_warp( ref, m, nw, nh, option | FLIMAGE_REFERENCE ) < 0 )
+    {
+        fprintf( stderr, "%-8s %-11s %2dx%-2d %-8s %-8s: warp failed\n",
+                 t->name, mat->name, w, h, canvas_names[ canvas ],
+                 subpixel ? "bilinear" : "nearest" );
+        flimage_free( fast );
+        flimage_free( ref );
+        return 1;
+    }
+
+    if ( fast->w != ref->w || fast->h != ref->h || fast->type != ref->type )
+    {
+        fprintf( stderr, "%-8s %-11s %2dx%-2d %-8s %-8s: result is %dx%d "
+                 "instead of %dx%d\n", t->name, mat->name, w, h,
+                 canvas_names[ canvas ], subpixel ? "bilinear" : "nearest",
+                 fast->w, fast->h, ref->w, ref->h );
+        flimage_free( fast );
+        flimage_free( ref );
+        return 1;
+    }
+
+    npix = ( long ) fast->w * fast->h;
+
+    if ( fast->type == FL_IMAGE_RGB )
+    {
+        compare_plane( ( void ** ) fast->red, ( void ** ) ref->red, 1,
+                       fast->w, fast->h, &maxdiff, &ndiff );
+        compare_plane( ( void ** ) fast->green, ( void ** ) ref->green, 1,
+                       fast->w, fast->h, &maxdiff, &ndiff );
+        compare_plane( ( void ** ) fast->blue, ( void ** ) ref->blue, 1,
+                       fast->w, fast->h, &maxdiff, &ndiff );
+        npix *= 3;
+    }
+    else if ( fast->type == FL_IMAGE_CI )
+        compare_plane( ( void ** ) fast->ci, ( void ** ) ref->ci, 2,
+                       fast->w, fast->h, &maxdiff, &ndiff );
+    else
+        compare_plane( ( void ** ) fast->gray, ( void ** ) ref->gray, 2,
+                       fast->w, fast->h, &maxdiff, &ndiff );
+
+    /* Nearest neighbour: any value may result where a different pixel
+       gets picked, but that must be rare. Bilinear: all pixels may be
+       off by a little. */
+
+    if ( subpixel )
+    {
+        limit = t->maxval > 255 ? 256 : 2;
+        nlimit = npix;
+    }
+    else
+    {
+        limit = t->maxval;
+        nlimit = npix / 100;
+    }
+
+    failed = maxdiff > limit || ndiff > nlimit;
+
+    if ( failed || verbose )
+        fprintf( stdout, "%-8s %-11s %2dx%-2d %-8s %-8s: "
+                 "max. difference %5d, %4ld of %5ld differ%s\n", t->name,
+                 mat->name, w, h, canvas_names[ canvas ],
+                 subpixel ? "bilinear" : "nearest", maxdiff, ndiff, npix,
+                 failed ? " FAILED" : "" );
+
+    flimage_free( fast );
+    flimage_free( ref );
+
+    return failed;
+}
+
+
+/***************************************
+ ***************************************/
+
+int
+main( int    argc,
+      char * argv[ ] )
+{
+    int i,
+        j,
+        k,
+        canvas,
+        subpixel,
+        errors = 0,
+        cases = 0;
+
+    verbose = argc > 1 && ! strcmp( argv[ 1 ], "-v" );
+
+    for ( i = 0; i < NTYPES; i++ )
+        for ( subpixel = 0; subpixel < 2; subpixel++ )
+        {
+            int terrors = 0;
+
+            /* Subpixel warping of color index images is done on RGB
+               images, so that's already covered */
+
+            if ( subpixel && types[ i ].type == FL_IMAGE_CI )
+                continue;
+
+            for ( j = 0; j < NMATRICES; j++ )
+                for ( k = 0; k < NSIZES; k++ )
+                    for ( canvas = 0; canvas < NCANVAS; canvas++ )
+                    {
+                        /* FLIMAGE_NOCENTER includes the FLIMAGE_SUBPIXEL
+                           bit, so it can't be used with nearest
+                           neighbour sampling */
+
+                        if ( ! subpixel && canvas == TOP_LEFT )
+                            continue;
+
+                        terrors += check_warp( types + i, matrices + j,
+                                               sizes[ k ][ 0 ],
+                                               sizes[ k ][ 1 ], canvas,
+                                               subpixel );
+                        cases++;
+                    }
+
+            fprintf( stdout, "%-8s %-8s: %s\n", types[ i ].name,
+                     subpixel ? "bilinear" : "nearest",
+                     terrors ? "FAILED" : "ok" );
+            errors += terrors;
+        }
+
+    fprintf( stdout, "%d cases checked, %d failures\n", cases, errors );
+
+    return errors ? 1 : 0;
+}
+
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
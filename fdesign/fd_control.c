@@ -795,6 +795,8 @@ stoptest_cb( FL_OBJECT * obj  FL_UNUSED_ARG,
         ob->y = p->y;
         ob->w = p->w;
         ob->h = p->h;
+
+        fl_notify_object( ob, FL_RESIZED );
     }
 
     fli_safe_free( oldgeom );
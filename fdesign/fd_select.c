@@ -553,7 +553,7 @@ handle_move( const XEvent * xev )
                 selobj[ i ]->fb1 -= y;
                 selobj[ i ]->fb2 -= y;
 
-                fli_notify_object( selobj[ i ], FL_RESIZED );
+                fl_notify_object( selobj[ i ], FL_RESIZED );
             }
         }
     }
@@ -621,7 +621,7 @@ move_selection( FL_Coord dx,
             ob->fb1 -= dy;
             ob->fb2 -= dy;
 
-            fli_notify_object( ob, FL_RESIZED );
+            fl_notify_object( ob, FL_RESIZED );
         }
     }
 
@@ -713,7 +713,7 @@ resize_selection( FL_Coord dx,
             selobj[ i ]->fb1 -= y;
             selobj[ i ]->fb2 -= y;
 
-            fli_notify_object( selobj[ i ], FL_RESIZED );
+            fl_notify_object( selobj[ i ], FL_RESIZED );
         }
 
     fli_recalc_intersections( cur_form );
@@ -1068,6 +1068,11 @@ align_selection( int dir )
             }
         }
 
+    for ( i = 0; i < selnumb; i++ )
+        if (    selobj[ i ]->objclass != FL_BEGIN_GROUP
+             && selobj[ i ]->objclass != FL_END_GROUP )
+            fl_notify_object( selobj[ i ], FL_RESIZED );
+
     redraw_the_form( 0 );
     changed = 1;
 }
@@ -1443,7 +1448,7 @@ paste_selection( void )
             selobj[ i ]->fb1 -= shift;
             selobj[ i ]->fb2 -= shift;
 
-            fli_notify_object( selobj[ i ], FL_RESIZED );
+            fl_notify_object( selobj[ i ], FL_RESIZED );
         }
 
     cleanup_selection( );
@@ -344,6 +344,12 @@ typedef struct flimage_ {
     int               isPixmap;
     FLIMAGESETUP      setup;
     char            * info;
+    void            * shm_info;       /* shared memory XImage state  */
+    void            * map_info;       /* memory mapped file data     */
+    void            * progress_info;  /* progressive display state   */
+    void            * frame_index;    /* file positions of frames    */
+    void            * tile_info;      /* tiles for zoomed display    */
+    double            zoom;           /* display scale, 0: not scaled */
 } FL_IMAGE;
 
 /* some configuration stuff */
@@ -365,6 +371,16 @@ typedef struct flimage_setup_ {
     int             no_auto_extension;
     int             report_frequency;
     int             double_buffer;
+    int             no_shm;           /* don't use MIT-SHM for display */
+    int             max_threads;      /* threads for image processing,
+                                         0 means one per CPU */
+    int             use_mmap;         /* map pixel data of files */
+    FL_WINDOW       progressive_win;  /* show images while reading */
+    int             dither;           /* FLIMAGE_DITHER_FS or _ORDERED */
+    long            cache_size;       /* bytes of decoded images kept by
+                                         flimage_load(), 0 means none */
+    long            tile_memory;      /* bytes of tiles kept for zoomed
+                                         display, 0 means 32 MB */
 
     /* internal use */
 
@@ -397,6 +413,16 @@ FL_EXPORT FL_IMAGE * flimage_load( const char * file );
 
 FL_EXPORT FL_IMAGE * flimage_read( FL_IMAGE * im );
 
+FL_EXPORT void flimage_get_cache_stats( unsigned long *,
+										unsigned long *,
+										int *,
+										unsigned long * );
+
+FL_EXPORT void flimage_flush_cache( void );
+
+FL_EXPORT int flimage_seek_frame( FL_IMAGE * im,
+								  int        n );
+
 FL_EXPORT int flimage_dump( FL_IMAGE *,
 							const char *,
 							const char * );
@@ -562,6 +588,13 @@ FL_EXPORT int flimage_getcolormap( FL_IMAGE * );
 
 FL_EXPORT void fl_select_mediancut_quantizer( void );
 
+/* Dithering done by the median cut quantizer */
+
+enum {
+   FLIMAGE_DITHER_FS      = 0,  /* Floyd-Steinberg error diffusion */
+   FLIMAGE_DITHER_ORDERED = 1   /* ordered (Bayer) dither          */
+};
+
 /* Simple image processing routines */
 
 #define FLIMAGE_SHARPEN        ( ( int** )( -1 ) )
@@ -575,6 +608,10 @@ enum {
    FLIMAGE_CENTER     =  2,     /* center warped image. default  */
    FLIMAGE_RIGHT      =  8,     /* flush right the warped image  */
    FLIMAGE_ASPECT     = 32,     /* fit the size */
+   FLIMAGE_BILINEAR   = 64,     /* scale with a bilinear filter  */
+   FLIMAGE_BICUBIC    = 128,    /* scale with a bicubic filter   */
+   FLIMAGE_LANCZOS    = 256,    /* scale with a Lanczos3 filter  */
+   FLIMAGE_REFERENCE  = 512,    /* warp with the slow float code */
    FLIMAGE_NOCENTER   = FL_ALIGN_LEFT_TOP
 };
 
@@ -640,6 +677,9 @@ FL_EXPORT int flimage_windowlevel( FL_IMAGE *,
 								   int,
 								   int );
 
+FL_EXPORT int flimage_auto_windowlevel( FL_IMAGE *,
+										double );
+
 FL_EXPORT int flimage_enhance( FL_IMAGE *,
 							   int );
 
@@ -651,6 +691,11 @@ FL_EXPORT Pixmap flimage_to_pixmap( FL_IMAGE *,
 
 FL_EXPORT FL_IMAGE * flimage_dup( FL_IMAGE * );
 
+FL_EXPORT FL_IMAGE * flimage_dup_shared( FL_IMAGE * );
+
+FL_EXPORT int flimage_detach( FL_IMAGE *,
+							  int );
+
 /* Miscellaneous prototypes */
 
 FL_EXPORT int fl_object_ps_dump( FL_OBJECT *,
@@ -159,8 +159,30 @@ enum {
     FL_MAKE_MATRIX
 };
 
+/* Copy-on-write sharing of matrices, see matrix.c */
+
+int flimage_is_matrix( void * );
+
+void * flimage_share_matrix( void * );
+
+void * flimage_view_matrix( void *,
+                            int,
+                            int,
+                            int,
+                            unsigned int );
+
+int flimage_matrix_is_shared( void * );
+
+void * flimage_detach_matrix( void *,
+                              int,
+                              int,
+                              unsigned int );
+
 void flimage_enable_gzip( void );
 
+int flimage_convert_for_io( FL_IMAGE *,
+                            FLIMAGE_IO * );
+
 void flimage_invalidate_pixels( FL_IMAGE * );
 
 int flimage_get_closest_color_from_map( FL_IMAGE *,
@@ -225,6 +247,232 @@ int flimage_to_ximage( FL_IMAGE *,
                        FL_WINDOW,
                        XWindowAttributes * );
 
+void flimage_destroy_ximage( FL_IMAGE * );
+
+/* SSE2/AVX2 code is only compiled on x86 with compilers that allow to
+   select the instruction set per function and is picked at run time */
+
+#if    ! defined FL_NO_SIMD                                  \
+    && ( defined __x86_64__ || defined __i386__ )            \
+    && ( defined __clang__ || ( defined __GNUC__ && __GNUC__ >= 5 ) )
+#define FLIMAGE_X86_SIMD  1
+#endif
+
+enum {
+    FLIMAGE_SIMD_NONE,
+    FLIMAGE_SIMD_SSE2,
+    FLIMAGE_SIMD_AVX2
+};
+
+int flimage_simd_level( void );
+
+/* Description of a TrueColor pixel layout and the function that
+   converts rows of separate r, g and b values to it */
+
+typedef struct flimage_pixfmt_ FLIMAGE_PIXFMT;
+
+typedef void ( * FLIMAGE_RGB2PIX )( const FLIMAGE_PIXFMT *,
+                                    const unsigned char *,
+                                    const unsigned char *,
+                                    const unsigned char *,
+                                    void *,
+                                    int );
+
+struct flimage_pixfmt_ {
+    unsigned int    rrshift,        /* right shift to reduce to rbits */
+                    grshift,
+                    brshift;
+    unsigned int    rlshift,        /* left shift to final position   */
+                    glshift,
+                    blshift;
+    unsigned int    rmask,
+                    gmask,
+                    bmask;
+    unsigned int    alpha;          /* or'ed into each pixel          */
+    int             bits_per_pixel;
+    int             swap;           /* XImage not in machine order    */
+    int             msbfirst;       /* byte order for 24 bpp          */
+    FLIMAGE_RGB2PIX convert;
+};
+
+void flimage_init_pixfmt( FLIMAGE_PIXFMT *,
+                          const FL_RGB2PIXEL *,
+                          int,
+                          int,
+                          unsigned int,
+                          int );
+
+void flimage_madd_u8( int *,
+                      const unsigned char *,
+                      int,
+                      int );
+
+void flimage_madd_u16( int *,
+                       const unsigned short *,
+                       int,
+                       int );
+
+void flimage_madd_i32( int *,
+                       const int *,
+                       int,
+                       int );
+
+void flimage_lut_u16( const unsigned short *,
+                      const unsigned short *,
+                      unsigned short *,
+                      int );
+
+void flimage_transpose_u8( const unsigned char *,
+                           long,
+                           unsigned char *,
+                           long,
+                           int,
+                           int );
+
+void flimage_transpose_u16( const unsigned short *,
+                            long,
+                            unsigned short *,
+                            long,
+                            int,
+                            int );
+
+void flimage_swap_reverse_u8( unsigned char *,
+                              unsigned char *,
+                              int );
+
+void flimage_swap_reverse_u16( unsigned short *,
+                               unsigned short *,
+                               int );
+
+void flimage_bilerp_u8( const unsigned char * const *,
+                        long,
+                        unsigned char * const *,
+                        int,
+                        int,
+                        int,
+                        int,
+                        int,
+                        int );
+
+void flimage_bilerp_u16( const unsigned short * const *,
+                         long,
+                         unsigned short * const *,
+                         int,
+                         int,
+                         int,
+                         int,
+                         int,
+                         int );
+
+void flimage_unpack_rgba( const FL_PACKED *,
+                          unsigned char *,
+                          unsigned char *,
+                          unsigned char *,
+                          unsigned char *,
+                          int );
+
+void flimage_pack_rgba( const unsigned char *,
+                        const unsigned char *,
+                        const unsigned char *,
+                        const unsigned char *,
+                        FL_PACKED *,
+                        int );
+
+void flimage_rgb_to_gray( const unsigned char *,
+                          const unsigned char *,
+                          const unsigned char *,
+                          unsigned short *,
+                          int );
+
+void flimage_packed_to_gray( const FL_PACKED *,
+                             unsigned short *,
+                             int );
+
+void flimage_u16_to_u8( const unsigned short *,
+                        unsigned char *,
+                        int );
+
+void flimage_scale_u16( const unsigned short *,
+                        unsigned short *,
+                        float,
+                        int );
+
+void flimage_lut_u32( const unsigned int *,
+                      const unsigned short *,
+                      unsigned int *,
+                      int );
+
+/* Histograms and table lookups on all pixels, see image_proc.c */
+
+int flimage_count_pixels( FL_IMAGE *,
+                          unsigned int *,
+                          int );
+
+void flimage_apply_lut16( FL_IMAGE *,
+                          const unsigned short *,
+                          unsigned short **,
+                          unsigned short ** );
+
+/* Worker threads, see image_thread.c */
+
+typedef void ( * FLIMAGE_JOB )( void *,
+                                int,
+                                int );
+
+int flimage_get_nthreads( FL_IMAGE * );
+
+void flimage_parallel_for( FL_IMAGE *,
+                           int,
+                           int,
+                           FLIMAGE_JOB,
+                           void * );
+
+/* Progressive display while reading, see image_disp.c */
+
+void flimage_rows_done( FL_IMAGE *,
+                        int,
+                        int );
+
+int flimage_is_progressive( FL_IMAGE * );
+
+void flimage_end_progress( FL_IMAGE * );
+
+/* Tiles for the zoomed display, see image_disp.c */
+
+void flimage_free_tiles( FL_IMAGE * );
+
+/* Memory mapped file data, see image_mmap.c */
+
+void * flimage_map_pixels( FL_IMAGE *,
+                           size_t );
+
+void flimage_unmap_pixels( FL_IMAGE * );
+
+/* Index of the frames of a multi-frame file, one record per frame,
+   see image.c */
+
+int flimage_add_frame( FL_IMAGE *,
+                       const void *,
+                       size_t );
+
+void * flimage_get_frame( FL_IMAGE *,
+                          int );
+
+int flimage_frame_count( FL_IMAGE * );
+
+void flimage_free_frame_index( FL_IMAGE * );
+
+/* Cache of decoded images, see image_cache.c */
+
+typedef struct flimage_cache_entry_ FLIMAGE_CACHE_ENTRY;
+
+FL_IMAGE * flimage_cache_find( const char *,
+                               FLIMAGE_SETUP *,
+                               FLIMAGE_CACHE_ENTRY ** );
+
+void flimage_cache_add( FLIMAGE_CACHE_ENTRY *,
+                        FL_IMAGE * );
+
 #if ! defined( SEEK_SET )
 #define SEEK_SET 0
 #endif
@@ -40,6 +40,9 @@ static int visual_cue( FL_IMAGE *,
                        const char * );
 static void error_message( FL_IMAGE *,
                            const char * );
+static FL_IMAGE * dup_image( FL_IMAGE *,
+                             int,
+                             int );
 
 static int nimage;
 static FLIMAGE_SETUP current_setup;
@@ -97,6 +100,32 @@ init_setup( void )
 }
 
 
+/***************************************
+ * Sets the members of an image that come from the current setup
+ ***************************************/
+
+static void
+use_current_setup( FL_IMAGE * image )
+{
+    image->setup = &current_setup;
+    image->visual_cue = current_setup.visual_cue;
+    image->error_message = current_setup.error_message;
+    image->app_data = current_setup.app_data;
+    image->xdisplay = current_setup.xdisplay;
+
+    if ( ! image->xdisplay )
+        image->xdisplay = fl_display;
+
+    /* make sure visual_cue and error_message are ok */
+
+    if ( ! image->visual_cue )
+        image->visual_cue = visual_cue;
+
+    if ( ! image->error_message )
+        image->error_message = error_message;
+}
+
+
 /***************************************
  ***************************************/
 
@@ -109,27 +138,20 @@ flimage_alloc( void )
 
     add_default_formats( );
 
-    image->setup = &current_setup;
-    image->visual_cue = current_setup.visual_cue;
-    image->error_message = current_setup.error_message;
+    use_current_setup( image );
     image->gray_maxval = 255;
     image->ci_maxval = 255;
     image->tran_index = -1;
     image->tran_rgb = -1;
     image->app_background = -1;
-    image->app_data = current_setup.app_data;
     image->total_frames = 1;
     image->xdist_scale = image->ydist_scale = 1.0;
     image->pscale = 1.0;
     image->display = flimage_display;
-    image->xdisplay = current_setup.xdisplay;
     image->infile = fl_malloc( MaxImageFileNameLen * sizeof *image->infile );
     image->outfile = fl_malloc( MaxImageFileNameLen * sizeof *image->outfile );
     image->infile[0] = image->outfile[ 0 ] = '\0';
 
-    if ( ! image->xdisplay )
-        image->xdisplay = fl_display;
-
     /* initialize the quantizer */
 
     if ( ! flimage_quantize_rgb )
@@ -138,14 +160,6 @@ flimage_alloc( void )
         flimage_quantize_packed = j2pass_quantize_packed;
     }
 
-    /* make sure visual_cue and error_message are ok */
-
-    if ( ! image->visual_cue )
-        image->visual_cue = visual_cue;
-
-    if ( ! image->error_message )
-        image->error_message = error_message;
-
     /* annotation stuff */
 
     image->display_markers = null_op;
@@ -314,6 +328,8 @@ flimage_read( FL_IMAGE * im )
     if ( ( error = ( flimage_getmem( image ) < 0 ) ) )
     {
         im->error_message( im, "ImageGetMem:Failed to allocate memory" );
+        if ( image->cleanup )
+            image->cleanup( image );
         flimage_freemem( im );
         return NULL;
     }
@@ -322,6 +338,7 @@ flimage_read( FL_IMAGE * im )
     image->total = im->h;
     image->error_message( image, "" );
     error = error || ( io->read_pixels( image ) < 0 );
+    flimage_end_progress( image );
     image->completed = im->total;
     sprintf( buf, "Done Reading %s", image->fmt_name );
     image->visual_cue( image, error ? "Error Reading" : buf );
@@ -359,12 +376,20 @@ flimage_load( const char * file )
 {
     FL_IMAGE *image,
              *im;
+    FLIMAGE_CACHE_ENTRY *entry;
     int err,
         tc,
         total_frames = 1;
     char buf[ 256 ];
 
     add_default_formats( );
+    init_setup( );
+
+    if ( ( image = flimage_cache_find( file, &current_setup, &entry ) ) )
+    {
+        use_current_setup( image );
+        return image;
+    }
 
     if ( ( image = flimage_open( file ) ) )
     {
@@ -378,7 +403,10 @@ flimage_load( const char * file )
     }
 
     if ( ! image )
+    {
+        flimage_cache_add( entry, NULL );
         return image;
+    }
 
     /* transparency */
 
@@ -401,9 +429,13 @@ flimage_load( const char * file )
         fli_safe_free( image->io_spec );
         image->spec_size = 0;
         image->display = flimage_sdisplay;
+        flimage_cache_add( entry, image );
         return image;
     }
 
+    /* images with several frames don't get cached */
+
+    flimage_cache_add( entry, NULL );
     image->current_frame = 1;
 
     /* we have multi-frames */
@@ -420,6 +452,7 @@ flimage_load( const char * file )
                  im->current_frame, current_setup.max_frames );
         im->visual_cue( im, buf );
         err = err || ( im->next_frame( im ) < 0 );
+        flimage_end_progress( im );
         total_frames += ! err;
     }
 
@@ -434,6 +467,11 @@ flimage_load( const char * file )
     if ( image->cleanup )
         image->cleanup( image );
 
+    /* the frames got a copy of the (now closed) input stream */
+
+    for ( im = image->next; im; im = im->next )
+        im->fpin = NULL;
+
     /* update the number of frames */
 
     image->total_frames = total_frames;
@@ -441,13 +479,189 @@ flimage_load( const char * file )
 }
 
 
+/***************************************
+ * Replaces the pixels of an image that was opened with flimage_open()
+ * and read with flimage_read() by those of frame n (counting from 1)
+ * of the file. Formats that support it build an index of the frames
+ * on the first call, so later calls cost about as much as reading a
+ * single frame, independent of n. On success im->total_frames is set
+ * to the number of frames in the file.
+ ***************************************/
+
+int
+flimage_seek_frame( FL_IMAGE * im,
+                    int        n )
+{
+    int error,
+        tc;
+    char buf[ 256 ];
+
+    if ( ! im || ! im->fpin || im->type == FL_IMAGE_NONE )
+    {
+        M_err( "flimage_seek_frame", "image not open for reading" );
+        return -1;
+    }
+
+    if ( ! im->random_frame )
+    {
+        flimage_error( im, "%s: can't seek frames of %s files",
+                       im->infile, im->fmt_name );
+        return -1;
+    }
+
+    if ( n < 1 )
+    {
+        flimage_error( im, "%s: bad frame number %d", im->infile, n );
+        return -1;
+    }
+
+    /* frames are read as the file type, whatever the image got
+       converted to in between */
+
+    im->type = im->original_type;
+    im->completed = 0;
+    im->total = im->h;
+
+    /* the frame gets read into the pixels (some formats only store what
+       changed from the frame before), so they must be the image's own */
+
+    if ( flimage_detach( im, im->type ) < 0 )
+    {
+        flimage_error( im, "%s: can't get memory for frame", im->infile );
+        return -1;
+    }
+
+    error = im->random_frame( im, n ) < 0;
+    flimage_end_progress( im );
+
+    /* buffers of other types have the size of an earlier frame */
+
+    flimage_invalidate_pixels( im );
+
+    im->completed = im->total;
+    sprintf( buf, "Done Reading frame %d of %s", n, im->fmt_name );
+    im->visual_cue( im, error ? "Error Reading" : buf );
+
+    if ( error )
+        return -1;
+
+    tc = im->tran_index;
+    if ( FL_IsCI( im->type ) && tc >= 0 && tc < im->map_len )
+        im->tran_rgb = FL_PACK3( im->red_lut[ tc ],
+                                 im->green_lut[ tc ],
+                                 im->blue_lut[ tc ] );
+
+    im->current_frame = n;
+    im->original_type = im->type;
+    im->modified = 1;
+
+    return 0;
+}
+
+
+/***************************************
+ * The frame index: an array of records, one per frame and all of the
+ * same size, whose meaning is up to the format handler
+ ***************************************/
+
+typedef struct {
+    int      nframes,
+             nalloc;
+    size_t   rec_size;
+    char   * rec;
+} FRAME_INDEX;
+
+
+/***************************************
+ * Appends the record for the next frame to the index of the image
+ ***************************************/
+
+int
+flimage_add_frame( FL_IMAGE   * im,
+                   const void * rec,
+                   size_t       rec_size )
+{
+    FRAME_INDEX *fi = im->frame_index;
+
+    if ( ! fi )
+    {
+        if ( ! ( fi = fl_calloc( 1, sizeof *fi ) ) )
+            return -1;
+        fi->rec_size = rec_size;
+        im->frame_index = fi;
+    }
+
+    if ( rec_size != fi->rec_size )
+        return -1;
+
+    if ( fi->nframes == fi->nalloc )
+    {
+        int nalloc = fi->nalloc ? 2 * fi->nalloc : 64;
+        char *p = fl_realloc( fi->rec, nalloc * rec_size );
+
+        if ( ! p )
+            return -1;
+
+        fi->rec = p;
+        fi->nalloc = nalloc;
+    }
+
+    memcpy( fi->rec + fi->nframes++ * rec_size, rec, rec_size );
+    return 0;
+}
+
+
+/***************************************
+ * Returns the record of frame n (counting from 1) or NULL
+ ***************************************/
+
+void *
+flimage_get_frame( FL_IMAGE * im,
+                   int        n )
+{
+    FRAME_INDEX *fi = im->frame_index;
+
+    if ( ! fi || n < 1 || n > fi->nframes )
+        return NULL;
+
+    return fi->rec + ( n - 1 ) * fi->rec_size;
+}
+
+
+/***************************************
+ * Returns the number of frames in the index, -1 if there's none yet
+ ***************************************/
+
+int
+flimage_frame_count( FL_IMAGE * im )
+{
+    FRAME_INDEX *fi = im->frame_index;
+
+    return fi ? fi->nframes : -1;
+}
+
+
+/***************************************
+ ***************************************/
+
+void
+flimage_free_frame_index( FL_IMAGE * im )
+{
+    FRAME_INDEX *fi = im->frame_index;
+
+    if ( ! fi )
+        return;
+
+    fli_safe_free( fi->rec );
+    fl_free( fi );
+    im->frame_index = NULL;
+}
+
+
 /*}*********************************************************************
  * Output routines
  *******************************************************************{**/
 
-static void convert_type( FL_IMAGE *,
-                          FLIMAGE_IO * );
-
 int
 flimage_dump( FL_IMAGE   * image,
               const char * filename,
@@ -498,7 +712,15 @@ flimage_dump( FL_IMAGE   * image,
             otype = image->type;
 
             for ( tmpimage = image; tmpimage; tmpimage = tmpimage->next )
-                convert_type( tmpimage, io );
+                if ( flimage_convert_for_io( tmpimage, io ) < 0 )
+                {
+                    flimage_error( image, "can't convert %s image for %s",
+                                   flimage_type_name( tmpimage->type ),
+                                   io->formal_name );
+                    image->type = otype;
+                    flimage_close( image );
+                    return -1;
+                }
 
             if ( image->pre_write && image->pre_write( image ) < 0 )
             {
@@ -533,12 +755,13 @@ flimage_dump( FL_IMAGE   * image,
 
 
 /***************************************
- * convert the image to a type the output routine can handle
+ * convert the image to a type the output routine can handle. Returns
+ * 0 on success and -1 if there's no conversion to such a type.
  ***************************************/
 
-static void
-convert_type( FL_IMAGE   * im,
-              FLIMAGE_IO * io )
+int
+flimage_convert_for_io( FL_IMAGE   * im,
+                        FLIMAGE_IO * io )
 {
     const int types[ ] = { FL_IMAGE_RGB,
                            FL_IMAGE_PACKED,
@@ -552,7 +775,7 @@ convert_type( FL_IMAGE   * im,
     /* if the output routine can handle the current image type, do nothing */
 
     if ( ( im->type & io->type ) )
-        return;
+        return 0;
 
     /* must force the conversion */
 
@@ -598,6 +821,8 @@ convert_type( FL_IMAGE   * im,
                flimage_type_name( im->type ) );
         im->force_convert = 0;
     }
+
+    return ( im->type & io->type ) ? 0 : -1;
 }
 
 
@@ -619,6 +844,7 @@ flimage_free( FL_IMAGE * image )
         flimage_freemem( im );
         if ( im == image )
             flimage_close( im );
+        flimage_free_frame_index( im );
         imnext = im->next;
         fli_safe_free( im->infile );
         fli_safe_free( im->outfile );
@@ -736,12 +962,14 @@ flimage_getmem( FL_IMAGE * im )
                                                     sizeof **im->gray ) );
             }
 
-            if ( ! err && ( ! im->wlut || im->gray_maxval > im->wlut_len ) )
+            /* the table gets one extra entry, see flimage_lut_u16() */
+
+            if ( ! err && ( ! im->wlut || im->gray_maxval >= im->wlut_len ) )
             {
                 fli_safe_free( im->wlut );
                 if ( ( im->wlut_len = im->gray_maxval + 1 ) < 256 )
                     im->wlut_len = 256;
-                err = ! ( im->wlut = fl_malloc( im->wlut_len
+                err = ! ( im->wlut = fl_malloc( ( im->wlut_len + 1 )
                                                 * sizeof *im->wlut ) );
             }
             break;
@@ -842,7 +1070,8 @@ flimage_getcolormap( FL_IMAGE * im )
 
     if ( im->map_len > im->wlut_len && FL_IsGray( im->type ) )
     {
-        im->wlut = fl_realloc( im->wlut, im->map_len * sizeof *im->wlut );
+        im->wlut = fl_realloc( im->wlut,
+                               ( im->map_len + 1 ) * sizeof *im->wlut );
         if ( ! im->wlut )
         {
             im->wlut_len = 0;
@@ -936,6 +1165,10 @@ flimage_freemem( FL_IMAGE * image )
         image->red = image->green = image->blue = image->alpha = NULL;
     }
 
+    /* the pixels may have been pointing into the mapped file */
+
+    flimage_unmap_pixels( image );
+
     if ( image->map_len > 0 && image->red_lut )
     {
         fl_free( image->red_lut );
@@ -960,11 +1193,8 @@ flimage_freemem( FL_IMAGE * image )
         image->pixmap_depth = 0;
     }
 
-    if ( image->ximage )
-    {
-        XDestroyImage( ( XImage * ) image->ximage );
-        image->ximage = NULL;
-    }
+    flimage_destroy_ximage( image );
+    flimage_free_tiles( image );
 
     if ( image->gc )
     {
@@ -1331,6 +1561,11 @@ copy_pixels( FL_IMAGE * dim,
             memcpy( dim->gray[ 0 ], sim->gray[ 0 ], size );
             break;
 
+        case FLIMAGE_PACKED:
+            size = sim->w * sim->h * sizeof **sim->packed;
+            memcpy( dim->packed[ 0 ], sim->packed[ 0 ], size );
+            break;
+
         default:
             M_err( "copy_pixel", "Bad type: %d", sim->type );
             break;
@@ -1338,6 +1573,132 @@ copy_pixels( FL_IMAGE * dim,
 }
 
 
+#define Share( dim, sim, m )  \
+    ( ! ( sim )->m || ( ( dim )->m = flimage_share_matrix( ( sim )->m ) ) )
+
+
+/***************************************
+ * Makes the new image use the pixels of the current type of the old
+ * one (copy-on-write). Returns -1 if they can't be shared, e.g. because
+ * they point into a memory mapped file.
+ ***************************************/
+
+static int
+share_pixels( FL_IMAGE * dim,
+              FL_IMAGE * sim )
+{
+    int ok;
+
+    switch ( sim->type )
+    {
+        case FLIMAGE_RGB:
+            ok =    Share( dim, sim, red )
+                 && Share( dim, sim, green )
+                 && Share( dim, sim, blue )
+                 && Share( dim, sim, alpha );
+
+            dim->rgba[ 0 ] = dim->red;
+            dim->rgba[ 1 ] = dim->green;
+            dim->rgba[ 2 ] = dim->blue;
+            dim->rgba[ 3 ] = dim->alpha;
+            break;
+
+        case FLIMAGE_CI:
+        case FLIMAGE_MONO:
+            ok = Share( dim, sim, ci );
+            break;
+
+        case FLIMAGE_GRAY:
+        case FLIMAGE_GRAY16:
+            ok = Share( dim, sim, gray );
+            break;
+
+        case FLIMAGE_PACKED:
+            ok = Share( dim, sim, packed );
+            break;
+
+        default:
+            ok = 0;
+            break;
+    }
+
+    if ( ! ok )
+    {
+        flimage_free_rgb( dim );
+        flimage_free_ci( dim );
+        flimage_free_gray( dim );
+        fl_free_matrix( dim->packed );
+        dim->packed = NULL;
+        return -1;
+    }
+
+    dim->matr = dim->h;
+    dim->matc = dim->w;
+
+    return 0;
+}
+
+
+#define Detach( im, m, err )                                               \
+    do {                                                                   \
+        void *tmp_;                                                        \
+                                                                           \
+        if ( ( im )->m )                                                   \
+        {                                                                  \
+            if ( ( tmp_ = flimage_detach_matrix( ( im )->m, ( im )->h,     \
+                                                 ( im )->w,                \
+                                                 sizeof **( im )->m ) ) )  \
+                ( im )->m = tmp_;                                          \
+            else                                                           \
+                err = 1;                                                   \
+        }                                                                  \
+    } while ( 0 )
+
+
+/***************************************
+ * Duplicates made with flimage_dup_shared() (and subimages) share the
+ * pixels with the original until one of them gets changed. Before
+ * pixels of the given types (an or'ed combination of FL_IMAGE_XXX
+ * values) get written to this function must be called, it makes copies
+ * of them for the image if they're shared with another one. Returns -1
+ * if there's not enough memory.
+ ***************************************/
+
+int
+flimage_detach( FL_IMAGE * im,
+                int        types )
+{
+    int err = 0;
+
+    if ( ! im )
+        return -1;
+
+    if ( types & FL_IMAGE_RGB )
+    {
+        Detach( im, red,   err );
+        Detach( im, green, err );
+        Detach( im, blue,  err );
+        Detach( im, alpha, err );
+
+        im->rgba[ 0 ] = im->red;
+        im->rgba[ 1 ] = im->green;
+        im->rgba[ 2 ] = im->blue;
+        im->rgba[ 3 ] = im->alpha;
+    }
+
+    if ( types & ( FL_IMAGE_CI | FL_IMAGE_MONO ) )
+        Detach( im, ci, err );
+
+    if ( types & ( FL_IMAGE_GRAY | FL_IMAGE_GRAY16 ) )
+        Detach( im, gray, err );
+
+    if ( types & FL_IMAGE_PACKED )
+        Detach( im, packed, err );
+
+    return err ? -1 : 0;
+}
+
+
 /***************************************
  ***************************************/
 
@@ -1351,6 +1712,21 @@ flimage_dup( FL_IMAGE * sim )
 }
 
 
+/***************************************
+ * Like flimage_dup(), but the pixels are shared with the original
+ * (copy-on-write) instead of being copied
+ ***************************************/
+
+FL_IMAGE *
+flimage_dup_shared( FL_IMAGE * sim )
+{
+    if ( ! sim || ! sim->w || sim->type == FLIMAGE_NONE )
+        return NULL;
+
+    return dup_image( sim, 1, 1 );
+}
+
+
 /***************************************
  * duplicate an image, with or without the pixels
  ***************************************/
@@ -1358,6 +1734,20 @@ flimage_dup( FL_IMAGE * sim )
 FL_IMAGE *
 flimage_dup_( FL_IMAGE * sim,
               int        pix )
+{
+    return dup_image( sim, pix, 0 );
+}
+
+
+/***************************************
+ * Duplicates an image. If 'pix' is set the pixels get copied or, if
+ * 'share' is also set, shared with the original if possible
+ ***************************************/
+
+static FL_IMAGE *
+dup_image( FL_IMAGE * sim,
+           int        pix,
+           int        share )
 {
     FL_IMAGE *im = flimage_alloc( );
     unsigned int mapsize = sim->map_len * sizeof *sim->red_lut;
@@ -1388,18 +1778,23 @@ flimage_dup_( FL_IMAGE * sim,
     im->extra_io_info = NULL;
     im->info = NULL;
 
-    flimage_getmem( im );
+    /* pixels, if requested, get copied or shared with the original (and
+       then copied only when that's not possible) */
+
+    if ( pix && share && share_pixels( im, sim ) == 0 )
+        flimage_getmem( im );
+    else
+    {
+        flimage_getmem( im );
+        if ( pix )
+            copy_pixels( im, sim );
+    }
 
     im->available_type = im->type;
     im->next = NULL;
     strcpy( im->infile = infile, sim->infile );
     strcpy( im->outfile = outfile, sim->outfile );
 
-    /* copy pixels if requested */
-
-    if ( pix )
-        copy_pixels( im, sim );
-
     if ( mapsize )
     {
         if ( flimage_getcolormap( im ) < 0 )
@@ -1431,6 +1826,11 @@ flimage_dup_( FL_IMAGE * sim,
     im->pixels = 0;
     im->pixmap = None;
     im->ximage = NULL;
+    im->shm_info = NULL;
+    im->map_info = NULL;
+    im->progress_info = NULL;
+    im->frame_index = NULL;
+    im->tile_info = NULL;
     im->info = 0;
     im->win = None;
     im->gc = im->textgc = im->markergc = None;
@@ -304,6 +304,8 @@ load_24bit_bmp( FL_IMAGE * im,
         for ( j = 0; j < sp->pad; j++ )
             getc( fp );
 
+        flimage_rows_done( im, i, 1 );
+
         if ( ! ( im->completed & FLIMAGE_REPFREQ ) )
             im->visual_cue( im, "Reading 24bit BMP" );
     }
@@ -340,6 +342,8 @@ load_8bit_bmp( FL_IMAGE * im,
                     *ci++ = pix;
             }
 
+            flimage_rows_done( im, i, 1 );
+
             if ( ! ( im->completed & FLIMAGE_REPFREQ ) )
                 im->visual_cue( im, "Reading 8bit BMP" );
         }
@@ -649,7 +653,7 @@ BMP_write_image( FL_IMAGE * im )
     else if ( sp->bpp == 8 )
     {
         unsigned short *p8,
-                       **ras = FL_IMAGE_CI ? im->ci:im->gray;
+                       **ras = im->type == FL_IMAGE_CI ? im->ci : im->gray;
 
         for ( i = im->h; --i >= 0; )
         {
@@ -0,0 +1,373 @@
+/*
+ *  This file is part of the XForms library package.
+ *
+ *  XForms is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1, or
+ *  (at your option) any later version.
+ *
+ *  XForms is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with XForms.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Cache of decoded images for flimage_load().
+ *
+ * If the 'cache_size' member of the setup is set, flimage_load() keeps a
+ * copy of each single-frame image it read from a regular file, up to
+ * that many bytes of pixel data in total. Loading the same file again
+ * then just returns another copy, without identifying and decoding the
+ * file. The copies are made with flimage_dup(), i.e. they don't share
+ * their pixels, so an application may write to the pixels of an image
+ * it got directly without that showing up in the cache.
+ *
+ * Entries are found by file name and are only used as long as the
+ * modification time (with nanoseconds where the system records them),
+ * size and inode of the file are the ones it had when it was read and
+ * its format is still registered, with annotations
+ * switched on or off as before (images that had annotations aren't
+ * cached at all). When the budget is exceeded the least recently used
+ * images get dropped.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "include/forms.h"
+#include "flimage.h"
+#include "flimage_int.h"
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+#define Mtime_nsec( st )  ( ( st )->st_mtim.tv_nsec )
+#else
+#define Mtime_nsec( st )  0L
+#endif
+
+
+struct flimage_cache_entry_ {
+    FLIMAGE_CACHE_ENTRY * prev,       /* towards more recently used */
+                        * next;
+    char                * file;
+    char                * format;     /* short name of the format   */
+    int                   annotation; /* format had annotations on  */
+    time_t                mtime;
+    long                  mtime_nsec;
+    off_t                 size;
+    dev_t                 dev;
+    ino_t                 ino;
+    unsigned long         bytes;      /* memory used by the pixels  */
+    FL_IMAGE            * image;
+};
+
+static FLIMAGE_CACHE_ENTRY *first,
+                           *last;
+static unsigned long total_bytes,
+                     hits,
+                     misses;
+static int nentries;
+
+
+/***************************************
+ * Memory used by the pixels and colormap of an image
+ ***************************************/
+
+static unsigned long
+image_bytes( FL_IMAGE * im )
+{
+    unsigned long n = ( unsigned long ) im->w * im->h;
+
+    switch ( im->type )
+    {
+        case FL_IMAGE_RGB :
+            n *= 4 * sizeof **im->red;
+            break;
+
+        case FL_IMAGE_PACKED :
+            n *= sizeof **im->packed;
+            break;
+
+        case FL_IMAGE_CI :
+        case FL_IMAGE_MONO :
+            n *= sizeof **im->ci;
+            break;
+
+        default :
+            n *= sizeof **im->gray;
+            break;
+    }
+
+    return n + im->map_len * 4 * sizeof *im->red_lut;
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+unlink_entry( FLIMAGE_CACHE_ENTRY * e )
+{
+    if ( e->prev )
+        e->prev->next = e->next;
+    else
+        first = e->next;
+
+    if ( e->next )
+        e->next->prev = e->prev;
+    else
+        last = e->prev;
+
+    e->prev = e->next = NULL;
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+link_first( FLIMAGE_CACHE_ENTRY * e )
+{
+    if ( ( e->next = first ) )
+        first->prev = e;
+    else
+        last = e;
+    first = e;
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+free_entry( FLIMAGE_CACHE_ENTRY * e )
+{
+    if ( e->image )
+        flimage_free( e->image );
+    fli_safe_free( e->file );
+    fli_safe_free( e->format );
+    fl_free( e );
+}
+
+
+/***************************************
+ * Removes an entry from the cache and deletes it
+ ***************************************/
+
+static void
+drop_entry( FLIMAGE_CACHE_ENTRY * e )
+{
+    unlink_entry( e );
+    total_bytes -= e->bytes;
+    nentries--;
+    free_entry( e );
+}
+
+
+/***************************************
+ * Drops the least recently used images until no more than
+ * 'budget' bytes are used
+ ***************************************/
+
+static void
+trim_cache( long budget )
+{
+    while ( last && ( budget <= 0 || total_bytes > ( unsigned long ) budget ) )
+        drop_entry( last );
+}
+
+
+/***************************************
+ * Returns a copy of the image of the entry or NULL if the file
+ * changed since the image was read or its format isn't available
+ * (anymore) in the same way.
+ ***************************************/
+
+static FL_IMAGE *
+use_entry( FLIMAGE_CACHE_ENTRY * e,
+           struct stat         * st )
+{
+    FLIMAGE_IO *io;
+    FL_IMAGE *im;
+
+    if (    e->mtime      != st->st_mtime
+         || e->mtime_nsec != Mtime_nsec( st )
+         || e->size       != st->st_size
+         || e->dev        != st->st_dev
+         || e->ino        != st->st_ino
+         || ! ( io = flimage_find_imageIO( e->format ) )
+         || io->annotation != e->annotation
+         || ! ( im = flimage_dup( e->image ) ) )
+        return NULL;
+
+    /* the format table may have been reallocated since */
+
+    im->image_io = io;
+    im->fmt_name = io->short_name;
+
+    if ( e->image->comments )
+        flimage_add_comments( im, e->image->comments,
+                              e->image->comments_len );
+
+    return im;
+}
+
+
+/***************************************
+ * Called by flimage_load() before anything else. Returns a new image
+ * made from the cached one if the file was read before and didn't
+ * change since. Otherwise NULL is returned and, if caching is switched
+ * on, '*entry' is set to a new entry that must be handed to
+ * flimage_cache_add() once the file has been read (or not).
+ ***************************************/
+
+FL_IMAGE *
+flimage_cache_find( const char           * file,
+                    FLIMAGE_SETUP        * setup,
+                    FLIMAGE_CACHE_ENTRY ** entry )
+{
+    FLIMAGE_CACHE_ENTRY *e;
+    FL_IMAGE *im;
+    struct stat st;
+
+    *entry = NULL;
+
+    trim_cache( setup->cache_size );
+
+    if (    setup->cache_size <= 0
+         || ! file
+         || stat( file, &st ) < 0
+         || ! S_ISREG( st.st_mode ) )
+        return NULL;
+
+    for ( e = first; e && strcmp( e->file, file ); e = e->next )
+        /* empty */ ;
+
+    if ( e )
+    {
+        if ( ( im = use_entry( e, &st ) ) )
+        {
+            unlink_entry( e );
+            link_first( e );
+            hits++;
+            return im;
+        }
+
+        drop_entry( e );
+    }
+
+    misses++;
+
+    if ( ! ( e = fl_calloc( 1, sizeof *e ) ) )
+        return NULL;
+
+    if ( ! ( e->file = fl_strdup( file ) ) )
+    {
+        fl_free( e );
+        return NULL;
+    }
+
+    e->mtime      = st.st_mtime;
+    e->mtime_nsec = Mtime_nsec( &st );
+    e->size       = st.st_size;
+    e->dev        = st.st_dev;
+    e->ino        = st.st_ino;
+
+    *entry = e;
+    return NULL;
+}
+
+
+/***************************************
+ * Puts a copy of the image just read into the entry returned by
+ * flimage_cache_find() and the entry into the cache - unless there's no
+ * image, it has several frames or annotations or it's larger than the
+ * whole cache, in which case the entry is just deleted.
+ ***************************************/
+
+void
+flimage_cache_add( FLIMAGE_CACHE_ENTRY * e,
+                   FL_IMAGE            * im )
+{
+    long budget;
+
+    if ( ! e )
+        return;
+
+    if (    ! im
+         || im->next
+         || im->ntext
+         || im->nmarkers
+         || ! im->fmt_name
+         || ( budget = im->setup->cache_size ) <= 0
+         || ( e->bytes = image_bytes( im ) ) > ( unsigned long ) budget
+         || ! ( e->format = fl_strdup( im->fmt_name ) )
+         || ! ( e->image = flimage_dup( im ) ) )
+    {
+        free_entry( e );
+        return;
+    }
+
+    if ( im->comments )
+        flimage_add_comments( e->image, im->comments, im->comments_len );
+
+    e->annotation = ( ( FLIMAGE_IO * ) im->image_io )->annotation;
+
+    link_first( e );
+    total_bytes += e->bytes;
+    nentries++;
+
+    trim_cache( budget );
+}
+
+
+/***************************************
+ * Returns how often flimage_load() found an image in the cache and how
+ * often not (since the last call of flimage_flush_cache()), and the
+ * number of images and bytes of pixel data currently in the cache.
+ * Each of the pointers may be NULL.
+ ***************************************/
+
+void
+flimage_get_cache_stats( unsigned long * nhits,
+                         unsigned long * nmisses,
+                         int           * nimages,
+                         unsigned long * nbytes )
+{
+    if ( nhits )
+        *nhits = hits;
+    if ( nmisses )
+        *nmisses = misses;
+    if ( nimages )
+        *nimages = nentries;
+    if ( nbytes )
+        *nbytes = total_bytes;
+}
+
+
+/***************************************
+ * Empties the cache and resets the counters
+ ***************************************/
+
+void
+flimage_flush_cache( void )
+{
+    trim_cache( 0 );
+    hits = misses = 0;
+}
+
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
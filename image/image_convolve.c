@@ -22,13 +22,15 @@
  *   All rights reserved.
  *
  *  General colvolution routines for RGB and gray (both 8bit and 16bit)
- *  images. 3x3 and 5x5 kernels are manually unrolled.
+ *  images. Separable kernels are done in two 1-D passes, rows are split
+ *  between the worker threads.
  */
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
 
+#include <string.h>
 #include "include/forms.h"
 #include "flimage.h"
 #include "flimage_int.h"
@@ -37,237 +39,302 @@
  * Convolution
  *******************************************************************{***/
 
-#define VectorP3( k, b, i )     (   k[ 0 ] * b[ i - 1 ]     \
-                                  + k[ 1 ] * b[ i ]         \
-                                  + k[ 2 ] * b[ i + 1 ] )
-
-#define VectorP5( k, b, i )     (   k[ 0 ] * b[ i - 2 ]     \
-                                  + k[ 1 ] * b[ i - 1 ]     \
-                                  + k[ 2 ] * b[ i ]         \
-                                  + k[ 3 ] * b[ i + 1 ]     \
-                                  + k[ 4 ] * b[ i + 2 ]     )
-
-#define conv3x3( cm, m, r, c )  (   VectorP3( cm[ 0 ], m[ r - 1 ], c )    \
-                                  + VectorP3( cm[ 1 ], m[ r + 0 ], c )    \
-                                  + VectorP3( cm[ 2 ], m[ r + 1 ], c ) )
+static void init_kernels(void);
 
-#define conv5x5( kernel, pc, row, col )                        \
-                            (   VectorP5( kernel[ 0 ], pc[ row - 2 ], col )  \
-                              + VectorP5( kernel[ 1 ], pc[ row - 1 ], col )  \
-                              + VectorP5( kernel[ 2 ], pc[ row + 0 ], col )  \
-                              + VectorP5( kernel[ 3 ], pc[ row + 1 ], col )  \
-                              + VectorP5( kernel[ 4 ], pc[ row + 2 ], col ) )
+/* A kernel that (apart from its center element) is the outer product of
+   a column and a row vector, i.e. kernel = u * v^T + center * delta, is
+   done as two 1-D passes, which for the built-in kernels and typical
+   blurring kernels is a lot faster. Everything is done with ints, so
+   results are exactly the same as with the full 2-D convolution. */
+
+typedef struct {
+    void       ** in;              /* source rows                       */
+    void       ** out;             /* result rows, same size            */
+    int           is_short;        /* unsigned short instead of char    */
+    int           w,
+                  h;
+    int        ** kernel;
+    int           krow,
+                  kcol;
+    int           separable;
+    int         * u,               /* column vector (krow)              */
+                * v;               /* row vector (kcol)                 */
+    int           center;
+    int           weight;
+    int           maxval;
+    int           err;
+} ConvJob;
+
+#define CONV_BAND  32
 
 
 /***************************************
  ***************************************/
 
 static int
-uc_conv5x5( int           ** kernel,
-            unsigned char ** pc,
-            int              r,
-            int              c )
+int_gcd( int a,
+         int b )
 {
-    return conv5x5( kernel, pc, r, c );
+    int t;
+
+    a = FL_abs( a );
+    b = FL_abs( b );
+
+    while ( b )
+    {
+        t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
 }
 
 
 /***************************************
+ * Tries to split the kernel into u * v^T + center * delta with integer
+ * vectors u and v. Returns 1 on success.
  ***************************************/
 
 static int
-us_conv5x5( int            ** kernel,
-            unsigned short ** s,
-            int               r,
-            int               c )
+split_kernel( ConvJob * cj )
 {
-    return conv5x5( kernel, s, r, c );
-}
+    int **k = cj->kernel;
+    int hr = cj->krow / 2,
+        hc = cj->kcol / 2;
+    int r0 = -1,
+        c0 = -1,
+        g = 0,
+        i,
+        j;
+
+    /* Find an off-center element, not in the center row or column */
+
+    for ( i = 0; i < cj->krow && r0 < 0; i++ )
+        for ( j = 0; j < cj->kcol; j++ )
+            if (    k[ i ][ j ]
+                 && ( i != hr || cj->krow == 1 )
+                 && ( j != hc || cj->kcol == 1 ) )
+            {
+                r0 = i;
+                c0 = j;
+                break;
+            }
 
+    if ( r0 < 0 )
+        return 0;
 
-static void init_kernels(void);
+    for ( j = 0; j < cj->kcol; j++ )
+        if ( r0 != hr || j != hc )
+            g = int_gcd( g, k[ r0 ][ j ] );
 
-/* normalize with weight the clamp */
+    if ( ! g )
+        return 0;
 
-#define NormAndClamp( pc, w, max )                        \
-            do {                                          \
-                if ( pc < 0 )                             \
-                    pc = 0;                               \
-                else if ( ( pc /=w ) > ( max ) )          \
-                    pc = ( max );                         \
-             } while ( 0 )
+    for ( j = 0; j < cj->kcol; j++ )
+        cj->v[ j ] = r0 == hr && j == hc ? 0 : k[ r0 ][ j ] / g;
 
+    for ( i = 0; i < cj->krow; i++ )
+    {
+        if ( k[ i ][ c0 ] % cj->v[ c0 ] )
+            return 0;
+        cj->u[ i ] = k[ i ][ c0 ] / cj->v[ c0 ];
+    }
+
+    for ( i = 0; i < cj->krow; i++ )
+        for ( j = 0; j < cj->kcol; j++ )
+            if (    ( i != hr || j != hc )
+                 && cj->u[ i ] * cj->v[ j ] != k[ i ][ j ] )
+                return 0;
+
+    cj->center = k[ hr ][ hc ] - cj->u[ hr ] * cj->v[ hc ];
+
+    return 1;
+}
 
 
 /***************************************
+ * acc[ 0 .. n - 1 ] += k * row[ x0 .. x0 + n - 1 ]
  ***************************************/
 
 static void
-rgb_convolve( unsigned char ** red,
-              unsigned char ** green,
-              unsigned char ** blue,
-              int              h,
-              int              w,
-              int           ** kernel,
-              int              krow,
-              int              kcol,
-              int              weight,
-              FL_IMAGE       * im,
-              const char     * what )
+madd_row( ConvJob * cj,
+          int     * acc,
+          int       y,
+          int       x0,
+          int       k,
+          int       n )
 {
-    int newr,
-        newg,
-        newb,
-        row,
-        col;
-    int k_halfh = krow / 2,
-        k_halfw = kcol / 2;
-
-    for ( h -= k_halfw, w -= k_halfw, row = 1; row < h; row++ )
-    {
-        if ( krow == 3 && kcol == 3 )
-        {
-            for ( col = k_halfw; col < w; col++ )
-            {
-                newr = conv3x3( kernel, red, row, col );
-                newg = conv3x3( kernel, green, row, col );
-                newb = conv3x3( kernel, blue, row, col );
+    if ( cj->is_short )
+        flimage_madd_u16( acc, ( ( unsigned short ** ) cj->in )[ y ] + x0,
+                          k, n );
+    else
+        flimage_madd_u8( acc, ( ( unsigned char ** ) cj->in )[ y ] + x0,
+                         k, n );
+}
 
-                NormAndClamp( newr, weight, FL_PCMAX );
-                NormAndClamp( newg, weight, FL_PCMAX );
-                NormAndClamp( newb, weight, FL_PCMAX );
 
-                red[ row ][ col ] = newr;
-                green[ row ][ col ] = newg;
-                blue[ row ][ col ] = newb;
-            }
-        }
-        else if ( krow == 5 && kcol == 5 )
-        {
-            for ( col = k_halfw; col < w; col++ )
-            {
-                newr = uc_conv5x5( kernel, red, row, col );
-                newg = uc_conv5x5( kernel, green, row, col );
-                newb = uc_conv5x5( kernel, blue, row, col );
+/***************************************
+ * Normalizes with the weight, clamps and stores
+ ***************************************/
 
-                NormAndClamp( newr, weight, FL_PCMAX );
-                NormAndClamp( newg, weight, FL_PCMAX );
-                NormAndClamp( newb, weight, FL_PCMAX );
+static void
+store_row( ConvJob * cj,
+           int     * acc,
+           int       y )
+{
+    int n = cj->w - 2 * ( cj->kcol / 2 ),
+        x0 = cj->kcol / 2,
+        i,
+        val;
 
-                red[ row ][ col ] = newr;
-                green[ row ][ col ] = newg;
-                blue[ row ][ col ] = newb;
-            }
-        }
-        else
-        {
-            int i,
-                j,
-                ccol,
-                ii,
-                jj;
+    for ( i = 0; i < n; i++ )
+    {
+        if ( ( val = acc[ i ] ) < 0 )
+            val = 0;
+        else if ( ( val /= cj->weight ) > cj->maxval )
+            val = cj->maxval;
+        acc[ i ] = val;
+    }
 
-            for ( col = k_halfw; col < w; col++ )
-            {
-                newr = newg = newb = 0;
-                ccol = col - k_halfw;
-
-                for ( i = 0; i < krow; i++ )
-                {
-                    ii = row - k_halfh + i;
-
-                    for ( jj = ccol, j = 0; j < kcol; jj++, j++ )
-                    {
-                        newr += kernel[ i ][ j ] * red[ ii ][ jj ];
-                        newg += kernel[ i ][ j ] * green[ ii ][ jj ];
-                        newb += kernel[ i ][ j ] * blue[ ii ][ jj ];
-                    }
-                }
-
-                NormAndClamp( newr, weight, FL_PCMAX );
-                NormAndClamp( newg, weight, FL_PCMAX );
-                NormAndClamp( newb, weight, FL_PCMAX );
-
-                red[ row ][ col ] = newr;
-                green[ row ][ col ] = newg;
-                blue[ row ][ col ] = newg;
-            }
-        }
+    if ( cj->is_short )
+    {
+        unsigned short *out = ( ( unsigned short ** ) cj->out )[ y ] + x0;
+
+        for ( i = 0; i < n; i++ )
+            out[ i ] = acc[ i ];
+    }
+    else
+    {
+        unsigned char *out = ( ( unsigned char ** ) cj->out )[ y ] + x0;
 
-        if ( ! ( ++im->completed & FLIMAGE_REPFREQ ) )
-            im->visual_cue( im, what );
+        for ( i = 0; i < n; i++ )
+            out[ i ] = acc[ i ];
     }
 }
 
 
 /***************************************
+ * Convolves a band of rows, 'first' and 'last' count from the first
+ * row that can be done completely
  ***************************************/
 
 static void
-gray_convolve( unsigned short ** gray,
-               int               h,
-               int               w,
-               int            ** kernel,
-               int               krow,
-               int               kcol,
-               int               weight,
-               FL_IMAGE        * im,
-               const char      * what )
+convolve_band( void * data,
+               int    first,
+               int    last )
 {
-    int newr,
-        row,
-        col;
-    int k_halfh = krow / 2,
-        k_halfw = kcol / 2;
+    ConvJob *cj = data;
+    int hr = cj->krow / 2,
+        n = cj->w - 2 * ( cj->kcol / 2 ),
+        y0 = first + hr,
+        y1 = last + hr,
+        *acc,
+        *tmp = NULL,
+        i,
+        j,
+        y;
+
+    if ( ! ( acc = fl_malloc( n * sizeof *acc ) ) )
+    {
+        cj->err = 1;
+        return;
+    }
 
-    for ( h -= k_halfw, w -= k_halfw, row = 1; row < h; row++ )
+    if ( cj->separable )
     {
-        if ( krow == 3 && kcol == 3 )
+        /* Horizontal pass over all rows needed by the band */
+
+        int nrows = y1 - y0 + 2 * hr;
+
+        if ( ! ( tmp = fl_calloc( ( size_t ) nrows * n, sizeof *tmp ) ) )
         {
-            for  (col = k_halfw; col < w; col++ )
-            {
-                newr = conv3x3( kernel, gray, row, col );
-                NormAndClamp( newr, weight, FL_PCMAX );
-                gray[ row ][ col ] = newr;
-            }
+            fl_free( acc );
+            cj->err = 1;
+            return;
         }
-        else if ( krow == 5 && kcol == 5 )
+
+        for ( y = 0; y < nrows; y++ )
+            for ( j = 0; j < cj->kcol; j++ )
+                if ( cj->v[ j ] )
+                    madd_row( cj, tmp + ( size_t ) y * n, y0 - hr + y, j,
+                              cj->v[ j ], n );
+
+        /* Vertical pass plus the center correction */
+
+        for ( y = y0; y < y1; y++ )
         {
-            for ( col = k_halfw; col < w; col++ )
-            {
-                newr = us_conv5x5( kernel, gray, row, col );
-                NormAndClamp( newr, weight, im->gray_maxval );
-                gray[ row ] [col ] = newr;
-            }
+            memset( acc, 0, n * sizeof *acc );
+
+            for ( i = 0; i < cj->krow; i++ )
+                if ( cj->u[ i ] )
+                    flimage_madd_i32( acc, tmp + ( size_t ) ( y - y0 + i ) * n,
+                                      cj->u[ i ], n );
+
+            if ( cj->center )
+                madd_row( cj, acc, y, cj->kcol / 2, cj->center, n );
+
+            store_row( cj, acc, y );
         }
-        else
+
+        fl_free( tmp );
+    }
+    else
+    {
+        for ( y = y0; y < y1; y++ )
         {
-            int i,
-                j,
-                ccol,
-                ii,
-                jj;
+            memset( acc, 0, n * sizeof *acc );
 
-            for ( col = k_halfw; col < w; col++ )
-            {
-                ccol = col - k_halfw;
+            for ( i = 0; i < cj->krow; i++ )
+                for ( j = 0; j < cj->kcol; j++ )
+                    if ( cj->kernel[ i ][ j ] )
+                        madd_row( cj, acc, y - hr + i, j,
+                                  cj->kernel[ i ][ j ], n );
 
-                for ( newr = 0, i = 0; i < krow; i++ )
-                {
-                    ii = row - k_halfh + i;
+            store_row( cj, acc, y );
+        }
+    }
 
-                    for ( jj = ccol, j = 0; j < kcol; jj++, j++ )
-                        newr += kernel[ i ][ j ] * gray[ ii ][ jj ];
-                }
+    fl_free( acc );
+}
 
-                NormAndClamp( newr, weight, FL_PCMAX );
-                gray[ row ][ col ] = newr;
-            }
-        }
 
-        if ( ! ( ++im->completed & FLIMAGE_REPFREQ ) )
-            im->visual_cue( im, what );
-    }
+/***************************************
+ * Convolves a single plane, the result replaces the interior of the
+ * plane, a border of half the kernel size is left alone
+ ***************************************/
+
+static int
+convolve_plane( ConvJob  * cj,
+                void    ** plane,
+                FL_IMAGE * im )
+{
+    int hr = cj->krow / 2,
+        hc = cj->kcol / 2,
+        size = cj->is_short ? sizeof( unsigned short ) : 1,
+        y;
+
+    if ( cj->h <= 2 * hr || cj->w <= 2 * hc )
+        return 0;
+
+    cj->in = plane;
+
+    if ( ! ( cj->out = fl_get_matrix( cj->h, cj->w, size ) ) )
+        return -1;
+
+    cj->err = 0;
+    flimage_parallel_for( im, cj->h - 2 * hr, CONV_BAND, convolve_band, cj );
+
+    if ( ! cj->err )
+        for ( y = hr; y < cj->h - hr; y++ )
+            memcpy( ( char * ) cj->in[ y ] + hc * size,
+                    ( char * ) cj->out[ y ] + hc * size,
+                    ( cj->w - 2 * hc ) * size );
+
+    fl_free_matrix( cj->out );
+    cj->out = NULL;
+
+    return cj->err ? -1 : 0;
 }
 
 
@@ -285,10 +352,12 @@ flimage_convolve( FL_IMAGE  * im,
                   int         kcol )
 {
     int weight = 0,
+        err = 0,
         i;
     const char * what = "convolving";
     char buf[ 128 ];
     SubImage *sub;
+    ConvJob cj;
 
     if ( !im || im->w <= 0 || im->type == FL_IMAGE_NONE )
     {
@@ -341,21 +410,38 @@ flimage_convolve( FL_IMAGE  * im,
     if ( ! ( sub = flimage_get_subimage( im, 1 ) ) )
         return -1;
 
+    memset( &cj, 0, sizeof cj );
+    cj.is_short = FL_IsGray( im->type );
+    cj.w        = sub->w;
+    cj.h        = sub->h;
+    cj.kernel   = kernel;
+    cj.krow     = krow;
+    cj.kcol     = kcol;
+    cj.weight   = weight;
+    cj.maxval   = im->type == FL_IMAGE_GRAY16 ? im->gray_maxval : FL_PCMAX;
+
+    if ( ( cj.u = fl_malloc( ( krow + kcol ) * sizeof *cj.u ) ) )
+    {
+        cj.v = cj.u + krow;
+        cj.separable = split_kernel( &cj );
+    }
+    else
+        err = 1;
+
     im->completed = 0;
     im->visual_cue( im, what );
 
-    if ( FL_IsGray( im->type ) )
-        gray_convolve( sub->mat[ 0 ], sub->h, sub->w,
-                       kernel, krow, kcol, weight, im, what );
-    else
-        rgb_convolve( sub->mat[ 0 ], sub->mat[ 1 ], sub->mat[ 2 ],
-                      sub->h, sub->w, kernel, krow, kcol, weight, im, what );
+    for ( i = 0; i < sub->comp && ! err; i++ )
+    {
+        err = convolve_plane( &cj, sub->mat[ i ], im ) < 0;
+        im->completed = ( i + 1 ) * im->total / sub->comp;
+        im->visual_cue( im, what );
+    }
 
-    im->completed = im->total;
-    sprintf( buf, "%s done", what );
-    im->visual_cue( im, buf );
+    if ( cj.u )
+        fl_free( cj.u );
 
-    if (im->subw)
+    if ( im->subw )
     {
         fl_free_matrix( sub->mat[ 0 ] );
         fl_free_matrix( sub->mat[ 1 ] );
@@ -364,6 +450,16 @@ flimage_convolve( FL_IMAGE  * im,
 
     im->modified = 1;
 
+    if ( err )
+    {
+        im->error_message( im, "Convolve: malloc failed" );
+        return -1;
+    }
+
+    im->completed = im->total;
+    sprintf( buf, "%s done", what );
+    im->visual_cue( im, buf );
+
     return 0;
 }
 
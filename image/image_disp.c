@@ -33,6 +33,13 @@
 #include "flimage.h"
 #include "flimage_int.h"
 
+#ifdef HAVE_XSHM
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/extensions/XShm.h>
+#endif
+
 #define IMAGEDEBUG  0
 #define TRACE       0
 
@@ -46,6 +53,9 @@ static int fl_display_rgb( FL_IMAGE * im,
                            Window     win );
 static int fl_display_packed( FL_IMAGE * im,
                               Window     win );
+static int display_tiles( FL_IMAGE *,
+                          Window,
+                          XWindowAttributes * );
 static int do_quantization( FL_IMAGE *,
                             Colormap,
                             int,
@@ -110,6 +120,7 @@ get_all_colors( FL_IMAGE      * im,
                 int           * npix,
                 XColor          xc[ ] )
 {
+    FLI_COLOR_INDEX *index;
     int i,
         max_colors = 1 << im->depth,
         n;
@@ -144,14 +155,28 @@ get_all_colors( FL_IMAGE      * im,
 
         XQueryColors( im->xdisplay, im->xcolormap, mapentry, max_colors );
 
+        /* With many colors missing an index beats searching the whole
+           colormap for each of them */
+
+        index = fli_make_xcolor_index( mapentry, max_colors );
+
         for ( i = 0; i < im->map_len; i++ )
-            if ( xc[ i ].pixel == FL_NoColor )
+            if ( xc[ i ].pixel != FL_NoColor )
+                continue;
+            else if ( index )
+                xc[ i ].pixel = mapentry[ fli_lookup_color_index( index,
+                                                        xc[ i ].red   >> 8,
+                                                        xc[ i ].green >> 8,
+                                                        xc[ i ].blue  >> 8 )
+                                        ].pixel;
+            else
                 fli_find_closest_color( xc[ i ].red   >> 8,
                                         xc[ i ].green >> 8,
                                         xc[ i ].blue  >> 8,
                                         mapentry, max_colors,
                                         &xc[ i ].pixel );
 
+        fli_free_color_index( index );
         fl_free( mapentry );
     }
 }
@@ -240,12 +265,305 @@ machine_endian( void )
 }
 
 
-#define SWAP_CHAR( a, b )               \
-    do {                                \
-        unsigned char tmp_char = a;     \
-        a = b;                          \
-        b = tmp_char;                   \
-    } while ( 0 )
+#ifdef HAVE_XSHM
+
+/* Per-image MIT-SHM state. The shared memory XImage is kept around between
+   redisplays and only gets recreated when size, depth or visual change */
+
+typedef struct {
+    XShmSegmentInfo   seginfo;
+    XImage          * ximage;
+    Visual          * visual;
+    int               depth;
+} FLIMAGE_SHM;
+
+static Display *shm_display;        /* display the test below was done for */
+static int shm_usable = -1;         /* -1: not yet tested, 0: no, 1: yes */
+static int shm_error;
+
+
+/***************************************
+ * Error handler used while attaching a segment. XShmAttach() fails
+ * (with BadAccess) when the server can't get at our memory, e.g. if
+ * it's running on a different machine.
+ ***************************************/
+
+static int
+shm_error_handler( Display     * d   FL_UNUSED_ARG,
+                   XErrorEvent * xev FL_UNUSED_ARG )
+{
+    shm_error = 1;
+    return 0;
+}
+
+
+/***************************************
+ * Returns if shared memory XImages can be used for the image
+ ***************************************/
+
+static int
+shm_available( FL_IMAGE * im )
+{
+    int major,
+        minor;
+    Bool pixmaps;
+
+    if ( im->setup->no_shm )
+        return 0;
+
+    if ( shm_display != im->xdisplay )
+    {
+        shm_display = im->xdisplay;
+        shm_usable = -1;
+    }
+
+    if ( shm_usable < 0 )
+        shm_usable = XShmQueryVersion( im->xdisplay, &major, &minor,
+                                       &pixmaps ) == True;
+
+    return shm_usable;
+}
+
+
+/***************************************
+ * Detaches and frees the shared memory segment of an image
+ ***************************************/
+
+static void
+shm_destroy( FL_IMAGE * im )
+{
+    FLIMAGE_SHM *shm = im->shm_info;
+
+    if ( ! shm )
+        return;
+
+    if ( im->ximage == shm->ximage )
+        im->ximage = NULL;
+
+    /* Make sure the server isn't still reading from the segment */
+
+    XShmDetach( im->xdisplay, &shm->seginfo );
+    XSync( im->xdisplay, False );
+    XDestroyImage( shm->ximage );
+    shmdt( shm->seginfo.shmaddr );
+
+    fl_free( shm );
+    im->shm_info = NULL;
+}
+
+
+/***************************************
+ * Returns a shared memory XImage for the image, reusing the one from a
+ * previous call if possible, or NULL if none can be had
+ ***************************************/
+
+static XImage *
+shm_get_ximage( FL_IMAGE * im )
+{
+    FLIMAGE_SHM *shm = im->shm_info;
+    int ( * oldhandler )( Display *, XErrorEvent * );
+    XImage *ximage;
+
+    if ( ! shm_available( im ) )
+        return NULL;
+
+    if (    shm
+         && shm->ximage->width  == im->w
+         && shm->ximage->height == im->h
+         && shm->depth == im->sdepth
+         && shm->visual == im->visual )
+    {
+        /* The server might still be busy with the last XShmPutImage() */
+
+        XSync( im->xdisplay, False );
+        return shm->ximage;
+    }
+
+    shm_destroy( im );
+
+    if ( ! ( shm = fl_calloc( 1, sizeof *shm ) ) )
+        return NULL;
+
+    ximage = XShmCreateImage( im->xdisplay, im->visual, im->sdepth, ZPixmap,
+                              NULL, &shm->seginfo, im->w, im->h );
+    if ( ! ximage )
+    {
+        fl_free( shm );
+        return NULL;
+    }
+
+    shm->seginfo.shmid = shmget( IPC_PRIVATE,
+                                 ximage->bytes_per_line * ximage->height,
+                                 IPC_CREAT | 0600 );
+    if ( shm->seginfo.shmid < 0 )
+    {
+        XDestroyImage( ximage );
+        fl_free( shm );
+        return NULL;
+    }
+
+    shm->seginfo.shmaddr = ximage->data = shmat( shm->seginfo.shmid, 0, 0 );
+    if ( shm->seginfo.shmaddr == ( char * ) -1 )
+    {
+        shmctl( shm->seginfo.shmid, IPC_RMID, 0 );
+        ximage->data = NULL;
+        XDestroyImage( ximage );
+        fl_free( shm );
+        return NULL;
+    }
+
+    shm->seginfo.readOnly = False;
+
+    shm_error = 0;
+    oldhandler = XSetErrorHandler( shm_error_handler );
+    XShmAttach( im->xdisplay, &shm->seginfo );
+    XSync( im->xdisplay, False );
+    XSetErrorHandler( oldhandler );
+
+    /* Once both sides are attached the segment can be marked for removal,
+       it then goes away automatically when the last user detaches */
+
+    shmctl( shm->seginfo.shmid, IPC_RMID, 0 );
+
+    if ( shm_error )
+    {
+        M_warn( "shm_get_ximage", "MIT-SHM not usable, falling back to "
+                "XPutImage()" );
+        shm_usable = 0;
+        shmdt( shm->seginfo.shmaddr );
+        ximage->data = NULL;
+        XDestroyImage( ximage );
+        fl_free( shm );
+        return NULL;
+    }
+
+    shm->ximage = ximage;
+    shm->visual = im->visual;
+    shm->depth  = im->sdepth;
+    im->shm_info = shm;
+
+    return ximage;
+}
+
+
+
+/***************************************
+ * Returns if the XImage is the shared memory XImage of the image
+ ***************************************/
+
+static int
+is_shm_ximage( FL_IMAGE * im,
+               XImage   * ximage )
+{
+    return    ximage
+           && im->shm_info
+           && ( ( FLIMAGE_SHM * ) im->shm_info )->ximage == ximage;
+}
+
+#endif
+
+
+/***************************************
+ * Gets rid of the XImage of an image. A shared memory XImage isn't
+ * destroyed but kept for reuse on the next redisplay.
+ ***************************************/
+
+static void
+release_ximage( FL_IMAGE * im,
+                XImage   * ximage )
+{
+    if ( ! ximage )
+        return;
+
+#ifdef HAVE_XSHM
+    if ( ! is_shm_ximage( im, ximage ) )
+#endif
+        XDestroyImage( ximage );
+
+    if ( im->ximage == ximage )
+        im->ximage = NULL;
+}
+
+
+/***************************************
+ * Destroys the XImage of an image, including the shared memory segment
+ * possibly associated with it
+ ***************************************/
+
+void
+flimage_destroy_ximage( FL_IMAGE * im )
+{
+    release_ximage( im, im->ximage );
+    im->ximage = NULL;
+
+#ifdef HAVE_XSHM
+    shm_destroy( im );
+#endif
+}
+
+
+/***************************************
+ * Creates an XImage (with memory for the pixel data) the size of the
+ * image. If possible a shared memory XImage is used, otherwise a normal
+ * XImage with padding 'pad' is created. Note that scanlines may be
+ * padded, so always use the 'bytes_per_line' member for stepping from
+ * one line to the next.
+ ***************************************/
+
+static XImage *
+create_ximage( FL_IMAGE * im,
+               int        pad )
+{
+    XImage *ximage = NULL;
+    char *data;
+
+    release_ximage( im, im->ximage );
+
+#ifdef HAVE_XSHM
+    if ( ( ximage = shm_get_ximage( im ) ) )
+        return ximage;
+#endif
+
+    if ( ! ( ximage = XCreateImage( im->xdisplay, im->visual, im->sdepth,
+                                    ZPixmap, 0, 0, im->w, im->h, pad, 0 ) ) )
+        return NULL;
+
+    if ( ! ( data = fl_malloc( im->h * ximage->bytes_per_line ) ) )
+    {
+        XDestroyImage( ximage );
+        return NULL;
+    }
+
+    ximage->data = data;
+    return ximage;
+}
+
+
+/***************************************
+ * Transfers (part of) the XImage of an image to a drawable
+ ***************************************/
+
+static void
+put_ximage( FL_IMAGE * im,
+            Drawable   d,
+            int        sx,
+            int        sy,
+            int        dx,
+            int        dy,
+            int        w,
+            int        h )
+{
+#ifdef HAVE_XSHM
+    if ( is_shm_ximage( im, im->ximage ) )
+    {
+        XShmPutImage( im->xdisplay, d, im->gc, im->ximage, sx, sy, dx, dy,
+                      w, h, False );
+        return;
+    }
+#endif
+
+    XPutImage( im->xdisplay, d, im->gc, im->ximage, sx, sy, dx, dy, w, h );
+}
 
 
 /***************************************
@@ -268,35 +586,22 @@ fl_display_ci( FL_IMAGE * im,
     int npixels = 0;
     int i,
         j,
-        pad,
-        total = im->w * im->h;
+        pad;
     XImage *ximage = 0;
 
     ci = im->pixels ? im->pixels : im->ci;
-    ipixels = ci[ 0 ];
 
     xcolormap = im->xcolormap;
 
     pad = im->depth <= 8 ? 8 : ( im->depth <= 16 ? 16 : 32 );
 
-    ximage = XCreateImage( im->xdisplay, im->visual, im->sdepth,
-                           ZPixmap, 0, 0, im->w, im->h, pad, 0 );
-
-    if ( ximage )
-    {
-        xpixels = fl_malloc( im->h * ximage->bytes_per_line * sizeof *xpixels );
-
-        if ( ! xpixels )
-            XFree( ximage );
-    }
-
-    if ( ! ximage || ! xpixels )
+    if ( ! ( ximage = create_ximage( im, pad ) ) )
     {
         im->error_message( im, "fl_display_ci: Can't allocate memory" );
         return -1;
     }
 
-    ximage->data = ( char * ) xpixels;
+    xpixels = ( unsigned char * ) ximage->data;
 
 #if IMAGEDEBUG
     M_err( "fl_display_ci", "w=%d bytes_per_line=%d bits_per_pixel=%d",
@@ -307,8 +612,7 @@ fl_display_ci( FL_IMAGE * im,
     {
         if ( ! ( xmapped = fl_malloc( im->map_len * sizeof *xmapped ) ) )
         {
-            XFree( ximage );
-            fl_free( xpixels );
+            release_ximage( im, ximage );
             M_err("fl_display_ci", "malloc failed");
             return -1;
         }
@@ -316,7 +620,7 @@ fl_display_ci( FL_IMAGE * im,
 #if IMAGEDEBUG
         fprintf( stderr, "rbits: %d gbits: %d bbits: %d\n",
                  im->rgb2p.rbits, im->rgb2p.gbits, im->rgb2p.bbits );
-        fprintf( stderr, "rshift: %d gshift: %d bshift: %d\n"a,
+        fprintf( stderr, "rshift: %d gshift: %d bshift: %d\n",
                  im->rgb2p.rshift, im->rgb2p.gshift, im->rgb2p.bshift );
 #endif
 
@@ -331,42 +635,52 @@ fl_display_ci( FL_IMAGE * im,
 
         if ( machine_endian( ) != ximage->byte_order )
         {
-            unsigned char *rgba = ( unsigned char * ) xmapped;
-
-            if ( ximage->bits_per_pixel == 32 )
+            for ( i = 0; i < im->map_len; i++ )
             {
-                for ( i = 0; i < im->map_len; i++, rgba += 4 )
-                {
-                    SWAP_CHAR( rgba[ 0 ], rgba[ 3 ] );
-                    SWAP_CHAR( rgba[ 1 ], rgba[ 2 ] );
-                }
+                unsigned long p = xmapped[ i ];
+
+                if ( ximage->bits_per_pixel == 32 )
+                    xmapped[ i ] =   ( ( p & 0x000000ffUL ) << 24 )
+                                   | ( ( p & 0x0000ff00UL ) <<  8 )
+                                   | ( ( p & 0x00ff0000UL ) >>  8 )
+                                   | ( ( p & 0xff000000UL ) >> 24 );
+                else if ( ximage->bits_per_pixel == 16 )
+                    xmapped[ i ] =   ( ( p & 0x00ffUL ) << 8 )
+                                   | ( ( p & 0xff00UL ) >> 8 );
             }
-            else if ( ximage->bits_per_pixel == 16 )
-                for ( i = 0; i < im->map_len; i++, rgba += 2 )
-                    SWAP_CHAR( rgba[ 0 ], rgba[ 1 ] );
         }
 
         if ( ximage->bits_per_pixel == 32 )
         {
-            unsigned int *ltmp = ( unsigned int * ) xpixels;
+            for ( j = 0; j < im->h; j++ )
+            {
+                unsigned int *ltmp =
+                   ( unsigned int * ) ( xpixels + j * ximage->bytes_per_line );
 
-            for ( i = 0; i < total; i++ )
-                *ltmp++ = xmapped[ ipixels[ i ] ];
+                for ( ipixels = ci[ j ], i = 0; i < im->w; i++ )
+                    *ltmp++ = xmapped[ ipixels[ i ] ];
+            }
         }
         else if ( ximage->bits_per_pixel == 16)
         {
-            unsigned short *stmp = ( unsigned short * ) xpixels;
+            for ( j = 0; j < im->h; j++ )
+            {
+                unsigned short *stmp =
+                  ( unsigned short * ) ( xpixels + j * ximage->bytes_per_line );
 
-            for ( i = 0; i < total; i++ )
-                *stmp++ = ( unsigned short ) xmapped[ ipixels[ i ] ];
+                for ( ipixels = ci[ j ], i = 0; i < im->w; i++ )
+                    *stmp++ = ( unsigned short ) xmapped[ ipixels[ i ] ];
+            }
         }
         else if ( ximage->bits_per_pixel == 8 )
         {
-            unsigned char *ctmp = xpixels;
-
-            for ( i = 0; i < total; i++ )
-                *ctmp++ = ( unsigned char ) xmapped[ ipixels[ i ] ];
+            for ( j = 0; j < im->h; j++ )
+            {
+                unsigned char *ctmp = xpixels + j * ximage->bytes_per_line;
 
+                for ( ipixels = ci[ j ], i = 0; i < im->w; i++ )
+                    *ctmp++ = ( unsigned char ) xmapped[ ipixels[ i ] ];
+            }
         }
         else if ( ximage->bits_per_pixel == 24 )
         {
@@ -396,6 +710,8 @@ fl_display_ci( FL_IMAGE * im,
         {
             im->error_message( im, "fl_display_ci: unhandled non-byte-aligned "
                                "pixel" );
+            release_ximage( im, ximage );
+            fl_free( xmapped );
             return -1;
         }
     }
@@ -456,8 +772,12 @@ fl_display_ci( FL_IMAGE * im,
             M_err( "fl_display_ci", "Converting %d pixels", im->w * im->h );
 #endif
 
-            for ( i = 0, total = im->w * im->h; i < total; i++ )
-                xpixels[ i ] = ( unsigned char ) xc[ ipixels[ i ] ].pixel;
+            for ( j = 0; j < im->h; j++ )
+            {
+                xpixtmp = xpixels + j * ximage->bytes_per_line;
+                for ( ipixels = ci[ j ], i = 0; i < im->w; i++ )
+                    xpixtmp[ i ] = ( unsigned char ) xc[ ipixels[ i ] ].pixel;
+            }
         }
         else
             M_err( "fl_display_ci", "unhandled bits_per_pixel=%d depth=%d",
@@ -471,8 +791,12 @@ fl_display_ci( FL_IMAGE * im,
         im->colors = npixels;
 
         if ( ximage->bits_per_pixel == 8 )
-            for ( i = 0; i < total; i++ )
-                xpixels[ i ] = ( unsigned char ) xc[ ipixels[ i ] ].pixel;
+            for ( j = 0; j < im->h; j++ )
+            {
+                xpixtmp = xpixels + j * ximage->bytes_per_line;
+                for ( ipixels = ci[ j ], i = 0; i < im->w; i++ )
+                    xpixtmp[ i ] = ( unsigned char ) xc[ ipixels[ i ] ].pixel;
+            }
         else
             M_err( "fl_display_ci", "unhandled bits_per_pixel=%d depth=%d",
                    ximage->bits_per_pixel, im->depth );
@@ -484,10 +808,7 @@ fl_display_ci( FL_IMAGE * im,
     M_err( "fl_display_ci", "about to XPutImage" );
 #endif
 
-    if ( ximage && ximage->data )
-        im->ximage = ximage;
-    else
-        fprintf( stderr, "no image\n" );
+    im->ximage = ximage;
 
     if ( npixels )
         XFreeColors( im->xdisplay, xcolormap, newpixels, npixels, 0 );
@@ -514,9 +835,6 @@ window_levelling( FL_IMAGE * im )
         lower,
         tmp,
         i;
-    int npix = im->w * im->h;
-    unsigned short *pix = im->pixels[ 0 ];  /* display image  */
-    unsigned short *ci = im->gray[ 0 ]; /* original image */
     unsigned short *wlut = im->wlut;
     float fact;
 
@@ -540,8 +858,7 @@ window_levelling( FL_IMAGE * im )
         wlut[ i ] = ( unsigned short ) ( ( tmp - lower ) * fact );
     }
 
-    for ( i = 0; i < npix; i++ )
-        pix[ i ] = wlut[ ci[ i ] ];
+    flimage_apply_lut16( im, wlut, im->gray, im->pixels );
 }
 
 
@@ -620,8 +937,7 @@ fl_display_gray( FL_IMAGE * im,
             for ( i = 0; i < 256; i++ )
                 wlut[ i ] = ( unsigned short ) ( i * scale );
 
-            for ( i = 0; i < npix; i++ )
-                pix[i] = wlut[ ci[ i ] ];
+            flimage_apply_lut16( im, wlut, im->gray, im->pixels );
         }
         else
             memcpy( pix, ci, npix * sizeof *ci );
@@ -637,30 +953,6 @@ fl_display_gray( FL_IMAGE * im,
 }
 
 
-#define RGBTOPIXEL( type )                                               \
-    do {                                                                 \
-        type *ltmp = ( type * ) xpixels;                                 \
-        if ( im->rgb2p.rbits > 8 )                                       \
-            for ( i = 0; i < total; ltmp++, i++ )                        \
-            {                                                            \
-                RGB2PIXEL_8_OR_MORE( im, red[ i ],green[ i ],blue[ i ],  \
-                                     &im->rgb2p, *ltmp );                \
-                if (    im->depth == 24 && im->sdepth == 32              \
-                     && i == im->tran_index )                            \
-                    *ltmp &= ~ 0xff000000;                               \
-            }                                                            \
-        else                                                             \
-            for ( i = 0; i < total; ltmp++, i++ )                        \
-            {                                                            \
-                RGB2PIXEL_8_OR_LESS( im, red[ i ],green[ i ],blue[ i ],  \
-                                     &im->rgb2p, *ltmp );                \
-                if (    im->depth == 24 && im->sdepth == 32              \
-                     && i == im->tran_index )                            \
-                    *ltmp &= ~ 0xff000000;                               \
-            }                                                            \
-    } while ( 0 )
-
-
 /***************************************
  ***************************************/
 
@@ -669,26 +961,29 @@ fl_display_rgb( FL_IMAGE * im,
                 Window     win  FL_UNUSED_ARG )
 {
     unsigned char *xpixels;
-    int total = im->w * im->h;
     XImage *ximage = 0;
-    unsigned char *red   = im->red[   0 ],
-                  *green = im->green[ 0 ],
-                  *blue  = im->blue[  0 ];
     int w = im->w,
         h = im->h;
 
     if ( im->vclass == DirectColor || im->vclass == TrueColor )
     {
-        int i;
+        FLIMAGE_PIXFMT fmt;
+        unsigned int alpha;
+        int j;
 
         /* Use minimum possible padding */
 
         int pad = im->depth <= 8 ? 8 : ( im->depth <= 16 ? 16 : 32 );
-        ximage = XCreateImage( im->xdisplay, im->visual, im->sdepth,
-                               ZPixmap, 0, 0, w, h, pad, 0 );
+
+        if ( ! ( ximage = create_ximage( im, pad ) ) )
+        {
+            flimage_error( im, "malloc() failed" );
+            return -1;
+        }
 
         if ( ximage->bits_per_pixel % 8 )
         {
+            release_ximage( im, ximage );
             im->error_message( im, "can't handle non-byte aligned pixel" );
             return -1;
         }
@@ -698,78 +993,27 @@ fl_display_rgb( FL_IMAGE * im,
                  ximage->bytes_per_line, ximage->bits_per_pixel );
 #endif
 
-        xpixels = fl_malloc( h * ximage->bytes_per_line * sizeof *xpixels );
-
-        if ( ! xpixels )
-        {
-            flimage_error( im, "malloc() failed" );
-            return -1;
-        }
-
-        ximage->data = ( char * ) xpixels;
+        xpixels = ( unsigned char * ) ximage->data;
 
-        if ( ximage->bits_per_pixel == 32 )
-        {
-            RGBTOPIXEL( unsigned int );
-
-            if ( machine_endian( ) != ximage->byte_order )
-            {
-                unsigned char *rgba = ( unsigned char * ) ximage->data;
+        /* With a 24 bit visual in 32 bit pixels the unused byte gets
+           set, except for the transparent pixel */
 
-                for ( i = 0; i < total; i++, rgba += 4 )
-                {
-                    SWAP_CHAR(rgba[ 0 ], rgba[ 3 ]);
-                    SWAP_CHAR(rgba[ 1 ], rgba[ 2 ]);
-                }
-            }
-        }
-        else if ( ximage->bits_per_pixel == 16 )
-        {
-            RGBTOPIXEL( unsigned short );
+        alpha =    im->depth == 24 && im->sdepth == 32
+                && ximage->bits_per_pixel == 32 ? 0xff000000 : 0;
+        flimage_init_pixfmt( &fmt, &im->rgb2p, ximage->bits_per_pixel,
+                             ximage->byte_order, alpha, -1 );
 
-            if ( machine_endian( ) != ximage->byte_order )
-            {
-                unsigned char *rgba = ( unsigned char * ) ximage->data;
-                int i;
+        for ( j = 0; j < h; j++ )
+            fmt.convert( &fmt, im->red[ j ], im->green[ j ], im->blue[ j ],
+                         xpixels + j * ximage->bytes_per_line, w );
 
-                for ( i = 0; i < total; i++, rgba += 2 )
-                    SWAP_CHAR( rgba[ 0 ], rgba[ 1 ] );
-            }
-        }
-        else if ( ximage->bits_per_pixel == 8 )
-        {
-            RGBTOPIXEL( unsigned char );
-        }
-        else if ( ximage->bits_per_pixel == 24 )
+        if ( alpha && im->tran_index >= 0 && im->tran_index < w * h )
         {
-            unsigned char *tt = ( unsigned char * ) xpixels,
-                          *tmp3;
-            unsigned int xcol;
-            int j;
-
-            for ( j = 0; j < im->h; j++, tt += ximage->bytes_per_line )
-            {
-                int i;
+            unsigned char *tp = xpixels
+                                + ( im->tran_index / w ) * ximage->bytes_per_line
+                                + ( im->tran_index % w ) * 4;
 
-                if ( ximage->byte_order == MSBFirst )
-                    for ( i = 0, tmp3 = tt; i < im->w; i++ )
-                    {
-                        xcol = rgb2pixel( im, red[ i ], green[ i ], blue[ i ],
-                                          &im->rgb2p );
-                        *tmp3++ = ( xcol >> 16 ) & 0xff;
-                        *tmp3++ = ( xcol >>  8 ) & 0xff;
-                        *tmp3++ = ( xcol       ) & 0xff;
-                    }
-                else
-                    for ( i = 0, tmp3 = tt; i < im->w; i++ )
-                    {
-                        xcol = rgb2pixel( im, red[ i ], green[ i ], blue[ i ],
-                                          &im->rgb2p );
-                        *tmp3++ = ( xcol       ) & 0xff;
-                        *tmp3++ = ( xcol >>  8 ) & 0xff;
-                        *tmp3++ = ( xcol >> 16 ) & 0xff;
-                    }
-            }
+            tp[ ximage->byte_order == MSBFirst ? 0 : 3 ] = 0;
         }
 
         im->ximage = ximage;
@@ -814,7 +1058,6 @@ fl_display_packed( FL_IMAGE * im,
 static void
 displayXImage( FL_IMAGE * im )
 {
-    XImage *ximage = im->ximage;
     Colormap xcolormap = im->xcolormap;
     unsigned long newpixels[ FLIMAGE_MAXLUT ];
     XColor xc[ FLIMAGE_MAXLUT ];
@@ -823,8 +1066,8 @@ displayXImage( FL_IMAGE * im )
     if ( im->vclass != TrueColor && im->vclass != DirectColor )
         get_all_colors( im, newpixels, &npix, xc );
 
-    XPutImage( im->xdisplay, im->win, im->gc, ximage, im->sxd, im->syd,
-               im->wxd, im->wyd, im->swd, im->shd );
+    put_ximage( im, im->win, im->sxd, im->syd, im->wxd, im->wyd,
+                im->swd, im->shd );
 
     if ( npix )
         XFreeColors( im->xdisplay, xcolormap, newpixels, npix, 0 );
@@ -845,6 +1088,7 @@ flimage_color_to_pixel( FL_IMAGE * im,
     XColor xc;
     static Colormap lastcolormap;
     static XColor *xcolor;
+    static FLI_COLOR_INDEX *xindex;
     unsigned long pixel = 0;
 
     *newpix = 0;
@@ -880,9 +1124,15 @@ flimage_color_to_pixel( FL_IMAGE * im,
                 xcolor[ i ].pixel = i;
             XQueryColors( im->xdisplay, im->xcolormap, xcolor, max_col );
             lastcolormap = im->xcolormap;
+
+            fli_free_color_index( xindex );
+            xindex = fli_make_xcolor_index( xcolor, max_col );
         }
 
-        fli_find_closest_color( r, g, b, xcolor, max_col, &pixel );
+        if ( xindex )
+            pixel = xcolor[ fli_lookup_color_index( xindex, r, g, b ) ].pixel;
+        else
+            fli_find_closest_color( r, g, b, xcolor, max_col, &pixel );
     }
 
     return pixel;
@@ -959,29 +1209,38 @@ handle_redraw( FL_IMAGE  * im,
  ***************************************/
 
 static void
-adapt_image_to_window( FL_IMAGE          * im,
-                       XWindowAttributes * xwa )
+visual_to_rgb2pixel( FL_RGB2PIXEL * rgb2p,
+                     Visual       * visual )
 {
-    FL_RGB2PIXEL *rgb2p = &im->rgb2p;
-
-    rgb2p->bits_per_rgb = xwa->visual->bits_per_rgb;
-    rgb2p->colormap_size = xwa->visual->map_entries;
+    rgb2p->bits_per_rgb = visual->bits_per_rgb;
+    rgb2p->colormap_size = visual->map_entries;
 
 #if IMAGEDEBUG
     fprintf( stderr, "bits_per_rgb=%d mapsize=%d\n",
-             im->rgb2p.bits_per_rgb, im->rgb2p.colormap_size );
+             rgb2p->bits_per_rgb, rgb2p->colormap_size );
 #endif
 
-    rgb2p->rmask = xwa->visual->red_mask;
-    rgb2p->gmask = xwa->visual->green_mask;
-    rgb2p->bmask = xwa->visual->blue_mask;
+    rgb2p->rmask = visual->red_mask;
+    rgb2p->gmask = visual->green_mask;
+    rgb2p->bmask = visual->blue_mask;
+    fli_rgbmask_to_shifts( rgb2p->rmask, &rgb2p->rshift, &rgb2p->rbits );
+    fli_rgbmask_to_shifts( rgb2p->gmask, &rgb2p->gshift, &rgb2p->gbits );
+    fli_rgbmask_to_shifts( rgb2p->bmask, &rgb2p->bshift, &rgb2p->bbits );
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+adapt_image_to_window( FL_IMAGE          * im,
+                       XWindowAttributes * xwa )
+{
+    visual_to_rgb2pixel( &im->rgb2p, xwa->visual );
     im->depth  = im->sdepth = xwa->depth;
     im->vclass = xwa->visual->class;
     im->visual = xwa->visual;
     im->xcolormap = xwa->colormap;
-    fli_rgbmask_to_shifts( rgb2p->rmask, &rgb2p->rshift, &rgb2p->rbits );
-    fli_rgbmask_to_shifts( rgb2p->gmask, &rgb2p->gshift, &rgb2p->gbits );
-    fli_rgbmask_to_shifts( rgb2p->bmask, &rgb2p->bshift, &rgb2p->bbits );
 }
 
 
@@ -1208,6 +1467,11 @@ flimage_sdisplay( FL_IMAGE * im,
 
     XGetWindowAttributes( im->xdisplay, win, &xwa );
 
+    if (    im->zoom > 0.0
+         && (    xwa.visual->class == TrueColor
+              || xwa.visual->class == DirectColor ) )
+        return display_tiles( im, win, &xwa );
+
     if ( ! im->setup->do_not_clear )
     {
         /* Only clear the minimum region we have to */
@@ -1240,11 +1504,7 @@ flimage_sdisplay( FL_IMAGE * im,
 
     /* If we got here, we need to re-generate ximage */
 
-    if ( im->ximage )
-    {
-        XDestroyImage( ( XImage * ) im->ximage );
-        im->ximage = None;
-    }
+    release_ximage( im, im->ximage );
 
     if ( ! Compatible( xwa, im ) )
     {
@@ -1266,8 +1526,8 @@ flimage_sdisplay( FL_IMAGE * im,
     {
         im->win = im->double_buffer ? im->pixmap : win;
 
-        XPutImage( im->xdisplay, im->win, im->gc, im->ximage,
-                   im->sxd, im->syd, im->wxd, im->wyd, im->swd, im->shd );
+        put_ximage( im, im->win, im->sxd, im->syd, im->wxd, im->wyd,
+                    im->swd, im->shd );
         im->display_markers( im );
         im->display_text( im );
         im->win = win;
@@ -1397,6 +1657,928 @@ flimage_display( FL_IMAGE * in_image,
 }
 
 
+/***************************************
+ * Progressive display: while an image is being read, rows the reader
+ * reports as done (via flimage_rows_done()) get converted and shown in
+ * the window set in the 'progressive_win' member of the setup. Updates
+ * are rate limited, the first one is done immediately. This is only
+ * supported for TrueColor and DirectColor visuals.
+ ***************************************/
+
+#define PROGRESS_USEC   40000       /* min. time between updates */
+#define PROGRESS_BAND   64          /* rows converted in one go  */
+
+typedef struct {
+    Window          win;
+    GC              gc;
+    XImage        * ximage;         /* PROGRESS_BAND rows        */
+    FLIMAGE_PIXFMT  fmt;
+    unsigned char * rgb[ 3 ];       /* a row of RGB values       */
+    int             first,          /* rows not shown yet        */
+                    last;
+    long            sec,            /* time of last update       */
+                    usec;
+} FLIMAGE_PROGRESS;
+
+/* Marks images for which progressive display isn't possible */
+
+static FLIMAGE_PROGRESS no_progress;
+
+
+/***************************************
+ ***************************************/
+
+static void
+free_progress( FL_IMAGE         * im,
+               FLIMAGE_PROGRESS * pg )
+{
+    if ( pg->ximage )
+        XDestroyImage( pg->ximage );    /* also frees the data */
+    if ( pg->gc )
+        XFreeGC( im->xdisplay, pg->gc );
+    fli_safe_free( pg->rgb[ 0 ] );
+    fl_free( pg );
+}
+
+
+/***************************************
+ * Sets up what's needed for showing rows of the image in the window.
+ * Returns NULL if that's not possible.
+ ***************************************/
+
+static FLIMAGE_PROGRESS *
+start_progress( FL_IMAGE * im )
+{
+    FLIMAGE_PROGRESS *pg;
+    XWindowAttributes xwa;
+    FL_RGB2PIXEL rgb2p;
+    unsigned int alpha;
+    int pad;
+
+    if (    ! im->xdisplay
+         || ! XGetWindowAttributes( im->xdisplay, im->setup->progressive_win,
+                                    &xwa )
+         || (    xwa.visual->class != TrueColor
+              && xwa.visual->class != DirectColor )
+         || ! ( pg = fl_calloc( 1, sizeof *pg ) ) )
+        return NULL;
+
+    pg->win = im->setup->progressive_win;
+    pg->first = im->h;
+    pg->last = -1;
+
+    pad = xwa.depth <= 8 ? 8 : ( xwa.depth <= 16 ? 16 : 32 );
+
+    if (    ! ( pg->rgb[ 0 ] = fl_malloc( 3 * im->w ) )
+         || ! ( pg->ximage = XCreateImage( im->xdisplay, xwa.visual,
+                                           xwa.depth, ZPixmap, 0, 0, im->w,
+                                           PROGRESS_BAND, pad, 0 ) )
+         || pg->ximage->bits_per_pixel % 8
+         || ! ( pg->ximage->data =
+                   fl_malloc( PROGRESS_BAND * pg->ximage->bytes_per_line ) ) )
+    {
+        free_progress( im, pg );
+        return NULL;
+    }
+
+    pg->rgb[ 1 ] = pg->rgb[ 0 ] + im->w;
+    pg->rgb[ 2 ] = pg->rgb[ 1 ] + im->w;
+    pg->gc = XCreateGC( im->xdisplay, pg->win, 0, 0 );
+
+    visual_to_rgb2pixel( &rgb2p, xwa.visual );
+    alpha =    xwa.depth == 32
+            && rgb2p.rbits + rgb2p.gbits + rgb2p.bbits == 24
+            && pg->ximage->bits_per_pixel == 32 ? 0xff000000 : 0;
+    flimage_init_pixfmt( &pg->fmt, &rgb2p, pg->ximage->bits_per_pixel,
+                         pg->ximage->byte_order, alpha, -1 );
+
+    return pg;
+}
+
+
+/***************************************
+ * Converts row y of the image into the band, returns 0 if the type
+ * of the image can't be displayed (yet)
+ ***************************************/
+
+static int
+progress_row( FL_IMAGE         * im,
+              FLIMAGE_PROGRESS * pg,
+              int                y,
+              unsigned char    * out )
+{
+    unsigned char *r = pg->rgb[ 0 ],
+                  *g = pg->rgb[ 1 ],
+                  *b = pg->rgb[ 2 ];
+    int x,
+        v;
+
+    if ( im->type == FL_IMAGE_RGB )
+    {
+        r = im->red[ y ];
+        g = im->green[ y ];
+        b = im->blue[ y ];
+    }
+    else if ( FL_IsCI( im->type ) && im->ci && im->map_len > 0 )
+    {
+        for ( x = 0; x < im->w; x++ )
+        {
+            v = FL_min( im->ci[ y ][ x ], im->map_len - 1 );
+            r[ x ] = im->red_lut[   v ];
+            g[ x ] = im->green_lut[ v ];
+            b[ x ] = im->blue_lut[  v ];
+        }
+    }
+    else if ( FL_IsGray( im->type ) && im->gray )
+    {
+        int maxval =    im->type == FL_IMAGE_GRAY16 && im->gray_maxval > 0
+                     ? im->gray_maxval : FL_PCMAX;
+
+        for ( x = 0; x < im->w; x++ )
+        {
+            v = FL_min( im->gray[ y ][ x ], maxval );
+            r[ x ] = g[ x ] = b[ x ] = ( v * FL_PCMAX ) / maxval;
+        }
+    }
+    else if ( im->type == FL_IMAGE_PACKED && im->packed )
+    {
+        for ( x = 0; x < im->w; x++ )
+            FL_UNPACK3( im->packed[ y ][ x ], r[ x ], g[ x ], b[ x ] );
+    }
+    else
+        return 0;
+
+    pg->fmt.convert( &pg->fmt, r, g, b, out, im->w );
+    return 1;
+}
+
+
+/***************************************
+ * Shows the rows waiting to be displayed
+ ***************************************/
+
+static void
+flush_progress( FL_IMAGE         * im,
+                FLIMAGE_PROGRESS * pg )
+{
+    XImage *ximage = pg->ximage;
+    int y,
+        n;
+
+    for ( y = pg->first; y <= pg->last; y += n )
+    {
+        for ( n = 0; n < PROGRESS_BAND && y + n <= pg->last; n++ )
+            if ( ! progress_row( im, pg, y + n,
+                                 ( unsigned char * ) ximage->data
+                                 + n * ximage->bytes_per_line ) )
+                break;
+
+        if ( n == 0 )
+            break;
+
+        XPutImage( im->xdisplay, pg->win, pg->gc, ximage, 0, 0,
+                   im->wx, im->wy + y, im->w, n );
+    }
+
+    XFlush( im->xdisplay );
+
+    pg->first = im->h;
+    pg->last = -1;
+}
+
+
+/***************************************
+ * Called by readers when rows first to first + n - 1 of the image have
+ * been read (or got new data)
+ ***************************************/
+
+void
+flimage_rows_done( FL_IMAGE * im,
+                   int        first,
+                   int        n )
+{
+    FLIMAGE_PROGRESS *pg = im->progress_info;
+    long sec,
+         usec;
+
+    if ( ! flimage_is_progressive( im ) || n <= 0 )
+        return;
+
+    if ( ! pg )
+    {
+        if ( ! ( pg = start_progress( im ) ) )
+        {
+            im->progress_info = &no_progress;
+            return;
+        }
+
+        im->progress_info = pg;
+    }
+
+    first = FL_clamp( first, 0, im->h - 1 );
+    pg->first = FL_min( pg->first, first );
+    pg->last = FL_max( pg->last, FL_min( first + n, im->h ) - 1 );
+
+    fl_gettime( &sec, &usec );
+
+    if ( ( sec - pg->sec ) * 1000000 + usec - pg->usec >= PROGRESS_USEC )
+    {
+        flush_progress( im, pg );
+        pg->sec = sec;
+        pg->usec = usec;
+    }
+}
+
+
+/***************************************
+ * Returns if the reader should report rows as they get done (and
+ * possibly make a partially read image look better)
+ ***************************************/
+
+int
+flimage_is_progressive( FL_IMAGE * im )
+{
+    return    im->setup
+           && im->setup->progressive_win
+           && im->progress_info != &no_progress;
+}
+
+
+/***************************************
+ * Shows what's still left over and cleans up after reading is done
+ ***************************************/
+
+void
+flimage_end_progress( FL_IMAGE * im )
+{
+    FLIMAGE_PROGRESS *pg = im->progress_info;
+
+    if ( pg && pg != &no_progress )
+    {
+        if ( pg->last >= pg->first )
+            flush_progress( im, pg );
+        free_progress( im, pg );
+    }
+
+    im->progress_info = NULL;
+}
+
+
+/***************************************
+ * Zoomed display: if the 'zoom' member of an image is set (and the
+ * visual is TrueColor or DirectColor) flimage_sdisplay() shows the
+ * subimage sx, sy, sw, sh scaled by that factor. The pixels shown come
+ * from a pyramid of versions of the image, each half the size of the
+ * one before, that are split into tiles of TILE_SIZE x TILE_SIZE
+ * pixels. Tiles are only made when they're needed to show a part of an
+ * image, from the original pixels or from four tiles of the level
+ * below, and are kept for further redisplays (e.g. while panning) up to
+ * the 'tile_memory' member of the setup, after which the least recently
+ * used ones get thrown away. Only the part of the window covered by the
+ * image gets converted, using the level with the lowest resolution that
+ * still has at least as many pixels as will be shown.
+ ***************************************/
+
+#define TILE_SIZE     256
+#define TILE_HASH     1024
+#define TILE_MEMORY   ( 32L * 1024 * 1024 )
+#define TILE_LEVELS   24
+
+typedef struct flimage_tile_ {
+    struct flimage_tile_ * hnext,       /* next in the hash chain     */
+                         * prev,        /* towards more recently used */
+                         * next;
+    int                    level,
+                           tx,
+                           ty;
+    FL_PACKED              pix[ 1 ];    /* TILE_SIZE rows of pixels   */
+} FLIMAGE_TILE;
+
+typedef struct {
+    FLIMAGE_TILE   * hash[ TILE_HASH ];
+    FLIMAGE_TILE   * first,
+                   * last;
+    long             bytes,
+                     min_bytes;             /* a row of visible tiles */
+    int              nlevels;
+    int              lw[ TILE_LEVELS ],     /* size of the levels     */
+                     lh[ TILE_LEVELS ];
+    Visual         * visual;
+    int              depth;
+    XImage         * ximage;                /* the visible part       */
+    FLIMAGE_PIXFMT   fmt;
+    FL_PACKED      * row;                   /* a row of the view      */
+    unsigned char  * rgb[ 3 ];
+    int            * xmap,                  /* level coordinates of   */
+                   * ymap;                  /* the view's pixels      */
+} FLIMAGE_TILES;
+
+#define TileHash( l, x, y )  \
+    ( ( ( l ) * 7919 + ( x ) * 131 + ( y ) ) & ( TILE_HASH - 1 ) )
+
+#define TileBytes  \
+    ( ( long ) ( sizeof( FLIMAGE_TILE )                                   \
+                 + ( TILE_SIZE * TILE_SIZE - 1 ) * sizeof( FL_PACKED ) ) )
+
+
+/***************************************
+ ***************************************/
+
+static void
+unlink_tile( FLIMAGE_TILES * tl,
+             FLIMAGE_TILE  * t )
+{
+    if ( t->prev )
+        t->prev->next = t->next;
+    else
+        tl->first = t->next;
+
+    if ( t->next )
+        t->next->prev = t->prev;
+    else
+        tl->last = t->prev;
+}
+
+
+/***************************************
+ * Puts a tile at the start (most recently used end) or the end of
+ * the LRU list
+ ***************************************/
+
+static void
+link_tile( FLIMAGE_TILES * tl,
+           FLIMAGE_TILE  * t,
+           int             at_start )
+{
+    if ( at_start )
+    {
+        t->prev = NULL;
+        if ( ( t->next = tl->first ) )
+            tl->first->prev = t;
+        else
+            tl->last = t;
+        tl->first = t;
+    }
+    else
+    {
+        t->next = NULL;
+        if ( ( t->prev = tl->last ) )
+            tl->last->next = t;
+        else
+            tl->first = t;
+        tl->last = t;
+    }
+}
+
+
+/***************************************
+ * Removes a tile from the hash table and LRU list and deletes it
+ ***************************************/
+
+static void
+drop_tile( FLIMAGE_TILES * tl,
+           FLIMAGE_TILE  * t )
+{
+    FLIMAGE_TILE **p = tl->hash + TileHash( t->level, t->tx, t->ty );
+
+    while ( *p != t )
+        p = &( *p )->hnext;
+    *p = t->hnext;
+
+    unlink_tile( tl, t );
+    tl->bytes -= TileBytes;
+    fl_free( t );
+}
+
+
+/***************************************
+ * Converts n pixels of row y of the image, starting at column x,
+ * to packed RGB values, as they would be displayed
+ ***************************************/
+
+static void
+source_to_packed( FL_IMAGE  * im,
+                  int         x,
+                  int         y,
+                  int         n,
+                  FL_PACKED * out )
+{
+    int i,
+        v,
+        tran = im->tran_rgb >= 0 && im->app_background >= 0;
+
+    if ( im->type == FL_IMAGE_RGB )
+        flimage_pack_rgba( im->red[ y ] + x, im->green[ y ] + x,
+                           im->blue[ y ] + x, NULL, out, n );
+    else if ( im->type == FL_IMAGE_PACKED )
+        memcpy( out, im->packed[ y ] + x, n * sizeof *out );
+    else if ( FL_IsCI( im->type ) )
+    {
+        unsigned short *ci = im->ci[ y ] + x;
+
+        for ( i = 0; i < n; i++ )
+        {
+            v = FL_clamp( ci[ i ], 0, im->map_len - 1 );
+            if ( v < 0 )
+                out[ i ] = 0;
+            else if ( tran && v == im->tran_index )
+                out[ i ] = im->app_background;
+            else
+                out[ i ] = FL_PACK3( im->red_lut[ v ], im->green_lut[ v ],
+                                     im->blue_lut[ v ] );
+        }
+
+        return;
+    }
+    else
+    {
+        unsigned short *gray = im->gray[ y ] + x;
+        int lower = 0,
+            upper = FL_PCMAX;
+
+        /* 16 bit gray values get window levelled */
+
+        if ( im->type == FL_IMAGE_GRAY16 )
+        {
+            upper = im->gray_maxval > 0 ? im->gray_maxval : FL_PCMAX;
+
+            if ( im->wwidth > 0 )
+            {
+                lower = FL_max( im->level - im->wwidth / 2, 0 );
+                upper = im->level + im->wwidth / 2;
+            }
+        }
+
+        for ( i = 0; i < n; i++ )
+        {
+            v = FL_clamp( gray[ i ], lower, upper );
+            v = upper > lower ? ( ( v - lower ) * FL_PCMAX ) / ( upper - lower )
+                              : 0;
+            out[ i ] = FL_PACK3( v, v, v );
+        }
+
+        return;
+    }
+
+    if ( tran )
+        for ( i = 0; i < n; i++ )
+            if ( ( int ) ( out[ i ] & 0xffffff ) == im->tran_rgb )
+                out[ i ] = im->app_background;
+}
+
+
+/***************************************
+ * Sets the pixels of a tile of level 0 from those of the image
+ ***************************************/
+
+static void
+fill_base_tile( FL_IMAGE     * im,
+                FLIMAGE_TILE * t )
+{
+    int x = t->tx * TILE_SIZE,
+        y = t->ty * TILE_SIZE,
+        w = FL_min( TILE_SIZE, im->w - x ),
+        h = FL_min( TILE_SIZE, im->h - y ),
+        j;
+
+    for ( j = 0; j < h; j++ )
+        source_to_packed( im, x, y + j, w, t->pix + j * TILE_SIZE );
+}
+
+
+static FLIMAGE_TILE * get_tile( FL_IMAGE *,
+                                FLIMAGE_TILES *,
+                                int,
+                                int,
+                                int,
+                                int );
+
+
+/***************************************
+ * Sets the pixels of a tile of a level above 0 to the averages of
+ * 2x2 blocks of pixels of the four tiles it covers in the level below.
+ * At the right and lower border of a level with an odd width or height
+ * the last column or row gets used twice. Returns -1 if one of the
+ * tiles below can't be made, the tile is then incomplete and mustn't
+ * be used.
+ ***************************************/
+
+static int
+fill_reduced_tile( FL_IMAGE      * im,
+                   FLIMAGE_TILES * tl,
+                   FLIMAGE_TILE  * t )
+{
+    int half = TILE_SIZE / 2,
+        l = t->level - 1,
+        q,
+        cx,
+        cy,
+        cw,
+        ch,
+        i,
+        j,
+        x0,
+        x1;
+    FLIMAGE_TILE *c;
+    FL_PACKED *r0,
+              *r1,
+              *out;
+    unsigned int a,
+                 b,
+                 e,
+                 d,
+                 even,
+                 odd;
+
+    for ( q = 0; q < 4; q++ )
+    {
+        cx = 2 * t->tx + ( q & 1 );
+        cy = 2 * t->ty + ( q >> 1 );
+
+        if ( cx * TILE_SIZE >= tl->lw[ l ] || cy * TILE_SIZE >= tl->lh[ l ] )
+            continue;
+
+        if ( ! ( c = get_tile( im, tl, l, cx, cy, 0 ) ) )
+            return -1;
+
+        cw = FL_min( TILE_SIZE, tl->lw[ l ] - cx * TILE_SIZE );
+        ch = FL_min( TILE_SIZE, tl->lh[ l ] - cy * TILE_SIZE );
+
+        for ( j = 0; j < ( ch + 1 ) / 2; j++ )
+        {
+            r0 = c->pix + 2 * j * TILE_SIZE;
+            r1 = c->pix + FL_min( 2 * j + 1, ch - 1 ) * TILE_SIZE;
+            out =   t->pix + ( ( q >> 1 ) * half + j ) * TILE_SIZE
+                  + ( q & 1 ) * half;
+
+            for ( i = 0; i < ( cw + 1 ) / 2; i++ )
+            {
+                x0 = 2 * i;
+                x1 = FL_min( x0 + 1, cw - 1 );
+                a = r0[ x0 ];
+                b = r0[ x1 ];
+                e = r1[ x0 ];
+                d = r1[ x1 ];
+
+                /* all four bytes at once, two in each half word */
+
+                even =   ( a & 0xff00ff ) + ( b & 0xff00ff )
+                       + ( e & 0xff00ff ) + ( d & 0xff00ff ) + 0x20002;
+                odd  =   ( ( a >> 8 ) & 0xff00ff ) + ( ( b >> 8 ) & 0xff00ff )
+                       + ( ( e >> 8 ) & 0xff00ff ) + ( ( d >> 8 ) & 0xff00ff )
+                       + 0x20002;
+                out[ i ] =   ( ( even >> 2 ) & 0xff00ff )
+                           | ( ( ( odd >> 2 ) & 0xff00ff ) << 8 );
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+/***************************************
+ * Returns tile (tx, ty) of a level, making it if necessary, or NULL
+ * if there's not enough memory (also for one of the tiles below). The tile stays valid until the next
+ * call. Tiles that are only needed for making a tile of the level
+ * above ('shown' not set) go to the end of the LRU list, so they're
+ * thrown away before tiles that are on the screen.
+ ***************************************/
+
+static FLIMAGE_TILE *
+get_tile( FL_IMAGE      * im,
+          FLIMAGE_TILES * tl,
+          int             level,
+          int             tx,
+          int             ty,
+          int             shown )
+{
+    FLIMAGE_TILE *t,
+                 **head = tl->hash + TileHash( level, tx, ty );
+    long budget = im->setup->tile_memory > 0 ?
+                  im->setup->tile_memory : TILE_MEMORY;
+
+    for ( t = *head; t; t = t->hnext )
+        if ( t->level == level && t->tx == tx && t->ty == ty )
+            break;
+
+    if ( t )
+    {
+        if ( shown && t != tl->first )
+        {
+            unlink_tile( tl, t );
+            link_tile( tl, t, 1 );
+        }
+
+        return t;
+    }
+
+    if ( ! ( t = fl_malloc( TileBytes ) ) )
+        return NULL;
+
+    t->level = level;
+    t->tx = tx;
+    t->ty = ty;
+
+    /* tiles of the level below get made (and possibly thrown away again)
+       before this one is in the table */
+
+    if ( level == 0 )
+        fill_base_tile( im, t );
+    else if ( fill_reduced_tile( im, tl, t ) < 0 )
+    {
+        fl_free( t );
+        return NULL;
+    }
+
+    budget = FL_max( budget, tl->min_bytes );
+
+    while ( tl->last && tl->bytes + TileBytes > budget )
+        drop_tile( tl, tl->last );
+
+    t->hnext = *head;
+    *head = t;
+    link_tile( tl, t, shown );
+    tl->bytes += TileBytes;
+
+    return t;
+}
+
+
+/***************************************
+ * Frees the tiles and everything else used for the zoomed display of
+ * an image
+ ***************************************/
+
+void
+flimage_free_tiles( FL_IMAGE * im )
+{
+    FLIMAGE_TILES *tl = im->tile_info;
+
+    if ( ! tl )
+        return;
+
+    while ( tl->last )
+        drop_tile( tl, tl->last );
+
+    if ( tl->ximage )
+        XDestroyImage( tl->ximage );    /* also frees the data */
+    fli_safe_free( tl->row );
+    fli_safe_free( tl->rgb[ 0 ] );
+    fli_safe_free( tl->xmap );
+
+    fl_free( tl );
+    im->tile_info = NULL;
+}
+
+
+/***************************************
+ * Gets the XImage and buffers for a view of w x h pixels ready
+ ***************************************/
+
+static int
+setup_view( FL_IMAGE          * im,
+            FLIMAGE_TILES     * tl,
+            XWindowAttributes * xwa,
+            int                 w,
+            int                 h )
+{
+    FL_RGB2PIXEL rgb2p;
+    unsigned int alpha;
+    int pad;
+
+    if (    tl->ximage
+         && tl->ximage->width == w
+         && tl->ximage->height == h
+         && tl->visual == xwa->visual
+         && tl->depth == xwa->depth )
+        return 0;
+
+    if ( tl->ximage )
+        XDestroyImage( tl->ximage );
+    fli_safe_free( tl->row );
+    fli_safe_free( tl->rgb[ 0 ] );
+    fli_safe_free( tl->xmap );
+
+    tl->visual = xwa->visual;
+    tl->depth = xwa->depth;
+
+    pad = xwa->depth <= 8 ? 8 : ( xwa->depth <= 16 ? 16 : 32 );
+
+    if (    ! ( tl->row = fl_malloc( w * sizeof *tl->row ) )
+         || ! ( tl->rgb[ 0 ] = fl_malloc( 3 * w ) )
+         || ! ( tl->xmap = fl_malloc( ( w + h ) * sizeof *tl->xmap ) )
+         || ! ( tl->ximage = XCreateImage( im->xdisplay, xwa->visual,
+                                           xwa->depth, ZPixmap, 0, 0, w, h,
+                                           pad, 0 ) ) )
+        return -1;
+
+    if (    tl->ximage->bits_per_pixel % 8
+         || ! ( tl->ximage->data = fl_malloc( h * tl->ximage->bytes_per_line ) ) )
+    {
+        XDestroyImage( tl->ximage );
+        tl->ximage = NULL;
+        return -1;
+    }
+
+    tl->rgb[ 1 ] = tl->rgb[ 0 ] + w;
+    tl->rgb[ 2 ] = tl->rgb[ 1 ] + w;
+    tl->ymap = tl->xmap + w;
+
+    visual_to_rgb2pixel( &rgb2p, xwa->visual );
+    alpha =    xwa->depth == 32
+            && rgb2p.rbits + rgb2p.gbits + rgb2p.bbits == 24
+            && tl->ximage->bits_per_pixel == 32 ? 0xff000000 : 0;
+    flimage_init_pixfmt( &tl->fmt, &rgb2p, tl->ximage->bits_per_pixel,
+                         tl->ximage->byte_order, alpha, -1 );
+
+    return 0;
+}
+
+
+/***************************************
+ * Shows the subimage scaled by im->zoom
+ ***************************************/
+
+static int
+display_tiles( FL_IMAGE          * im,
+               Window              win,
+               XWindowAttributes * xwa )
+{
+    FLIMAGE_TILES *tl = im->tile_info;
+    FLIMAGE_TILE *t;
+    XImage *ximage;
+    double zoom = im->zoom;
+    int sw = im->sw ? im->sw : im->w,
+        sh = im->sh ? im->sh : im->h,
+        dw,
+        dh,
+        level,
+        scale,
+        x,
+        y,
+        n,
+        ty;
+    char *line;
+
+    /* pixels drawn before got changed */
+
+    if ( im->modified )
+    {
+        flimage_free_tiles( im );
+        release_ximage( im, im->ximage );
+
+        if ( im->pixels )
+        {
+            fl_free_matrix( im->pixels );
+            im->pixels = NULL;
+        }
+
+        im->display_type = FL_IMAGE_NONE;
+        tl = NULL;
+    }
+
+    if ( ! tl )
+    {
+        if ( ! ( tl = im->tile_info = fl_calloc( 1, sizeof *tl ) ) )
+            return -1;
+
+        tl->lw[ 0 ] = im->w;
+        tl->lh[ 0 ] = im->h;
+
+        for ( level = 1;    level < TILE_LEVELS
+                         && ( tl->lw[ level - 1 ] > 1
+                              || tl->lh[ level - 1 ] > 1 ); level++ )
+        {
+            tl->lw[ level ] = ( tl->lw[ level - 1 ] + 1 ) / 2;
+            tl->lh[ level ] = ( tl->lh[ level - 1 ] + 1 ) / 2;
+        }
+
+        tl->nlevels = level;
+    }
+
+    /* only what's inside the window needs to be done */
+
+    dw = FL_min( FL_max( sw * zoom + 0.5, 1.0 ), xwa->width  - im->wx );
+    dh = FL_min( FL_max( sh * zoom + 0.5, 1.0 ), xwa->height - im->wy );
+
+    if ( ! im->setup->do_not_clear )
+    {
+        if ( im->wx > 0 )
+            XClearArea( im->xdisplay, win, 0, 0, im->wx, 0, 0 );
+        if ( im->wy > 0 )
+            XClearArea( im->xdisplay, win, 0, 0, 0, im->wy, 0 );
+
+        XClearArea( im->xdisplay, win, im->wx + FL_max( dw, 0 ), 0, 0, 0, 0 );
+        XClearArea( im->xdisplay, win, 0, im->wy + FL_max( dh, 0 ), 0, 0, 0 );
+    }
+
+    if ( dw <= 0 || dh <= 0 )
+    {
+        im->modified = 0;
+        return 0;
+    }
+
+    if ( setup_view( im, tl, xwa, dw, dh ) < 0 )
+    {
+        flimage_error( im, "Can't allocate memory for display" );
+        flimage_free_tiles( im );
+        return -1;
+    }
+
+    /* the level to use is the one with the lowest resolution that has
+       at least one pixel for each one shown */
+
+    for ( level = 0, scale = 1;
+          level + 1 < tl->nlevels && zoom * 2 * scale <= 1.0;
+          level++, scale *= 2 )
+        /* empty */ ;
+
+    for ( x = 0; x < dw; x++ )
+        tl->xmap[ x ] = FL_min( ( int ) ( ( im->sx + ( x + 0.5 ) / zoom )
+                                          / scale ),
+                                tl->lw[ level ] - 1 );
+    for ( y = 0; y < dh; y++ )
+        tl->ymap[ y ] = FL_min( ( int ) ( ( im->sy + ( y + 0.5 ) / zoom )
+                                          / scale ),
+                                tl->lh[ level ] - 1 );
+
+    /* at least the tiles for a row of the view must fit in, otherwise
+       they'd have to be made again for each row */
+
+    tl->min_bytes =   ( tl->xmap[ dw - 1 ] / TILE_SIZE - tl->xmap[ 0 ] / TILE_SIZE
+                        + 1 ) * TileBytes;
+
+    ximage = tl->ximage;
+
+    for ( y = 0; y < dh; y++ )
+    {
+        line = ximage->data + y * ximage->bytes_per_line;
+
+        /* when enlarging, rows repeat */
+
+        if ( y > 0 && tl->ymap[ y ] == tl->ymap[ y - 1 ] )
+        {
+            memcpy( line, line - ximage->bytes_per_line,
+                    ximage->bytes_per_line );
+            continue;
+        }
+
+        ty = tl->ymap[ y ] / TILE_SIZE;
+
+        for ( x = 0; x < dw; x += n )
+        {
+            int tx = tl->xmap[ x ] / TILE_SIZE,
+                i;
+            FL_PACKED *src;
+
+            for ( n = 1; x + n < dw && tl->xmap[ x + n ] / TILE_SIZE == tx; n++ )
+                /* empty */ ;
+
+            if ( ! ( t = get_tile( im, tl, level, tx, ty, 1 ) ) )
+            {
+                memset( tl->row + x, 0, n * sizeof *tl->row );
+                continue;
+            }
+
+            src = t->pix + ( tl->ymap[ y ] % TILE_SIZE ) * TILE_SIZE
+                  - tx * TILE_SIZE;
+            for ( i = x; i < x + n; i++ )
+                tl->row[ i ] = src[ tl->xmap[ i ] ];
+        }
+
+        flimage_unpack_rgba( tl->row, tl->rgb[ 0 ], tl->rgb[ 1 ], tl->rgb[ 2 ],
+                             NULL, dw );
+        tl->fmt.convert( &tl->fmt, tl->rgb[ 0 ], tl->rgb[ 1 ], tl->rgb[ 2 ],
+                         line, dw );
+    }
+
+    if ( ! im->gc )
+        im->gc = XCreateGC( im->xdisplay, win, 0, 0 );
+
+    XPutImage( im->xdisplay, win, im->gc, ximage, 0, 0, im->wx, im->wy,
+               dw, dh );
+
+    /* annotations are drawn (unscaled) only when there's no scaling */
+
+    if ( zoom == 1.0 )
+    {
+        im->sxd = im->sx;
+        im->syd = im->sy;
+        im->wxd = im->wx;
+        im->wyd = im->wy;
+        im->swd = dw;
+        im->shd = dh;
+        im->win = win;
+        im->display_markers( im );
+        im->display_text( im );
+    }
+
+    im->modified = 0;
+    return 0;
+}
+
+
 /***************************************
  * convert an XImage into flimage
  ***************************************/
@@ -1475,7 +2657,7 @@ convert_ximage( FL_IMAGE * im,
     im->h = ximage->height;
     flimage_invalidate_pixels( im );
 
-    if ( flimage_getmem( im ) < 0 )
+    if ( flimage_getmem( im ) < 0 || flimage_detach( im, im->type ) < 0 )
     {
         flimage_error( im, "ConvertXImage(%dX%d): out of memory",
                        im->w, im->h );
@@ -1657,8 +2839,7 @@ flimage_from_pixmap_( FL_IMAGE * im,
 
     /* The old Ximage is now out of date */
 
-    if ( im->ximage )
-        XDestroyImage((XImage *) im->ximage);
+    release_ximage( im, im->ximage );
 
     im->ximage = ximage;
 
@@ -1699,8 +2880,7 @@ Pixmap flimage_to_pixmap( FL_IMAGE  * im,
     pixmap = XCreatePixmap( im->xdisplay, win, im->w, im->h, xwa.depth );
 
     if ( flimage_to_ximage( im, win, &xwa ) >= 0 )
-        XPutImage( im->xdisplay, pixmap, im->gc, im->ximage,
-                   0, 0, 0, 0, im->w, im->h );
+        put_ximage( im, pixmap, 0, 0, 0, 0, im->w, im->h );
 
     return pixmap;
 }
@@ -1732,8 +2912,7 @@ flimage_render_annotation( FL_IMAGE  * im,
     if ( flimage_to_ximage( im, win, &xwa ) < 0 )
         return -1;
 
-    XPutImage( im->xdisplay, im->pixmap, im->gc, im->ximage, 0, 0, 0, 0,
-               im->w, im->h );
+    put_ximage( im, im->pixmap, 0, 0, 0, 0, im->w, im->h );
 
     im->win = im->pixmap;
     im->display_markers( im );
@@ -118,6 +118,7 @@ typedef struct
     int    blank;
     int    has_blank;
     int    nframe;
+    long   data_offset;                 /* file position of first frame    */
     int    dim[ MAXDIM ];               /* dimensions                      */
     char   label[ MAXDIM ][ MAXLEN ];   /* name of each dimension          */
     char   bunit[ MAXLEN ];             /* unit name of the quantities     */
@@ -246,6 +247,8 @@ static int parse_fits_header( FILE *,
 #define LBCOL      0        /* black           */
 
 static int FITS_next( FL_IMAGE * );
+static int FITS_random( FL_IMAGE *,
+                        int );
 
 
 /***************************************
@@ -323,6 +326,8 @@ FITS_description( FL_IMAGE * im )
 
     im->more = sp->ndim > 2 && sp->dim[ 2 ] > 1;
     im->next_frame = FITS_next;
+    im->random_frame = FITS_random;
+    sp->data_offset = ftell( im->fpin );
 
     /* label the axis if available */
 
@@ -545,35 +550,117 @@ parse_fits_header( FILE     * fp,
 
 
 /***************************************
- * Assuming IEEE-745 floating point native
+ * Converts a row of big endian data from the file to doubles, taking
+ * care of blanks and NaNs. Assuming IEEE-745 floating point native
+ ***************************************/
+
+static void
+convert_row( const SPEC          * sp,
+             const unsigned char * c,
+             FLOAT64             * out,
+             int                   w )
+{
+    unsigned char uc[ 8 ];
+    FLOAT32 fval,
+            tmp32;
+    FLOAT64 dval,
+            tmp64;
+    int ival,
+        j;
+    short sval;
+
+    switch ( sp->bpp )
+    {
+        case 8 :
+            for ( j = 0; j < w; j++ )
+                out[ j ] = c[ j ];
+            break;
+
+        case 16 :
+            for ( j = 0; j < w; j++, c += 2 )
+            {
+                sval = ( c[ 0 ] << 8 ) | c[ 1 ];
+                if ( sp->has_blank && sval == sp->blank )
+                    sval = blank_replace;
+                out[ j ] = sval;
+            }
+            break;
+
+        case 32 :
+            for ( j = 0; j < w; j++, c += 4 )
+            {
+                ival =   ( c[ 0 ] << 24 )
+                       | ( c[ 1 ] << 16 )
+                       | ( c[ 2 ] <<  8 )
+                       | c[ 3 ];
+                if ( sp->has_blank && ival == sp->blank )
+                    ival = blank_replace;
+                out[ j ] = ival;
+            }
+            break;
+
+        case -32 :
+            for ( j = 0; j < w; j++, c += 4 )
+            {
+                /* memcpy() instead of a cast to avoid type-punning */
+
+                if ( little_endian )
+                {
+                    SWAP4( c, uc );
+                    memcpy( &fval, uc, 4 );
+                }
+                else
+                    memcpy( &fval, c, 4 );
+
+                if ( ISNAN( fval, tmp32 ) )
+                    fval = nan_replace;
+                out[ j ] = fval;
+            }
+            break;
+
+        case -64 :
+            for ( j = 0; j < w; j++, c += 8 )
+            {
+                if ( little_endian )
+                {
+                    SWAP8( c, uc );
+                    memcpy( &dval, uc, 8 );
+                }
+                else
+                    memcpy( &dval, c, 8 );
+
+                if ( ISNAN( dval, tmp64 ) )
+                    dval = nan_replace;
+                out[ j ] = dval;
+            }
+            break;
+    }
+}
+
+
+/***************************************
+ * Reads a frame. If possible the data are memory mapped instead of
+ * being read into a buffer - for large files this saves a copy of
+ * the raw data.
  ***************************************/
 
 static int
 FITS_load( FL_IMAGE * im )
 {
-    unsigned short *ci = FL_IsGray( im->type ) ? im->gray[ 0 ] : im->ci[ 0 ];
+    unsigned short *ci;
     SPEC *sp = im->io_spec;
     FLOAT64  offset,
              scale,
              dmin,
              dmax,
-            *dval,
-             tmp64;
-    FILE *fp = im->fpin;
+            *row;
+    size_t row_len;
     int  i,
          j,
-         n,
-         k,
-         byte_per_pix,
          has_minmax,
-        *ival,
-         err;
-    unsigned char *c,
-                   uc[ 8 ];
-    short *sval;
-    FLOAT32 *fval,
-             tmp32;
-    void **vals;
+         nrows;
+    unsigned char *data,
+                  *buf = NULL;
 
     dmin = 1.0e30;
     dmax = -1.0e30;
@@ -583,136 +670,56 @@ FITS_load( FL_IMAGE * im )
     M_err( "fits_load", "sp->dmax=%g sp->dmin=%g", sp->dmax, sp->dmin );
 #endif
 
-    /* read the data */
+    row_len = ( size_t ) im->w * ( FL_abs( sp->bpp ) / 8 );
 
-    byte_per_pix = FL_abs( sp->bpp ) / 8;
-    if ( ! ( vals = fl_get_matrix( im->h, im->w, byte_per_pix ) ) )
+    if ( ! ( row = fl_malloc( im->w * sizeof *row ) ) )
     {
         im->error_message( im, "Can't get memory for FITS" );
         return -1;
     }
 
-    for ( err = 0, i = im->h - 1; !err && i >= 0; i--, im->completed++ )
-    {
-        if ( ! ( im->completed & FLIMAGE_REPFREQ ) )
-            im->visual_cue( im, "Reading FITS" );
+    /* get at the data, either mapped or read into a buffer */
 
-        k = im->h - 1 - i;
-
-        if ( ( err = ( fread( c = vals[ k ], byte_per_pix, im->w, fp ) !=
-                                                          ( size_t ) im->w ) ) )
-            im->error_message( im, "Error reading FITS" );
-
-        /* now do data conversion to MSBF order */
-
-        switch ( sp->bpp )
+    if ( ( data = flimage_map_pixels( im, row_len * im->h ) ) )
+        nrows = im->h;
+    else
+    {
+        if ( ! ( data = buf = fl_malloc( row_len * im->h ) ) )
         {
-            case 32 :
-                for ( ival = vals[k], j = 0; j < im->w; j++, c += 4 )
-                {
-                    ival[ j ] =   ( c[ 0 ] << 24 )
-                                | ( c[ 1 ] << 16 )
-                                | ( c[ 2 ] <<  8 )
-                                | c[ 3 ];
-
-                    if ( sp->has_blank && ival[ j ] == sp->blank )
-                        ival[ j ] = blank_replace;
-                }
-
-                if ( ! has_minmax )
-                {
-                    for ( j = 0; j < im->w; j++ )
-                        if ( ival[ j ] < dmin )
-                            dmin = ival[ j ];
-                        else if ( ival[ j ] > dmax )
-                            dmax = ival[ j ];
-                }
-                break;
-
-            case 16 :
-                for ( sval = vals[ k ], j = 0; j < im->w; j++, c += 2 )
-                {
-                    sval[ j ] = ( c[ 0 ] << 8 ) | c[ 1 ];
-                    if ( sp->has_blank && sval[ j ] == sp->blank )
-                        sval[ j ] = blank_replace;
-                }
-
-                if ( ! has_minmax )
-                {
-                    for ( j = 0; j < im->w; j++ )
-                        if ( sval[ j ] < dmin )
-                            dmin = sval[ j ];
-                        else if ( sval[ j ] > dmax )
-                            dmax = sval[ j ];
-                }
-                break;
-
-            case 8 :
-                if ( ! has_minmax )
-                {
-                    for ( j = 0; j < im->w; j++ )
-                        if ( c[ j ] < dmin )
-                            dmin = c[ j ];
-                        else if ( c[ j ] > dmax )
-                            dmax = c[ j ];
-                }
-                break;
-
-            case -32 :
-                for ( fval = vals[ k ], j = 0; j < im->w; j++, c += 4 )
-                {
-                    if ( little_endian )
-                    {
-                        /* Using
-                            fval[ j ] = * ( FLOAT32 * ) uc;
-                           results in type-punning warning, so instead: */
-                        memcpy( fval + j, uc, 4 );
-                    }
-
-                    if ( ISNAN( fval[ j ], tmp32 ) )
-                        fval[ j ] = nan_replace;
-                }
-
-                if ( ! has_minmax )
-                {
-                    for ( j = 0; j < im->w; j++ )
-                        if ( fval[ j ] < dmin )
-                            dmin = fval[ j ];
-                        else if ( fval[ j ] > dmax )
-                            dmax = fval[ j ];
-                }
-                break;
+            fl_free( row );
+            im->error_message( im, "Can't get memory for FITS" );
+            return -1;
+        }
 
-            case -64 :
-                for ( dval = vals[ k ], j = 0; j < im->w; j++, c += 8 )
-                {
-                    if ( little_endian )
-                    {
-                        SWAP8( c, uc );
-                        /* Using
-                            dval[ j ] = * ( FLOAT64 * ) uc;
-                           results in type-punning warning, so instead: */
-                        memcpy( dval + j, uc, 8 );
-                    }
-
-                    if ( ISNAN( dval[ j ], tmp64 ) )
-                        dval[ j ] = nan_replace;
-                }
+        for ( nrows = 0; nrows < im->h; nrows++, im->completed++ )
+        {
+            if ( ! ( im->completed & FLIMAGE_REPFREQ ) )
+                im->visual_cue( im, "Reading FITS" );
 
-                if ( ! has_minmax )
-                {
-                    for ( j = 0; j < im->w; j++ )
-                        if ( dval[ j ] < dmin )
-                            dmin = dval[ j ];
-                        else if ( dval[ j ] > dmax )
-                            dmax = dval[ j ];
-                }
+            if ( fread( data + nrows * row_len, 1, row_len, im->fpin )
+                 != row_len )
+            {
+                im->error_message( im, "Error reading FITS" );
                 break;
+            }
         }
     }
 
     if ( ! has_minmax )
     {
+        for ( i = 0; i < nrows; i++ )
+        {
+            convert_row( sp, data + i * row_len, row, im->w );
+
+            for ( j = 0; j < im->w; j++ )
+            {
+                if ( row[ j ] < dmin )
+                    dmin = row[ j ];
+                if ( row[ j ] > dmax )
+                    dmax = row[ j ];
+            }
+        }
+
         sp->dmin = sp->bzero + dmin * sp->bscale;
         sp->dmax = sp->bzero + dmax * sp->bscale;
     }
@@ -738,23 +745,24 @@ FITS_load( FL_IMAGE * im )
 
     /* remap data into pixels */
 
-    if ( sp->bpp == 8 )
-        for ( c = vals[ 0 ], n = im->w * im->h; --n > 0; )
-            ci[ n ] = offset + c[ n ] * scale;
-    else if ( sp->bpp == 16 )
-        for ( sval = vals[ 0 ], n = im->w * im->h; --n > 0; )
-            ci[ n ] = offset + sval[ n ] * scale;
-    else if ( sp->bpp == 32 )
-        for ( ival = vals[ 0 ], n = im->w * im->h; --n > 0; )
-            ci[ n ] = offset + ival[ n ] * scale;
-    else if ( sp->bpp == -32 )
-        for ( fval = vals[ 0 ], n = im->w * im->h; --n > 0; )
-            ci[ n ] = offset + fval[ n ] * scale;
-    else if ( sp->bpp == -64 )
-        for ( dval = vals[ 0 ], n = im->w * im->h; --n > 0; )
-            ci[ n ] = offset + dval[ n ] * scale;
-
-    fl_free_matrix( vals );
+    for ( i = 0; i < nrows; i++ )
+    {
+        if ( ! buf && ! ( im->completed++ & FLIMAGE_REPFREQ ) )
+            im->visual_cue( im, "Reading FITS" );
+
+        ci = FL_IsGray( im->type ) ? im->gray[ i ] : im->ci[ i ];
+        convert_row( sp, data + i * row_len, row, im->w );
+
+        for ( j = 0; j < im->w; j++ )
+            ci[ j ] = offset + row[ j ] * scale;
+    }
+
+    if ( buf )
+        fl_free( buf );
+    else
+        flimage_unmap_pixels( im );
+
+    fl_free( row );
 
     return im->completed >= im->h / 2 ? 1 : -1;
 }
@@ -829,6 +837,48 @@ FITS_next( FL_IMAGE * im )
 }
 
 
+/***************************************
+ * All frames of a data cube have the same size and follow each other
+ * directly, so the position of frame n can be computed
+ ***************************************/
+
+static int
+FITS_random( FL_IMAGE * im,
+             int        n )
+{
+    SPEC *sp = im->io_spec;
+    long frame_size = ( long ) im->w * im->h * ( FL_abs( sp->bpp ) / 8 );
+    int nframes = sp->ndim > 2 ? FL_max( sp->dim[ 2 ], 1 ) : 1;
+    int status;
+
+    im->total_frames = nframes;
+
+    if ( n > nframes )
+    {
+        flimage_error( im, "%s: no frame %d", im->infile, n );
+        return -1;
+    }
+
+    if (    sp->data_offset < 0
+         || fseek( im->fpin, sp->data_offset + ( n - 1 ) * frame_size,
+                   SEEK_SET ) < 0 )
+    {
+        flimage_error( im, "%s: can't seek to frame %d", im->infile, n );
+        return -1;
+    }
+
+    if ( flimage_getmem( im ) < 0 )
+        return -1;
+
+    sp->nframe = n;
+    clearerr( im->fpin );
+
+    status = FITS_load( im );
+    im->more = status >= 0 && n < nframes;
+    return status;
+}
+
+
 /***************************************
  ***************************************/
 
@@ -114,6 +114,8 @@ typedef struct
 } SPEC;
 
 static int GIF_next( FL_IMAGE * );
+static int GIF_random( FL_IMAGE *,
+                       int );
 
 
 /***************************************
@@ -130,6 +132,7 @@ GIF_description( FL_IMAGE * im )
     im->spec_size = sizeof *sp;
 
     im->next_frame = GIF_next;
+    im->random_frame = GIF_random;
     sp->gc.tran = 0;
 
     /* identify should've already checked signature. */
@@ -294,7 +297,6 @@ read_descriptor_block( FL_IMAGE * im )
 }
 
 
-#define Badfread( a, b, c, d )    ( fread( a, b, c, d ) != ( c ) )
 #define Badfwrite( a, b, c, d )   ( fwrite( a, b, c, d ) != ( c ) )
 
 
@@ -353,8 +355,6 @@ static int readextension( FILE *,
 static int next_lineno( int,
                         int,
                         int );
-static int process_lzw_code( FL_IMAGE *,
-                             int );
 static void outputline( FL_IMAGE *,
                         unsigned char * );
 
@@ -382,7 +382,8 @@ outputline( FL_IMAGE      * im,
     unsigned char *pi = line;
     SPEC *sp = im->io_spec;
     static int lines;
-    int k;
+    int k,
+        i;
 
     if ( sp->cur_total == 0 )   /* first entry */
         lines = 0;
@@ -401,6 +402,25 @@ outputline( FL_IMAGE      * im,
     for ( po = im->ci[ k ], line += im->w; pi < line; )
         *po++ = *pi++;
 
+    /* For progressive display rows of an interlaced image not read yet
+       get filled in with the line just read. They're all from later
+       passes, so get overwritten again */
+
+    if ( flimage_is_progressive( im ) )
+    {
+        int n = 1;
+
+        if ( sp->interlace )
+            n = k % 8 == 0 ? 8 : ( k % 4 == 0 ? 4 : ( k % 2 == 0 ? 2 : 1 ) );
+
+        n = FL_min( n, im->h - k );
+
+        for ( i = 1; i < n; i++ )
+            memcpy( im->ci[ k + i ], im->ci[ k ], im->w * sizeof **im->ci );
+
+        flimage_rows_done( im, k, n );
+    }
+
     im->completed = ++lines;
     if ( ! ( im->completed & FLIMAGE_REPFREQ ) )
         im->visual_cue( im, "Reading GIF" );
@@ -431,6 +451,30 @@ getblock( FILE * fp,
 #define TRAILER       0x3b
 
 
+/***************************************
+ * Reads the data blocks of a graphics control extension
+ ***************************************/
+
+static int
+read_gc( FILE     * fp,
+         GIFGCNTL * gc )
+{
+    char buf[ 258 ];
+    int count;
+
+    while ( ( count = getblock( fp, buf ) ) != 0 && count != EOF )
+    {
+        gc->tran = buf[ 0 ] & 1;
+        gc->input = buf[ 0 ] & 2;
+        gc->delay = 10 * ( buf[ 0 ] + ( buf[ 1 ] << 8 ) );
+        if ( gc->tran )
+            gc->tran_col = buf[ 3 ];
+    }
+
+    return count;
+}
+
+
 /***************************************
  *  As long as we are not doing the extension, print it out to stderr
  ***************************************/
@@ -491,14 +535,7 @@ readextension( FILE     * fp,
 
         case GIFEXT_GC :        /* graphics control     */
             M_info( 0, "%s:GraphicsControl extension", im->infile );
-            while ( ( count = getblock( fp, buf ) ) != 0 && count != EOF )
-            {
-                sp->gc.tran = buf[ 0 ] & 1;
-                sp->gc.input = buf[ 0 ] & 2;
-                sp->gc.delay = 10 * ( buf[ 0 ] + ( buf[ 1 ] << 8 ) );
-                if ( sp->gc.tran )
-                    sp->gc.tran_col = buf[ 3 ];
-            }
+            count = read_gc( fp, &sp->gc );
             break;
 
         case GIFEXT_APP :       /* application extension */
@@ -560,7 +597,7 @@ skip_extension( FILE     * fp,
 }
 
 
-#define LZW_INIT          9000
+#define LZW_MAXCODE   4096
 
 
 static int bpp,
@@ -570,9 +607,212 @@ static int bpp,
 
 #include <ctype.h>
 
-static unsigned char * lhead,
-                     *lbuf,
-                     *stackp;   /* local buffers */
+
+/*******************************************************************
+ * The decoder. Codes are taken from the data sub-blocks via a small
+ * bit buffer, the string for a code is written directly to its place
+ * in the output buffer, last character first, by following the prefix
+ * chain (the length of each string is kept in the table, so there's no
+ * need for a stack). Complete scanlines get handed to outputline().
+ *******************************************************************/
+
+typedef struct {
+    FILE           * fp;
+    unsigned char    block[ 256 ];   /* current data sub-block      */
+    int              pos,
+                     len;
+    int              done;           /* no more data for this image */
+    unsigned int     accum;          /* bits not used yet           */
+    int              bits;
+    unsigned short   prefix[ LZW_MAXCODE ];
+    unsigned char    suffix[ LZW_MAXCODE ];
+    unsigned short   length[ LZW_MAXCODE ];
+} LZW_DECODER;
+
+
+/***************************************
+ * Returns the next code of 'size' bits or -1 if there's no more data
+ ***************************************/
+
+static int
+read_code( LZW_DECODER * lzw,
+           int           size )
+{
+    int code,
+        count;
+
+    while ( lzw->bits < size )
+    {
+        if ( lzw->pos >= lzw->len )
+        {
+            if (    lzw->done
+                 || ( count = getc( lzw->fp ) ) == EOF
+                 || count == 0
+                 || ( count = fread( lzw->block, 1, count, lzw->fp ) ) == 0 )
+            {
+                lzw->done = 1;
+                return -1;
+            }
+
+            lzw->len = count;
+            lzw->pos = 0;
+        }
+
+        lzw->accum |= ( unsigned int ) lzw->block[ lzw->pos++ ] << lzw->bits;
+        lzw->bits += 8;
+    }
+
+    code = lzw->accum & gif_codemask[ size ];
+    lzw->accum >>= size;
+    lzw->bits -= size;
+
+    return code;
+}
+
+
+/***************************************
+ * Skips data sub-blocks not used up, up to and including the
+ * terminating empty block
+ ***************************************/
+
+static void
+skip_data_blocks( LZW_DECODER * lzw )
+{
+    int count;
+
+    if ( lzw->done )
+        return;
+
+    while ( ( count = getc( lzw->fp ) ) != EOF && count > 0 )
+        if ( fread( lzw->block, 1, count, lzw->fp ) != ( size_t ) count )
+            break;
+
+    lzw->done = 1;
+}
+
+
+/***************************************
+ * Decodes the raster data of an image. Returns -1 on bad data,
+ * otherwise 0 (even if the data end early or there are too many)
+ ***************************************/
+
+static int
+decode_raster( FL_IMAGE      * im,
+               LZW_DECODER   * lzw,
+               unsigned char * buf )
+{
+    SPEC *sp = im->io_spec;
+    long npix = ( long ) im->w * im->h;
+    int size = CodeSize + 1,
+        avail = ClearCode + 2,
+        oldcode = -1,
+        code,
+        incode,
+        firstchar = 0,
+        len,
+        n = 0,
+        i;
+    unsigned char *p,
+                  *line;
+
+    for ( i = 0; i < ClearCode; i++ )
+    {
+        lzw->prefix[ i ] = 0;
+        lzw->suffix[ i ] = i;
+        lzw->length[ i ] = 1;
+    }
+
+    while ( ( code = read_code( lzw, size ) ) >= 0 )
+    {
+        if ( code == ClearCode )
+        {
+            size = CodeSize + 1;
+            avail = ClearCode + 2;
+            oldcode = -1;
+            continue;
+        }
+
+        if ( code == EOFCode )
+            break;
+
+        /* this is possible only if the image file is corrupt */
+
+        if ( code > avail || ( oldcode == -1 && code >= ClearCode ) )
+        {
+            flimage_error( im, "GIFLZW(%s): Bad code 0x%04x", im->infile,
+                           code );
+            return -1;
+        }
+
+        if ( oldcode == -1 )
+        {
+            buf[ n++ ] = firstchar = code;
+            oldcode = code;
+        }
+        else
+        {
+            /* The string for a code not yet in the table is the one of
+               the previous code plus its first character */
+
+            incode = code < avail ? code : oldcode;
+            len = lzw->length[ incode ];
+
+            for ( p = buf + n + len - 1; incode >= ClearCode; p-- )
+            {
+                *p = lzw->suffix[ incode ];
+                incode = lzw->prefix[ incode ];
+            }
+
+            *p = firstchar = incode;
+            n += len;
+
+            if ( code == avail )
+                buf[ n++ ] = firstchar;
+
+            /* Once the table is full it stays that way until the next
+               clear code */
+
+            if ( avail < LZW_MAXCODE )
+            {
+                lzw->prefix[ avail ] = oldcode;
+                lzw->suffix[ avail ] = firstchar;
+                lzw->length[ avail ] = lzw->length[ oldcode ] + 1;
+
+                if ( ++avail == 1 << size && size < 12 )
+                    size++;
+            }
+
+            oldcode = code;
+        }
+
+        if ( n >= im->w )
+        {
+            for ( line = buf; n >= im->w; n -= im->w, line += im->w )
+                outputline( im, line );
+
+            memmove( buf, line, n );
+
+            if ( sp->cur_total > npix )
+            {
+                flimage_error( im, "%s: Raster full before EOI",
+                               im->infile );
+                break;
+            }
+        }
+    }
+
+    /* Pixels that are decoded but don't fill a complete line */
+
+    if ( n > 0 && sp->cur_total < npix )
+    {
+        M_warn( "GIFReadPix", "total %ld should be %ld",
+                ( long ) sp->cur_total + n, npix );
+        memset( buf + n, 0, im->w - n );
+        outputline( im, buf );
+    }
+
+    return 0;
+}
 
 
 /***************************************
@@ -581,16 +821,15 @@ static unsigned char * lhead,
 static int
 GIF_load( FL_IMAGE * im )
 {
-    int bits = 0,
-        err,
-        count,
-        code = -1;
-    unsigned int datum = 0;
-    unsigned char *ch,
-                  buf[ 257 ];
+    LZW_DECODER *lzw;
+    unsigned char *buf,
+                  tmp[ 50 ];
     SPEC *sp = im->io_spec;
     const char *func = "GIFReadPix";
     FILE *fp = im->fpin;
+    int err,
+        code,
+        count;
 
     sp->ctext = 0;
 
@@ -601,41 +840,32 @@ GIF_load( FL_IMAGE * im )
         return -1;
     }
 
-    /* initialize the decompressor */
+    bpp = CodeSize;
+    ClearCode = 1 << bpp;
+    EOFCode = ClearCode + 1;
 
-    err = sp->cur_total = 0;
-    process_lzw_code( im, LZW_INIT );
+    /* room for a line plus the longest possible string */
 
-    while ( ! err && ( count = getc( fp ) ) != EOF && count > 0 )
-    {
-        err = Badfread( buf, 1, ( size_t )count, fp );
-        for ( ch = buf; count-- > 0; ch++ )
-        {
-            datum += *ch << bits;
-            bits += 8;
-            while ( bits >= CodeSize && ! err )
-            {
-                code = datum & gif_codemask[ CodeSize ];
-                datum >>= CodeSize;
-                bits -= CodeSize;
-                err = code == EOFCode || process_lzw_code( im, code );
-            }
-        }
+    lzw = fl_calloc( 1, sizeof *lzw );
+    buf = fl_malloc( im->w + LZW_MAXCODE + 1 );
 
-        /* EOFcode is not exactly an errr */
+    if ( ! lzw || ! buf )
+    {
+        fli_safe_free( lzw );
+        fli_safe_free( buf );
+        flimage_error( im, "GIF_load: malloc() failed" );
+        return -1;
+    }
 
-        if ( err && code == EOFCode )
-            err = 0;
+    lzw->fp = fp;
+    sp->cur_total = 0;
 
-        if ( code != EOFCode && sp->cur_total > (long) im->w * im->h )
-        {
-            flimage_error( im, "%s: Raster full before EOI", im->infile );
-            err = 1;
-        }
-    }
+    err = decode_raster( im, lzw, buf ) < 0;
 
     if ( ! err )
     {
+        skip_data_blocks( lzw );
+
         if ( ( code = getc( fp ) ) == EXTENSION )
         {
             ungetc( code, fp );
@@ -650,28 +880,17 @@ GIF_load( FL_IMAGE * im )
             ungetc( IMAGESEP, fp );
         }
         else if (    code != EOF
-                  && fread( buf, 1, 50, fp )
+                  && fread( tmp, 1, sizeof tmp, fp )
                   && getc( fp ) != EOF )
         {
             M_info( func, "%s: Garbage(> 50bytes) at end", im->infile );
         }
     }
 
-    count = sp->cur_total / im->w;
-
-    /* final check: get pixels that are decoded but yet to be output */
+    fl_free( buf );
+    fl_free( lzw );
 
-    if ( count < im->h )
-    {
-        int leftover;
-        leftover = lbuf - lhead;
-
-        M_warn( func, "total %ld should be %d", sp->cur_total + leftover,
-                im->w * im->h );
-
-        if ( leftover )
-            outputline( im, lhead );
-    }
+    count = sp->cur_total / im->w;
 
     /* if more than 1/4 image is read, return positive value so that driver
        will try to display it.  */
@@ -683,189 +902,196 @@ GIF_load( FL_IMAGE * im )
 
 
 /***************************************
- * process_lzw_code - Process a compression code.  "clear" resets the
- * code table. Otherwise make a new code table entry, and output the
- * bytes associated with the code.
- *
- * Based on gifpaste by Kipp Hickman @ Silicon Graphics
  ***************************************/
 
-#define OUTPIX( c )    ( *lbuf++ = ( c ) )
-#define MC_SIZE        4097
+static int
+GIF_next( FL_IMAGE * im )
+{
+    int ow = im->w,
+        oh = im->h;
+    int ret;
 
+    read_descriptor_block( im );
 
-/***************************************
- * if we've got more than one scanline, output
- ***************************************/
+    /* It would seem from the doc that it is possible new image could be
+       larger than last one */
 
-static void
-flush_buffer( FL_IMAGE * im )
-{
-    int incode;
+    if ( ow != im->w || oh != im->h )
+        flimage_getmem( im );
 
-    incode = lbuf - lhead;
+#if 0
+    del_text( );
+#endif
 
-    if ( incode >= im->w )
-    {
-        int i;
+    im->more = 0;       /* gif_load will do turn it on if more */
+    im->modified = 1;
 
-        lbuf = lhead;
+    ret = GIF_load( im );
 
-        while ( incode >= im->w )
-        {
-            outputline( im, lbuf );
-            incode -= im->w;
-            lbuf += im->w;
-        }
+    return ret;
+}
 
-        /* copy the left over */
 
-        for ( i = 0; i < incode; i++ )
-            lhead[ i ] = *lbuf++;
-        lbuf = lhead + incode;
-    }
-}
+/* What's needed to start reading a frame without going through the ones
+   before it. Frames aren't combined with each other, so the only state
+   carried over from one frame to the next is the colormap (a frame
+   without a local one uses the one of the frame before), the graphics
+   control settings and the transparent index */
+
+typedef struct {
+    long     offset;        /* of the image separator            */
+    long     map_offset;    /* of the colormap in effect, or -1  */
+    int      map_len;
+    int      tran_index;
+    GIFGCNTL gc;
+} GIFFRAME;
 
 
 /***************************************
+ * Skips a sequence of data blocks
  ***************************************/
 
 static int
-process_lzw_code( FL_IMAGE * im,
-                  int        code )
+skip_blocks( FILE * fp )
 {
-    int incode;
-    static unsigned char firstchar;
-    static unsigned char stack[ MC_SIZE ];
-    static int avail,
-               oldcode;
-    static unsigned char suffix[ MC_SIZE ];
-    static unsigned short prefix[ MC_SIZE ];
-
-    if ( code == LZW_INIT )
-    {
-        lbuf = lhead = fl_realloc( lhead, im->w + 1 + 4096 );
-
-        bpp = CodeSize;
-        ClearCode = 1 << bpp;
-        EOFCode = ClearCode + 1;
-        CodeSize = bpp + 1;
-
-        for ( incode = ClearCode; --incode >= 0; )
-        {
-            *( suffix + incode ) = incode;
-            *( prefix + incode ) = 0;
-        }
+    int count;
 
-        avail = ClearCode + 2;
-        oldcode = -1;
-        stackp = stack;
-        return lbuf ? 0 : -1;
-    }
+    while ( ( count = getc( fp ) ) != EOF && count != 0 )
+        if ( fseek( fp, count, SEEK_CUR ) < 0 )
+            return EOF;
 
-    if ( code == ClearCode )
-    {
-        CodeSize = bpp + 1;
-        avail = ClearCode + 2;
-        oldcode = -1;
-        return 0;
-    }
+    return count;
+}
 
-    /* this is possible only if the image file is corrupt */
 
-    if ( code > avail || code < 0 )
-    {
-        flimage_error( im, "GIFLZW(%s): Bad code 0x%04x", im->infile, code );
-        return -1;
-    }
+/***************************************
+ * Runs through the whole file without decoding anything and records
+ * the state the decoder is in at the start of each frame
+ ***************************************/
 
-    if ( oldcode == -1 )
-    {
-        OUTPIX( suffix[ code ] );
-        firstchar = oldcode = code;
+static int
+build_frame_index( FL_IMAGE * im )
+{
+    FILE *fp = im->fpin;
+    unsigned char buf[ 13 ];
+    GIFFRAME f;
+    int c,
+        done = 0;
 
-        /* Clive Stubbings.
-         * There is the posibility of an image with just alternate
-         * single code bytes and resets. I know thats really dumb,
-         * but I found one and it took a long time to work out why
-         * it crashed...
-         * So flush the buffer before it overuns. */
+    rewind( fp );
 
-        flush_buffer( im );
-        return 0;
-    }
+    if ( fread( buf, 1, 13, fp ) != 13 )
+        return -1;
 
-    incode = code;
-    if ( code == avail )
-    {               /* the first code is always < avail */
-        *stackp++ = firstchar;
-        code = oldcode;
-    }
+    memset( &f, 0, sizeof f );
+    f.tran_index = -1;
+    f.map_offset = -1;
+    f.map_len = 1 << ( 1 + ( buf[ 10 ] & 0x07 ) );
 
-    while ( code > ClearCode )
+    if ( buf[ 10 ] & 0x80 )
     {
-        *stackp++ = suffix[ code ];
-        code = prefix[ code ];
+        f.map_offset = 13;
+        fseek( fp, 3 * f.map_len, SEEK_CUR );
     }
 
-    if ( avail >= 4096 )
+    while ( ! done && ( c = getc( fp ) ) != EOF )
     {
-        flimage_error( im, "GIFLZW(%s): BadBlock--TableFull", im->infile );
-        return -1;
-    }
+        switch ( c )
+        {
+            case '\0' :
+                break;
 
-    *stackp++ = firstchar = suffix[ code ];
-    prefix[ avail ] = oldcode;
-    suffix[ avail ] = firstchar;
+            case EXTENSION :
+                if ( ( c = getc( fp ) ) == GIFEXT_GC )
+                    c = read_gc( fp, &f.gc );
+                else if ( c != EOF )
+                    c = skip_blocks( fp );
+                done = c == EOF;
+                break;
 
-    avail++;
-    if ( ( avail & gif_codemask[ CodeSize ] ) == 0 && avail < 4096 )
-        CodeSize++;
+            case IMAGESEP :
+                f.offset = ftell( fp ) - 1;
+                if ( flimage_add_frame( im, &f, sizeof f ) < 0 )
+                {
+                    flimage_free_frame_index( im );
+                    return -1;
+                }
 
-    oldcode = incode;
+                if ( fseek( fp, 8, SEEK_CUR ) < 0 || ( c = getc( fp ) ) == EOF )
+                {
+                    done = 1;
+                    break;
+                }
 
-    do
-    {
-        OUTPIX( *--stackp );
-    }
-    while ( stackp > stack );
+                if ( c & 0x80 )
+                {
+                    f.map_len = 1 << ( ( c & 0x07 ) + 1 );
+                    f.map_offset = ftell( fp );
+                    fseek( fp, 3 * f.map_len, SEEK_CUR );
+                }
 
-    /* if we've got more than one scanline, output */
+                if ( f.gc.tran && f.gc.tran_col < f.map_len )
+                    f.tran_index = f.gc.tran_col;
 
-    flush_buffer( im );
+                done = getc( fp ) == EOF || skip_blocks( fp ) == EOF;
+                break;
 
-    return 0;
+            default :           /* trailer or garbage */
+                done = 1;
+                break;
+        }
+    }
+
+    clearerr( fp );
+    return flimage_frame_count( im ) > 0 ? 0 : -1;
 }
 
 
 /***************************************
+ * Reads frame n after restoring the decoder state recorded for it
  ***************************************/
 
 static int
-GIF_next( FL_IMAGE * im )
+GIF_random( FL_IMAGE * im,
+            int        n )
 {
-    int ow = im->w,
-        oh = im->h;
-    int ret;
+    SPEC *sp = im->io_spec;
+    GIFFRAME *f;
 
-    read_descriptor_block( im );
+    if ( flimage_frame_count( im ) < 0 && build_frame_index( im ) < 0 )
+    {
+        flimage_error( im, "%s: can't index frames", im->infile );
+        return -1;
+    }
 
-    /* It would seem from the doc that it is possible new image could be
-       larger than last one */
+    im->total_frames = flimage_frame_count( im );
 
-    if ( ow != im->w || oh != im->h )
-        flimage_getmem( im );
+    if ( ! ( f = flimage_get_frame( im, n ) ) )
+    {
+        flimage_error( im, "%s: no frame %d", im->infile, n );
+        return -1;
+    }
 
-#if 0
-    del_text( );
-#endif
+    if ( f->map_offset >= 0 )
+    {
+        im->map_len = f->map_len;
+        flimage_getcolormap( im );
+        fseek( im->fpin, f->map_offset, SEEK_SET );
+        read_map( im );
+    }
 
-    im->more = 0;       /* gif_load will do turn it on if more */
-    im->modified = 1;
+    sp->gc = f->gc;
+    im->tran_index = f->tran_index;
 
-    ret = GIF_load( im );
+    if (    fseek( im->fpin, f->offset, SEEK_SET ) < 0
+         || read_descriptor_block( im ) < 0
+         || flimage_getmem( im ) < 0 )
+        return -1;
 
-    return ret;
+    im->more = 0;
+    im->modified = 1;
+
+    return GIF_load( im );
 }
 
 /******************* END of DECODER ****************************}*****/
@@ -918,86 +1144,57 @@ next_lineno( int i,
  * Write image to a disk file in GIF format.
  ************************************************************/
 
-/* current char, cchar, must be of signed type, and code and prefix must be
- * at least 12 bits long. */
+/* The string table of the encoder is a trie kept in arrays indexed by
+ * the codes: child[ code ] is the most recently added string extending
+ * the string with that code by one character, sibling[ code ] the next
+ * (older) string with the same prefix and chr[ code ] the character the
+ * string ends in. Only the roots need resetting when the table gets
+ * cleared, a new entry starts out without children. */
 
-typedef struct strspace_
-{
-    struct strspace_ * next;            /* link          */
-    int                code;            /* emit code     */
-    int                cchar;           /* current char */
-} Strtab;
-
-typedef struct
-{
-    int prefix,
-        cchar,
-        code;
-} WorkStr;
-
-#define  MAXTABL  4097
+#define MAXTABL  4096
 
-static Strtab *strtab[ MAXTABL ],
-               strspace[ MAXTABL ];
+static unsigned short child[ MAXTABL ],
+                      sibling[ MAXTABL ];
+static unsigned char  chr[ MAXTABL ];
 
 
 /**************************************************************
- * Check if current string is already in the string table
+ * Looks up the string made up of the prefix and the character.
+ * Returns its code or -1 if it's not in the table.
  **************************************************************/
 
 static int
-in_table( WorkStr * cstr )
+in_table( int prefix,
+          int cchar )
 {
-    Strtab *p = strtab[ cstr->prefix ];
+    int code = child[ prefix ];
 
-    for ( ; p && p->cchar != cstr->cchar; p = p->next )
-        /* empty */ ;
+    while ( code && chr[ code ] != cchar )
+        code = sibling[ code ];
 
-    return p ? p->code : -1;
+    return code ? code : -1;
 }
 
-#define USE_TAB_FUNC
-
-
-/*
- * A macro and function are supplied to insert a string into the
- * string table.
- */
 
-#ifdef USE_TAB_FUNC
-
-/***************************************
- ***************************************/
+/**************************************************************
+ * Adds the string made up of the prefix and the character
+ **************************************************************/
 
 static void
-addto_table( WorkStr * cstr,
-             int       code )
+addto_table( int prefix,
+             int cchar,
+             int code )
 {
-    Strtab *p = &strspace[ code ];
-
-    p->code = code;
-    p->cchar = cstr->cchar;
-    p->next = strtab[ cstr->prefix ];
-    strtab[ cstr->prefix ] = p;
+    chr[ code ] = cchar;
+    child[ code ] = 0;
+    sibling[ code ] = child[ prefix ];
+    child[ prefix ] = code;
 }
 
-#else
-
-#define  addto_table(cstr, ccode )                         \
-    do {                                                   \
-        Strtab *p = &strspace[ ccode ];                    \
-        p->code = ccode;                                   \
-        p->cchar = cstr->cchar;                            \
-        p->next = strtab[ cstr->prefix ];                  \
-        strtab[ cstr->prefix ] = p;                        \
-   } while( 0 )
-#endif
-
 
 static void output_lzw_code( unsigned int,
                              FILE * );
-static void init_table( int,
-                        FILE * );
+static void init_table( FILE * );
 #if 0
 static unsigned short * get_scan_line( FL_IMAGE *,
                                        int );
@@ -1147,13 +1344,14 @@ write_desc( FL_IMAGE * im,
 static int
 write_pixels( FL_IMAGE * im )
 {
-    int j, code,
-        ccode;
+    int j,
+        code,
+        ccode,
+        prefix,
+        cchar;
     unsigned short *scan,
                    *ss;
-    WorkStr *cstr;
     int colors;
-    WorkStr workstring;
     FILE *fp = im->fpout;
 
     /* IMPORTANT: number of colors handed to this routine might not be 2^n,
@@ -1171,10 +1369,9 @@ write_pixels( FL_IMAGE * im )
     EOFCode = ClearCode + 1;
     CodeSize = bpp + 1;     /* start encoding */
 
-    init_table( colors, fp );   /* initialize the LZW tables */
-    cstr = &workstring;
+    init_table( fp );       /* initialize the LZW tables */
     ccode = EOFCode + 1;
-    cstr->prefix = -1;
+    prefix = -1;
 
     /* start raster stream. Old way of doing things, that is as soon as we
        get 4095, a clearcode is emitted. */
@@ -1185,38 +1382,40 @@ write_pixels( FL_IMAGE * im )
 
         for ( ss = scan + im->w; scan < ss; scan++ )
         {
-            cstr->cchar = *scan & ( colors - 1 );
-            if ( cstr->prefix >= 0 )
+            cchar = *scan & ( colors - 1 );
+
+            if ( prefix < 0 )           /* root entry */
             {
-                if ( ( code = in_table( cstr ) ) >= 0 )
-                    cstr->prefix = code;
-                else
-                {
-                    addto_table( cstr, ccode );
-                    output_lzw_code( cstr->prefix, fp );
-                    cstr->prefix = cstr->cchar;
-
-                    if ( ccode >= 1 << CodeSize )
-                        CodeSize++;
-                    ccode++;
-
-                    if ( ccode >= 4096 )
-                    {
-                        output_lzw_code( cstr->prefix, fp );
-                        init_table( colors, fp );
-                        ccode = EOFCode + 1;
-                        cstr->prefix = -1;
-                    }
-                }
+                prefix = cchar;
+                continue;
             }
-            else
-            {           /* root entry */
-                cstr->prefix = cstr->code = cstr->cchar;
+
+            if ( ( code = in_table( prefix, cchar ) ) >= 0 )
+            {
+                prefix = code;
+                continue;
+            }
+
+            addto_table( prefix, cchar, ccode );
+            output_lzw_code( prefix, fp );
+            prefix = cchar;
+
+            if ( ccode >= 1 << CodeSize )
+                CodeSize++;
+            ccode++;
+
+            if ( ccode >= 4096 )
+            {
+                output_lzw_code( prefix, fp );
+                init_table( fp );
+                ccode = EOFCode + 1;
+                prefix = -1;
             }
         }
     }
 
-    output_lzw_code( cstr->prefix, fp );
+    if ( prefix >= 0 )
+        output_lzw_code( prefix, fp );
     output_lzw_code( EOFCode, fp );
     putc( 0, fp );      /* end block  */
 
@@ -1255,26 +1454,12 @@ GIF_write( FL_IMAGE * sim )
  ***************************************/
 
 static void
-init_table( int    rootlen,
-            FILE * fp )
+init_table( FILE * fp )
 {
-    int i;
-    Strtab *sp = strspace;
-
     output_lzw_code( ClearCode, fp );
 
     CodeSize = bpp + 1;
-
-    for ( i = 0; i < rootlen; i++, sp++ )
-    {
-        sp->next = 0;
-        sp->code = i;
-        sp->cchar = -1;
-        strtab[ i ] = sp;
-    }
-
-    for ( ; i < MAXTABL; i++, sp++ )
-        strtab[ i ] = sp->next = 0;
+    memset( child, 0, ( EOFCode + 1 ) * sizeof *child );
 }
 
 
@@ -22,8 +22,22 @@
  *  All rights reserved.
  *
  *  handle gzip/compress
+ *
+ *  With zlib gzip'ed files are decompressed on the fly: im->fpin gets
+ *  replaced by a stdio stream that returns the uncompressed data, so
+ *  the reader of the compressed format doesn't know the difference.
+ *  For writing, the image gets written into a temporary file first
+ *  that's compressed afterwards, since some writers (e.g. TIFF) seek
+ *  back to fill in offsets. Files from compress (and systems without
+ *  zlib) still go through external filters.
  */
 
+/* for fopencookie() */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
@@ -32,6 +46,12 @@
 #include "flimage.h"
 #include "flimage_int.h"
 
+#ifdef HAVE_ZLIB
+#include <stdio.h>
+#include <unistd.h>
+#include <zlib.h>
+#endif
+
 
 /***************************************
  ***************************************/
@@ -48,26 +68,308 @@ GZIP_identify( FILE * fp )
 }
 
 
+#ifdef HAVE_ZLIB
+
+/***************************************
+ * stdio callbacks for a gzFile
+ ***************************************/
+
+#ifdef HAVE_FOPENCOOKIE
+
+static ssize_t
+gz_read( void   * cookie,
+         char   * buf,
+         size_t   size )
+{
+    return gzread( cookie, buf, size );
+}
+
+
+static int
+gz_seek( void    * cookie,
+         off64_t * offset,
+         int       whence )
+{
+    z_off_t pos;
+
+    if ( whence == SEEK_END
+         || ( pos = gzseek( cookie, *offset, whence ) ) < 0 )
+        return -1;
+
+    *offset = pos;
+    return 0;
+}
+
+#else   /* funopen() */
+
+static int
+gz_read( void * cookie,
+         char * buf,
+         int    size )
+{
+    return gzread( cookie, buf, size );
+}
+
+
+static fpos_t
+gz_seek( void   * cookie,
+         fpos_t   offset,
+         int      whence )
+{
+    return whence == SEEK_END ? -1 : gzseek( cookie, offset, whence );
+}
+
+#endif
+
+
+static int
+gz_close( void * cookie )
+{
+    return gzclose( cookie ) == Z_OK ? 0 : -1;
+}
+
+
 /***************************************
+ * Returns a stream for reading the uncompressed data of the file fp is
+ * open for, via a duplicate of its file descriptor
+ ***************************************/
+
+static FILE *
+gz_stream( FILE * fp )
+{
+    int fd = dup( fileno( fp ) );
+    gzFile gz;
+    FILE *zfp;
+
+    if ( fd < 0 )
+        return NULL;
+
+    lseek( fd, 0, SEEK_SET );
+
+    if ( ! ( gz = gzdopen( fd, "rb" ) ) )
+    {
+        close( fd );
+        return NULL;
+    }
+
+    gzbuffer( gz, 65536 );
+
+#ifdef HAVE_FOPENCOOKIE
+    {
+        cookie_io_functions_t io;
+
+        io.read  = gz_read;
+        io.write = NULL;
+        io.seek  = gz_seek;
+        io.close = gz_close;
+        zfp = fopencookie( gz, "rb", io );
+    }
+#else
+    zfp = funopen( gz, gz_read, NULL, gz_seek, gz_close );
+#endif
+
+    if ( ! zfp )
+        gzclose( gz );
+
+    return zfp;
+}
+
+
+/***************************************
+ * Finds out what's in the compressed file and switches over to
+ * the reader for that format
  ***************************************/
 
 static int
 GZIP_description( FL_IMAGE * im )
 {
     static char *cmds[ ] = { "gzip -dc %s > %s", NULL };
+    FLIMAGE_IO *io;
+    FILE *zfp;
+    unsigned char magic[ 2 ];
 
-    return flimage_description_via_filter( im, cmds, "reading gzip ...", 0 );
+    /* Leave data from compress to the gzip program */
+
+    rewind( im->fpin );
+    if (    fread( magic, 1, 2, im->fpin ) != 2
+         || magic[ 1 ] != 0213
+         || ! ( zfp = gz_stream( im->fpin ) ) )
+        return flimage_description_via_filter( im, cmds,
+                                               "reading gzip ...", 0 );
+
+    for ( io = flimage_io; io->formal_name; io++ )
+    {
+        if (    io->read_description != GZIP_description
+             && io->read_description
+             && io->read_pixels
+             && io->identify( zfp ) > 0 )
+            break;
+        rewind( zfp );
+    }
+
+    if ( ! io->formal_name )
+    {
+        flimage_error( im, "%s: unknown format of compressed data",
+                       im->infile );
+        fclose( zfp );
+        return -1;
+    }
+
+    im->visual_cue( im, "reading gzip ..." );
+
+    fclose( im->fpin );
+    im->fpin = zfp;
+
+    if ( strcmp( im->fmt_name, "gzip" ) == 0 )
+        im->fmt_name = io->short_name;
+
+    im->image_io = io;
+    im->type = io->type;
+    im->foffset = ftell( zfp );
+
+    return io->read_description( im );
+}
+
+
+/***************************************
+ * The format for the uncompressed data is taken from the file name
+ * with the ".gz" removed, e.g., "frame.fits.gz" gets written as FITS.
+ * If there's none it's one of the PNM formats.
+ ***************************************/
+
+static FLIMAGE_IO *
+inner_format( FL_IMAGE * im )
+{
+    static char *pnm[ ] = { "ppm", "pgm", "pbm" };
+    char name[ 260 ],
+         *ext;
+    FLIMAGE_IO *io,
+               *first = NULL;
+    size_t i;
+
+    strncpy( name, im->outfile, sizeof name - 1 );
+    name[ sizeof name - 1 ] = '\0';
+    if ( ( ext = strrchr( name, '.' ) ) && ! strcasecmp( ext, ".gz" ) )
+        *ext = '\0';
+
+    if ( ( ext = strrchr( name, '.' ) ) && ! strchr( ext, '/' ) )
+        for ( ext++, io = flimage_io; io->formal_name; io++ )
+            if (    io->write_image
+                 && strcmp( io->short_name, "gzip" )
+                 && (    ! strcasecmp( io->extension, ext )
+                      || ! strcasecmp( io->short_name, ext ) ) )
+                return io;
+
+    for ( i = 0; i < sizeof pnm / sizeof *pnm; i++ )
+        for ( io = flimage_io; io->formal_name; io++ )
+            if ( ! strcmp( io->short_name, pnm[ i ] ) && io->write_image )
+            {
+                if ( im->type & io->type )
+                    return io;
+                if ( ! first )
+                    first = io;
+            }
+
+    return first;
 }
 
 
 /***************************************
+ * Compresses everything in 'from' into the file 'to' is open for
  ***************************************/
 
 static int
-GZIP_load( FL_IMAGE * im  FL_UNUSED_ARG )
+gz_copy( FILE * from,
+         FILE * to )
 {
-    fprintf( stderr, "should never been here\n" );
-    return -1;
+    char buf[ 65536 ];
+    int fd = dup( fileno( to ) );
+    gzFile gz;
+    size_t n;
+    int status = 0;
+
+    if ( fd < 0 || ! ( gz = gzdopen( fd, "wb" ) ) )
+    {
+        if ( fd >= 0 )
+            close( fd );
+        return -1;
+    }
+
+    rewind( from );
+    while ( status == 0 && ( n = fread( buf, 1, sizeof buf, from ) ) > 0 )
+        if ( gzwrite( gz, buf, n ) != ( int ) n )
+            status = -1;
+
+    if ( ferror( from ) )
+        status = -1;
+
+    if ( gzclose( gz ) != Z_OK )
+        status = -1;
+
+    return status;
+}
+
+
+/***************************************
+ ***************************************/
+
+static int
+GZIP_dump( FL_IMAGE * im )
+{
+    FLIMAGE_IO *io;
+    FL_IMAGE *frame;
+    FILE *fpout = im->fpout,
+         *tmp;
+    int status;
+
+    if ( ! ( io = inner_format( im ) ) )
+    {
+        flimage_error( im, "can't find format handler" );
+        return -1;
+    }
+
+    for ( frame = im; frame; frame = frame->next )
+        if ( flimage_convert_for_io( frame, io ) < 0 )
+        {
+            flimage_error( im, "%s: can't convert %s image for %s",
+                           im->outfile, flimage_type_name( frame->type ),
+                           io->formal_name );
+            return -1;
+        }
+
+    if ( ! ( tmp = tmpfile( ) ) )
+    {
+        flimage_error( im, "%s: can't create temporary file", im->outfile );
+        return -1;
+    }
+
+    im->fpout = tmp;
+    status = io->write_image( im );
+    im->fpout = fpout;
+
+    if ( status >= 0 && ( fflush( tmp ) != 0 || gz_copy( tmp, fpout ) < 0 ) )
+    {
+        flimage_error( im, "%s: can't write compressed data", im->outfile );
+        status = -1;
+    }
+
+    fclose( tmp );
+
+    return status;
+}
+
+#else   /* ! HAVE_ZLIB */
+
+
+/***************************************
+ ***************************************/
+
+static int
+GZIP_description( FL_IMAGE * im )
+{
+    static char *cmds[ ] = { "gzip -dc %s > %s", NULL };
+
+    return flimage_description_via_filter( im, cmds, "reading gzip ...", 0 );
 }
 
 
@@ -82,6 +384,19 @@ GZIP_dump( FL_IMAGE * im )
     return flimage_write_via_filter( im, cmds, formats, 0 );
 }
 
+#endif   /* HAVE_ZLIB */
+
+
+/***************************************
+ ***************************************/
+
+static int
+GZIP_load( FL_IMAGE * im  FL_UNUSED_ARG )
+{
+    fprintf( stderr, "should never been here\n" );
+    return -1;
+}
+
 
 /***************************************
  ***************************************/
@@ -227,6 +227,7 @@ flimage_write_via_filter( FL_IMAGE     * im,
          cmd[ 1024 ];
     char * const *shellcmd;
     FLIMAGE_IO *io;
+    FILE *fpout = im->fpout;
     int err,
         status;
 
@@ -249,6 +250,8 @@ flimage_write_via_filter( FL_IMAGE     * im,
     {
         fprintf( stderr, "can't open %s\n", tmpf );
         remove( tmpf );
+        strcpy( im->outfile, ofile );
+        im->fpout = fpout;
         return -1;
     }
 
@@ -256,6 +259,7 @@ flimage_write_via_filter( FL_IMAGE     * im,
 
     err = io->write_image( im ) < 0;
     fclose( im->fpout );
+    im->fpout = fpout;      /* closed by the caller */
     if ( verbose )
         fprintf( stderr, "Done writing %s (%s) \n",
                  im->outfile, io->short_name );
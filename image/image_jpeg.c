@@ -331,6 +331,9 @@ JPEG_read_pixels( FL_IMAGE * im )
             flimage_error( im, "%s: unknown color space", im->infile );
             err = 1;
         }
+
+        if ( ! err )
+            flimage_rows_done( im, cinfo->output_scanline - 1, 1 );
     }
 
     jpeg_finish_decompress( cinfo );
@@ -83,6 +83,20 @@ typedef unsigned char JSAMPLE;
 #define C1_SHIFT  ( BITS_IN_JSAMPLE - HIST_C1_BITS )
 #define C2_SHIFT  ( BITS_IN_JSAMPLE - HIST_C2_BITS )
 
+/* Total number of histogram cells and the index of the cell of a color
+   when the histogram is seen as a flat array */
+
+#define HIST_CELLS  ( HIST_C0_ELEMS * HIST_C1_ELEMS * HIST_C2_ELEMS )
+
+#define HIST_INDEX( c0, c1, c2 )                                        \
+    (   ( ( ( c0 ) >> C0_SHIFT ) << ( HIST_C1_BITS + HIST_C2_BITS ) )   \
+      | ( ( ( c1 ) >> C1_SHIFT ) << HIST_C2_BITS )                      \
+      | ( ( c2 ) >> C2_SHIFT ) )
+
+/* Images with fewer pixels aren't worth splitting between threads */
+
+#define PARALLEL_MIN_PIXELS  ( 1 << 16 )
+
 typedef u_short histcell;   /* histogram cell; prefer an unsigned int type */
 typedef histcell *histptr;  /* for pointers to histogram cells */
 typedef histcell hist1d[HIST_C2_ELEMS];     /* typedefs for the array */
@@ -140,13 +154,13 @@ static void prescan_quantize( SPEC *,
 static void select_colors( SPEC *,
                            int );
 
-static void pass2_fs_dither( SPEC *,
-                             unsigned char **,
-                             unsigned char **,
-                             unsigned char **,
-                             unsigned short **,
-                             int,
-                             int );
+static void pass2_dither( SPEC *,
+                          unsigned char **,
+                          unsigned char **,
+                          unsigned char **,
+                          unsigned short **,
+                          int,
+                          int );
 
 
 /***************************************
@@ -269,8 +283,7 @@ j2pass_quantize_rgb( unsigned char  ** red,
         memset( sp->histogram[ i ], 0,
                 HIST_C1_ELEMS * HIST_C2_ELEMS * sizeof( histcell ) );
 
-    sp->on_odd_row = 0;
-    pass2_fs_dither( sp, red, green, blue, ci, w, h );
+    pass2_dither( sp, red, green, blue, ci, w, h );
     *actual_color = sp->actual_number_of_colors;
     cleanup_spec( sp );
 
@@ -355,8 +368,7 @@ j2pass_quantize_packed( unsigned int   ** packed,
         memset( sp->histogram[ i ], 0,
                 HIST_C1_ELEMS * HIST_C2_ELEMS * sizeof( histcell ) );
 
-    sp->on_odd_row = 0;
-    pass2_fs_dither( sp, red, green, blue, ci, w, h );
+    pass2_dither( sp, red, green, blue, ci, w, h );
     *actual_color = sp->actual_number_of_colors;
 
     fl_free_matrix( red );
@@ -748,6 +760,48 @@ fill_inverse_cmap( SPEC * cquantize,
 }
 
 
+/* Number of update boxes along each axis and in all */
+
+#define BOX_C0_COUNT  ( HIST_C0_ELEMS >> BOX_C0_LOG )
+#define BOX_C1_COUNT  ( HIST_C1_ELEMS >> BOX_C1_LOG )
+#define BOX_C2_COUNT  ( HIST_C2_ELEMS >> BOX_C2_LOG )
+#define BOX_COUNT     ( BOX_C0_COUNT * BOX_C1_COUNT * BOX_C2_COUNT )
+
+
+/***************************************
+ * Fills the update boxes start to end - 1 (counted with c2 varying
+ * fastest). Different boxes don't share any cells, so this can be
+ * done for several ranges of boxes at once.
+ ***************************************/
+
+static void
+fill_boxes( void * data,
+            int    start,
+            int    end )
+{
+    SPEC *sp = data;
+    int i;
+
+    for ( i = start; i < end; i++ )
+        fill_inverse_cmap( sp,
+                           ( i / ( BOX_C1_COUNT * BOX_C2_COUNT ) ) << BOX_C0_LOG,
+                           ( ( i / BOX_C2_COUNT ) % BOX_C1_COUNT ) << BOX_C1_LOG,
+                           ( i % BOX_C2_COUNT ) << BOX_C2_LOG );
+}
+
+
+/***************************************
+ * Fills in the complete inverse colormap in advance instead of one
+ * update box at a time while dithering
+ ***************************************/
+
+static void
+fill_whole_inverse_cmap( SPEC * sp )
+{
+    flimage_parallel_for( sp->im, BOX_COUNT, 8, fill_boxes, sp );
+}
+
+
 #define RIGHT_SHIFT( x, shft)   ( ( x ) >> ( shft ) )
 
 
@@ -961,6 +1015,170 @@ pass2_fs_dither( SPEC            * sp,
 }
 
 
+/* 8x8 Bayer matrix for ordered dithering */
+
+static const unsigned char bayer[ 8 ][ 8 ] = {
+    {  0, 32,  8, 40,  2, 34, 10, 42 },
+    { 48, 16, 56, 24, 50, 18, 58, 26 },
+    { 12, 44,  4, 36, 14, 46,  6, 38 },
+    { 60, 28, 52, 20, 62, 30, 54, 22 },
+    {  3, 35, 11, 43,  1, 33,  9, 41 },
+    { 51, 19, 59, 27, 49, 17, 57, 25 },
+    { 15, 47,  7, 39, 13, 45,  5, 37 },
+    { 63, 31, 55, 23, 61, 29, 53, 21 }
+};
+
+typedef struct {
+    SPEC            * sp;
+    unsigned char  ** red,
+                   ** green,
+                   ** blue;
+    unsigned short ** output_buf;
+    int               width;
+    int               offset[ 8 ][ 8 ];   /* added to each component */
+} ORDERED_DITHER;
+
+
+/***************************************
+ * Ordered dithering of the rows start to end - 1. Each pixel only
+ * depends on its own value and position, so any number of bands
+ * of rows can be done at the same time. The inverse colormap must
+ * have been filled in completely.
+ ***************************************/
+
+static void
+ordered_dither_rows( void * data,
+                     int    start,
+                     int    end )
+{
+    ORDERED_DITHER *od = data;
+    hist3d histogram = od->sp->histogram;
+    unsigned char *r,
+                  *g,
+                  *b;
+    unsigned short *outptr;
+    const int *offset;
+    int row,
+        col,
+        c0,
+        c1,
+        c2;
+
+    for ( row = start; row < end; row++ )
+    {
+        r = od->red[ row ];
+        g = od->green[ row ];
+        b = od->blue[ row ];
+        outptr = od->output_buf[ row ];
+        offset = od->offset[ row & 7 ];
+
+        for ( col = 0; col < od->width; col++ )
+        {
+            c0 = r[ col ] + offset[ col & 7 ];
+            c1 = g[ col ] + offset[ col & 7 ];
+            c2 = b[ col ] + offset[ col & 7 ];
+
+            c0 = FL_PCCLAMP( c0 );
+            c1 = FL_PCCLAMP( c1 );
+            c2 = FL_PCCLAMP( c2 );
+
+            outptr[ col ] = histogram[ c0 >> C0_SHIFT ]
+                                     [ c1 >> C1_SHIFT ]
+                                     [ c2 >> C2_SHIFT ] - 1;
+        }
+    }
+}
+
+
+/***************************************
+ * This version performs ordered dithering, split between threads
+ ***************************************/
+
+static void
+pass2_ordered_dither( SPEC            * sp,
+                      unsigned char  ** red,
+                      unsigned char  ** green,
+                      unsigned char  ** blue,
+                      unsigned short ** output_buf,
+                      int               width,
+                      int               num_rows )
+{
+    ORDERED_DITHER od;
+    int spread,
+        n,
+        i,
+        j;
+
+    if ( sp->im )
+    {
+        sp->im->completed = -1;
+        sp->im->visual_cue( sp->im, "Dithering ..." );
+    }
+
+    /* The amplitude of the dither is the spacing the colors would have if
+       they were evenly distributed over the color cube */
+
+    for ( n = 1; n * n * n < sp->actual_number_of_colors; n++ )
+        /* empty */ ;
+    spread = ( MAXJSAMPLE + 1 ) / n;
+
+    for ( i = 0; i < 8; i++ )
+        for ( j = 0; j < 8; j++ )
+            od.offset[ i ][ j ] = ( ( 2 * bayer[ i ][ j ] - 63 ) * spread ) / 128;
+
+    od.sp         = sp;
+    od.red        = red;
+    od.green      = green;
+    od.blue       = blue;
+    od.output_buf = output_buf;
+    od.width      = width;
+
+    flimage_parallel_for( sp->im, num_rows, 16, ordered_dither_rows, &od );
+
+    if( sp->im )
+    {
+        sp->im->completed = sp->im->total = sp->im->h;
+        sp->im->visual_cue( sp->im, "Dithering done" );
+    }
+}
+
+
+/***************************************
+ * Maps the pixels to the selected colors, with the dithering
+ * requested in the setup. For large images the inverse colormap
+ * gets computed in advance by several threads, Floyd-Steinberg
+ * dithering would otherwise compute it piece by piece.
+ ***************************************/
+
+static void
+pass2_dither( SPEC            * sp,
+              unsigned char  ** red,
+              unsigned char  ** green,
+              unsigned char  ** blue,
+              unsigned short ** output_buf,
+              int               width,
+              int               num_rows )
+{
+    int ordered =    sp->im
+                  && sp->im->setup
+                  && sp->im->setup->dither == FLIMAGE_DITHER_ORDERED;
+
+    if (    ordered
+         || (    width * num_rows >= PARALLEL_MIN_PIXELS
+              && flimage_get_nthreads( sp->im ) > 1 ) )
+        fill_whole_inverse_cmap( sp );
+
+    if ( ordered )
+        pass2_ordered_dither( sp, red, green, blue, output_buf,
+                              width, num_rows );
+    else
+    {
+        sp->on_odd_row = 0;
+        pass2_fs_dither( sp, red, green, blue, output_buf, width, num_rows );
+    }
+}
+
+
 /***************************************
  * Shrink the min/max bounds of a box to enclose only nonzero elements,
  * and recompute its volume and population
@@ -1397,8 +1615,96 @@ select_colors( SPEC * sp,
 }
 
 
+typedef struct {
+    SPEC           * sp;
+    unsigned char ** r,
+                  ** g,
+                  ** b;
+    int              width,
+                     num_rows;
+    int              nbands;
+    unsigned int   * counts;         /* HIST_CELLS counters per band */
+} PRESCAN;
+
+
+/***************************************
+ * Counts the colors in the bands of rows start to end - 1, each band
+ * into a histogram of its own
+ ***************************************/
+
+static void
+prescan_bands( void * data,
+               int    start,
+               int    end )
+{
+    PRESCAN *ps = data;
+    unsigned int *counts;
+    unsigned char *r,
+                  *g,
+                  *b;
+    int band,
+        row,
+        row_end,
+        col;
+
+    for ( band = start; band < end; band++ )
+    {
+        counts = ps->counts + band * HIST_CELLS;
+        memset( counts, 0, HIST_CELLS * sizeof *counts );
+
+        row_end = ( band + 1 ) * ps->num_rows / ps->nbands;
+
+        for ( row = band * ps->num_rows / ps->nbands; row < row_end; row++ )
+        {
+            r = ps->r[ row ];
+            g = ps->g[ row ];
+            b = ps->b[ row ];
+
+            for ( col = 0; col < ps->width; col++ )
+                counts[ HIST_INDEX( r[ col ], g[ col ], b[ col ] ) ]++;
+        }
+    }
+}
+
+
+/***************************************
+ * Adds up the histograms of all bands for the c0 planes start to
+ * end - 1 of the histogram, saturating the cells just like a serial
+ * scan would
+ ***************************************/
+
+static void
+merge_histograms( void * data,
+                  int    start,
+                  int    end )
+{
+    PRESCAN *ps = data;
+    histptr histp;
+    unsigned int sum,
+                 *counts;
+    int c0,
+        i,
+        band;
+
+    for ( c0 = start; c0 < end; c0++ )
+    {
+        histp = ps->sp->histogram[ c0 ][ 0 ];
+        counts = ps->counts + c0 * HIST_C1_ELEMS * HIST_C2_ELEMS;
+
+        for ( i = 0; i < HIST_C1_ELEMS * HIST_C2_ELEMS; i++ )
+        {
+            for ( sum = 0, band = 0; band < ps->nbands; band++ )
+                sum += counts[ band * HIST_CELLS + i ];
+
+            histp[ i ] = sum > ( histcell ) ~ 0 ? ( histcell ) ~ 0 : sum;
+        }
+    }
+}
+
+
 /***************************************
- * get histogram
+ * get histogram. For large images each thread builds a histogram
+ * for a band of rows, which then get merged.
  ***************************************/
 
 static void
@@ -1412,6 +1718,7 @@ prescan_quantize( SPEC           * sp,
     histptr histp;
     hist3d histogram = sp->histogram;
     int row, col;
+    PRESCAN ps;
 
     if ( sp->im )
     {
@@ -1419,6 +1726,28 @@ prescan_quantize( SPEC           * sp,
         sp->im->visual_cue( sp->im, "Getting Histogram ..." );
     }
 
+    ps.nbands = FL_min( flimage_get_nthreads( sp->im ), num_rows );
+
+    if (    ps.nbands > 1
+         && width * num_rows >= PARALLEL_MIN_PIXELS
+         && ( ps.counts = fl_malloc( ps.nbands * HIST_CELLS
+                                     * sizeof *ps.counts ) ) )
+    {
+        ps.sp       = sp;
+        ps.r        = r;
+        ps.g        = g;
+        ps.b        = b;
+        ps.width    = width;
+        ps.num_rows = num_rows;
+
+        flimage_parallel_for( sp->im, ps.nbands, 1, prescan_bands, &ps );
+        flimage_parallel_for( sp->im, HIST_C0_ELEMS, 1, merge_histograms,
+                              &ps );
+
+        fl_free( ps.counts );
+        return;
+    }
+
     for ( row = 0; row < num_rows; row++ )
     {
         for ( col = width; --col >= 0; )
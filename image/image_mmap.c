@@ -0,0 +1,154 @@
+/*
+ *  This file is part of the XForms library package.
+ *
+ *  XForms is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1, or
+ *  (at your option) any later version.
+ *
+ *  XForms is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with XForms.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Memory mapping of the uncompressed pixel data of image files.
+ *
+ * If the 'use_mmap' member of the setup is set, readers may ask for the
+ * next n bytes of the input file to be mapped instead of reading them
+ * through stdio. If the on-disk layout matches the in-memory one the
+ * reader can point the rows of the image (via fl_make_matrix()) directly
+ * into the mapping, which then stays around until the image memory is
+ * released. The mapping is private and writable, so the application can
+ * change the pixels without the file being changed. But each page
+ * written to gets copied, so readers shouldn't convert data in place
+ * (e.g. swap bytes) but while copying them out of the mapping.
+ *
+ * Only a single mapping per image exists at any time. Mapping fails
+ * (and the reader has to fall back to stdio) for input that isn't a
+ * regular file, e.g. decompressed data.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "include/forms.h"
+#include "flimage.h"
+#include "flimage_int.h"
+
+#if defined HAVE_MMAP && defined HAVE_SYS_MMAN_H
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#define FLIMAGE_USE_MMAP  1
+#endif
+
+
+typedef struct {
+    void   * addr;
+    size_t   len;
+} FLIMAGE_MAP;
+
+
+/***************************************
+ * Maps the next 'len' bytes of the input file of the image and returns
+ * a pointer to them, or NULL if memory mapping isn't switched on or
+ * possible. On success the input stream is positioned after the mapped
+ * data, as if they had been read.
+ ***************************************/
+
+void *
+flimage_map_pixels( FL_IMAGE * im,
+                    size_t     len )
+{
+#ifdef FLIMAGE_USE_MMAP
+    FLIMAGE_MAP *map;
+    struct stat st;
+    long pos,
+         page;
+    size_t skip;
+    void *addr;
+    int fd;
+
+    if (    ! im->setup
+         || ! im->setup->use_mmap
+         || ! im->fpin
+         || len == 0
+         || ( fd = fileno( im->fpin ) ) < 0
+         || fstat( fd, &st ) < 0
+         || ! S_ISREG( st.st_mode )
+         || ( pos = ftell( im->fpin ) ) < 0
+         || ( off_t ) len > st.st_size - pos )
+        return NULL;
+
+    flimage_unmap_pixels( im );
+
+    if ( ( page = sysconf( _SC_PAGESIZE ) ) <= 0 )
+        page = 4096;
+
+    skip = pos % page;
+
+    if ( ( addr = mmap( NULL, len + skip, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE, fd, pos - skip ) ) == MAP_FAILED )
+        return NULL;
+
+    if ( ! ( map = fl_malloc( sizeof *map ) ) )
+    {
+        munmap( addr, len + skip );
+        return NULL;
+    }
+
+#ifdef MADV_SEQUENTIAL
+    madvise( addr, len + skip, MADV_SEQUENTIAL );
+#endif
+
+    map->addr = addr;
+    map->len = len + skip;
+    im->map_info = map;
+
+    fseek( im->fpin, pos + len, SEEK_SET );
+
+    return ( char * ) addr + skip;
+#else
+    ( void ) im;
+    ( void ) len;
+    return NULL;
+#endif
+}
+
+
+/***************************************
+ * Releases the mapping of the image (if there's one). Nothing may
+ * point into it anymore.
+ ***************************************/
+
+void
+flimage_unmap_pixels( FL_IMAGE * im )
+{
+#ifdef FLIMAGE_USE_MMAP
+    FLIMAGE_MAP *map = im->map_info;
+
+    if ( ! map )
+        return;
+
+    munmap( map->addr, map->len );
+    fl_free( map );
+#endif
+
+    im->map_info = NULL;
+}
+
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -21,7 +21,9 @@
  *  Copyright (c) 1993, 1998-2002  By T.C. Zhao
  *  All rights reserved.
  *
- *  TODO: png should be implemented in real code
+ *  PNG file IO support. With libpng images are decoded and encoded
+ *  directly, one row at a time for non-interlaced images. Without it
+ *  the netpbm filters pngtopnm and pnmtopng are used.
  */
 
 #ifdef HAVE_CONFIG_H
@@ -32,6 +34,11 @@
 #include "flimage.h"
 #include "flimage_int.h"
 
+#ifdef HAVE_LIBPNG
+#include <png.h>
+#include <setjmp.h>
+#endif
+
 
 /***************************************
  ***************************************/
@@ -48,6 +55,507 @@ PNG_identify( FILE * fp )
 }
 
 
+#ifdef HAVE_LIBPNG
+
+typedef struct {
+    png_structp   png;
+    png_infop     info;
+    int           channels;        /* samples per pixel after transforms */
+    int           depth;           /* 8 or 16 bits per sample            */
+    int           passes;          /* more than 1 for interlaced images  */
+    FL_IMAGE    * image;
+} SPEC;
+
+
+/***************************************
+ ***************************************/
+
+static void
+png_error_handler( png_structp  png,
+                   png_const_charp msg )
+{
+    SPEC *sp = png_get_error_ptr( png );
+
+    flimage_error( sp->image, "%s: %s", sp->image->infile ?
+                   sp->image->infile : "PNG", msg );
+    longjmp( png_jmpbuf( png ), 1 );
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+png_warning_handler( png_structp     png  FL_UNUSED_ARG,
+                     png_const_charp msg  FL_UNUSED_ARG )
+{
+}
+
+
+/***************************************
+ * Gets rid of the libpng structures, called on all paths by which
+ * reading ends and by flimage_read() if it gives up after the
+ * description has been read
+ ***************************************/
+
+static void
+PNG_cleanup( FL_IMAGE * im )
+{
+    SPEC *sp = im->io_spec;
+
+    if ( sp && sp->png )
+        png_destroy_read_struct( &sp->png, &sp->info, NULL );
+
+    im->cleanup = NULL;
+}
+
+
+/***************************************
+ ***************************************/
+
+static int
+PNG_description( FL_IMAGE * im )
+{
+    SPEC *sp = fl_calloc( 1, sizeof *sp );
+    png_uint_32 w,
+                h;
+    int depth,
+        color_type,
+        interlace;
+    png_textp text;
+    int ntext,
+        i;
+
+    if ( ! sp )
+    {
+        flimage_error( im, "PNG: malloc() failed" );
+        return -1;
+    }
+
+    sp->image = im;
+    im->io_spec = sp;
+    im->cleanup = PNG_cleanup;
+
+    if (    ! ( sp->png = png_create_read_struct( PNG_LIBPNG_VER_STRING, sp,
+                                                  png_error_handler,
+                                                  png_warning_handler ) )
+         || ! ( sp->info = png_create_info_struct( sp->png ) ) )
+    {
+        flimage_error( im, "PNG: can't initialize libpng" );
+        PNG_cleanup( im );
+        return -1;
+    }
+
+    if ( setjmp( png_jmpbuf( sp->png ) ) )
+    {
+        PNG_cleanup( im );
+        return -1;
+    }
+
+    /* The signature has already been read by PNG_identify() */
+
+    png_init_io( sp->png, im->fpin );
+    png_set_sig_bytes( sp->png, 8 );
+    png_read_info( sp->png, sp->info );
+    png_get_IHDR( sp->png, sp->info, &w, &h, &depth, &color_type,
+                  &interlace, NULL, NULL );
+
+    im->w = w;
+    im->h = h;
+
+    /* Everything is turned into 8 bit samples except for 16 bit gray
+       scale images, palette indices become one byte per pixel */
+
+    if ( depth < 8 )
+        png_set_packing( sp->png );
+
+    switch ( color_type )
+    {
+        case PNG_COLOR_TYPE_PALETTE :
+        {
+            png_colorp palette;
+            int npal;
+
+            im->type = depth == 1 ? FL_IMAGE_MONO : FL_IMAGE_CI;
+            png_get_PLTE( sp->png, sp->info, &palette, &npal );
+            im->map_len = FL_max( npal, 2 );
+            break;
+        }
+
+        case PNG_COLOR_TYPE_GRAY :
+        case PNG_COLOR_TYPE_GRAY_ALPHA :
+            if ( depth < 8 )
+                png_set_expand_gray_1_2_4_to_8( sp->png );
+            if ( color_type == PNG_COLOR_TYPE_GRAY_ALPHA )
+                png_set_strip_alpha( sp->png );
+            im->type = depth == 16 ? FL_IMAGE_GRAY16 : FL_IMAGE_GRAY;
+            im->gray_maxval = depth == 16 ? 65535 : 255;
+            break;
+
+        default :
+            if ( depth == 16 )
+                png_set_strip_16( sp->png );
+            if ( png_get_valid( sp->png, sp->info, PNG_INFO_tRNS ) )
+                png_set_tRNS_to_alpha( sp->png );
+            im->type = FL_IMAGE_RGB;
+            break;
+    }
+
+    sp->passes = png_set_interlace_handling( sp->png );
+    png_read_update_info( sp->png, sp->info );
+
+    sp->channels = png_get_channels( sp->png, sp->info );
+    sp->depth = png_get_bit_depth( sp->png, sp->info );
+
+    if ( png_get_text( sp->png, sp->info, &text, &ntext ) > 0 )
+        for ( i = 0; i < ntext; i++ )
+            if ( ! strcmp( text[ i ].key, "Comment" ) && text[ i ].text )
+                flimage_add_comments( im, text[ i ].text,
+                                      strlen( text[ i ].text ) );
+
+    im->original_type = im->type;
+    return 0;
+}
+
+
+/***************************************
+ * Copies a decoded row into the image
+ ***************************************/
+
+static void
+store_row( FL_IMAGE            * im,
+           SPEC                * sp,
+           const unsigned char * buf,
+           int                   row )
+{
+    int i;
+
+    if ( im->type == FL_IMAGE_RGB )
+    {
+        unsigned char *r = im->red[ row ],
+                      *g = im->green[ row ],
+                      *b = im->blue[ row ],
+                      *a = im->alpha ? im->alpha[ row ] : NULL;
+
+        if ( sp->channels == 4 )
+            for ( i = 0; i < im->w; i++, buf += 4 )
+            {
+                r[ i ] = buf[ 0 ];
+                g[ i ] = buf[ 1 ];
+                b[ i ] = buf[ 2 ];
+                if ( a )
+                    a[ i ] = buf[ 3 ];
+            }
+        else
+            for ( i = 0; i < im->w; i++, buf += 3 )
+            {
+                r[ i ] = buf[ 0 ];
+                g[ i ] = buf[ 1 ];
+                b[ i ] = buf[ 2 ];
+            }
+    }
+    else if ( im->type == FL_IMAGE_GRAY16 )
+    {
+        unsigned short *gray = im->gray[ row ];
+
+        for ( i = 0; i < im->w; i++, buf += 2 )
+            gray[ i ] = ( buf[ 0 ] << 8 ) | buf[ 1 ];
+    }
+    else
+    {
+        unsigned short *p = FL_IsCI( im->type ) ? im->ci[ row ]
+                                                : im->gray[ row ];
+
+        for ( i = 0; i < im->w; i++ )
+            p[ i ] = buf[ i ];
+    }
+}
+
+
+/***************************************
+ ***************************************/
+
+static int
+PNG_read_pixels( FL_IMAGE * im )
+{
+    SPEC *sp = im->io_spec;
+    size_t rowbytes = png_get_rowbytes( sp->png, sp->info );
+    unsigned char *volatile buf = NULL;
+    png_bytep *volatile rows = NULL;
+    int i;
+
+    im->completed = 0;
+
+    if ( setjmp( png_jmpbuf( sp->png ) ) )
+    {
+        PNG_cleanup( im );
+        fli_safe_free( buf );
+        fli_safe_free( rows );
+
+        /* keep what we've got */
+
+        return im->completed > im->h / 3 ? 1 : -1;
+    }
+
+    if ( FL_IsCI( im->type ) )
+    {
+        png_colorp palette;
+        png_bytep trans;
+        int npal = 0,
+            ntrans = 0;
+
+        png_get_PLTE( sp->png, sp->info, &palette, &npal );
+        for ( i = 0; i < npal && i < im->map_len; i++ )
+        {
+            im->red_lut[   i ] = palette[ i ].red;
+            im->green_lut[ i ] = palette[ i ].green;
+            im->blue_lut[  i ] = palette[ i ].blue;
+        }
+
+        if (    png_get_tRNS( sp->png, sp->info, &trans, &ntrans, NULL )
+             && trans )
+            for ( i = 0; i < ntrans; i++ )
+                if ( trans[ i ] == 0 )
+                {
+                    im->tran_index = i;
+                    break;
+                }
+    }
+
+    if ( sp->passes == 1 )
+    {
+        /* Decode and store one row at a time */
+
+        if ( ! ( buf = fl_malloc( rowbytes ) ) )
+            png_error( sp->png, "malloc() failed" );
+
+        for ( i = 0; i < im->h; i++ )
+        {
+            png_read_row( sp->png, buf, NULL );
+            store_row( im, sp, buf, i );
+            flimage_rows_done( im, i, 1 );
+
+            im->completed = i + 1;
+            if ( ! ( im->completed & FLIMAGE_REPFREQ ) )
+                im->visual_cue( im, "Reading PNG" );
+        }
+    }
+    else
+    {
+        /* Interlaced images need all rows for each pass */
+
+        if (    ! ( buf = fl_malloc( rowbytes * im->h ) )
+             || ! ( rows = fl_malloc( im->h * sizeof *rows ) ) )
+            png_error( sp->png, "malloc() failed" );
+
+        for ( i = 0; i < im->h; i++ )
+            rows[ i ] = buf + i * rowbytes;
+
+        /* For progressive display read one pass after the other, with
+           the pixels of a pass replicated to the rows and columns not
+           read yet, and show what we have after each pass */
+
+        if ( flimage_is_progressive( im ) )
+        {
+            int pass;
+
+            memset( buf, 0, rowbytes * im->h );
+
+            for ( pass = 0; pass < sp->passes; pass++ )
+            {
+                png_read_rows( sp->png, NULL, rows, im->h );
+
+                for ( i = 0; i < im->h; i++ )
+                    store_row( im, sp, rows[ i ], i );
+                flimage_rows_done( im, 0, im->h );
+            }
+        }
+        else
+        {
+            png_read_image( sp->png, rows );
+
+            for ( i = 0; i < im->h; i++ )
+                store_row( im, sp, rows[ i ], i );
+        }
+
+        im->completed = im->h;
+    }
+
+    png_read_end( sp->png, NULL );
+    PNG_cleanup( im );
+    fli_safe_free( buf );
+    fli_safe_free( rows );
+
+    return 0;
+}
+
+
+/***************************************
+ ***************************************/
+
+static int
+PNG_dump( FL_IMAGE * im )
+{
+    SPEC spec;
+    unsigned char *volatile buf = NULL;
+    volatile int color_type,
+                 depth = 8,
+                 channels = 1;
+    int i,
+        j;
+
+    memset( &spec, 0, sizeof spec );
+    spec.image = im;
+
+    if ( im->type == FL_IMAGE_RGB )
+    {
+        color_type = PNG_COLOR_TYPE_RGB;
+        channels = 3;
+    }
+    else if ( FL_IsCI( im->type ) )
+        color_type = PNG_COLOR_TYPE_PALETTE;
+    else
+    {
+        color_type = PNG_COLOR_TYPE_GRAY;
+        if ( im->type == FL_IMAGE_GRAY16 )
+        {
+            depth = 16;
+            channels = 2;
+        }
+    }
+
+    if (    ! ( spec.png = png_create_write_struct( PNG_LIBPNG_VER_STRING,
+                                                    &spec, png_error_handler,
+                                                    png_warning_handler ) )
+         || ! ( spec.info = png_create_info_struct( spec.png ) ) )
+    {
+        flimage_error( im, "PNG: can't initialize libpng" );
+        png_destroy_write_struct( &spec.png, NULL );
+        return -1;
+    }
+
+    if ( setjmp( png_jmpbuf( spec.png ) ) )
+    {
+        png_destroy_write_struct( &spec.png, &spec.info );
+        fli_safe_free( buf );
+        return -1;
+    }
+
+    png_init_io( spec.png, im->fpout );
+
+    png_set_IHDR( spec.png, spec.info, im->w, im->h, depth, color_type,
+                  PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+                  PNG_FILTER_TYPE_DEFAULT );
+
+    if ( color_type == PNG_COLOR_TYPE_PALETTE )
+    {
+        png_color palette[ 256 ];
+        int n = FL_min( im->map_len, 256 );
+
+        for ( i = 0; i < n; i++ )
+        {
+            palette[ i ].red   = im->red_lut[   i ];
+            palette[ i ].green = im->green_lut[ i ];
+            palette[ i ].blue  = im->blue_lut[  i ];
+        }
+
+        png_set_PLTE( spec.png, spec.info, palette, n );
+
+        if ( im->tran_index >= 0 && im->tran_index < n )
+        {
+            png_byte trans[ 256 ];
+
+            memset( trans, 255, sizeof trans );
+            trans[ im->tran_index ] = 0;
+            png_set_tRNS( spec.png, spec.info, trans, im->tran_index + 1,
+                          NULL );
+        }
+    }
+
+    if ( im->comments && im->comments_len > 0 )
+    {
+        png_text text;
+
+        memset( &text, 0, sizeof text );
+        text.compression = PNG_TEXT_COMPRESSION_NONE;
+        text.key = ( png_charp ) "Comment";
+        text.text = im->comments;
+        text.text_length = strlen( im->comments );
+        png_set_text( spec.png, spec.info, &text, 1 );
+    }
+
+    png_write_info( spec.png, spec.info );
+
+    if ( ! ( buf = fl_malloc( ( size_t ) im->w * channels ) ) )
+        png_error( spec.png, "malloc() failed" );
+
+    for ( j = 0; j < im->h; j++ )
+    {
+        unsigned char *p = buf;
+
+        if ( im->type == FL_IMAGE_RGB )
+            for ( i = 0; i < im->w; i++ )
+            {
+                *p++ = im->red[   j ][ i ];
+                *p++ = im->green[ j ][ i ];
+                *p++ = im->blue[  j ][ i ];
+            }
+        else if ( FL_IsCI( im->type ) )
+            for ( i = 0; i < im->w; i++ )
+                *p++ = im->ci[ j ][ i ];
+        else if ( depth == 16 )
+        {
+            unsigned int maxval = FL_max( im->gray_maxval, 1 ),
+                         v;
+
+            for ( i = 0; i < im->w; i++ )
+            {
+                v = ( im->gray[ j ][ i ] * 65535U + maxval / 2 ) / maxval;
+                v = FL_min( v, 65535U );
+                *p++ = v >> 8;
+                *p++ = v & 0xff;
+            }
+        }
+        else
+            for ( i = 0; i < im->w; i++ )
+                *p++ = im->gray[ j ][ i ];
+
+        png_write_row( spec.png, buf );
+
+        if ( ! ( j & FLIMAGE_REPFREQ ) )
+        {
+            im->completed = j;
+            im->visual_cue( im, "Writing PNG" );
+        }
+    }
+
+    png_write_end( spec.png, spec.info );
+    png_destroy_write_struct( &spec.png, &spec.info );
+    fl_free( buf );
+    fflush( im->fpout );
+
+    return 1;
+}
+
+
+/***************************************
+ ***************************************/
+
+void
+flimage_enable_png( void )
+{
+    flimage_add_format( "Portable Network Graphics", "png", "png",
+                        FL_IMAGE_RGB | FL_IMAGE_GRAY | FL_IMAGE_GRAY16
+                        | FL_IMAGE_CI | FL_IMAGE_MONO,
+                        PNG_identify,
+                        PNG_description,
+                        PNG_read_pixels,
+                        PNG_dump );
+}
+
+#else   /* ! HAVE_LIBPNG */
+
+
 /***************************************
  ***************************************/
 
@@ -101,6 +609,8 @@ flimage_enable_png( void )
                         PNG_dump);
 }
 
+#endif   /* HAVE_LIBPNG */
+
 
 /*
  * Local variables:
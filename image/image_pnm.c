@@ -33,6 +33,7 @@
 #include "flimage_int.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <ctype.h>
 
 typedef struct
@@ -153,7 +154,7 @@ PNM_description( FL_IMAGE * im )
     else
         sp->maxval = 1;
 
-    if ( sp->maxval > 255 && sp->raw )
+    if ( sp->maxval > 255 && sp->raw && ! sp->pgm )
     {
         im->error_message( im, "can't handle 2byte raw ppm file" );
         return -1;
@@ -162,7 +163,7 @@ PNM_description( FL_IMAGE * im )
     im->type = FL_IMAGE_RGB;
 
     if ( sp->pgm )
-        im->type = sp->maxval > 256 ? FL_IMAGE_GRAY16 : FL_IMAGE_GRAY;
+        im->type = sp->maxval > 255 ? FL_IMAGE_GRAY16 : FL_IMAGE_GRAY;
 
     if (sp->pbm)
         im->type = FL_IMAGE_MONO;
@@ -177,6 +178,97 @@ PNM_description( FL_IMAGE * im )
 }
 
 
+/***************************************
+ ***************************************/
+
+static int
+is_little_endian( void )
+{
+    unsigned short one = 1;
+
+    return * ( unsigned char * ) &one;
+}
+
+
+/***************************************
+ * Gets the pixels of a raw file from the memory mapped file instead of
+ * reading them. Only 16-bit graymaps on big-endian machines can use
+ * the mapped data unchanged as the image's pixels. Everything else gets
+ * converted while being copied out of the mapping, which is never
+ * written to (that would make the system copy each page touched).
+ * Returns 0 if the file couldn't be mapped and must be read the normal
+ * way.
+ ***************************************/
+
+static int
+read_mapped_pixels( FL_IMAGE * im )
+{
+    size_t i,
+           npix = ( size_t ) im->w * im->h;
+    unsigned char *p;
+
+    if ( im->type == FL_IMAGE_RGB )
+    {
+        unsigned char *r = im->red[   0 ];
+        unsigned char *g = im->green[ 0 ];
+        unsigned char *b = im->blue[  0 ];
+
+        if ( ! ( p = flimage_map_pixels( im, 3 * npix ) ) )
+            return 0;
+
+        for ( i = 0; i < npix; i++, p += 3 )
+        {
+            r[ i ] = p[ 0 ];
+            g[ i ] = p[ 1 ];
+            b[ i ] = p[ 2 ];
+        }
+    }
+    else if ( im->type == FL_IMAGE_GRAY )
+    {
+        unsigned short *gray = im->gray[ 0 ];
+
+        if ( ! ( p = flimage_map_pixels( im, npix ) ) )
+            return 0;
+
+        for ( i = 0; i < npix; i++ )
+            gray[ i ] = p[ i ];
+    }
+    else if ( im->type == FL_IMAGE_GRAY16 )
+    {
+        unsigned short **gray;
+
+        if ( ! ( p = flimage_map_pixels( im, 2 * npix ) ) )
+            return 0;
+
+        /* Use the mapped data if they're in the machine's byte order
+           and properly aligned */
+
+        if ( is_little_endian( ) )
+        {
+            unsigned short *gray0 = im->gray[ 0 ];
+
+            for ( i = 0; i < npix; i++, p += 2 )
+                gray0[ i ] = ( p[ 0 ] << 8 ) | p[ 1 ];
+        }
+        else if (    ! ( ( unsigned long ) p & ( sizeof **gray - 1 ) )
+                  && ( gray = fl_make_matrix( im->h, im->w, sizeof **gray,
+                                              p ) ) )
+        {
+            fl_free_matrix( im->gray );
+            im->gray = gray;
+            return 1;
+        }
+        else
+            memcpy( im->gray[ 0 ], p, 2 * npix );
+    }
+    else
+        return 0;
+
+    flimage_unmap_pixels( im );
+    return 1;
+}
+
+
 /***************************************
  ***************************************/
 
@@ -184,9 +276,17 @@ static int
 PNM_read_pixels( FL_IMAGE * im )
 {
     int i,
+        x,
+        y,
         npix = im->w * im->h;
     SPEC *sp = im->io_spec;
 
+    if ( sp->raw && read_mapped_pixels( im ) )
+    {
+        flimage_rows_done( im, 0, im->h );
+        return 1;
+    }
+
     if ( im->type == FL_IMAGE_RGB )
     {
         unsigned char *r = im->red[   0 ];
@@ -195,11 +295,16 @@ PNM_read_pixels( FL_IMAGE * im )
 
         if ( sp->raw )
         {
-            for ( i = 0; i < npix; i++ )
+            for ( y = 0; y < im->h; y++ )
             {
-                *r++ = getc( im->fpin );
-                *g++ = getc( im->fpin );
-                *b++ = getc( im->fpin );
+                for ( x = 0; x < im->w; x++ )
+                {
+                    *r++ = getc( im->fpin );
+                    *g++ = getc( im->fpin );
+                    *b++ = getc( im->fpin );
+                }
+
+                flimage_rows_done( im, y, 1 );
             }
         }
         else
@@ -233,9 +338,20 @@ PNM_read_pixels( FL_IMAGE * im )
     {
         unsigned short *gray = im->gray[0];
 
-        if ( sp->raw )
-            for ( i = 0; i < npix; i++ )
-                gray[ i ] = getc( im->fpin );
+        if ( sp->raw && im->type == FL_IMAGE_GRAY16 )
+            for ( y = 0; y < im->h; y++ )
+            {
+                for ( x = 0; x < im->w; x++ )
+                    *gray++ = fli_fget2MSBF( im->fpin );
+                flimage_rows_done( im, y, 1 );
+            }
+        else if ( sp->raw )
+            for ( y = 0; y < im->h; y++ )
+            {
+                for ( x = 0; x < im->w; x++ )
+                    *gray++ = getc( im->fpin );
+                flimage_rows_done( im, y, 1 );
+            }
         else
             for ( i = 0; i < npix; i++ )
                 gray[ i ] = fli_readpint( im->fpin );
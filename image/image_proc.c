@@ -151,7 +151,8 @@ flimage_tint( FL_IMAGE     * im,
 
 
 /* get a subimage of the image. if parameter make is true,
-   we fake a matrix so processing is done in place
+   we fake a matrix so processing is done in place (the pixels first
+   get detached from other images sharing them)
  */
 
 #define MAX_RETBUF  6       /* hack to be limited re-entrent */
@@ -165,6 +166,12 @@ flimage_get_subimage( FL_IMAGE * im,
     SubImage *sub = subimage + buf;
     void * ( * submat )( void *, int, int, int, int, int, int, unsigned int );
 
+    if ( make && flimage_detach( im, im->type ) < 0 )
+    {
+        im->error_message( im, "Failed to get working memory" );
+        return NULL;
+    }
+
     submat = make ? make_submatrix : get_submatrix;
     im->subx = FL_clamp( im->subx, 0, im->w - 1 );
     im->suby = FL_clamp( im->suby, 0, im->h - 1 );
@@ -265,8 +272,7 @@ make_submatrix( void         * in,
         return 0;
     }
 
-    if (    mat[ -1 ] != ( char * ) FL_GET_MATRIX
-         && mat[ -1 ] != ( char * ) FL_MAKE_MATRIX )
+    if ( ! flimage_is_matrix( mat ) )
     {
         M_err( "make_submatrix", "input is not a matrix" );
         return NULL;
@@ -281,7 +287,9 @@ make_submatrix( void         * in,
 }
 
 
-/* grab a piece of a matrix */
+/* grab a piece of a matrix. It shares the memory with the matrix until
+   one of them gets detached for writing (only matrices that can't be
+   shared get copied right away) */
 
 static void *
 get_submatrix( void         * in,
@@ -305,14 +313,18 @@ get_submatrix( void         * in,
         return 0;
     }
 
-    if (    mat[ -1 ] != ( char * ) FL_GET_MATRIX
-         && mat[ -1 ] != ( char * ) FL_MAKE_MATRIX )
+    if ( ! flimage_is_matrix( mat ) )
     {
         M_err( "get_submatrix", "input is not a matrix" );
         return NULL;
     }
 
-    subm = fl_get_matrix( rows, cols, esize );
+    if ( ( subm = flimage_view_matrix( mat, r1, c1, rs, esize ) ) )
+        return subm;
+
+    if ( ! ( subm = fl_get_matrix( rs, cs, esize ) ) )
+        return NULL;
+
     for ( i = 0; i < rs; i++ )
         memcpy( subm[ i ], mat[ r1 + i ] + offset, size );
 
@@ -321,17 +333,229 @@ get_submatrix( void         * in,
 
 
 /***********************************************************************
- * Histogram equalization
+ * Histograms. The image is split into bands of rows which are counted
+ * by the worker threads, each into histograms of its own, that get
+ * added up at the end. Scattered increments can't be vectorized, but
+ * for small histograms the counts of neighbouring pixels go into
+ * different copies, which keeps the increments of runs of equal values
+ * from having to wait for each other.
  ***********************************************************************/
 
+#define PARALLEL_MIN_PIXELS  ( 1 << 16 )
+#define HIST_MAX_COPIES      4
+#define HIST_MAX_COPY_BINS   4096
+
+typedef struct {
+    FL_IMAGE      * im;
+    int             band_rows;
+    int             nbins;          /* bins per histogram            */
+    int             ncopies;        /* copies per band               */
+    size_t          band_size;      /* counts per band               */
+    unsigned int  * counts;
+    unsigned char * gray;           /* a row of gray values per band */
+} HIST_JOB;
+
+
+/***************************************
+ * Counts a row of values, the ones larger than nbins - 1 go into the
+ * last bin
+ ***************************************/
+
+static void
+count_row( unsigned int         * hist,
+           int                    ncopies,
+           int                    nbins,
+           const unsigned short * p,
+           int                    n )
+{
+    unsigned int *h0 = hist,
+                 *h1 = h0 + nbins,
+                 *h2 = h1 + nbins,
+                 *h3 = h2 + nbins;
+    unsigned int maxval = nbins - 1;
+    int i = 0;
+
+    if ( ncopies == 4 )
+        for ( ; i + 4 <= n; i += 4 )
+        {
+            h0[ FL_min( p[ i     ], maxval ) ]++;
+            h1[ FL_min( p[ i + 1 ], maxval ) ]++;
+            h2[ FL_min( p[ i + 2 ], maxval ) ]++;
+            h3[ FL_min( p[ i + 3 ], maxval ) ]++;
+        }
+
+    for ( ; i < n; i++ )
+        h0[ FL_min( p[ i ], maxval ) ]++;
+}
+
+
+/***************************************
+ * Counts a row of an RGB image into the red, green, blue and gray
+ * histograms. The gray values get computed for the whole row first,
+ * which the compiler can vectorize.
+ ***************************************/
+
+static void
+count_rgb_row( unsigned int        * hist,
+               const FL_PCTYPE     * r,
+               const FL_PCTYPE     * g,
+               const FL_PCTYPE     * b,
+               unsigned char       * gray,
+               int                   n )
+{
+    unsigned int *rh = hist,
+                 *gh = rh + FL_PCMAX + 1,
+                 *bh = gh + FL_PCMAX + 1,
+                 *yh = bh + FL_PCMAX + 1;
+    int i;
+
+    for ( i = 0; i < n; i++ )
+        gray[ i ] = FL_RGB2GRAY( r[ i ], g[ i ], b[ i ] );
+
+    for ( i = 0; i < n; i++ )
+    {
+        rh[ r[ i ] ]++;
+        gh[ g[ i ] ]++;
+        bh[ b[ i ] ]++;
+        yh[ gray[ i ] ]++;
+    }
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+count_bands( void * data,
+             int    start,
+             int    end )
+{
+    HIST_JOB *hj = data;
+    FL_IMAGE *im = hj->im;
+    unsigned int *hist;
+    int band,
+        row,
+        last;
+
+    for ( band = start; band < end; band++ )
+    {
+        hist = hj->counts + band * hj->band_size;
+        row = band * hj->band_rows;
+        last = FL_min( im->h, row + hj->band_rows );
+
+        for ( ; row < last; row++ )
+            if ( im->type == FL_IMAGE_RGB )
+                count_rgb_row( hist, im->red[ row ], im->green[ row ],
+                               im->blue[ row ], hj->gray + band * im->w,
+                               im->w );
+            else
+                count_row( hist, hj->ncopies, hj->nbins,
+                           FL_IsCI( im->type ) ? im->ci[ row ]
+                                               : im->gray[ row ],
+                           im->w );
+    }
+}
+
+
+/***************************************
+ * Counts the pixels of a gray, color index or RGB image. For RGB images
+ * 'hist' receives four histograms of FL_PCMAX + 1 bins each, for red,
+ * green, blue and the gray value of the pixels ('nbins' is ignored).
+ * Otherwise it's a single one of 'nbins' bins for the gray values or
+ * colormap indices, where larger values get counted in the last bin.
+ * Counts saturate instead of overflowing.
+ ***************************************/
+
+int
+flimage_count_pixels( FL_IMAGE     * im,
+                      unsigned int * hist,
+                      int            nbins )
+{
+    HIST_JOB hj;
+    unsigned long sum;
+    size_t i,
+           nhist;
+    int nbands,
+        k;
+
+    if ( im->type == FL_IMAGE_RGB )
+    {
+        nbins = FL_PCMAX + 1;
+        nhist = 4;
+        hj.ncopies = 1;
+    }
+    else if ( FL_IsGray( im->type ) || FL_IsCI( im->type ) )
+    {
+        nhist = 1;
+        hj.ncopies = nbins <= HIST_MAX_COPY_BINS ? HIST_MAX_COPIES : 1;
+    }
+    else
+        return -1;
+
+    if ( nbins <= 0 || im->w <= 0 || im->h <= 0 )
+        return -1;
+
+    nbands = 1;
+    if ( im->w * im->h >= PARALLEL_MIN_PIXELS )
+        nbands = FL_min( flimage_get_nthreads( im ), im->h );
+
+    hj.im        = im;
+    hj.nbins     = nbins;
+    hj.band_rows = ( im->h + nbands - 1 ) / nbands;
+    hj.band_size = nhist * hj.ncopies * nbins;
+    hj.gray      = NULL;
+
+    if (    ! ( hj.counts = fl_calloc( nbands * hj.band_size,
+                                       sizeof *hj.counts ) )
+         || (    im->type == FL_IMAGE_RGB
+              && ! ( hj.gray = fl_malloc( nbands * im->w ) ) ) )
+    {
+        fli_safe_free( hj.counts );
+        flimage_error( im, "histogram: can't get memory" );
+        return -1;
+    }
+
+    flimage_parallel_for( im, nbands, 1, count_bands, &hj );
+
+    /* add up the copies of all bands */
+
+    for ( i = 0; i < nhist * nbins; i++ )
+    {
+        for ( sum = 0, k = 0; k < nbands * hj.ncopies; k++ )
+            sum += hj.counts[ k * nhist * nbins + i ];
+
+        hist[ i ] = sum > ~ 0U ? ~ 0U : sum;
+    }
+
+    fl_free( hj.counts );
+    fli_safe_free( hj.gray );
+
+    return 0;
+}
+
+
+/***************************************
+ * Adds to a histogram bin without overflowing
+ ***************************************/
+
+#define HIST_ADD( h, n )  do {                                  \
+                              unsigned int t_ = ( h ) + ( n );  \
+                              ( h ) = t_ < ( n ) ? ~ 0U : t_;   \
+                          } while ( 0 )
+
+
+/***************************************
+ * Fills im->hist with the histograms of red, green, blue and gray
+ * values. For color index images the colormap indices are counted
+ * and the counts then distributed via the colormap.
+ ***************************************/
+
 static int
-get_histogram(FL_IMAGE * im)
+get_histogram( FL_IMAGE * im )
 {
-    unsigned int *rhist,
-                 *ghist,
-                 *bhist,
-                 *grhist;
     unsigned int size = ( FL_PCMAX + 3 ) * sizeof **im->hist;
+    unsigned int *counts;
+    int i;
 
     if ( ! im->hist[ 0 ] )
     {
@@ -341,60 +565,50 @@ get_histogram(FL_IMAGE * im)
         im->hist[ 3 ] = fl_malloc( size );
     }
 
-    memset( rhist  = im->hist[ 0 ], 0, size );
-    memset( ghist  = im->hist[ 1 ], 0, size );
-    memset( bhist  = im->hist[ 2 ], 0, size );
-    memset( grhist = im->hist[ 3 ], 0, size );
+    for ( i = 0; i < 4; i++ )
+        memset( im->hist[ i ], 0, size );
 
     if ( im->type == FL_IMAGE_RGB )
     {
-        int g,
-            n;
+        unsigned int rgb[ 4 * ( FL_PCMAX + 1 ) ];
 
-        for ( n = im->w * im->h; --n >= 0; )
-        {
-            if ( ++rhist[ im->red[ 0 ][ n ] ] == 0 )
-                rhist[ im->red[ 0 ][ n ] ]--;
-            if ( ++ghist[ im->green[ 0 ][ n ] ] == 0 )
-                ghist[ im->green[ 0 ][ n ] ]--;
-            if ( ++bhist[ im->blue[ 0 ][ n ] ] == 0 )
-                bhist[ im->blue[ 0 ][ n ] ]--;
-            g = FL_RGB2GRAY( im->red[ 0 ][ n ],
-                             im->green[ 0 ][ n ],
-                             im->blue[ 0 ][ n ] );
-            if ( ++grhist[ g ] == 0 )
-                grhist[ g ]--;
-        }
+        if ( flimage_count_pixels( im, rgb, 0 ) < 0 )
+            return -1;
+
+        for ( i = 0; i < 4; i++ )
+            memcpy( im->hist[ i ], rgb + i * ( FL_PCMAX + 1 ),
+                    ( FL_PCMAX + 1 ) * sizeof *rgb );
     }
     else if ( im->type == FL_IMAGE_GRAY )
+        return flimage_count_pixels( im, im->hist[ 3 ], FL_PCMAX + 1 );
+    else if ( im->type == FL_IMAGE_CI )
     {
-        int n;
+        int r,
+            g,
+            b;
 
-        for ( n = im->w * im->h; --n >= 0; )
+        if ( ! ( counts = fl_malloc( im->map_len * sizeof *counts ) ) )
+            return -1;
+
+        if ( flimage_count_pixels( im, counts, im->map_len ) < 0 )
         {
-            if ( ++grhist[ im->gray[ 0 ][ n ] ] == 0 )
-                grhist[ im->gray[ 0 ][ n ] ]--;
+            fl_free( counts );
+            return -1;
         }
-    }
-    else if ( im->type == FL_IMAGE_CI )
-    {
-        unsigned short *ci = im->ci[ 0 ];
-        int g;
 
-        for ( ci = im->ci[ 0 ] + im->w * im->h; --ci >= im->ci[ 0 ]; )
+        for ( i = 0; i < im->map_len; i++ )
         {
-            if ( ++rhist[ im->red_lut[ *ci ] ] )
-                rhist[ im->red_lut[ *ci ] ]--;
-            if ( ++ghist[ im->green_lut[ *ci ] ] )
-                ghist[ im->green_lut[ *ci ] ]--;
-            if ( ++bhist[ im->blue_lut[ *ci ] ] )
-                bhist[ im->blue_lut[ *ci ] ]--;
-            g = FL_RGB2GRAY( im->red_lut[   *ci ],
-                             im->green_lut[ *ci ],
-                             im->blue_lut[  *ci ] );
-            if ( ++grhist[ g ] == 0 )
-                grhist[ g ]--;
+            r = im->red_lut[ i ];
+            g = im->green_lut[ i ];
+            b = im->blue_lut[ i ];
+
+            HIST_ADD( im->hist[ 0 ][ r ], counts[ i ] );
+            HIST_ADD( im->hist[ 1 ][ g ], counts[ i ] );
+            HIST_ADD( im->hist[ 2 ][ b ], counts[ i ] );
+            HIST_ADD( im->hist[ 3 ][ FL_RGB2GRAY( r, g, b ) ], counts[ i ] );
         }
+
+        fl_free( counts );
     }
     else
     {
@@ -406,47 +620,243 @@ get_histogram(FL_IMAGE * im)
 }
 
 
+/***********************************************************************
+ * Table lookups on all pixels, done in bands of rows by the worker
+ * threads
+ ***********************************************************************/
+
+typedef struct {
+    FL_IMAGE             * im;
+    const void           * lut;
+    unsigned short      ** in,
+                        ** out;
+} LUT_JOB;
+
+
+/***************************************
+ ***************************************/
+
+static void
+lut16_rows( void * data,
+            int    start,
+            int    end )
+{
+    LUT_JOB *lj = data;
+
+    for ( ; start < end; start++ )
+        flimage_lut_u16( lj->lut, lj->in[ start ], lj->out[ start ],
+                         lj->im->w );
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+lut8_rows( void * data,
+           int    start,
+           int    end )
+{
+    LUT_JOB *lj = data;
+    FL_IMAGE *im = lj->im;
+    const FL_PCTYPE *lut = lj->lut;
+    FL_PCTYPE *p;
+    int i,
+        c;
+
+    for ( ; start < end; start++ )
+        for ( c = 0; c < 3; c++ )
+        {
+            p = ( c == 0 ? im->red : ( c == 1 ? im->green : im->blue ) )
+                [ start ];
+
+            for ( i = 0; i < im->w; i++ )
+                p[ i ] = lut[ p[ i ] ];
+        }
+}
+
+
+/***************************************
+ * Sets out[ i ][ j ] = lut[ in[ i ][ j ] ] for all pixels of the image
+ * ('in' and 'out' may be the same). The table must have one more entry
+ * than the largest value in 'in' requires, see flimage_lut_u16().
+ ***************************************/
+
+void
+flimage_apply_lut16( FL_IMAGE             * im,
+                     const unsigned short * lut,
+                     unsigned short      ** in,
+                     unsigned short      ** out )
+{
+    LUT_JOB lj;
+
+    lj.im  = im;
+    lj.lut = lut;
+    lj.in  = in;
+    lj.out = out;
+
+    flimage_parallel_for( im, im->h, FL_max( 1, PARALLEL_MIN_PIXELS / im->w ),
+                          lut16_rows, &lj );
+}
+
+
+/***********************************************************************
+ * Histogram equalization
+ ***********************************************************************/
+
 int
 flimage_enhance( FL_IMAGE * im,
                  int        delta  FL_UNUSED_ARG )
 {
-    long sum[ FL_PCMAX + 2 ];
+    unsigned long *sum;
+    unsigned int *hist;
+    unsigned short *lut;
+    FL_PCTYPE lut8[ FL_PCMAX + 1 ];
+    float fact;
     int i,
-        n;
+        nbins,
+        maxval = FL_PCMAX;
+
+    if ( im->type == FL_IMAGE_MONO )
+        flimage_convert( im, FL_IMAGE_GRAY, 0 );
 
-    if (im->type == FL_IMAGE_CI)
-        flimage_convert(im, FL_IMAGE_RGB, 0);
-    else if (im->type == FL_IMAGE_MONO)
-        flimage_convert(im, FL_IMAGE_GRAY, 0);
+    if ( im->type == FL_IMAGE_GRAY16 )
+    {
+        maxval = im->gray_maxval;
+        hist = fl_malloc( ( maxval + 1 ) * sizeof *hist );
+        if ( hist && flimage_count_pixels( im, hist, maxval + 1 ) < 0 )
+            fli_safe_free( hist );
+    }
+    else
+        hist = get_histogram( im ) < 0 ? NULL : im->hist[ 3 ];
 
-    get_histogram( im );
-    memset( sum, 0, sizeof sum );
-    sum[ 0 ] = im->hist[ 3 ][ 0 ];
+    nbins = maxval + 1;
+    sum = fl_malloc( nbins * sizeof *sum );
+    lut = fl_malloc( ( nbins + 1 ) * sizeof *lut );
+
+    if ( ! hist || ! sum || ! lut )
+    {
+        if ( im->type == FL_IMAGE_GRAY16 )
+            fli_safe_free( hist );
+        fli_safe_free( sum );
+        fli_safe_free( lut );
+        fprintf( stderr, "image_enhance: unhandled" );
+        return -1;
+    }
 
-    for ( i = 1; i <= FL_PCMAX; i++ )
-        sum[ i ] = sum[ i - 1 ] + im->hist[ 3 ][ i ];
+    /* the cumulative histogram, scaled to the range of values, makes up
+       the lookup table */
 
-    for ( i = 0; i <= FL_PCMAX; i++ )
-        sum[ i ] *= ( FL_PCMAX - 0.999f ) / ( im->w * im->h );
+    fact = ( maxval - 0.999f ) / ( im->w * im->h );
 
-    if (im->type == FL_IMAGE_RGB)
-        for (n = im->w * im->h; --n >= 0;)
+    for ( sum[ 0 ] = hist[ 0 ], i = 1; i < nbins; i++ )
+        sum[ i ] = sum[ i - 1 ] + hist[ i ];
+
+    for ( i = 0; i < nbins; i++ )
+        lut[ i ] = sum[ i ] * fact;
+    lut[ nbins ] = 0;
+
+    if ( im->type == FL_IMAGE_GRAY16 )
+        fl_free( hist );
+
+    /* the colormap belongs to the image alone, the pixels may not */
+
+    if ( im->type != FL_IMAGE_CI && flimage_detach( im, im->type ) < 0 )
+    {
+        fl_free( sum );
+        fl_free( lut );
+        return -1;
+    }
+
+    if ( im->type == FL_IMAGE_CI )
+    {
+        /* the same as converting to RGB first and then doing it on the
+           red, green and blue values of each pixel */
+
+        for ( i = 0; i < im->map_len; i++ )
         {
-            im->red[0][n] = sum[im->red[0][n]];
-            im->green[0][n] = sum[im->green[0][n]];
-            im->blue[0][n] = sum[im->blue[0][n]];
+            im->red_lut[   i ] = lut[ im->red_lut[   i ] ];
+            im->green_lut[ i ] = lut[ im->green_lut[ i ] ];
+            im->blue_lut[  i ] = lut[ im->blue_lut[  i ] ];
         }
-    else if (im->type == FL_IMAGE_GRAY)
-        for (n = im->w * im->h; --n >= 0;)
-            im->gray[0][n] = sum[im->gray[0][n]];
+
+        flimage_convert( im, FL_IMAGE_RGB, 0 );
+    }
+    else if ( im->type == FL_IMAGE_RGB )
+    {
+        LUT_JOB lj;
+
+        for ( i = 0; i <= FL_PCMAX; i++ )
+            lut8[ i ] = lut[ i ];
+
+        lj.im  = im;
+        lj.lut = lut8;
+
+        flimage_parallel_for( im, im->h,
+                              FL_max( 1, PARALLEL_MIN_PIXELS / im->w ),
+                              lut8_rows, &lj );
+    }
     else
-        fprintf(stderr, "image_enhance: unhandled");
+        flimage_apply_lut16( im, lut, im->gray, im->gray );
+
+    fl_free( sum );
+    fl_free( lut );
 
     im->modified = 1;
     return 0;
 }
 
 
+/***************************************
+ * Sets the window level and width of a 16 bit gray image such that the
+ * given fraction of the darkest and the brightest pixels fall outside
+ * of the window
+ ***************************************/
+
+int
+flimage_auto_windowlevel( FL_IMAGE * im,
+                          double     clip )
+{
+    unsigned int *hist;
+    double npix,
+           sum;
+    int lower,
+        upper,
+        width;
+
+    if ( ! im || im->type != FL_IMAGE_GRAY16 || im->gray_maxval <= 0 )
+        return -1;
+
+    if ( ! ( hist = fl_malloc( ( im->gray_maxval + 1 ) * sizeof *hist ) ) )
+        return -1;
+
+    if ( flimage_count_pixels( im, hist, im->gray_maxval + 1 ) < 0 )
+    {
+        fl_free( hist );
+        return -1;
+    }
+
+    npix = ( double ) im->w * im->h;
+    clip = FL_clamp( clip, 0.0, 0.5 ) * npix;
+
+    for ( sum = 0, lower = 0; lower < im->gray_maxval; lower++ )
+        if ( ( sum += hist[ lower ] ) > clip )
+            break;
+
+    for ( sum = 0, upper = im->gray_maxval; upper > lower; upper-- )
+        if ( ( sum += hist[ upper ] ) > clip )
+            break;
+
+    fl_free( hist );
+
+    /* the window goes from level - width / 2 to level + width / 2 */
+
+    width = FL_max( 2, ( upper - lower + 1 ) & ~ 1 );
+
+    return flimage_windowlevel( im, lower + width / 2, width );
+}
+
+
 int
 flimage_get_closest_color_from_map( FL_IMAGE     * im,
                                     unsigned int   col )
@@ -43,7 +43,16 @@ static void *rotate_matrix( void *,
                             int,
                             int,
                             int,
-                            size_t );
+                            size_t,
+                            FL_IMAGE * );
+
+static void flip_matrix( void *,
+                         int,
+                         int,
+                         size_t,
+                         int,
+                         int,
+                         FL_IMAGE * );
 
 
 /***************************************
@@ -72,7 +81,43 @@ flimage_rotate( FL_IMAGE * im,
     if ( deg == 0 || deg == 3600 )
         return 0;
 
-    /* handle special cases TODO */
+    if (    im->type != FL_IMAGE_RGB
+         && ! FL_IsGray( im->type )
+         && ! FL_IsCI( im->type ) )
+    {
+        M_err( "flimage_rotate", "InternalError: unsupported image "
+               "type\n" );
+        return -1;
+    }
+
+    /* Turning the image upside down can be done in place */
+
+    if ( deg == 1800 )
+    {
+        if ( flimage_detach( im, im->type ) < 0 )
+        {
+            flimage_error( im, "can't allocate memory for rotation" );
+            return -1;
+        }
+
+        if ( im->type == FL_IMAGE_RGB )
+        {
+            flip_matrix( im->red,   im->h, im->w, 1, 1, 1, im );
+            flip_matrix( im->green, im->h, im->w, 1, 1, 1, im );
+            flip_matrix( im->blue,  im->h, im->w, 1, 1, 1, im );
+            if ( im->alpha )
+                flip_matrix( im->alpha, im->h, im->w, 1, 1, 1, im );
+        }
+        else if ( FL_IsGray( im->type ) )
+            flip_matrix( im->gray, im->h, im->w, 2, 1, 1, im );
+        else
+            flip_matrix( im->ci, im->h, im->w, 2, 1, 1, im );
+
+        flimage_invalidate_pixels( im );
+        im->sx = im->sy = im->sw = im->sh = 0;
+        im->modified = 1;
+        return 0;
+    }
 
     if ( deg % 900 == 0 )
     {
@@ -80,37 +125,30 @@ flimage_rotate( FL_IMAGE * im,
         if ( im->type == FL_IMAGE_RGB )
         {
             r = rotate_matrix( im->red,   im->h, im->w, deg,
-                               sizeof **im->red );
+                               sizeof **im->red, im );
             g = rotate_matrix( im->green, im->h, im->w, deg,
-                               sizeof **im->green );
+                               sizeof **im->green, im );
             b = rotate_matrix( im->blue,  im->h, im->w, deg,
-                               sizeof **im->blue );
+                               sizeof **im->blue, im );
         }
-        else if ( im->type == FL_IMAGE_GRAY )
-            r = rotate_matrix( im->gray, im->h, im->w, deg, sizeof **im->gray );
-        else if ( im->type == FL_IMAGE_CI )
-            r = rotate_matrix( im->ci, im->h, im->w, deg, sizeof **im->ci );
+        else if ( FL_IsGray( im->type ) )
+            r = rotate_matrix( im->gray, im->h, im->w, deg, sizeof **im->gray,
+                               im );
         else
+            r = rotate_matrix( im->ci, im->h, im->w, deg, sizeof **im->ci,
+                               im );
+
+        if ( ! r || ( im->type == FL_IMAGE_RGB && ( ! g || ! b ) ) )
         {
-            M_err( "flimage_rotate", "InternalError: unsupported image "
-                   "type\n" );
+            fl_free_matrix( r );
+            fl_free_matrix( g );
+            fl_free_matrix( b );
             return -1;
         }
 
-        if ( deg % 180 == 0 )
-        {
-            nw = im->w;
-            nh = im->h;
-        }
-        else
-        {
-            nw = im->h;
-            nh = im->w;
-        }
+        nw = im->h;
+        nh = im->w;
 
-        if ( ! r )
-            return -1;
-    
         flimage_replace_image( im, nw, nh, r, g, b );
 
         return 0;
@@ -136,13 +174,6 @@ flimage_rotate( FL_IMAGE * im,
 }
 
 
-static int flip_matrix( void *,
-                        int,
-                        int,
-                        int,
-                        int );
-
-
 /***************************************
  ***************************************/
 
@@ -150,154 +181,193 @@ int
 flimage_flip( FL_IMAGE * im,
               int        axis )
 {
-    int err = 0;
+    int cols = axis == 'c' || axis == 'x';
+
+    if ( flimage_detach( im, im->type ) < 0 )
+    {
+        flimage_error( im, "can't allocate memory for flipping" );
+        return -1;
+    }
 
     if ( im->type == FL_IMAGE_RGB )
-        err =    flip_matrix( im->red,   im->h, im->w, 1, axis ) < 0
-              || flip_matrix( im->green, im->h, im->w, 1, axis ) < 0
-              || flip_matrix( im->blue,  im->h, im->w, 1, axis ) < 0;
+    {
+        flip_matrix( im->red,   im->h, im->w, 1, cols, ! cols, im );
+        flip_matrix( im->green, im->h, im->w, 1, cols, ! cols, im );
+        flip_matrix( im->blue,  im->h, im->w, 1, cols, ! cols, im );
+        if ( im->alpha )
+            flip_matrix( im->alpha, im->h, im->w, 1, cols, ! cols, im );
+    }
     else if (FL_IsGray(im->type))
-        err = flip_matrix( im->gray, im->h, im->w, 2, axis ) < 0;
+        flip_matrix( im->gray, im->h, im->w, 2, cols, ! cols, im );
     else
-        err = flip_matrix( im->ci, im->h, im->w, 2, axis ) < 0;
+        flip_matrix( im->ci, im->h, im->w, 2, cols, ! cols, im );
 
-    if ( ! err )
-        im->modified = 1;
+    flimage_invalidate_pixels( im );
+    im->modified = 1;
 
-    return err ? -1 : 0;
+    return 0;
 }
 
 
-/* low level matrix stuff */
+/* low level matrix stuff. All of it works on the rows of the matrix in
+   parallel, in pieces of ROT_GRAIN rows or columns */
 
-#define flip_col( type, matrix, rows, cols )                           \
-      do  {                                                            \
-         type **mm = matrix,                                           \
-               *t,                                                     \
-               *h,                                                     \
-                tmp;                                                   \
-         int    j;                                                     \
-         for ( j = 0; j < rows; j++ )                                  \
-            for( t = ( h = mm[ j ] ) + cols - 1; t > h; t--, h++ )     \
-            {                                                          \
-               tmp = *h;                                               \
-               *h = *t;                                                \
-               *t = tmp;                                               \
-            }                                                          \
-      } while ( 0 )
+#define ROT_GRAIN        64
+#define SWAP_CHUNK       1024
 
+typedef struct {
+    unsigned char ** mm;
+    int              rows,
+                     cols;
+    size_t           esize;
+    int              reverse,       /* reverse order within rows */
+                     mirror;        /* reverse order of rows     */
+} FLIP_JOB;
 
 
 /***************************************
- * flip a matrix. Mirror about the x or y
+ * Exchanges n bytes at p and q (which may not overlap)
  ***************************************/
 
-static int
-flip_matrix( void * matrix,
-             int    rows,
-             int    cols,
-             int    esize,
-             int    what )
+static void
+swap_bytes( unsigned char * p,
+            unsigned char * q,
+            size_t          n )
 {
-    if ( what == 'c' || what == 'x' )   /* flip columns */
+    unsigned char tmp[ SWAP_CHUNK ];
+    size_t k;
+
+    for ( ; n > 0; n -= k, p += k, q += k )
     {
-        if ( esize == 2 )
-            flip_col( unsigned short, matrix, rows, cols );
-        else
-            flip_col( unsigned char, matrix, rows, cols );
+        k = FL_min( n, SWAP_CHUNK );
+        memcpy( tmp, p, k );
+        memcpy( p, q, k );
+        memcpy( q, tmp, k );
     }
-    else
-    {
-        int i,
-            is = rows / 2;
-        size_t size = esize * cols;
-        unsigned char *tmp,
-                      **mm = matrix;
+}
 
-        if ( ! ( tmp = fl_malloc( size ) ) )
-            return -1;
 
-        /* if we only flip the pointers, this will be faster, but then, the
-           1-d property is violated */
+/***************************************
+ * Deals with rows start to end - 1 and their mirror rows
+ ***************************************/
 
-        for ( i = 0; i < is; i++ )
-        {
-            memcpy( tmp, mm[ i ], size );
-            memcpy( mm[ i ], mm[ rows - 1 - i ], size );
-            memcpy( mm[ rows - 1 - i ], tmp, size );
-        }
+static void
+flip_rows( void * data,
+           int    start,
+           int    end )
+{
+    FLIP_JOB *fj = data;
+    int i,
+        k;
 
-        fl_free( tmp );
+    for ( i = start; i < end; i++ )
+    {
+        k = fj->mirror ? fj->rows - 1 - i : i;
+
+        if ( ! fj->reverse )
+            swap_bytes( fj->mm[ i ], fj->mm[ k ], fj->esize * fj->cols );
+        else if ( fj->esize == 2 )
+            flimage_swap_reverse_u16( ( unsigned short * ) fj->mm[ i ],
+                                      ( unsigned short * ) fj->mm[ k ],
+                                      fj->cols );
+        else
+            flimage_swap_reverse_u8( fj->mm[ i ], fj->mm[ k ], fj->cols );
     }
-
-    return 0;
 }
 
 
-/* special angles: +-90, +-180 */
-/***************************************************************
- * rotate a matrix by 90, or -90 or multiples of it
- * Rotate 180 can be implented as two 90 rotations, but current
- * code is faster.
- *
- * NOTE: input dimension is the diemsnion of the matrix to be
- *       rotated. caller must take care of the rotated dimensions
- **************************************************************/
+/***************************************
+ * flip a matrix in place. Mirror about the x or y axis if only one of
+ * 'reverse' (for the columns) or 'mirror' (for the rows) is set, or
+ * about both (i.e. rotate by 180 degrees) if both are
+ ***************************************/
 
-/*  Rotate 90 degrees */
-
-#define DO_M90( type, out, in )                      \
-    do {                                             \
-        type  *p= ( ( type ** ) out )[ 0 ],          \
-             **o= in;                                \
-        int i,                                       \
-            j;                                       \
-        for ( j = 0; j < col; j++ )                  \
-        {                                            \
-            for ( i = row - 1; i >= 0; i-- )         \
-                *p++ = o[ i ][ j ];                  \
-        }                                            \
-    } while ( 0 )
-
-/*  Rotate -90 degrees */
-
-#define DO_90( type, out, in )                       \
-    do {                                             \
-        type  *p= ( ( type ** ) out )[ 0 ],          \
-             **o= in;                                \
-        int i,                                       \
-            j;                                       \
-        for ( j = col - 1; j >= 0; j-- )             \
-        {                                            \
-            for ( i = 0; i < row; i++ )              \
-                *p++ = o[ i ][ j ];                  \
-        }                                            \
-    } while ( 0 )
-
-#define DO_180( ty, out, in )                               \
-    do {                                                    \
-        ty *p= ( ( ty ** ) out )[ 0 ],                      \
-           *o= ( ( ty ** ) in  )[ 0 ];                      \
-        ty *os;                                             \
-        for ( os= o + col * row-1 ; os > o; *p++ = *os-- )  \
-            /* empty */ ;                                   \
-    } while( 0 )
+static void
+flip_matrix( void     * matrix,
+             int        rows,
+             int        cols,
+             size_t     esize,
+             int        reverse,
+             int        mirror,
+             FL_IMAGE * im )
+{
+    FLIP_JOB fj;
+    int n = rows;
+
+    fj.mm      = matrix;
+    fj.rows    = rows;
+    fj.cols    = cols;
+    fj.esize   = esize;
+    fj.reverse = reverse;
+    fj.mirror  = mirror;
+
+    /* when mirroring, each call deals with two rows, the one in the
+       middle only needs reversing (if at all) */
+
+    if ( mirror )
+        n = ( rows + ( reverse ? 1 : 0 ) ) / 2;
+
+    flimage_parallel_for( im, n, ROT_GRAIN, flip_rows, &fj );
+}
 
 
+/* special angles: +-90. The rotations are transposes with either the
+   output or the input rows taken in reverse order, i.e., with negative
+   row strides */
+
+typedef struct {
+    const unsigned char * in;       /* first row to be read      */
+    long                  istride;  /* in elements               */
+    unsigned char       * out;      /* first row to be written   */
+    long                  ostride;
+    int                   rows;
+    size_t                esize;
+} ROT_JOB;
+
 
 /***************************************
+ * Transposes the columns start to end - 1 of the input
  ***************************************/
 
+static void
+rotate_cols( void * data,
+             int    start,
+             int    end )
+{
+    ROT_JOB *rj = data;
+
+    if ( rj->esize == 2 )
+        flimage_transpose_u16( ( const unsigned short * ) rj->in + start,
+                               rj->istride,
+                               ( unsigned short * ) rj->out
+                               + start * rj->ostride,
+                               rj->ostride, rj->rows, end - start );
+    else
+        flimage_transpose_u8( rj->in + start, rj->istride,
+                              rj->out + start * rj->ostride, rj->ostride,
+                              rj->rows, end - start );
+}
+
+
+/***************************************************************
+ * rotate a matrix by 90, or -90 or multiples of it (except 180,
+ * which is done in place by flip_matrix())
+ *
+ * NOTE: input dimension is the diemsnion of the matrix to be
+ *       rotated. caller must take care of the rotated dimensions
+ **************************************************************/
+
 static void *
-rotate_matrix( void * m,
-               int    row,
-               int    col,
-               int    deg,
-               size_t e )
+rotate_matrix( void     * m,
+               int        row,
+               int        col,
+               int        deg,
+               size_t     e,
+               FL_IMAGE * im )
 {
-    int nrow = row,
-        ncol = col;
-    void *mm;
+    unsigned char **in = m,
+                  **out;
+    ROT_JOB rj;
 
     /* Coerce angle to be +/- 360 */
 
@@ -313,43 +383,40 @@ rotate_matrix( void * m,
             deg -= 360;
     }
 
-    if ( deg == 90 || deg == -90 )
+    if ( deg != 90 && deg != -90 )
     {
-        nrow = col;
-        ncol = row;
+        M_err( "RotateMatrix", "InternalError: bad special angle\n" );
+        return 0;
     }
 
-    if ( ! ( mm = fl_get_matrix( nrow, ncol, e ) ) )
+    if ( ! ( out = fl_get_matrix( col, row, e ) ) )
         return 0;
 
+    rj.rows  = row;
+    rj.esize = e;
+
     if ( deg == 90 )
     {
-        if ( e == 2 )
-            DO_90( unsigned short, mm, m );
-        else
-            DO_90( unsigned char, mm, m );
-    }
-    else if ( deg == -90 )
-    {
-        if ( e == 2 )
-            DO_M90( unsigned short, mm, m );
-        else
-            DO_M90( unsigned char, mm, m );
-    }
-    else if ( deg == 180 || deg == -180 )
-    {
-        if ( e == 2 )
-            DO_180( unsigned short, mm, m );
-        else
-            DO_180( unsigned char, mm, m );
+        /* out[ col - 1 - j ][ i ] = in[ i ][ j ] */
+
+        rj.in      = in[ 0 ];
+        rj.istride = col;
+        rj.out     = out[ col - 1 ];
+        rj.ostride = - ( long ) row;
     }
     else
     {
-        M_err( "RotateMatrix", "InternalError: bad special angle\n" );
-        return 0;
+        /* out[ j ][ row - 1 - i ] = in[ i ][ j ] */
+
+        rj.in      = in[ row - 1 ];
+        rj.istride = - ( long ) col;
+        rj.out     = out[ 0 ];
+        rj.ostride = row;
     }
 
-    return mm;
+    flimage_parallel_for( im, col, ROT_GRAIN, rotate_cols, &rj );
+
+    return out;
 }
 
 
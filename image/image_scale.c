@@ -28,10 +28,16 @@
 #include "config.h"
 #endif
 
+#include <math.h>
+#include <string.h>
 #include "include/forms.h"
 #include "flimage.h"
 #include "flimage_int.h"
 
+#ifndef M_PI
+#define M_PI  3.14159265358979323846
+#endif
+
 
 /***************************************
  * Scale an image without subpixel sampling. Parameter im is strictly
@@ -198,6 +204,365 @@ image_scale( void     * om[ ],
 }
 
 
+/* Filtered scaling. The filter is applied separately in x and y
+   direction with weights that get computed only once per row and
+   column. The output is split into strips of rows that are scaled
+   independently by the worker threads, each strip first filtering
+   just the source rows it needs horizontally into a temporary buffer
+   and then filtering these vertically. */
+
+#define STRIP_HEIGHT  32
+
+typedef struct {
+    double   ( * filter )( double );
+    double     radius;
+} ScaleFilter;
+
+typedef struct {
+    int     taps;                  /* max. number of weights per pixel */
+    int   * start;                 /* first source pixel               */
+    int   * count;                 /* number of source pixels          */
+    float * weight;                /* taps weights per output pixel    */
+} ScaleTable;
+
+typedef struct {
+    void        ** om;
+    void        ** nm;
+    int            nw,
+                   nh,
+                   comp;
+    int            maxval;
+    ScaleTable     xtab,
+                   ytab;
+    int            err;
+} ScaleJob;
+
+
+/***************************************
+ ***************************************/
+
+static double
+bilinear_filter( double x )
+{
+    x = fabs( x );
+    return x < 1.0 ? 1.0 - x : 0.0;
+}
+
+
+/***************************************
+ * Catmull-Rom cubic (a = -0.5)
+ ***************************************/
+
+static double
+bicubic_filter( double x )
+{
+    x = fabs( x );
+
+    if ( x < 1.0 )
+        return ( 1.5 * x - 2.5 ) * x * x + 1.0;
+    if ( x < 2.0 )
+        return ( ( -0.5 * x + 2.5 ) * x - 4.0 ) * x + 2.0;
+    return 0.0;
+}
+
+
+/***************************************
+ ***************************************/
+
+static double
+lanczos_filter( double x )
+{
+    x = fabs( x );
+
+    if ( x < 1.0e-7 )
+        return 1.0;
+    if ( x >= 3.0 )
+        return 0.0;
+
+    x *= M_PI;
+    return 3.0 * sin( x ) * sin( x / 3.0 ) / ( x * x );
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+free_scale_table( ScaleTable * t )
+{
+    fli_safe_free( t->start );
+    fli_safe_free( t->count );
+    fli_safe_free( t->weight );
+}
+
+
+/***************************************
+ * Computes the normalized weights for scaling 'in' pixels to 'out'.
+ * When shrinking the filter gets stretched so that all source pixels
+ * contribute.
+ ***************************************/
+
+static int
+make_scale_table( ScaleTable        * t,
+                  int                 in,
+                  int                 out,
+                  const ScaleFilter * f )
+{
+    double scale = ( double ) in / out,
+           fscale = FL_max( scale, 1.0 ),
+           support = f->radius * fscale;
+    int i,
+        k;
+
+    t->taps   = 2 * ( int ) ceil( support ) + 1;
+    t->start  = fl_malloc( out * sizeof *t->start );
+    t->count  = fl_malloc( out * sizeof *t->count );
+    t->weight = fl_malloc( out * t->taps * sizeof *t->weight );
+
+    if ( ! t->start || ! t->count || ! t->weight )
+    {
+        free_scale_table( t );
+        return -1;
+    }
+
+    for ( i = 0; i < out; i++ )
+    {
+        double center = ( i + 0.5 ) * scale,
+               sum = 0.0;
+        float *wt = t->weight + i * t->taps;
+        int xmin = FL_max( ( int ) ( center - support + 0.5 ), 0 ),
+            xmax = FL_min( ( int ) ( center + support + 0.5 ), in );
+
+        if ( xmax - xmin > t->taps )
+            xmax = xmin + t->taps;
+        if ( xmax <= xmin )
+        {
+            xmin = FL_clamp( ( int ) center, 0, in - 1 );
+            xmax = xmin + 1;
+        }
+
+        for ( k = 0; k < xmax - xmin; k++ )
+            sum += wt[ k ] = f->filter( ( xmin + k - center + 0.5 ) / fscale );
+
+        if ( sum == 0.0 )
+        {
+            wt[ 0 ] = 1.0;
+            xmax = xmin + 1;
+        }
+        else
+            for ( k = 0; k < xmax - xmin; k++ )
+                wt[ k ] /= sum;
+
+        t->start[ i ] = xmin;
+        t->count[ i ] = xmax - xmin;
+    }
+
+    return 0;
+}
+
+
+/***************************************
+ * Scales the output rows from strip 'first' up to 'last'
+ ***************************************/
+
+static void
+filter_strips( void * data,
+               int    first,
+               int    last )
+{
+    ScaleJob *sj = data;
+    ScaleTable *xt = &sj->xtab,
+               *yt = &sj->ytab;
+    int nw = sj->nw,
+        comp = sj->comp;
+    float *tmp = NULL,
+          *acc;
+    size_t tmp_size = 0;
+    int s,
+        c,
+        x,
+        y,
+        k;
+
+    if ( ! ( acc = fl_malloc( nw * sizeof *acc ) ) )
+    {
+        sj->err = 1;
+        return;
+    }
+
+    for ( s = first; s < last; s++ )
+    {
+        int y0 = s * STRIP_HEIGHT,
+            y1 = FL_min( sj->nh, y0 + STRIP_HEIGHT ),
+            sy0 = yt->start[ y0 ],
+            sy1 = 0;
+        size_t need;
+
+        for ( y = y0; y < y1; y++ )
+        {
+            sy0 = FL_min( sy0, yt->start[ y ] );
+            sy1 = FL_max( sy1, yt->start[ y ] + yt->count[ y ] );
+        }
+
+        need = ( size_t ) ( sy1 - sy0 ) * nw * sizeof *tmp;
+        if ( need > tmp_size )
+        {
+            float *t = fl_realloc( tmp, need );
+
+            if ( ! t )
+            {
+                sj->err = 1;
+                break;
+            }
+
+            tmp = t;
+            tmp_size = need;
+        }
+
+        for ( c = 0; c < comp; c++ )
+        {
+            /* Horizontal pass over the source rows needed */
+
+            for ( y = sy0; y < sy1; y++ )
+            {
+                float *out = tmp + ( size_t ) ( y - sy0 ) * nw;
+
+                if ( comp == 1 )
+                {
+                    unsigned short *in = ( ( unsigned short ** ) sj->om[ 0 ] )[ y ];
+
+                    for ( x = 0; x < nw; x++ )
+                    {
+                        const unsigned short *p = in + xt->start[ x ];
+                        const float *wt = xt->weight + x * xt->taps;
+                        float v = 0.0;
+
+                        for ( k = 0; k < xt->count[ x ]; k++ )
+                            v += wt[ k ] * p[ k ];
+                        out[ x ] = v;
+                    }
+                }
+                else
+                {
+                    unsigned char *in = ( ( unsigned char ** ) sj->om[ c ] )[ y ];
+
+                    for ( x = 0; x < nw; x++ )
+                    {
+                        const unsigned char *p = in + xt->start[ x ];
+                        const float *wt = xt->weight + x * xt->taps;
+                        float v = 0.0;
+
+                        for ( k = 0; k < xt->count[ x ]; k++ )
+                            v += wt[ k ] * p[ k ];
+                        out[ x ] = v;
+                    }
+                }
+            }
+
+            /* Vertical pass, a row at a time */
+
+            for ( y = y0; y < y1; y++ )
+            {
+                const float *wt = yt->weight + y * yt->taps;
+                const float *in = tmp + ( size_t ) ( yt->start[ y ] - sy0 ) * nw;
+
+                for ( x = 0; x < nw; x++ )
+                    acc[ x ] = wt[ 0 ] * in[ x ];
+
+                for ( k = 1; k < yt->count[ y ]; k++ )
+                {
+                    in += nw;
+                    for ( x = 0; x < nw; x++ )
+                        acc[ x ] += wt[ k ] * in[ x ];
+                }
+
+                if ( comp == 1 )
+                {
+                    unsigned short *out = ( ( unsigned short ** ) sj->nm[ 0 ] )[ y ];
+
+                    for ( x = 0; x < nw; x++ )
+                    {
+                        int v = acc[ x ] + 0.5f;
+
+                        out[ x ] = FL_clamp( v, 0, sj->maxval );
+                    }
+                }
+                else
+                {
+                    unsigned char *out = ( ( unsigned char ** ) sj->nm[ c ] )[ y ];
+
+                    for ( x = 0; x < nw; x++ )
+                    {
+                        int v = acc[ x ] + 0.5f;
+
+                        out[ x ] = FL_clamp( v, 0, 255 );
+                    }
+                }
+            }
+        }
+    }
+
+    fl_free( acc );
+    if ( tmp )
+        fl_free( tmp );
+}
+
+
+/***************************************
+ * Scaling with a bilinear, bicubic or Lanczos filter
+ ***************************************/
+
+static int
+image_filter_scale( void     * om[ ],
+                    void     * nm[ ],
+                    int        h,
+                    int        w,
+                    int        nh,
+                    int        nw,
+                    int        comp,
+                    int        option,
+                    FL_IMAGE * im )
+{
+    static ScaleFilter filters[ ] = {
+        { bilinear_filter, 1.0 },
+        { bicubic_filter,  2.0 },
+        { lanczos_filter,  3.0 }
+    };
+    ScaleFilter *f;
+    ScaleJob sj;
+
+    if ( option & FLIMAGE_LANCZOS )
+        f = filters + 2;
+    else if ( option & FLIMAGE_BICUBIC )
+        f = filters + 1;
+    else
+        f = filters;
+
+    memset( &sj, 0, sizeof sj );
+    sj.om     = om;
+    sj.nm     = nm;
+    sj.nw     = nw;
+    sj.nh     = nh;
+    sj.comp   = comp;
+    sj.maxval = im->type == FL_IMAGE_GRAY16 ? im->gray_maxval : 255;
+
+    if (    make_scale_table( &sj.xtab, w, nw, f ) < 0
+         || make_scale_table( &sj.ytab, h, nh, f ) < 0 )
+    {
+        free_scale_table( &sj.xtab );
+        return -1;
+    }
+
+    flimage_parallel_for( im, ( nh + STRIP_HEIGHT - 1 ) / STRIP_HEIGHT, 1,
+                          filter_strips, &sj );
+
+    free_scale_table( &sj.xtab );
+    free_scale_table( &sj.ytab );
+
+    return sj.err ? -1 : 0;
+}
+
+
 /***************************************
  ***************************************/
 
@@ -211,6 +576,8 @@ flimage_scale( FL_IMAGE * im,
          *nm[ 3 ] = { 0, 0, 0 };
     int err = 0,
         comp;
+    int filter = option & ( FLIMAGE_BILINEAR | FLIMAGE_BICUBIC
+                            | FLIMAGE_LANCZOS );
 
     if ( ! im || im->w <= 0 || im->type == FL_IMAGE_NONE )
         return -1;
@@ -220,9 +587,9 @@ flimage_scale( FL_IMAGE * im,
     if ( im->w == nw && im->h == nh )
         return 0;
 
-    /* Convert to RGB only if subpixel and not gray */
+    /* Convert to RGB only if subpixel (or filtered) and not gray */
 
-    if ( option & FLIMAGE_SUBPIXEL )
+    if ( option & FLIMAGE_SUBPIXEL || filter )
     {
         if ( im->type == FL_IMAGE_CI )
             err = flimage_convert( im, FL_IMAGE_RGB, 0 ) < 0;
@@ -293,6 +660,9 @@ flimage_scale( FL_IMAGE * im,
         im->visual_cue( im, "Scaling Done" );
         return err;
     }
+    else if ( filter )
+        err = image_filter_scale( om, nm, im->h, im->w, nh, nw, comp,
+                                  filter, im ) < 0;
     else if ( option & FLIMAGE_SUBPIXEL )
         err = image_scale( om, nm, im->h, im->w, nh, nw, comp, im ) < 0;
     else
@@ -0,0 +1,1976 @@
+/*
+ *  This file is part of the XForms library package.
+ *
+ *  XForms is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1, or
+ *  (at your option) any later version.
+ *
+ *  XForms is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with XForms.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Run-time selection of SSE2/AVX2 code, the kernels for converting
+ * separate red, green and blue planes into rows of TrueColor pixels
+ * and the row primitives used by the convolution, the histogram and
+ * the type conversion code.
+ *
+ * The plain C kernels are the reference implementation, the vectorized
+ * ones must produce exactly the same output.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "include/forms.h"
+#include "flinternal.h"
+#include "flimage.h"
+#include "flimage_int.h"
+
+#ifdef FLIMAGE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+
+static int cpu_simd_level = FLIMAGE_SIMD_NONE;
+
+#ifdef HAVE_PTHREAD
+static pthread_once_t simd_once = PTHREAD_ONCE_INIT;
+#else
+static int simd_tested = 0;
+#endif
+
+
+/***************************************
+ * Determines the best instruction set extension the CPU supports
+ ***************************************/
+
+static void
+test_simd( void )
+{
+#ifdef FLIMAGE_X86_SIMD
+    __builtin_cpu_init( );
+
+    if ( __builtin_cpu_supports( "avx2" ) )
+        cpu_simd_level = FLIMAGE_SIMD_AVX2;
+    else if ( __builtin_cpu_supports( "sse2" ) )
+        cpu_simd_level = FLIMAGE_SIMD_SSE2;
+#endif
+}
+
+
+/***************************************
+ * Returns the best instruction set extension the CPU supports. The
+ * test is done only once, even when called from several threads.
+ ***************************************/
+
+int
+flimage_simd_level( void )
+{
+#ifdef HAVE_PTHREAD
+    pthread_once( &simd_once, test_simd );
+#else
+    if ( ! simd_tested )
+    {
+        test_simd( );
+        simd_tested = 1;
+    }
+#endif
+
+    return cpu_simd_level;
+}
+
+
+/***************************************
+ ***************************************/
+
+static unsigned int
+bswap32( unsigned int p )
+{
+    return   ( ( p & 0x000000ffU ) << 24 )
+           | ( ( p & 0x0000ff00U ) <<  8 )
+           | ( ( p & 0x00ff0000U ) >>  8 )
+           | ( ( p & 0xff000000U ) >> 24 );
+}
+
+
+#define PIXFMT_PIXEL( f, r, g, b )                                        \
+    (   ( ( ( ( unsigned int ) ( r ) >> ( f )->rrshift ) << ( f )->rlshift ) \
+          & ( f )->rmask )                                                \
+      | ( ( ( ( unsigned int ) ( g ) >> ( f )->grshift ) << ( f )->glshift ) \
+          & ( f )->gmask )                                                \
+      | ( ( ( ( unsigned int ) ( b ) >> ( f )->brshift ) << ( f )->blshift ) \
+          & ( f )->bmask )                                                \
+      | ( f )->alpha )
+
+
+/***************************************
+ * Reference implementation, handles all pixel sizes
+ ***************************************/
+
+static void
+rgb2pix_c( const FLIMAGE_PIXFMT * fmt,
+           const unsigned char  * r,
+           const unsigned char  * g,
+           const unsigned char  * b,
+           void                 * out,
+           int                    n )
+{
+    int i;
+    unsigned int p;
+
+    switch ( fmt->bits_per_pixel )
+    {
+        case 32 :
+        {
+            unsigned int *o = out;
+
+            for ( i = 0; i < n; i++ )
+            {
+                p = PIXFMT_PIXEL( fmt, r[ i ], g[ i ], b[ i ] );
+                o[ i ] = fmt->swap ? bswap32( p ) : p;
+            }
+            break;
+        }
+
+        case 16 :
+        {
+            unsigned short *o = out;
+
+            for ( i = 0; i < n; i++ )
+            {
+                p = PIXFMT_PIXEL( fmt, r[ i ], g[ i ], b[ i ] ) & 0xffff;
+                o[ i ] = fmt->swap ? ( ( p >> 8 ) | ( p << 8 ) ) : p;
+            }
+            break;
+        }
+
+        case 24 :
+        {
+            unsigned char *o = out;
+
+            for ( i = 0; i < n; i++ )
+            {
+                p = PIXFMT_PIXEL( fmt, r[ i ], g[ i ], b[ i ] );
+                if ( fmt->msbfirst )
+                {
+                    *o++ = ( p >> 16 ) & 0xff;
+                    *o++ = ( p >>  8 ) & 0xff;
+                    *o++ = ( p       ) & 0xff;
+                }
+                else
+                {
+                    *o++ = ( p       ) & 0xff;
+                    *o++ = ( p >>  8 ) & 0xff;
+                    *o++ = ( p >> 16 ) & 0xff;
+                }
+            }
+            break;
+        }
+
+        case 8 :
+        {
+            unsigned char *o = out;
+
+            for ( i = 0; i < n; i++ )
+                o[ i ] = PIXFMT_PIXEL( fmt, r[ i ], g[ i ], b[ i ] );
+            break;
+        }
+    }
+}
+
+
+#ifdef FLIMAGE_X86_SIMD
+
+/* All the vector kernels do as much of the row as they can and then
+   leave the rest to the reference implementation */
+
+/***************************************
+ * SSE2: 4 pixels of 32 bits from 4 zero-extended channel values each
+ ***************************************/
+
+__attribute__(( target( "sse2" ) ))
+static inline __m128i
+sse2_pix32( const FLIMAGE_PIXFMT * fmt,
+            __m128i                r,
+            __m128i                g,
+            __m128i                b )
+{
+    __m128i p;
+
+    r = _mm_sll_epi32( _mm_srl_epi32( r, _mm_cvtsi32_si128( fmt->rrshift ) ),
+                       _mm_cvtsi32_si128( fmt->rlshift ) );
+    g = _mm_sll_epi32( _mm_srl_epi32( g, _mm_cvtsi32_si128( fmt->grshift ) ),
+                       _mm_cvtsi32_si128( fmt->glshift ) );
+    b = _mm_sll_epi32( _mm_srl_epi32( b, _mm_cvtsi32_si128( fmt->brshift ) ),
+                       _mm_cvtsi32_si128( fmt->blshift ) );
+
+    p = _mm_or_si128(
+            _mm_or_si128( _mm_and_si128( r, _mm_set1_epi32( fmt->rmask ) ),
+                          _mm_and_si128( g, _mm_set1_epi32( fmt->gmask ) ) ),
+            _mm_or_si128( _mm_and_si128( b, _mm_set1_epi32( fmt->bmask ) ),
+                          _mm_set1_epi32( fmt->alpha ) ) );
+
+    if ( fmt->swap )
+    {
+        __m128i m = _mm_set1_epi32( 0xff );
+
+        p = _mm_or_si128(
+                _mm_or_si128( _mm_slli_epi32( p, 24 ),
+                              _mm_slli_epi32( _mm_and_si128( p,
+                                            _mm_slli_epi32( m, 8 ) ), 8 ) ),
+                _mm_or_si128( _mm_and_si128( _mm_srli_epi32( p, 8 ),
+                                             _mm_slli_epi32( m, 8 ) ),
+                              _mm_srli_epi32( p, 24 ) ) );
+    }
+
+    return p;
+}
+
+
+/***************************************
+ ***************************************/
+
+__attribute__(( target( "sse2" ) ))
+static void
+rgb2pix_sse2( const FLIMAGE_PIXFMT * fmt,
+              const unsigned char  * r,
+              const unsigned char  * g,
+              const unsigned char  * b,
+              void                 * out,
+              int                    n )
+{
+    __m128i zero = _mm_setzero_si128( );
+    int i = 0;
+
+    if ( fmt->bits_per_pixel == 32 )
+    {
+        __m128i *o = out;
+
+        for ( ; i + 16 <= n; i += 16, o += 4 )
+        {
+            __m128i vr = _mm_loadu_si128( ( const __m128i * ) ( r + i ) ),
+                    vg = _mm_loadu_si128( ( const __m128i * ) ( g + i ) ),
+                    vb = _mm_loadu_si128( ( const __m128i * ) ( b + i ) );
+            __m128i rl = _mm_unpacklo_epi8( vr, zero ),
+                    rh = _mm_unpackhi_epi8( vr, zero ),
+                    gl = _mm_unpacklo_epi8( vg, zero ),
+                    gh = _mm_unpackhi_epi8( vg, zero ),
+                    bl = _mm_unpacklo_epi8( vb, zero ),
+                    bh = _mm_unpackhi_epi8( vb, zero );
+
+            _mm_storeu_si128( o,
+                      sse2_pix32( fmt, _mm_unpacklo_epi16( rl, zero ),
+                                       _mm_unpacklo_epi16( gl, zero ),
+                                       _mm_unpacklo_epi16( bl, zero ) ) );
+            _mm_storeu_si128( o + 1,
+                      sse2_pix32( fmt, _mm_unpackhi_epi16( rl, zero ),
+                                       _mm_unpackhi_epi16( gl, zero ),
+                                       _mm_unpackhi_epi16( bl, zero ) ) );
+            _mm_storeu_si128( o + 2,
+                      sse2_pix32( fmt, _mm_unpacklo_epi16( rh, zero ),
+                                       _mm_unpacklo_epi16( gh, zero ),
+                                       _mm_unpacklo_epi16( bh, zero ) ) );
+            _mm_storeu_si128( o + 3,
+                      sse2_pix32( fmt, _mm_unpackhi_epi16( rh, zero ),
+                                       _mm_unpackhi_epi16( gh, zero ),
+                                       _mm_unpackhi_epi16( bh, zero ) ) );
+        }
+
+        out = o;
+    }
+    else if ( fmt->bits_per_pixel == 16 )
+    {
+        __m128i *o = out;
+        __m128i rrs = _mm_cvtsi32_si128( fmt->rrshift ),
+                rls = _mm_cvtsi32_si128( fmt->rlshift ),
+                grs = _mm_cvtsi32_si128( fmt->grshift ),
+                gls = _mm_cvtsi32_si128( fmt->glshift ),
+                brs = _mm_cvtsi32_si128( fmt->brshift ),
+                bls = _mm_cvtsi32_si128( fmt->blshift );
+        __m128i rm = _mm_set1_epi16( fmt->rmask ),
+                gm = _mm_set1_epi16( fmt->gmask ),
+                bm = _mm_set1_epi16( fmt->bmask ),
+                am = _mm_set1_epi16( fmt->alpha & 0xffff );
+
+        for ( ; i + 8 <= n; i += 8, o++ )
+        {
+            __m128i vr, vg, vb, p;
+
+            vr = _mm_unpacklo_epi8(
+                       _mm_loadl_epi64( ( const __m128i * ) ( r + i ) ), zero );
+            vg = _mm_unpacklo_epi8(
+                       _mm_loadl_epi64( ( const __m128i * ) ( g + i ) ), zero );
+            vb = _mm_unpacklo_epi8(
+                       _mm_loadl_epi64( ( const __m128i * ) ( b + i ) ), zero );
+
+            vr = _mm_and_si128( _mm_sll_epi16( _mm_srl_epi16( vr, rrs ), rls ),
+                                rm );
+            vg = _mm_and_si128( _mm_sll_epi16( _mm_srl_epi16( vg, grs ), gls ),
+                                gm );
+            vb = _mm_and_si128( _mm_sll_epi16( _mm_srl_epi16( vb, brs ), bls ),
+                                bm );
+            p = _mm_or_si128( _mm_or_si128( vr, vg ), _mm_or_si128( vb, am ) );
+
+            if ( fmt->swap )
+                p = _mm_or_si128( _mm_slli_epi16( p, 8 ),
+                                  _mm_srli_epi16( p, 8 ) );
+
+            _mm_storeu_si128( o, p );
+        }
+
+        out = o;
+    }
+
+    if ( i < n )
+        rgb2pix_c( fmt, r + i, g + i, b + i, out, n - i );
+}
+
+
+/***************************************
+ * AVX2: 8 pixels of 32 bits, the 3 lowest bytes of each valid for 24 bpp
+ ***************************************/
+
+__attribute__(( target( "avx2" ) ))
+static inline __m256i
+avx2_pix32( const FLIMAGE_PIXFMT * fmt,
+            const unsigned char  * r,
+            const unsigned char  * g,
+            const unsigned char  * b )
+{
+    __m256i vr = _mm256_cvtepu8_epi32(
+                             _mm_loadl_epi64( ( const __m128i * ) r ) ),
+            vg = _mm256_cvtepu8_epi32(
+                             _mm_loadl_epi64( ( const __m128i * ) g ) ),
+            vb = _mm256_cvtepu8_epi32(
+                             _mm_loadl_epi64( ( const __m128i * ) b ) );
+
+    vr = _mm256_sll_epi32( _mm256_srl_epi32( vr,
+                                     _mm_cvtsi32_si128( fmt->rrshift ) ),
+                           _mm_cvtsi32_si128( fmt->rlshift ) );
+    vg = _mm256_sll_epi32( _mm256_srl_epi32( vg,
+                                     _mm_cvtsi32_si128( fmt->grshift ) ),
+                           _mm_cvtsi32_si128( fmt->glshift ) );
+    vb = _mm256_sll_epi32( _mm256_srl_epi32( vb,
+                                     _mm_cvtsi32_si128( fmt->brshift ) ),
+                           _mm_cvtsi32_si128( fmt->blshift ) );
+
+    return _mm256_or_si256(
+        _mm256_or_si256( _mm256_and_si256( vr, _mm256_set1_epi32( fmt->rmask ) ),
+                         _mm256_and_si256( vg, _mm256_set1_epi32( fmt->gmask ) ) ),
+        _mm256_or_si256( _mm256_and_si256( vb, _mm256_set1_epi32( fmt->bmask ) ),
+                         _mm256_set1_epi32( fmt->alpha ) ) );
+}
+
+
+/***************************************
+ ***************************************/
+
+__attribute__(( target( "avx2" ) ))
+static void
+rgb2pix_avx2( const FLIMAGE_PIXFMT * fmt,
+              const unsigned char  * r,
+              const unsigned char  * g,
+              const unsigned char  * b,
+              void                 * out,
+              int                    n )
+{
+    int i = 0;
+
+    if ( fmt->bits_per_pixel == 32 )
+    {
+        __m256i *o = out;
+        __m256i swap = _mm256_setr_epi8(  3,  2,  1,  0,  7,  6,  5,  4,
+                                         11, 10,  9,  8, 15, 14, 13, 12,
+                                          3,  2,  1,  0,  7,  6,  5,  4,
+                                         11, 10,  9,  8, 15, 14, 13, 12 );
+
+        for ( ; i + 8 <= n; i += 8, o++ )
+        {
+            __m256i p = avx2_pix32( fmt, r + i, g + i, b + i );
+
+            if ( fmt->swap )
+                p = _mm256_shuffle_epi8( p, swap );
+            _mm256_storeu_si256( o, p );
+        }
+
+        out = o;
+    }
+    else if ( fmt->bits_per_pixel == 24 )
+    {
+        unsigned char *o = out;
+        __m256i pack = fmt->msbfirst ?
+              _mm256_setr_epi8(  2,  1,  0,  6,  5,  4, 10,  9,
+                                 8, 14, 13, 12, -1, -1, -1, -1,
+                                 2,  1,  0,  6,  5,  4, 10,  9,
+                                 8, 14, 13, 12, -1, -1, -1, -1 )
+            : _mm256_setr_epi8(  0,  1,  2,  4,  5,  6,  8,  9,
+                                10, 12, 13, 14, -1, -1, -1, -1,
+                                 0,  1,  2,  4,  5,  6,  8,  9,
+                                10, 12, 13, 14, -1, -1, -1, -1 );
+
+        for ( ; i + 8 <= n; i += 8, o += 24 )
+        {
+            __m256i p = _mm256_shuffle_epi8( avx2_pix32( fmt, r + i, g + i,
+                                                         b + i ),
+                                             pack );
+            __m128i hi = _mm256_extracti128_si256( p, 1 );
+            int last;
+
+            /* 12 bytes from each lane, without writing past the end */
+
+            _mm_storeu_si128( ( __m128i * ) o, _mm256_castsi256_si128( p ) );
+            _mm_storel_epi64( ( __m128i * ) ( o + 12 ), hi );
+            last = _mm_cvtsi128_si32( _mm_srli_si128( hi, 8 ) );
+            memcpy( o + 20, &last, 4 );
+        }
+
+        out = o;
+    }
+    else if ( fmt->bits_per_pixel == 16 )
+    {
+        __m256i *o = out;
+        __m128i rrs = _mm_cvtsi32_si128( fmt->rrshift ),
+                rls = _mm_cvtsi32_si128( fmt->rlshift ),
+                grs = _mm_cvtsi32_si128( fmt->grshift ),
+                gls = _mm_cvtsi32_si128( fmt->glshift ),
+                brs = _mm_cvtsi32_si128( fmt->brshift ),
+                bls = _mm_cvtsi32_si128( fmt->blshift );
+        __m256i rm = _mm256_set1_epi16( fmt->rmask ),
+                gm = _mm256_set1_epi16( fmt->gmask ),
+                bm = _mm256_set1_epi16( fmt->bmask ),
+                am = _mm256_set1_epi16( fmt->alpha & 0xffff );
+
+        for ( ; i + 16 <= n; i += 16, o++ )
+        {
+            __m256i vr, vg, vb, p;
+
+            vr = _mm256_cvtepu8_epi16(
+                              _mm_loadu_si128( ( const __m128i * ) ( r + i ) ) );
+            vg = _mm256_cvtepu8_epi16(
+                              _mm_loadu_si128( ( const __m128i * ) ( g + i ) ) );
+            vb = _mm256_cvtepu8_epi16(
+                              _mm_loadu_si128( ( const __m128i * ) ( b + i ) ) );
+
+            vr = _mm256_and_si256(
+                     _mm256_sll_epi16( _mm256_srl_epi16( vr, rrs ), rls ), rm );
+            vg = _mm256_and_si256(
+                     _mm256_sll_epi16( _mm256_srl_epi16( vg, grs ), gls ), gm );
+            vb = _mm256_and_si256(
+                     _mm256_sll_epi16( _mm256_srl_epi16( vb, brs ), bls ), bm );
+            p = _mm256_or_si256( _mm256_or_si256( vr, vg ),
+                                 _mm256_or_si256( vb, am ) );
+
+            if ( fmt->swap )
+                p = _mm256_or_si256( _mm256_slli_epi16( p, 8 ),
+                                     _mm256_srli_epi16( p, 8 ) );
+
+            _mm256_storeu_si256( o, p );
+        }
+
+        out = o;
+    }
+
+    if ( i < n )
+        rgb2pix_c( fmt, r + i, g + i, b + i, out, n - i );
+}
+
+#endif   /* FLIMAGE_X86_SIMD */
+
+
+/***************************************
+ * Sets up the description of the pixel format of a TrueColor or
+ * DirectColor XImage. 'byte_order' is the byte order of the XImage,
+ * 'alpha' gets or'ed into each pixel. 'simd_level' restricts which
+ * kernel will be used, pass -1 to get the best one for the CPU.
+ ***************************************/
+
+void
+flimage_init_pixfmt( FLIMAGE_PIXFMT     * fmt,
+                     const FL_RGB2PIXEL * rgb2p,
+                     int                  bits_per_pixel,
+                     int                  byte_order,
+                     unsigned int         alpha,
+                     int                  simd_level )
+{
+    static unsigned short endian = 0x1234;
+    int machine_order = *( unsigned char * ) &endian == 0x12 ?
+                        MSBFirst : LSBFirst;
+
+    /* Channel values are first shifted to the right if the visual has
+       less than 8 bits for them, then to their position (and further
+       to the left if there are more than 8 bits) */
+
+    fmt->rrshift = rgb2p->rbits < 8 ? 8 - rgb2p->rbits : 0;
+    fmt->grshift = rgb2p->gbits < 8 ? 8 - rgb2p->gbits : 0;
+    fmt->brshift = rgb2p->bbits < 8 ? 8 - rgb2p->bbits : 0;
+    fmt->rlshift = rgb2p->rshift + ( rgb2p->rbits > 8 ? rgb2p->rbits - 8 : 0 );
+    fmt->glshift = rgb2p->gshift + ( rgb2p->gbits > 8 ? rgb2p->gbits - 8 : 0 );
+    fmt->blshift = rgb2p->bshift + ( rgb2p->bbits > 8 ? rgb2p->bbits - 8 : 0 );
+    fmt->rmask = rgb2p->rmask;
+    fmt->gmask = rgb2p->gmask;
+    fmt->bmask = rgb2p->bmask;
+    fmt->alpha = alpha;
+    fmt->bits_per_pixel = bits_per_pixel;
+    fmt->swap = bits_per_pixel > 8 && byte_order != machine_order;
+    fmt->msbfirst = byte_order == MSBFirst;
+
+    if ( simd_level < 0 || simd_level > flimage_simd_level( ) )
+        simd_level = flimage_simd_level( );
+
+    fmt->convert = rgb2pix_c;
+
+#ifdef FLIMAGE_X86_SIMD
+    /* Vector shifts take the same count for all lanes, so masks that
+       don't fit into 16 bits can't be dealt with for 16 bpp */
+
+    if ( bits_per_pixel == 16
+         && ( ( fmt->rmask | fmt->gmask | fmt->bmask ) & ~0xffffU ) )
+        return;
+
+    if ( simd_level >= FLIMAGE_SIMD_AVX2 && bits_per_pixel != 8 )
+        fmt->convert = rgb2pix_avx2;
+    else if (    simd_level >= FLIMAGE_SIMD_SSE2
+              && ( bits_per_pixel == 32 || bits_per_pixel == 16 ) )
+        fmt->convert = rgb2pix_sse2;
+#endif
+}
+
+
+/***************************************
+ * Multiply-accumulate of a row: acc[ i ] += k * in[ i ] for 0 <= i < n,
+ * for 8 bit, 16 bit and int input
+ ***************************************/
+
+#ifdef FLIMAGE_X86_SIMD
+
+__attribute__(( target( "avx2" ) ))
+static void
+madd_u8_avx2( int                 * acc,
+              const unsigned char * in,
+              int                   k,
+              int                   n )
+{
+    __m256i vk = _mm256_set1_epi32( k );
+    int i;
+
+    for ( i = 0; i + 8 <= n; i += 8 )
+    {
+        __m256i a = _mm256_loadu_si256( ( __m256i * ) ( acc + i ) ),
+                v = _mm256_cvtepu8_epi32(
+                            _mm_loadl_epi64( ( const __m128i * ) ( in + i ) ) );
+
+        a = _mm256_add_epi32( a, _mm256_mullo_epi32( v, vk ) );
+        _mm256_storeu_si256( ( __m256i * ) ( acc + i ), a );
+    }
+
+    for ( ; i < n; i++ )
+        acc[ i ] += k * in[ i ];
+}
+
+
+/***************************************
+ ***************************************/
+
+__attribute__(( target( "avx2" ) ))
+static void
+madd_u16_avx2( int                  * acc,
+               const unsigned short * in,
+               int                    k,
+               int                    n )
+{
+    __m256i vk = _mm256_set1_epi32( k );
+    int i;
+
+    for ( i = 0; i + 8 <= n; i += 8 )
+    {
+        __m256i a = _mm256_loadu_si256( ( __m256i * ) ( acc + i ) ),
+                v = _mm256_cvtepu16_epi32(
+                            _mm_loadu_si128( ( const __m128i * ) ( in + i ) ) );
+
+        a = _mm256_add_epi32( a, _mm256_mullo_epi32( v, vk ) );
+        _mm256_storeu_si256( ( __m256i * ) ( acc + i ), a );
+    }
+
+    for ( ; i < n; i++ )
+        acc[ i ] += k * in[ i ];
+}
+
+
+/***************************************
+ ***************************************/
+
+__attribute__(( target( "avx2" ) ))
+static void
+madd_i32_avx2( int       * acc,
+               const int * in,
+               int         k,
+               int         n )
+{
+    __m256i vk = _mm256_set1_epi32( k );
+    int i;
+
+    for ( i = 0; i + 8 <= n; i += 8 )
+    {
+        __m256i a = _mm256_loadu_si256( ( __m256i * ) ( acc + i ) ),
+                v = _mm256_loadu_si256( ( const __m256i * ) ( in + i ) );
+
+        a = _mm256_add_epi32( a, _mm256_mullo_epi32( v, vk ) );
+        _mm256_storeu_si256( ( __m256i * ) ( acc + i ), a );
+    }
+
+    for ( ; i < n; i++ )
+        acc[ i ] += k * in[ i ];
+}
+
+#endif   /* FLIMAGE_X86_SIMD */
+
+
+/***************************************
+ ***************************************/
+
+void
+flimage_madd_u8( int                 * acc,
+                 const unsigned char * in,
+                 int                   k,
+                 int                   n )
+{
+    int i;
+
+#ifdef FLIMAGE_X86_SIMD
+    if ( flimage_simd_level( ) >= FLIMAGE_SIMD_AVX2 )
+    {
+        madd_u8_avx2( acc, in, k, n );
+        return;
+    }
+#endif
+
+    for ( i = 0; i < n; i++ )
+        acc[ i ] += k * in[ i ];
+}
+
+
+/***************************************
+ ***************************************/
+
+void
+flimage_madd_u16( int                  * acc,
+                  const unsigned short * in,
+                  int                    k,
+                  int                    n )
+{
+    int i;
+
+#ifdef FLIMAGE_X86_SIMD
+    if ( flimage_simd_level( ) >= FLIMAGE_SIMD_AVX2 )
+    {
+        madd_u16_avx2( acc, in, k, n );
+        return;
+    }
+#endif
+
+    for ( i = 0; i < n; i++ )
+        acc[ i ] += k * in[ i ];
+}
+
+
+/***************************************
+ ***************************************/
+
+void
+flimage_madd_i32( int       * acc,
+                  const int * in,
+                  int         k,
+                  int         n )
+{
+    int i;
+
+#ifdef FLIMAGE_X86_SIMD
+    if ( flimage_simd_level( ) >= FLIMAGE_SIMD_AVX2 )
+    {
+        madd_i32_avx2( acc, in, k, n );
+        return;
+    }
+#endif
+
+    for ( i = 0; i < n; i++ )
+        acc[ i ] += k * in[ i ];
+}
+
+
+/***************************************
+ * Table lookup for a row of 16 bit values, out[ i ] = lut[ in[ i ] ] for
+ * 0 <= i < n ('in' and 'out' may be the same). The AVX2 version fetches
+ * each entry together with the one following it, so the table must have
+ * one more entry than the largest value in 'in' requires.
+ ***************************************/
+
+#ifdef FLIMAGE_X86_SIMD
+
+__attribute__(( target( "avx2" ) ))
+static void
+lut_u16_avx2( const unsigned short * lut,
+              const unsigned short * in,
+              unsigned short       * out,
+              int                    n )
+{
+    __m256i mask = _mm256_set1_epi32( 0xffff );
+    int i;
+
+    for ( i = 0; i + 16 <= n; i += 16 )
+    {
+        __m256i a = _mm256_cvtepu16_epi32(
+                            _mm_loadu_si128( ( const __m128i * ) ( in + i ) ) ),
+                b = _mm256_cvtepu16_epi32(
+                        _mm_loadu_si128( ( const __m128i * ) ( in + i + 8 ) ) );
+
+        a = _mm256_and_si256( _mm256_i32gather_epi32( ( const int * ) lut,
+                                                      a, 2 ), mask );
+        b = _mm256_and_si256( _mm256_i32gather_epi32( ( const int * ) lut,
+                                                      b, 2 ), mask );
+
+        /* packing works per 128 bit lane, so the quadwords need to be put
+           back into order */
+
+        a = _mm256_permute4x64_epi64( _mm256_packus_epi32( a, b ), 0xd8 );
+        _mm256_storeu_si256( ( __m256i * ) ( out + i ), a );
+    }
+
+    for ( ; i < n; i++ )
+        out[ i ] = lut[ in[ i ] ];
+}
+
+#endif   /* FLIMAGE_X86_SIMD */
+
+
+/***************************************
+ ***************************************/
+
+void
+flimage_lut_u16( const unsigned short * lut,
+                 const unsigned short * in,
+                 unsigned short       * out,
+                 int                    n )
+{
+    int i;
+
+#ifdef FLIMAGE_X86_SIMD
+    if ( flimage_simd_level( ) >= FLIMAGE_SIMD_AVX2 )
+    {
+        lut_u16_avx2( lut, in, out, n );
+        return;
+    }
+#endif
+
+    for ( i = 0; i < n; i++ )
+        out[ i ] = lut[ in[ i ] ];
+}
+
+
+/***************************************
+ * Transposing: out[ j * ostride + i ] = in[ i * istride + j ] for a
+ * block of rows x cols elements. The strides are in elements and may be
+ * negative, which makes the transpose a rotation by 90 degrees. The
+ * block is done in tiles of TRANSPOSE_TILE x TRANSPOSE_TILE elements,
+ * so both the rows read and the rows written stay in the cache, and the
+ * SSE2 versions transpose 16 x 16 bytes or 8 x 8 shorts in registers.
+ ***************************************/
+
+#define TRANSPOSE_TILE  64
+
+#define TRANSPOSE_C( type )                                             \
+static void                                                             \
+transpose_##type##_c( const type##_t * in,                              \
+                      long             istride,                         \
+                      type##_t       * out,                             \
+                      long             ostride,                         \
+                      int              rows,                            \
+                      int              cols )                           \
+{                                                                       \
+    int i,                                                              \
+        j;                                                              \
+                                                                        \
+    for ( i = 0; i < rows; i++, in += istride, out++ )                  \
+        for ( j = 0; j < cols; j++ )                                    \
+            out[ j * ostride ] = in[ j ];                               \
+}
+
+typedef unsigned char  u8_t;
+typedef unsigned short u16_t;
+
+TRANSPOSE_C( u8 )
+TRANSPOSE_C( u16 )
+
+
+#ifdef FLIMAGE_X86_SIMD
+
+/* With unpacking at every stage the transposed rows come out in an order
+   with the bits of their indices reversed */
+
+static const int bitrev[ 16 ] = { 0, 8, 4, 12, 2, 10, 6, 14,
+                                  1, 9, 5, 13, 3, 11, 7, 15 };
+
+
+/***************************************
+ ***************************************/
+
+__attribute__(( target( "sse2" ) ))
+static void
+transpose_u8_sse2( const unsigned char * in,
+                   long                  istride,
+                   unsigned char       * out,
+                   long                  ostride,
+                   int                   rows,
+                   int                   cols )
+{
+    __m128i x[ 16 ],
+            y[ 16 ];
+    int i,
+        j,
+        k;
+
+    for ( i = 0; i + 16 <= rows; i += 16 )
+        for ( j = 0; j + 16 <= cols; j += 16 )
+        {
+            for ( k = 0; k < 16; k++ )
+                x[ k ] = _mm_loadu_si128( ( const __m128i * )
+                                          ( in + ( i + k ) * istride + j ) );
+
+            for ( k = 0; k < 8; k++ )
+            {
+                y[ k     ] = _mm_unpacklo_epi8( x[ 2 * k ], x[ 2 * k + 1 ] );
+                y[ k + 8 ] = _mm_unpackhi_epi8( x[ 2 * k ], x[ 2 * k + 1 ] );
+            }
+
+            for ( k = 0; k < 8; k++ )
+            {
+                x[ k     ] = _mm_unpacklo_epi16( y[ 2 * k ], y[ 2 * k + 1 ] );
+                x[ k + 8 ] = _mm_unpackhi_epi16( y[ 2 * k ], y[ 2 * k + 1 ] );
+            }
+
+            for ( k = 0; k < 8; k++ )
+            {
+                y[ k     ] = _mm_unpacklo_epi32( x[ 2 * k ], x[ 2 * k + 1 ] );
+                y[ k + 8 ] = _mm_unpackhi_epi32( x[ 2 * k ], x[ 2 * k + 1 ] );
+            }
+
+            for ( k = 0; k < 8; k++ )
+            {
+                x[ k     ] = _mm_unpacklo_epi64( y[ 2 * k ], y[ 2 * k + 1 ] );
+                x[ k + 8 ] = _mm_unpackhi_epi64( y[ 2 * k ], y[ 2 * k + 1 ] );
+            }
+
+            for ( k = 0; k < 16; k++ )
+                _mm_storeu_si128( ( __m128i * )
+                                  ( out + ( j + bitrev[ k ] ) * ostride + i ),
+                                  x[ k ] );
+        }
+
+    /* what's left at the right and bottom edge */
+
+    j = cols & ~ 15;
+    transpose_u8_c( in + j, istride, out + j * ostride, ostride, rows,
+                    cols - j );
+    i = rows & ~ 15;
+    transpose_u8_c( in + i * istride, istride, out + i, ostride, rows - i, j );
+}
+
+
+/***************************************
+ ***************************************/
+
+__attribute__(( target( "sse2" ) ))
+static void
+transpose_u16_sse2( const unsigned short * in,
+                    long                   istride,
+                    unsigned short       * out,
+                    long                   ostride,
+                    int                    rows,
+                    int                    cols )
+{
+    __m128i x[ 8 ],
+            y[ 8 ];
+    int i,
+        j,
+        k;
+
+    for ( i = 0; i + 8 <= rows; i += 8 )
+        for ( j = 0; j + 8 <= cols; j += 8 )
+        {
+            for ( k = 0; k < 8; k++ )
+                x[ k ] = _mm_loadu_si128( ( const __m128i * )
+                                          ( in + ( i + k ) * istride + j ) );
+
+            for ( k = 0; k < 4; k++ )
+            {
+                y[ k     ] = _mm_unpacklo_epi16( x[ 2 * k ], x[ 2 * k + 1 ] );
+                y[ k + 4 ] = _mm_unpackhi_epi16( x[ 2 * k ], x[ 2 * k + 1 ] );
+            }
+
+            for ( k = 0; k < 4; k++ )
+            {
+                x[ k     ] = _mm_unpacklo_epi32( y[ 2 * k ], y[ 2 * k + 1 ] );
+                x[ k + 4 ] = _mm_unpackhi_epi32( y[ 2 * k ], y[ 2 * k + 1 ] );
+            }
+
+            for ( k = 0; k < 4; k++ )
+            {
+                y[ k     ] = _mm_unpacklo_epi64( x[ 2 * k ], x[ 2 * k + 1 ] );
+                y[ k + 4 ] = _mm_unpackhi_epi64( x[ 2 * k ], x[ 2 * k + 1 ] );
+            }
+
+            /* 3 bit reversal, i.e., every other entry of the 4 bit one */
+
+            for ( k = 0; k < 8; k++ )
+                _mm_storeu_si128( ( __m128i * )
+                                  ( out + ( j + bitrev[ 2 * k ] ) * ostride
+                                    + i ),
+                                  y[ k ] );
+        }
+
+    j = cols & ~ 7;
+    transpose_u16_c( in + j, istride, out + j * ostride, ostride, rows,
+                     cols - j );
+    i = rows & ~ 7;
+    transpose_u16_c( in + i * istride, istride, out + i, ostride, rows - i,
+                     j );
+}
+
+#endif   /* FLIMAGE_X86_SIMD */
+
+
+/***************************************
+ ***************************************/
+
+void
+flimage_transpose_u8( const unsigned char * in,
+                      long                  istride,
+                      unsigned char       * out,
+                      long                  ostride,
+                      int                   rows,
+                      int                   cols )
+{
+    void ( * tile )( const unsigned char *, long, unsigned char *, long,
+                     int, int ) = transpose_u8_c;
+    int i,
+        j;
+
+#ifdef FLIMAGE_X86_SIMD
+    if ( flimage_simd_level( ) >= FLIMAGE_SIMD_SSE2 )
+        tile = transpose_u8_sse2;
+#endif
+
+    for ( i = 0; i < rows; i += TRANSPOSE_TILE )
+        for ( j = 0; j < cols; j += TRANSPOSE_TILE )
+            tile( in + i * istride + j, istride, out + j * ostride + i,
+                  ostride, FL_min( TRANSPOSE_TILE, rows - i ),
+                  FL_min( TRANSPOSE_TILE, cols - j ) );
+}
+
+
+/***************************************
+ ***************************************/
+
+void
+flimage_transpose_u16( const unsigned short * in,
+                       long                   istride,
+                       unsigned short       * out,
+                       long                   ostride,
+                       int                    rows,
+                       int                    cols )
+{
+    void ( * tile )( const unsigned short *, long, unsigned short *, long,
+                     int, int ) = transpose_u16_c;
+    int i,
+        j;
+
+#ifdef FLIMAGE_X86_SIMD
+    if ( flimage_simd_level( ) >= FLIMAGE_SIMD_SSE2 )
+        tile = transpose_u16_sse2;
+#endif
+
+    for ( i = 0; i < rows; i += TRANSPOSE_TILE )
+        for ( j = 0; j < cols; j += TRANSPOSE_TILE )
+            tile( in + i * istride + j, istride, out + j * ostride + i,
+                  ostride, FL_min( TRANSPOSE_TILE, rows - i ),
+                  FL_min( TRANSPOSE_TILE, cols - j ) );
+}
+
+
+/***************************************
+ * Exchanges p[ i ] and q[ n - 1 - i ] for 0 <= i < n, so each row ends
+ * up with the other one's elements in reverse order. If p and q are the
+ * same row it just gets reversed.
+ ***************************************/
+
+#ifdef FLIMAGE_X86_SIMD
+
+__attribute__(( target( "sse2" ) ))
+static inline __m128i
+reverse_u16_sse2( __m128i v )
+{
+    v = _mm_shufflehi_epi16( _mm_shufflelo_epi16( v, 0x1b ), 0x1b );
+    return _mm_shuffle_epi32( v, 0x4e );
+}
+
+
+/***************************************
+ ***************************************/
+
+__attribute__(( target( "sse2" ) ))
+static inline __m128i
+reverse_u8_sse2( __m128i v )
+{
+    return reverse_u16_sse2( _mm_or_si128( _mm_slli_epi16( v, 8 ),
+                                           _mm_srli_epi16( v, 8 ) ) );
+}
+
+
+/***************************************
+ * Does the part of the rows that can be done in vectors, returns how
+ * many elements of p that are
+ ***************************************/
+
+__attribute__(( target( "sse2" ) ))
+static int
+swap_reverse_u8_sse2( unsigned char * p,
+                      unsigned char * q,
+                      int             n )
+{
+    int lim = p == q ? n / 2 : n,
+        i;
+
+    for ( i = 0; i + 16 <= lim; i += 16 )
+    {
+        __m128i a = _mm_loadu_si128( ( __m128i * ) ( p + i ) ),
+                b = _mm_loadu_si128( ( __m128i * ) ( q + n - 16 - i ) );
+
+        _mm_storeu_si128( ( __m128i * ) ( p + i ), reverse_u8_sse2( b ) );
+        _mm_storeu_si128( ( __m128i * ) ( q + n - 16 - i ),
+                          reverse_u8_sse2( a ) );
+    }
+
+    return i;
+}
+
+
+/***************************************
+ ***************************************/
+
+__attribute__(( target( "sse2" ) ))
+static int
+swap_reverse_u16_sse2( unsigned short * p,
+                       unsigned short * q,
+                       int              n )
+{
+    int lim = p == q ? n / 2 : n,
+        i;
+
+    for ( i = 0; i + 8 <= lim; i += 8 )
+    {
+        __m128i a = _mm_loadu_si128( ( __m128i * ) ( p + i ) ),
+                b = _mm_loadu_si128( ( __m128i * ) ( q + n - 8 - i ) );
+
+        _mm_storeu_si128( ( __m128i * ) ( p + i ), reverse_u16_sse2( b ) );
+        _mm_storeu_si128( ( __m128i * ) ( q + n - 8 - i ),
+                          reverse_u16_sse2( a ) );
+    }
+
+    return i;
+}
+
+#endif   /* FLIMAGE_X86_SIMD */
+
+
+/***************************************
+ ***************************************/
+
+void
+flimage_swap_reverse_u8( unsigned char * p,
+                         unsigned char * q,
+                         int             n )
+{
+    unsigned char t;
+    int lim = p == q ? n / 2 : n,
+        i = 0;
+
+#ifdef FLIMAGE_X86_SIMD
+    if ( flimage_simd_level( ) >= FLIMAGE_SIMD_SSE2 )
+        i = swap_reverse_u8_sse2( p, q, n );
+#endif
+
+    for ( ; i < lim; i++ )
+    {
+        t = p[ i ];
+        p[ i ] = q[ n - 1 - i ];
+        q[ n - 1 - i ] = t;
+    }
+}
+
+
+/***************************************
+ ***************************************/
+
+void
+flimage_swap_reverse_u16( unsigned short * p,
+                          unsigned short * q,
+                          int              n )
+{
+    unsigned short t;
+    int lim = p == q ? n / 2 : n,
+        i = 0;
+
+#ifdef FLIMAGE_X86_SIMD
+    if ( flimage_simd_level( ) >= FLIMAGE_SIMD_SSE2 )
+        i = swap_reverse_u16_sse2( p, q, n );
+#endif
+
+    for ( ; i < lim; i++ )
+    {
+        t = p[ i ];
+        p[ i ] = q[ n - 1 - i ];
+        q[ n - 1 - i ] = t;
+    }
+}
+
+
+/***************************************
+ * Bilinear interpolation for warping: output pixel k of each of the
+ * 'nplanes' planes is interpolated at x = X + k * DX, y = Y + k * DY,
+ * coordinates in 16.16 fixed point that must all lie inside the image,
+ * i.e., 0 <= x < w - 1 and 0 <= y < h - 1. The planes are contiguous
+ * with 'stride' elements per row. Weights have 8 bits for bytes and 12
+ * bits for shorts (with the horizontally interpolated values kept with
+ * 4 fractional bits) and the result is rounded, all of which the AVX2
+ * versions (with gathers for the 2 x 2 pixel neighbourhoods) reproduce
+ * exactly.
+ ***************************************/
+
+static void
+bilerp_u8_c( const unsigned char * const * in,
+             long                          stride,
+             unsigned char * const       * out,
+             int                           nplanes,
+             int                           X,
+             int                           Y,
+             int                           DX,
+             int                           DY,
+             int                           n )
+{
+    const unsigned char *p0;
+    unsigned int t0,
+                 t1;
+    int k,
+        c,
+        fx,
+        fy;
+
+    for ( k = 0; k < n; k++, X += DX, Y += DY )
+    {
+        fx = ( X >> 8 ) & 0xff;
+        fy = ( Y >> 8 ) & 0xff;
+
+        for ( c = 0; c < nplanes; c++ )
+        {
+            p0 = in[ c ] + ( Y >> 16 ) * stride + ( X >> 16 );
+            t0 = p0[ 0 ] * ( 256 - fx ) + p0[ 1 ] * fx;
+            t1 = p0[ stride ] * ( 256 - fx ) + p0[ stride + 1 ] * fx;
+            out[ c ][ k ] = ( t0 * 256 + ( t1 - t0 ) * fy + 0x8000 ) >> 16;
+        }
+    }
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+bilerp_u16_c( const unsigned short * const * in,
+              long                           stride,
+              unsigned short * const       * out,
+              int                            nplanes,
+              int                            X,
+              int                            Y,
+              int                            DX,
+              int                            DY,
+              int                            n )
+{
+    const unsigned short *p0;
+    unsigned int t0,
+                 t1;
+    int k,
+        c,
+        fx,
+        fy;
+
+    for ( k = 0; k < n; k++, X += DX, Y += DY )
+    {
+        fx = ( X >> 4 ) & 0xfff;
+        fy = ( Y >> 4 ) & 0xfff;
+
+        for ( c = 0; c < nplanes; c++ )
+        {
+            p0 = in[ c ] + ( Y >> 16 ) * stride + ( X >> 16 );
+            t0 = ( p0[ 0 ] * 4096 + ( p0[ 1 ] - p0[ 0 ] ) * fx + 0x80 ) >> 8;
+            t1 = (   p0[ stride ] * 4096
+                   + ( p0[ stride + 1 ] - p0[ stride ] ) * fx + 0x80 ) >> 8;
+            out[ c ][ k ] = ( t0 * 4096 + ( t1 - t0 ) * fy + 0x8000 ) >> 16;
+        }
+    }
+}
+
+
+#ifdef FLIMAGE_X86_SIMD
+
+/***************************************
+ * For the bytes the gathers read 4 bytes at the upper left pixel and 4
+ * bytes ending with the lower right one, so nothing outside of the
+ * plane gets touched.
+ ***************************************/
+
+__attribute__(( target( "avx2" ) ))
+static int
+bilerp_u8_avx2( const unsigned char * const * in,
+                long                          stride,
+                unsigned char * const       * out,
+                int                           nplanes,
+                int                           X,
+                int                           Y,
+                int                           DX,
+                int                           DY,
+                int                           n )
+{
+    const __m256i lane = _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 ),
+                  m8 = _mm256_set1_epi32( 0xff ),
+                  c256 = _mm256_set1_epi32( 256 ),
+                  half = _mm256_set1_epi32( 0x8000 ),
+                  vstride = _mm256_set1_epi32( stride ),
+                  lo = _mm256_setr_epi8( 0, -1, 1, -1, 4, -1, 5, -1,
+                                         8, -1, 9, -1, 12, -1, 13, -1,
+                                         0, -1, 1, -1, 4, -1, 5, -1,
+                                         8, -1, 9, -1, 12, -1, 13, -1 ),
+                  hi = _mm256_setr_epi8( 2, -1, 3, -1, 6, -1, 7, -1,
+                                         10, -1, 11, -1, 14, -1, 15, -1,
+                                         2, -1, 3, -1, 6, -1, 7, -1,
+                                         10, -1, 11, -1, 14, -1, 15, -1 ),
+                  bytes = _mm256_setr_epi8( 0, 4, 8, 12, -1, -1, -1, -1,
+                                            -1, -1, -1, -1, -1, -1, -1, -1,
+                                            0, 4, 8, 12, -1, -1, -1, -1,
+                                            -1, -1, -1, -1, -1, -1, -1, -1 ),
+                  join = _mm256_setr_epi32( 0, 4, 1, 1, 1, 1, 1, 1 );
+    __m256i vx = _mm256_add_epi32( _mm256_set1_epi32( X ),
+                                   _mm256_mullo_epi32( lane,
+                                                   _mm256_set1_epi32( DX ) ) ),
+            vy = _mm256_add_epi32( _mm256_set1_epi32( Y ),
+                                   _mm256_mullo_epi32( lane,
+                                                   _mm256_set1_epi32( DY ) ) ),
+            dx8 = _mm256_set1_epi32( 8 * DX ),
+            dy8 = _mm256_set1_epi32( 8 * DY ),
+            fx,
+            fy,
+            wx,
+            off,
+            g0,
+            g1,
+            t0,
+            t1,
+            v;
+    int k,
+        c;
+
+    for ( k = 0; k + 8 <= n; k += 8 )
+    {
+        fx = _mm256_and_si256( _mm256_srai_epi32( vx, 8 ), m8 );
+        fy = _mm256_and_si256( _mm256_srai_epi32( vy, 8 ), m8 );
+        wx = _mm256_or_si256( _mm256_sub_epi32( c256, fx ),
+                              _mm256_slli_epi32( fx, 16 ) );
+        off = _mm256_add_epi32( _mm256_mullo_epi32( _mm256_srai_epi32( vy, 16 ),
+                                                    vstride ),
+                                _mm256_srai_epi32( vx, 16 ) );
+
+        for ( c = 0; c < nplanes; c++ )
+        {
+            g0 = _mm256_i32gather_epi32( ( const int * ) in[ c ], off, 1 );
+            g1 = _mm256_i32gather_epi32( ( const int * )
+                                         ( in[ c ] + stride - 2 ), off, 1 );
+
+            /* pairs of horizontal neighbours as 16 bit values, multiplied
+               with their weights and added */
+
+            t0 = _mm256_madd_epi16( _mm256_shuffle_epi8( g0, lo ), wx );
+            t1 = _mm256_madd_epi16( _mm256_shuffle_epi8( g1, hi ), wx );
+
+            v = _mm256_add_epi32( _mm256_slli_epi32( t0, 8 ),
+                                  _mm256_mullo_epi32( _mm256_sub_epi32( t1,
+                                                                        t0 ),
+                                                      fy ) );
+            v = _mm256_srli_epi32( _mm256_add_epi32( v, half ), 16 );
+            v = _mm256_permutevar8x32_epi32( _mm256_shuffle_epi8( v, bytes ),
+                                             join );
+            _mm_storel_epi64( ( __m128i * ) ( out[ c ] + k ),
+                              _mm256_castsi256_si128( v ) );
+        }
+
+        vx = _mm256_add_epi32( vx, dx8 );
+        vy = _mm256_add_epi32( vy, dy8 );
+    }
+
+    return k;
+}
+
+
+/***************************************
+ ***************************************/
+
+__attribute__(( target( "avx2" ) ))
+static int
+bilerp_u16_avx2( const unsigned short * const * in,
+                 long                           stride,
+                 unsigned short * const       * out,
+                 int                            nplanes,
+                 int                            X,
+                 int                            Y,
+                 int                            DX,
+                 int                            DY,
+                 int                            n )
+{
+    const __m256i lane = _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 ),
+                  m12 = _mm256_set1_epi32( 0xfff ),
+                  m16 = _mm256_set1_epi32( 0xffff ),
+                  r8 = _mm256_set1_epi32( 0x80 ),
+                  half = _mm256_set1_epi32( 0x8000 ),
+                  vstride = _mm256_set1_epi32( stride );
+    __m256i vx = _mm256_add_epi32( _mm256_set1_epi32( X ),
+                                   _mm256_mullo_epi32( lane,
+                                                   _mm256_set1_epi32( DX ) ) ),
+            vy = _mm256_add_epi32( _mm256_set1_epi32( Y ),
+                                   _mm256_mullo_epi32( lane,
+                                                   _mm256_set1_epi32( DY ) ) ),
+            dx8 = _mm256_set1_epi32( 8 * DX ),
+            dy8 = _mm256_set1_epi32( 8 * DY ),
+            fx,
+            fy,
+            off,
+            g,
+            s,
+            t0,
+            t1,
+            v;
+    int k,
+        c;
+
+    for ( k = 0; k + 8 <= n; k += 8 )
+    {
+        fx = _mm256_and_si256( _mm256_srai_epi32( vx, 4 ), m12 );
+        fy = _mm256_and_si256( _mm256_srai_epi32( vy, 4 ), m12 );
+        off = _mm256_add_epi32( _mm256_mullo_epi32( _mm256_srai_epi32( vy, 16 ),
+                                                    vstride ),
+                                _mm256_srai_epi32( vx, 16 ) );
+
+        for ( c = 0; c < nplanes; c++ )
+        {
+            g = _mm256_i32gather_epi32( ( const int * ) in[ c ], off, 2 );
+            s = _mm256_and_si256( g, m16 );
+            t0 = _mm256_add_epi32( _mm256_slli_epi32( s, 12 ),
+                      _mm256_mullo_epi32( _mm256_sub_epi32(
+                                              _mm256_srli_epi32( g, 16 ), s ),
+                                          fx ) );
+            t0 = _mm256_srli_epi32( _mm256_add_epi32( t0, r8 ), 8 );
+
+            g = _mm256_i32gather_epi32( ( const int * ) ( in[ c ] + stride ),
+                                        off, 2 );
+            s = _mm256_and_si256( g, m16 );
+            t1 = _mm256_add_epi32( _mm256_slli_epi32( s, 12 ),
+                      _mm256_mullo_epi32( _mm256_sub_epi32(
+                                              _mm256_srli_epi32( g, 16 ), s ),
+                                          fx ) );
+            t1 = _mm256_srli_epi32( _mm256_add_epi32( t1, r8 ), 8 );
+
+            v = _mm256_add_epi32( _mm256_slli_epi32( t0, 12 ),
+                                  _mm256_mullo_epi32( _mm256_sub_epi32( t1,
+                                                                        t0 ),
+                                                      fy ) );
+            v = _mm256_srli_epi32( _mm256_add_epi32( v, half ), 16 );
+            v = _mm256_permute4x64_epi64( _mm256_packus_epi32( v, v ), 0x08 );
+            _mm_storeu_si128( ( __m128i * ) ( out[ c ] + k ),
+                              _mm256_castsi256_si128( v ) );
+        }
+
+        vx = _mm256_add_epi32( vx, dx8 );
+        vy = _mm256_add_epi32( vy, dy8 );
+    }
+
+    return k;
+}
+
+#endif   /* FLIMAGE_X86_SIMD */
+
+
+/***************************************
+ ***************************************/
+
+void
+flimage_bilerp_u8( const unsigned char * const * in,
+                   long                          stride,
+                   unsigned char * const       * out,
+                   int                           nplanes,
+                   int                           X,
+                   int                           Y,
+                   int                           DX,
+                   int                           DY,
+                   int                           n )
+{
+    unsigned char *o[ 3 ];
+    int k = 0,
+        c;
+
+#ifdef FLIMAGE_X86_SIMD
+    if ( flimage_simd_level( ) >= FLIMAGE_SIMD_AVX2 )
+        k = bilerp_u8_avx2( in, stride, out, nplanes, X, Y, DX, DY, n );
+#endif
+
+    if ( k == 0 )
+    {
+        bilerp_u8_c( in, stride, out, nplanes, X, Y, DX, DY, n );
+        return;
+    }
+
+    for ( c = 0; c < nplanes; c++ )
+        o[ c ] = out[ c ] + k;
+
+    bilerp_u8_c( in, stride, o, nplanes, X + k * DX, Y + k * DY, DX, DY,
+                 n - k );
+}
+
+
+/***************************************
+ ***************************************/
+
+void
+flimage_bilerp_u16( const unsigned short * const * in,
+                    long                           stride,
+                    unsigned short * const       * out,
+                    int                            nplanes,
+                    int                            X,
+                    int                            Y,
+                    int                            DX,
+                    int                            DY,
+                    int                            n )
+{
+    unsigned short *o[ 3 ];
+    int k = 0,
+        c;
+
+#ifdef FLIMAGE_X86_SIMD
+    if ( flimage_simd_level( ) >= FLIMAGE_SIMD_AVX2 )
+        k = bilerp_u16_avx2( in, stride, out, nplanes, X, Y, DX, DY, n );
+#endif
+
+    if ( k == 0 )
+    {
+        bilerp_u16_c( in, stride, out, nplanes, X, Y, DX, DY, n );
+        return;
+    }
+
+    for ( c = 0; c < nplanes; c++ )
+        o[ c ] = out[ c ] + k;
+
+    bilerp_u16_c( in, stride, o, nplanes, X + k * DX, Y + k * DY, DX, DY,
+                  n - k );
+}
+
+
+
+/***********************************************************************
+ * Row kernels for the image type conversions (see image_type.c). The
+ * vectorized versions of the ones dealing with packed pixels rely on the
+ * default layout of 8 bits per component with red in the lowest byte.
+ ***********************************************************************/
+
+#if    FL_PCBITS == 8 && FL_RSHIFT == 0 && FL_GSHIFT == 8  \
+    && FL_BSHIFT == 16 && FL_ASHIFT == 24
+#define PACKED_RGBA8  1
+#endif
+
+
+/***************************************
+ * Splits n packed pixels into separate components, 'a' may be NULL if
+ * the alpha values aren't needed
+ ***************************************/
+
+#if defined FLIMAGE_X86_SIMD && defined PACKED_RGBA8
+
+__attribute__(( target( "avx2" ) ))
+static int
+unpack_rgba_avx2( const FL_PACKED * p,
+                  unsigned char   * r,
+                  unsigned char   * g,
+                  unsigned char   * b,
+                  unsigned char   * a,
+                  int               n )
+{
+    /* gathers the bytes of each component of 4 pixels in one dword per
+       128 bit lane, the dword permutation afterwards restores the pixel
+       order the unpacking between the lanes messed up */
+
+    __m256i comp = _mm256_setr_epi8( 0, 4, 8, 12, 1, 5, 9, 13,
+                                     2, 6, 10, 14, 3, 7, 11, 15,
+                                     0, 4, 8, 12, 1, 5, 9, 13,
+                                     2, 6, 10, 14, 3, 7, 11, 15 ),
+            order = _mm256_setr_epi32( 0, 4, 1, 5, 2, 6, 3, 7 );
+    int i;
+
+    for ( i = 0; i + 32 <= n; i += 32 )
+    {
+        const __m256i *src = ( const __m256i * ) ( p + i );
+        __m256i v0 = _mm256_shuffle_epi8( _mm256_loadu_si256( src     ), comp ),
+                v1 = _mm256_shuffle_epi8( _mm256_loadu_si256( src + 1 ), comp ),
+                v2 = _mm256_shuffle_epi8( _mm256_loadu_si256( src + 2 ), comp ),
+                v3 = _mm256_shuffle_epi8( _mm256_loadu_si256( src + 3 ), comp ),
+                rg01 = _mm256_unpacklo_epi32( v0, v1 ),
+                ba01 = _mm256_unpackhi_epi32( v0, v1 ),
+                rg23 = _mm256_unpacklo_epi32( v2, v3 ),
+                ba23 = _mm256_unpackhi_epi32( v2, v3 );
+
+        _mm256_storeu_si256( ( __m256i * ) ( r + i ),
+                             _mm256_permutevar8x32_epi32(
+                                 _mm256_unpacklo_epi64( rg01, rg23 ), order ) );
+        _mm256_storeu_si256( ( __m256i * ) ( g + i ),
+                             _mm256_permutevar8x32_epi32(
+                                 _mm256_unpackhi_epi64( rg01, rg23 ), order ) );
+        _mm256_storeu_si256( ( __m256i * ) ( b + i ),
+                             _mm256_permutevar8x32_epi32(
+                                 _mm256_unpacklo_epi64( ba01, ba23 ), order ) );
+        if ( a )
+            _mm256_storeu_si256( ( __m256i * ) ( a + i ),
+                                 _mm256_permutevar8x32_epi32(
+                                     _mm256_unpackhi_epi64( ba01, ba23 ),
+                                     order ) );
+    }
+
+    return i;
+}
+
+#endif
+
+
+/***************************************
+ ***************************************/
+
+void
+flimage_unpack_rgba( const FL_PACKED * p,
+                     unsigned char   * r,
+                     unsigned char   * g,
+                     unsigned char   * b,
+                     unsigned char   * a,
+                     int               n )
+{
+    int i = 0;
+
+#if defined FLIMAGE_X86_SIMD && defined PACKED_RGBA8
+    if ( flimage_simd_level( ) >= FLIMAGE_SIMD_AVX2 )
+        i = unpack_rgba_avx2( p, r, g, b, a, n );
+#endif
+
+    for ( ; i < n; i++ )
+    {
+        r[ i ] = FL_GETR( p[ i ] );
+        g[ i ] = FL_GETG( p[ i ] );
+        b[ i ] = FL_GETB( p[ i ] );
+        if ( a )
+            a[ i ] = FL_GETA( p[ i ] );
+    }
+}
+
+
+/***************************************
+ * Combines n sets of components into packed pixels, if 'a' is NULL the
+ * alpha values are 0
+ ***************************************/
+
+#if defined FLIMAGE_X86_SIMD && defined PACKED_RGBA8
+
+__attribute__(( target( "sse2" ) ))
+static int
+pack_rgba_sse2( const unsigned char * r,
+                const unsigned char * g,
+                const unsigned char * b,
+                const unsigned char * a,
+                FL_PACKED           * p,
+                int                   n )
+{
+    __m128i *dst;
+    int i;
+
+    for ( i = 0; i + 16 <= n; i += 16 )
+    {
+        __m128i vr = _mm_loadu_si128( ( const __m128i * ) ( r + i ) ),
+                vg = _mm_loadu_si128( ( const __m128i * ) ( g + i ) ),
+                vb = _mm_loadu_si128( ( const __m128i * ) ( b + i ) ),
+                va = a ? _mm_loadu_si128( ( const __m128i * ) ( a + i ) )
+                       : _mm_setzero_si128( ),
+                rg0 = _mm_unpacklo_epi8( vr, vg ),
+                rg1 = _mm_unpackhi_epi8( vr, vg ),
+                ba0 = _mm_unpacklo_epi8( vb, va ),
+                ba1 = _mm_unpackhi_epi8( vb, va );
+
+        dst = ( __m128i * ) ( p + i );
+        _mm_storeu_si128( dst,     _mm_unpacklo_epi16( rg0, ba0 ) );
+        _mm_storeu_si128( dst + 1, _mm_unpackhi_epi16( rg0, ba0 ) );
+        _mm_storeu_si128( dst + 2, _mm_unpacklo_epi16( rg1, ba1 ) );
+        _mm_storeu_si128( dst + 3, _mm_unpackhi_epi16( rg1, ba1 ) );
+    }
+
+    return i;
+}
+
+#endif
+
+
+/***************************************
+ ***************************************/
+
+void
+flimage_pack_rgba( const unsigned char * r,
+                   const unsigned char * g,
+                   const unsigned char * b,
+                   const unsigned char * a,
+                   FL_PACKED           * p,
+                   int                   n )
+{
+    int i = 0;
+
+#if defined FLIMAGE_X86_SIMD && defined PACKED_RGBA8
+    if ( flimage_simd_level( ) >= FLIMAGE_SIMD_SSE2 )
+        i = pack_rgba_sse2( r, g, b, a, p, n );
+#endif
+
+    for ( ; i < n; i++ )
+        p[ i ] = FL_PACK4( r[ i ], g[ i ], b[ i ], a ? a[ i ] : 0 );
+}
+
+
+/***************************************
+ * Gray values of n pixels given as separate components
+ ***************************************/
+
+#ifdef FLIMAGE_X86_SIMD
+
+__attribute__(( target( "avx2" ) ))
+static int
+rgb_to_gray_avx2( const unsigned char * r,
+                  const unsigned char * g,
+                  const unsigned char * b,
+                  unsigned short      * gray,
+                  int                   n )
+{
+    __m256i wr = _mm256_set1_epi16( 78 ),
+            wg = _mm256_set1_epi16( 150 ),
+            wb = _mm256_set1_epi16( 28 );
+    int i;
+
+    /* 78 + 150 + 28 = 256, so the sums fit into 16 bits */
+
+    for ( i = 0; i + 16 <= n; i += 16 )
+    {
+        __m256i vr = _mm256_cvtepu8_epi16(
+                            _mm_loadu_si128( ( const __m128i * ) ( r + i ) ) ),
+                vg = _mm256_cvtepu8_epi16(
+                            _mm_loadu_si128( ( const __m128i * ) ( g + i ) ) ),
+                vb = _mm256_cvtepu8_epi16(
+                            _mm_loadu_si128( ( const __m128i * ) ( b + i ) ) ),
+                s = _mm256_add_epi16( _mm256_add_epi16(
+                                               _mm256_mullo_epi16( vr, wr ),
+                                               _mm256_mullo_epi16( vg, wg ) ),
+                                      _mm256_mullo_epi16( vb, wb ) );
+
+        _mm256_storeu_si256( ( __m256i * ) ( gray + i ),
+                             _mm256_srli_epi16( s, 8 ) );
+    }
+
+    return i;
+}
+
+#endif
+
+
+/***************************************
+ ***************************************/
+
+void
+flimage_rgb_to_gray( const unsigned char * r,
+                     const unsigned char * g,
+                     const unsigned char * b,
+                     unsigned short      * gray,
+                     int                   n )
+{
+    int i = 0;
+
+#ifdef FLIMAGE_X86_SIMD
+    if ( flimage_simd_level( ) >= FLIMAGE_SIMD_AVX2 )
+        i = rgb_to_gray_avx2( r, g, b, gray, n );
+#endif
+
+    for ( ; i < n; i++ )
+        gray[ i ] = FL_RGB2GRAY( r[ i ], g[ i ], b[ i ] );
+}
+
+
+/***************************************
+ * Gray values of n packed pixels
+ ***************************************/
+
+#if defined FLIMAGE_X86_SIMD && defined PACKED_RGBA8
+
+__attribute__(( target( "avx2" ) ))
+static __m256i
+packed_gray_avx2( __m256i v )
+{
+    /* red and blue as the two 16 bit halves of each pixel get weighted
+       in one go, green is alone in the low half after the shift */
+
+    __m256i rb = _mm256_and_si256( v, _mm256_set1_epi32( 0x00ff00ff ) ),
+            g  = _mm256_and_si256( _mm256_srli_epi32( v, 8 ),
+                                   _mm256_set1_epi32( 0xff ) );
+
+    rb = _mm256_madd_epi16( rb, _mm256_set1_epi32( ( 28 << 16 ) | 78 ) );
+    g  = _mm256_madd_epi16( g, _mm256_set1_epi32( 150 ) );
+
+    return _mm256_srli_epi32( _mm256_add_epi32( rb, g ), 8 );
+}
+
+
+/***************************************
+ ***************************************/
+
+__attribute__(( target( "avx2" ) ))
+static int
+packed_to_gray_avx2( const FL_PACKED * p,
+                     unsigned short  * gray,
+                     int               n )
+{
+    int i;
+
+    for ( i = 0; i + 16 <= n; i += 16 )
+    {
+        __m256i lo = packed_gray_avx2( _mm256_loadu_si256(
+                                           ( const __m256i * ) ( p + i ) ) ),
+                hi = packed_gray_avx2( _mm256_loadu_si256(
+                                       ( const __m256i * ) ( p + i + 8 ) ) );
+
+        _mm256_storeu_si256( ( __m256i * ) ( gray + i ),
+                             _mm256_permute4x64_epi64(
+                                 _mm256_packus_epi32( lo, hi ), 0xd8 ) );
+    }
+
+    return i;
+}
+
+#endif
+
+
+/***************************************
+ ***************************************/
+
+void
+flimage_packed_to_gray( const FL_PACKED * p,
+                        unsigned short  * gray,
+                        int               n )
+{
+    int i = 0;
+
+#if defined FLIMAGE_X86_SIMD && defined PACKED_RGBA8
+    if ( flimage_simd_level( ) >= FLIMAGE_SIMD_AVX2 )
+        i = packed_to_gray_avx2( p, gray, n );
+#endif
+
+    for ( ; i < n; i++ )
+        gray[ i ] = FL_RGB2GRAY( FL_GETR( p[ i ] ),
+                                 FL_GETG( p[ i ] ),
+                                 FL_GETB( p[ i ] ) );
+}
+
+
+/***************************************
+ * Narrows n 16 bit values to 8 bits, keeping just the low bits just
+ * like an assignment does
+ ***************************************/
+
+#ifdef FLIMAGE_X86_SIMD
+
+__attribute__(( target( "sse2" ) ))
+static int
+u16_to_u8_sse2( const unsigned short * in,
+                unsigned char        * out,
+                int                    n )
+{
+    __m128i mask = _mm_set1_epi16( 0xff );
+    int i;
+
+    for ( i = 0; i + 16 <= n; i += 16 )
+    {
+        __m128i lo = _mm_and_si128( _mm_loadu_si128(
+                                      ( const __m128i * ) ( in + i ) ), mask ),
+                hi = _mm_and_si128( _mm_loadu_si128(
+                                  ( const __m128i * ) ( in + i + 8 ) ), mask );
+
+        _mm_storeu_si128( ( __m128i * ) ( out + i ),
+                          _mm_packus_epi16( lo, hi ) );
+    }
+
+    return i;
+}
+
+#endif
+
+
+/***************************************
+ ***************************************/
+
+void
+flimage_u16_to_u8( const unsigned short * in,
+                   unsigned char        * out,
+                   int                    n )
+{
+    int i = 0;
+
+#ifdef FLIMAGE_X86_SIMD
+    if ( flimage_simd_level( ) >= FLIMAGE_SIMD_SSE2 )
+        i = u16_to_u8_sse2( in, out, n );
+#endif
+
+    for ( ; i < n; i++ )
+        out[ i ] = in[ i ];
+}
+
+
+/***************************************
+ * out[ i ] = in[ i ] * scale for n values, truncated as by a conversion
+ * from float ('in' and 'out' may be the same). The products must fit
+ * into 16 bits.
+ ***************************************/
+
+#ifdef FLIMAGE_X86_SIMD
+
+__attribute__(( target( "avx2" ) ))
+static int
+scale_u16_avx2( const unsigned short * in,
+                unsigned short       * out,
+                float                  scale,
+                int                    n )
+{
+    __m256 s = _mm256_set1_ps( scale );
+    int i;
+
+    for ( i = 0; i + 16 <= n; i += 16 )
+    {
+        __m256i a = _mm256_cvtepu16_epi32(
+                            _mm_loadu_si128( ( const __m128i * ) ( in + i ) ) ),
+                b = _mm256_cvtepu16_epi32(
+                        _mm_loadu_si128( ( const __m128i * ) ( in + i + 8 ) ) );
+
+        a = _mm256_cvttps_epi32( _mm256_mul_ps( _mm256_cvtepi32_ps( a ), s ) );
+        b = _mm256_cvttps_epi32( _mm256_mul_ps( _mm256_cvtepi32_ps( b ), s ) );
+
+        _mm256_storeu_si256( ( __m256i * ) ( out + i ),
+                             _mm256_permute4x64_epi64(
+                                 _mm256_packus_epi32( a, b ), 0xd8 ) );
+    }
+
+    return i;
+}
+
+#endif
+
+
+/***************************************
+ ***************************************/
+
+void
+flimage_scale_u16( const unsigned short * in,
+                   unsigned short       * out,
+                   float                  scale,
+                   int                    n )
+{
+    int i = 0;
+
+#ifdef FLIMAGE_X86_SIMD
+    if ( flimage_simd_level( ) >= FLIMAGE_SIMD_AVX2 )
+        i = scale_u16_avx2( in, out, scale, n );
+#endif
+
+    for ( ; i < n; i++ )
+        out[ i ] = in[ i ] * scale;
+}
+
+
+/***************************************
+ * Table lookup into 32 bit entries, out[ i ] = lut[ in[ i ] ]
+ ***************************************/
+
+#ifdef FLIMAGE_X86_SIMD
+
+__attribute__(( target( "avx2" ) ))
+static int
+lut_u32_avx2( const unsigned int   * lut,
+              const unsigned short * in,
+              unsigned int         * out,
+              int                    n )
+{
+    int i;
+
+    for ( i = 0; i + 8 <= n; i += 8 )
+    {
+        __m256i k = _mm256_cvtepu16_epi32(
+                            _mm_loadu_si128( ( const __m128i * ) ( in + i ) ) );
+
+        _mm256_storeu_si256( ( __m256i * ) ( out + i ),
+                             _mm256_i32gather_epi32( ( const int * ) lut,
+                                                     k, 4 ) );
+    }
+
+    return i;
+}
+
+#endif
+
+
+/***************************************
+ ***************************************/
+
+void
+flimage_lut_u32( const unsigned int   * lut,
+                 const unsigned short * in,
+                 unsigned int         * out,
+                 int                    n )
+{
+    int i = 0;
+
+#ifdef FLIMAGE_X86_SIMD
+    if ( flimage_simd_level( ) >= FLIMAGE_SIMD_AVX2 )
+        i = lut_u32_avx2( lut, in, out, n );
+#endif
+
+    for ( ; i < n; i++ )
+        out[ i ] = lut[ in[ i ] ];
+}
+
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,252 @@
+/*
+ *  This file is part of the XForms library package.
+ *
+ *  XForms is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1, or
+ *  (at your option) any later version.
+ *
+ *  XForms is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with XForms.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * A small pool of worker threads for splitting image operations into
+ * independent pieces (usually bands of rows).
+ *
+ * The threads get started the first time they're needed and then wait
+ * for work. The thread calling flimage_parallel_for() works on the job
+ * itself and only returns when all of it is done. A job started while
+ * another one is still running (e.g. from one of the workers or from a
+ * different application thread) is simply done by the caller alone.
+ * Jobs must not call any X or visual cue functions.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <unistd.h>
+#include "include/forms.h"
+#include "flimage.h"
+#include "flimage_int.h"
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#define FLIMAGE_MAX_THREADS  64
+
+
+/***************************************
+ * Returns the number of threads to be used for processing the image
+ ***************************************/
+
+int
+flimage_get_nthreads( FL_IMAGE * im )
+{
+#ifdef HAVE_PTHREAD
+    static int ncpu = 0;
+    int n = im && im->setup ? im->setup->max_threads : 0;
+
+    if ( n <= 0 )
+    {
+        if ( ! ncpu )
+        {
+#ifdef _SC_NPROCESSORS_ONLN
+            ncpu = sysconf( _SC_NPROCESSORS_ONLN );
+#endif
+            if ( ncpu <= 0 )
+                ncpu = 1;
+        }
+
+        n = ncpu;
+    }
+
+    return FL_min( n, FLIMAGE_MAX_THREADS );
+#else
+    return 1;
+#endif
+}
+
+
+#ifdef HAVE_PTHREAD
+
+static struct {
+    pthread_mutex_t   mutex;
+    pthread_cond_t    work_cond;      /* new job was posted      */
+    pthread_cond_t    done_cond;      /* a worker has finished   */
+    int               nworkers;       /* threads started         */
+    unsigned long     generation;     /* incremented per job     */
+    int               in_use;
+    FLIMAGE_JOB       job;
+    void            * data;
+    int               n,
+                      grain,
+                      next;           /* start of next piece     */
+    int               max_active;     /* workers allowed on job  */
+    int               active;         /* workers busy on job     */
+} pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+           PTHREAD_COND_INITIALIZER, 0, 0, 0, NULL, NULL, 0, 0, 0, 0, 0 };
+
+
+/***************************************
+ * Hands out pieces of the current job until there are none left.
+ * Must be called with the mutex locked.
+ ***************************************/
+
+static void
+do_pieces( void )
+{
+    FLIMAGE_JOB job = pool.job;
+    void *data = pool.data;
+    int start,
+        end;
+
+    while ( pool.next < pool.n )
+    {
+        start = pool.next;
+        end = FL_min( pool.n, start + pool.grain );
+        pool.next = end;
+
+        pthread_mutex_unlock( &pool.mutex );
+        job( data, start, end );
+        pthread_mutex_lock( &pool.mutex );
+    }
+}
+
+
+/***************************************
+ ***************************************/
+
+static void *
+worker( void * arg  FL_UNUSED_ARG )
+{
+    unsigned long seen = 0;
+
+    pthread_mutex_lock( &pool.mutex );
+
+    while ( 1 )
+    {
+        while ( seen == pool.generation )
+            pthread_cond_wait( &pool.work_cond, &pool.mutex );
+
+        seen = pool.generation;
+
+        if ( pool.active >= pool.max_active || pool.next >= pool.n )
+            continue;
+
+        pool.active++;
+        do_pieces( );
+        pool.active--;
+
+        pthread_cond_signal( &pool.done_cond );
+    }
+
+    return NULL;
+}
+
+
+/***************************************
+ * Makes sure there are at least n worker threads, returns how many
+ * there are. Must be called with the mutex locked.
+ ***************************************/
+
+static int
+start_workers( int n )
+{
+    pthread_attr_t attr;
+    pthread_t tid;
+
+    pthread_attr_init( &attr );
+    pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+
+    while (    pool.nworkers < n
+            && pthread_create( &tid, &attr, worker, NULL ) == 0 )
+        pool.nworkers++;
+
+    pthread_attr_destroy( &attr );
+
+    return pool.nworkers;
+}
+
+#endif   /* HAVE_PTHREAD */
+
+
+/***************************************
+ * Calls job( data, start, end ) for consecutive pieces of at most
+ * 'grain' elements until the range 0 to n - 1 has been covered,
+ * using as many threads as configured for the image.
+ ***************************************/
+
+void
+flimage_parallel_for( FL_IMAGE    * im,
+                      int           n,
+                      int           grain,
+                      FLIMAGE_JOB   job,
+                      void        * data )
+{
+#ifdef HAVE_PTHREAD
+    int nthreads;
+#endif
+
+    if ( n <= 0 )
+        return;
+
+    if ( grain <= 0 )
+        grain = 1;
+
+#ifdef HAVE_PTHREAD
+    nthreads = FL_min( flimage_get_nthreads( im ), ( n + grain - 1 ) / grain );
+
+    if ( nthreads > 1 )
+    {
+        pthread_mutex_lock( &pool.mutex );
+
+        if ( ! pool.in_use && start_workers( nthreads - 1 ) > 0 )
+        {
+            pool.in_use     = 1;
+            pool.job        = job;
+            pool.data       = data;
+            pool.n          = n;
+            pool.grain      = grain;
+            pool.next       = 0;
+            pool.max_active = nthreads - 1;
+            pool.generation++;
+
+            pthread_cond_broadcast( &pool.work_cond );
+
+            do_pieces( );
+
+            while ( pool.active > 0 )
+                pthread_cond_wait( &pool.done_cond, &pool.mutex );
+
+            pool.in_use = 0;
+            pool.job = NULL;
+            pool.data = NULL;
+            pthread_mutex_unlock( &pool.mutex );
+            return;
+        }
+
+        pthread_mutex_unlock( &pool.mutex );
+    }
+#else
+    ( void ) im;
+#endif
+
+    job( data, 0, n );
+}
+
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
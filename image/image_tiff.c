@@ -35,6 +35,10 @@
 #include "flimage.h"
 #include "flimage_int.h"
 
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 #if defined __sun__ && ! defined SYSV 
 int fgetc( FILE *stream );
 int fputc( int c, FILE *stream );
@@ -164,6 +168,8 @@ TIFF_description( FL_IMAGE * im )
 
 static int read_pixels( FL_IMAGE * im );
 static int TIFF_next( FL_IMAGE * );
+static int TIFF_random( FL_IMAGE *,
+                        int );
 static int load_tiff_colormap( FL_IMAGE * );
 
 
@@ -183,6 +189,7 @@ TIFF_readpixels( FL_IMAGE * im )
         im->next_frame = 0;
 
     im->more = sp->ifd_offset != 0;
+    im->random_frame = TIFF_random;
 
     return read_pixels(im);
 }
@@ -211,6 +218,86 @@ TIFF_next( FL_IMAGE * im )
 }
 
 
+/***************************************
+ * Walks the chain of IFDs and records their offsets as the frame index.
+ * Each IFD takes at least 18 bytes, so a chain longer than that allows
+ * for must contain a loop.
+ ***************************************/
+
+static int
+build_ifd_index( FL_IMAGE * im )
+{
+    SPEC *sp = im->io_spec;
+    FILE *fp = im->fpin;
+    long max_ifds;
+    int offset,
+        num_tags,
+        n = 0;
+
+    if ( fseek( fp, 0, SEEK_END ) < 0 || ( max_ifds = ftell( fp ) / 18 ) <= 0 )
+        return -1;
+
+    fseek( fp, 4, SEEK_SET );
+    offset = sp->read4bytes( fp );
+
+    while ( offset > 0 && ! feof( fp ) && ! ferror( fp ) )
+    {
+        if (    ++n > max_ifds
+             || flimage_add_frame( im, &offset, sizeof offset ) < 0 )
+        {
+            flimage_error( im, "%s: bad IFD chain", im->infile );
+            flimage_free_frame_index( im );
+            return -1;
+        }
+
+        fseek( fp, offset, SEEK_SET );
+        num_tags = sp->read2bytes( fp );
+        fseek( fp, offset + num_tags * 12 + 2, SEEK_SET );
+        offset = sp->read4bytes( fp );
+    }
+
+    return flimage_frame_count( im ) > 0 ? 0 : -1;
+}
+
+
+/***************************************
+ * Reads frame (page) n, using the IFD index
+ ***************************************/
+
+static int
+TIFF_random( FL_IMAGE * im,
+             int        n )
+{
+    SPEC *sp = im->io_spec;
+    int *offset;
+
+    if ( flimage_frame_count( im ) < 0 && build_ifd_index( im ) < 0 )
+        return -1;
+
+    im->total_frames = flimage_frame_count( im );
+
+    if ( ! ( offset = flimage_get_frame( im, n ) ) )
+    {
+        flimage_error( im, "%s: no frame %d", im->infile, n );
+        return -1;
+    }
+
+    sp->ifd_offset = *offset;
+
+    if (    read_tiff_ifd( im->fpin, sp ) < 0
+         || get_image_info_from_ifd( im ) < 0 )
+    {
+        flimage_error( im, "%s: can't get info on frame %d", im->infile, n );
+        return -1;
+    }
+
+    if ( flimage_getmem( im ) < 0 )
+        return -1;
+
+    return TIFF_readpixels( im );
+}
+
+
 static int write_ifd( FL_IMAGE *,
                       SPEC * );
 static int write_pixels( FL_IMAGE *,
@@ -326,7 +413,9 @@ static int junkBuffer;
 #define   Uncompressed          1
 #define   LZW                   5
 #define   JPEG                  6
+#define   Deflate               8
 #define   PackBits              32773
+#define   OldDeflate            32946
 #define PhotometricI      262
 #define   PhotoBW0White         0
 #define   PhotoBW0Black         1
@@ -352,6 +441,9 @@ static int junkBuffer;
 #define   RRGGBB              2
 #define GrayResponse      291
 #define ColorResponse     301
+#define Predictor         317
+#define   NoPrediction          1
+#define   HorizontalDiff        2
 #define ColorMap          320
 
 /* tiff support types   */
@@ -392,6 +484,7 @@ TIFFTag interestedTags[ ] =
     NV( PlannarConfig,   kUShort ),
     NV( GrayResponse,    kUShort ),
     NV( ColorResponse,   kUShort ),
+    NV( Predictor,       kUShort ),
     NV( ColorMap,        kUShort ),
     /* sentinel */
 
@@ -623,6 +716,17 @@ read_tiff_ifd( FILE * fp,
         i;
     TIFFTag *tag;
 
+    /* Tags missing from this IFD must not keep the values they had in
+       a previous one */
+
+    for ( tag = interestedTags; tag->tag_value; tag++ )
+    {
+        if ( tag->value && tag->value != &junkBuffer )
+            fl_free( tag->value );
+        tag->value = &junkBuffer;
+        tag->count = 0;
+    }
+
     fseek( fp, sp->ifd_offset, SEEK_SET );
 
     num_tags = sp->read2bytes( fp );
@@ -666,229 +770,555 @@ read_tiff_ifd( FILE * fp,
 }
 
 
+/*******************************************************************
+ * Decoders for compressed strips. They get the raw data of a strip
+ * and fill in at most 'outlen' bytes, returning how many they got
+ * (or -1 on a data error). A short strip is not an error, the rest
+ * of it simply stays black.
+ *******************************************************************/
+
+/***************************************
+ * PackBits run length encoding
+ ***************************************/
+
+static int
+packbits_decode( const unsigned char * in,
+                 int                   inlen,
+                 unsigned char       * out,
+                 int                   outlen )
+{
+    int pos = 0,
+        n = 0,
+        b,
+        cnt;
+
+    while ( pos < inlen && n < outlen )
+    {
+        b = in[ pos++ ];
+
+        if ( b < 128 )              /* b + 1 literal bytes */
+        {
+            cnt = FL_min( b + 1, FL_min( inlen - pos, outlen - n ) );
+            memcpy( out + n, in + pos, cnt );
+            pos += b + 1;
+            n += cnt;
+        }
+        else if ( b > 128 && pos < inlen )  /* next byte 257 - b times */
+        {
+            cnt = FL_min( 257 - b, outlen - n );
+            memset( out + n, in[ pos++ ], cnt );
+            n += cnt;
+        }
+    }
+
+    return n;
+}
+
+
 /***************************************
- * parameter endian is the endian the input data is in
+ * TIFF flavour of LZW: codes are packed MSB first and the code
+ * size increases one code earlier than with GIF. As in the GIF
+ * decoder the length of each string is kept, so a string can be
+ * written out backwards in one go.
  ***************************************/
 
-static unsigned short *
-convert2( unsigned short * sbuf,
-          int              nbytes,
-          int              endian )
+#define LZW_CLEAR   256
+#define LZW_EOI     257
+#define LZW_FIRST   258
+#define LZW_MAX     4096
+
+static int
+lzw_decode( const unsigned char * in,
+            int                   inlen,
+            unsigned char       * out,
+            int                   outlen )
 {
-    int nshort = nbytes / 2,
+    unsigned short prefix[ LZW_MAX ],
+                   length[ LZW_MAX ];
+    unsigned char suffix[ LZW_MAX ];
+    unsigned long accum = 0;
+    int bits = 0,
+        pos = 0,
+        size = 9,
+        next = LZW_FIRST,
+        old = -1,
+        n = 0,
+        code,
+        c,
         i,
-        j;
-    unsigned char *buf = ( unsigned char * ) sbuf;
+        len;
+
+    /* old-style (pre TIFF 6.0) LZW was packed LSB first */
 
-    if ( nbytes & 1 )
+    if ( inlen >= 2 && in[ 0 ] == 0 && ( in[ 1 ] & 1 ) )
+        return -1;
+
+    for ( i = 0; i < 256; i++ )
     {
-        fprintf( stderr, "Error: Bad ByteCount %d\n", nbytes );
-        return sbuf;
+        suffix[ i ] = i;
+        length[ i ] = 1;
     }
 
-    if ( endian == machine_endian( ) )
-        return sbuf;
+    while ( n < outlen )
+    {
+        while ( bits < size )
+        {
+            if ( pos >= inlen )     /* missing EOI code */
+                return n;
+            accum = ( accum << 8 ) | in[ pos++ ];
+            bits += 8;
+        }
+
+        bits -= size;
+        code = ( accum >> bits ) & ( ( 1 << size ) - 1 );
+
+        if ( code == LZW_EOI )
+            break;
+
+        if ( code == LZW_CLEAR )
+        {
+            size = 9;
+            next = LZW_FIRST;
+            old = -1;
+            continue;
+        }
+
+        if ( old < 0 )
+        {
+            if ( code > 255 )
+                return -1;
+            out[ n++ ] = old = code;
+            continue;
+        }
+
+        if ( code > next || ( code >= LZW_CLEAR && code < LZW_FIRST ) )
+            return -1;
 
-    if ( endian == MSBFirst )
+        /* For a code not yet in the table (KwKwK case) the string is the
+           previous one followed by its own first character */
+
+        c = code == next ? old : code;
+        len = length[ c ] + ( code == next );
+
+        for ( i = n + length[ c ] - 1; c >= LZW_FIRST; c = prefix[ c ], i-- )
+            if ( i < outlen )
+                out[ i ] = suffix[ c ];
+        if ( i < outlen )
+            out[ i ] = c;
+
+        if ( code == next && n + len - 1 < outlen )
+            out[ n + len - 1 ] = c;
+
+        if ( next < LZW_MAX )
+        {
+            prefix[ next ] = old;
+            suffix[ next ] = c;
+            length[ next ] = length[ old ] + 1;
+
+            if ( ++next >= ( 1 << size ) - 1 && size < 12 )
+                size++;
+        }
+
+        old = code;
+        n = FL_min( n + len, outlen );
+    }
+
+    return n;
+}
+
+
+#ifdef HAVE_ZLIB
+
+/***************************************
+ * zlib compressed strips
+ ***************************************/
+
+static int
+deflate_decode( const unsigned char * in,
+                int                   inlen,
+                unsigned char       * out,
+                int                   outlen )
+{
+    z_stream z;
+    int status;
+
+    memset( &z, 0, sizeof z );
+    z.next_in   = ( Bytef * ) in;
+    z.avail_in  = inlen;
+    z.next_out  = out;
+    z.avail_out = outlen;
+
+    if ( inflateInit( &z ) != Z_OK )
+        return -1;
+
+    status = inflate( &z, Z_FINISH );
+    inflateEnd( &z );
+
+    if ( status != Z_STREAM_END && status != Z_BUF_ERROR && status != Z_OK )
+        return -1;
+
+    return outlen - z.avail_out;
+}
+
+#endif
+
+
+/* What's needed for decoding the strips of an image */
+
+typedef struct {
+    FL_IMAGE       * im;
+    SPEC           * sp;
+    int              compress,
+                     predictor,
+                     config;
+    int              bpl,             /* bytes per row of a strip          */
+                     rps;             /* rows per strip                    */
+    unsigned char  * data;            /* all strips as read from the file  */
+    long           * start;           /* where each strip starts in data   */
+    int            * bytecount;       /* bytes actually read for a strip   */
+    const char    ** error;           /* per strip, NULL if it went well   */
+} STRIPS;
+
+
+/***************************************
+ * Undoes horizontal differencing of 8 bit samples
+ ***************************************/
+
+static void
+undo_predictor8( unsigned char * buf,
+                 int             bpl,
+                 int             nrows,
+                 int             spp )
+{
+    unsigned char *p;
+    int i;
+
+    for ( ; --nrows >= 0; buf += bpl )
+        for ( p = buf, i = spp; i < bpl; i++ )
+            p[ i ] += p[ i - spp ];
+}
+
+
+/***************************************
+ * Converts the decoded rows of a strip, starting at image row 'row',
+ * to image pixels
+ ***************************************/
+
+static const char *
+convert_strip( STRIPS        * st,
+               unsigned char * tmp,
+               int             row,
+               int             nrows )
+{
+    FL_IMAGE *im = st->im;
+    SPEC *sp = st->sp;
+    int end = row + nrows,
+        j;
+
+    if ( sp->spp == 1 )
     {
-        for ( i = j = 0; i < nshort; i++, j += 2 )
-            sbuf[ i ] = ( buf[ j ] << 8 ) | buf[ j + 1 ];
+        unsigned short **ctmp = FL_IsCI( im->type ) ? im->ci : im->gray;
+
+        if ( sp->bps[ 0 ] == 8 )
+        {
+            for ( ; row < end; row++, tmp += st->bpl )
+                for ( j = 0; j < im->w; j++ )
+                    ctmp[ row ][ j ] = tmp[ j ];
+        }
+        else if ( sp->bps[ 0 ] > 8 )
+        {
+            /* TIFF SPEC did not define 16 bps, and seems libtiff always
+               uses MSB. The strip data may start at an odd address, so
+               the samples get assembled from their bytes. */
+
+            for ( ; row < end; row++, tmp += st->bpl )
+            {
+                unsigned short *c = ctmp[ row ];
+                unsigned short prev = 0;
+                unsigned char *t = tmp;
+
+                for ( j = 0; j < im->w; j++, t += 2 )
+                {
+                    c[ j ] = ( t[ 0 ] << 8 ) | t[ 1 ];
+                    if ( st->predictor == HorizontalDiff )
+                        prev = c[ j ] += prev;
+                }
+            }
+        }
+        else if ( sp->bps[ 0 ] == 4 )
+        {
+            for ( ; row < end; row++, tmp += st->bpl )
+            {
+                unsigned char *t = tmp;
+
+                for ( j = 0; j < im->w - 1; t++ )
+                {
+                    im->ci[ row ][ j++ ] = ( *t >> 4 ) & 0x0f;
+                    im->ci[ row ][ j++ ] = *t & 0x0f;
+                }
+
+                if ( j < im->w )
+                    im->ci[ row ][ j ] = ( *t >> 4 ) & 0x0f;
+            }
+        }
+        else if ( sp->bps[ 0 ] == 1 )
+        {
+            for ( ; row < end; row++, tmp += st->bpl )
+                unpack_bits( im->ci[ row ], tmp, im->w );
+        }
+        else
+            return "Unhandled bits per sample";
+    }
+    else if ( sp->spp == 3 || sp->spp == 4 )
+    {
+        if ( sp->bps[ 0 ] != 8 )
+            return "Unsupported bits per sample";
+
+        if ( st->config == RGBRGB )
+        {
+            for ( ; row < end; row++ )
+                for ( j = 0; j < im->w; j++, tmp += sp->spp )
+                {
+                    im->red[   row ][ j ] = tmp[ 0 ];
+                    im->green[ row ][ j ] = tmp[ 1 ];
+                    im->blue[  row ][ j ] = tmp[ 2 ];
+                }
+        }
+        else if ( st->config == RRGGBB )
+        {
+            for ( ; row < end; row++ )
+            {
+                for ( j = 0; j < im->w; j++, tmp++ )
+                    im->red[ row ][ j ] = *tmp;
+
+                for ( j = 0; j < im->w; j++, tmp++ )
+                    im->green[ row ][ j ] = *tmp;
+
+                for ( j = 0; j < im->w; j++, tmp++ )
+                    im->blue[ row ][ j ] = *tmp;
+            }
+        }
+        else
+            return "Unknown PlannarConfig";
     }
     else
+        return "Unsupported samples per pixel";
+
+    return NULL;
+}
+
+
+/***************************************
+ * Decompresses and converts a single strip. Returns an error message
+ * or NULL. Strips cover different rows of the image, so different
+ * strips can be decoded at the same time.
+ ***************************************/
+
+static const char *
+decode_strip( STRIPS * st,
+              int      strip )
+{
+    int row = strip * st->rps,
+        nrows = FL_min( st->rps, st->im->h - row ),
+        len = nrows * st->bpl,
+        count = st->bytecount[ strip ],
+        n;
+    unsigned char *in = st->data + st->start[ strip ],
+                  *buf = in;
+    const char *err;
+
+    if ( nrows <= 0 )
+        return NULL;
+
+    if ( st->compress != Uncompressed || count < len )
     {
-        for ( i = j = 0; i < nshort; i++, j += 2 )
-            sbuf[ i ] = buf[ j ] | ( buf[ j + 1 ] << 8 );
+        if ( ! ( buf = fl_calloc( 1, len + 1 ) ) )
+            return "Can't allocate strip buffer";
+
+        switch ( st->compress )
+        {
+            case LZW :
+                n = lzw_decode( in, count, buf, len );
+                break;
+
+            case PackBits :
+                n = packbits_decode( in, count, buf, len );
+                break;
+
+#ifdef HAVE_ZLIB
+            case Deflate :
+            case OldDeflate :
+                n = deflate_decode( in, count, buf, len );
+                break;
+#endif
+
+            default :
+                memcpy( buf, in, n = FL_min( count, len ) );
+                break;
+        }
+
+        if ( n < 0 )
+        {
+            fl_free( buf );
+            return "Corrupt compressed strip";
+        }
     }
 
-    return sbuf;
+    if ( st->predictor == HorizontalDiff && st->sp->bps[ 0 ] == 8 )
+        undo_predictor8( buf, st->bpl, nrows, st->sp->spp );
+
+    err = convert_strip( st, buf, row, nrows );
+
+    if ( buf != in )
+        fl_free( buf );
+
+    return err;
 }
 
 
+/***************************************
+ ***************************************/
+
+static void
+decode_strips( void * data,
+               int    start,
+               int    end )
+{
+    STRIPS *st = data;
+    int strip;
+
+    for ( strip = start; strip < end; strip++ )
+        st->error[ strip ] = decode_strip( st, strip );
+}
+
 
 /***************************************
+ * Reads all strips of the image into memory and then decodes them,
+ * with as many threads as there are strips (or CPUs)
  ***************************************/
 
 static int
 read_pixels( FL_IMAGE * im )
 {
     SPEC *sp = im->io_spec;
-    int nstrips,
-        val,
-        err,
-        i,
-        j,
-        strip,
-        row,
-        bytecount;
-    TIFFTag *tag,
+    STRIPS st;
+    TIFFTag *offsetTag,
             *bytecountTag,
             *rowsPerStripTag;
-    unsigned char *tmpbuffer,
-                  *tmp;
-    int compress,
-        rps,
-        bpl;
-    unsigned short *sbuf;
+    int nstrips,
+        strip,
+        err = 0;
+    long total;
     FILE *fp = im->fpin;
 
     rowsPerStripTag = find_tag( RowsPerStrip );
 
-    if ( ( val = rowsPerStripTag->value[ 0 ] ) <= 0 )
+    /* a missing RowsPerStrip tag means the whole image is one strip */
+
+    if ( ! rowsPerStripTag->count )
+        st.rps = im->h;
+    else if ( ( st.rps = rowsPerStripTag->value[ 0 ] ) <= 0 )
     {
         flimage_error( im, "Bad RowsPerStrip tag" );
         return -1;
     }
 
-    if (    ( compress = find_tag( Compression )->value[ 0 ] )
-         && compress != Uncompressed )
+    st.rps = FL_min( st.rps, im->h );
+
+    if ( ( st.compress = find_tag( Compression )->value[ 0 ] ) == 0 )
+        st.compress = Uncompressed;
+
+    if (    st.compress != Uncompressed
+         && st.compress != LZW
+         && st.compress != PackBits
+#ifdef HAVE_ZLIB
+         && st.compress != Deflate
+         && st.compress != OldDeflate
+#endif
+       )
     {
-        flimage_error( im, "can't handled compressed TIF" );
+        flimage_error( im, "can't handle TIFF compression %d", st.compress );
         return -1;
     }
 
-    nstrips = ( im->h + val - 1 ) / val;
-    bytecountTag = find_tag( StripByteCount );
+    st.predictor = find_tag( Predictor )->value[ 0 ];
 
-    if ( nstrips != bytecountTag->count )
+    if (    st.predictor == HorizontalDiff
+         && sp->bps[ 0 ] != 8
+         && sp->bps[ 0 ] != 16 )
     {
-        flimage_error( im, "Inconsistent in number of strips" );
+        flimage_error( im, "can't handle TIFF predictor with %d bits",
+                       sp->bps[ 0 ] );
         return -1;
     }
 
-    bpl = ( im->w * sp->spp * find_tag( BitsPerSample )->value[ 0 ] + 7 ) / 8;
-    rps = rowsPerStripTag->value[ 0 ];
-    tag = find_tag( StripOffsets );
+    nstrips = ( im->h + st.rps - 1 ) / st.rps;
+    bytecountTag = find_tag( StripByteCount );
+    offsetTag = find_tag( StripOffsets );
 
-    if ( ! ( tmpbuffer = fl_malloc( bytecountTag->value[ 0 ] + 4 ) ) )
+    if ( nstrips != bytecountTag->count || nstrips > offsetTag->count )
     {
-        flimage_error( im, "Can't allocate strip buffer (%d bytes)",
-                       bytecountTag->value[ 0 ] );
+        flimage_error( im, "Inconsistent in number of strips" );
         return -1;
     }
 
-    for ( row = strip = err = 0; !err && strip < nstrips; strip++ )
-    {
-#if TIFF_DEBUG
-        fprintf( stderr, "strip%d at %d\n", strip, tag->value[ strip ] );
-#endif
-        fseek( fp, tag->value[strip], SEEK_SET );
-
-        bytecount = bytecountTag->value[ strip ];
+    st.im = im;
+    st.sp = sp;
+    st.config = find_tag( PlannarConfig )->count ?
+                find_tag( PlannarConfig )->value[ 0 ] : RGBRGB;
+    st.bpl = ( im->w * sp->spp * find_tag( BitsPerSample )->value[ 0 ] + 7 )
+             / 8;
 
-        if ( ( err = ( fread( tmpbuffer, 1, bytecount, fp ) == 0 ) ) )
-            M_err( "ReadStrip", "Error reading ByteCount" );
+    for ( total = strip = 0; strip < nstrips; strip++ )
+        total += FL_max( bytecountTag->value[ strip ], 0 );
 
-        /* TODO: de-compress the tmpbuffer */
+    st.start     = fl_malloc( nstrips * sizeof *st.start );
+    st.bytecount = fl_malloc( nstrips * sizeof *st.bytecount );
+    st.error     = fl_calloc( nstrips, sizeof *st.error );
+    st.data      = fl_malloc( total + 4 );
 
-        tmp = tmpbuffer;
-        if ( sp->spp == 1 )
-        {
-            if ( sp->bps[ 0 ] == 8 )
-            {
-                unsigned short **ctmp = FL_IsCI( im->type ) ? im->ci : im->gray;
-
-                for ( i = 0; row < im->h && i < rps; i++, row++ )
-                {
-                    for ( j = 0; j < im->w; j++ )
-                        ctmp[ row ][ j ] = tmp[ j ];
-                    tmp += im->w;
-                }
-            }
-            else if ( sp->bps[ 0 ] > 8 )
-            {
-                unsigned short **ctmp = FL_IsCI( im->type ) ? im->ci : im->gray;
+    if ( ! st.start || ! st.bytecount || ! st.error || ! st.data )
+    {
+        flimage_error( im, "Can't allocate strip buffer (%ld bytes)", total );
+        err = 1;
+    }
 
-                /* TIFF SPEC did not define 16 bps, and seems libtiff always
-                   uses MSB. */
+    /* read all strips first, file access can't be split between threads */
 
-                sbuf = convert2( ( void * ) tmp, bytecount,
-                                 MSBFirst /* sp->endian */ );
+    for ( total = strip = 0; ! err && strip < nstrips; strip++ )
+    {
+#if TIFF_DEBUG
+        fprintf( stderr, "strip%d at %d\n", strip, offsetTag->value[ strip ] );
+#endif
+        st.start[ strip ] = total;
+        st.bytecount[ strip ] = 0;
 
-                for ( i = 0; row < im->h && i < rps; i++, row++ )
-                {
-                    memcpy( ctmp[ row ], sbuf, bpl );
-                    sbuf += im->w;
-                }
-            }
-            else if ( sp->bps[ 0 ] == 4 )
-            {
-                for ( i = 0; row < im->h && i < rps; i++, row++, tmp += bpl )
-                {
-                    for ( j = 0; j < im->w - 1; tmp++ )
-                    {
-                        im->ci[ row ][ j++ ] = ( *tmp >> 4 ) & 0x0f;
-                        im->ci[ row ][ j++ ] = *tmp & 0x0f;
-                    }
+        if ( bytecountTag->value[ strip ] <= 0 )
+            continue;
 
-                    im->ci[ row ][ j++ ] = ( *tmp >> 4 ) & 0x0f;
+        fseek( fp, offsetTag->value[ strip ], SEEK_SET );
 
-                    if ( j < im->w )
-                        im->ci[ row ][ j ] = *tmp & 0x0f;
-                }
-            }
-            else if ( sp->bps[0] == 1 )
-            {
-                for ( i = 0; row < im->h && i < rps; i++, row++, tmp += bpl )
-                    unpack_bits( im->ci[ row ], tmp, im->w );
-            }
-            else
-            {
-                M_err( "ReadStrip", "Unhandled bpp=%d\n", sp->bps[ 0 ] );
-                return -1;
-            }
-        }
-        else if ( sp->spp == 3 || sp->spp == 4 )
-        {
-            int config = find_tag( PlannarConfig )->value[ 0 ];
+        if ( ( err = ( st.bytecount[ strip ] =
+                       fread( st.data + total, 1, bytecountTag->value[ strip ],
+                              fp ) ) == 0 ) )
+            M_err( "ReadStrip", "Error reading ByteCount" );
 
-            if ( sp->bps[ 0 ] == 8 )
-            {
-                if ( config == RGBRGB )
-                {
-                    for ( i = 0; row < im->h && i < rps; i++, row++ )
-                    {
-                        for ( j = 0; j < im->w; j++, tmp += sp->spp )
-                        {
-                            im->red[   row ][ j ] = *tmp;
-                            im->green[ row ][ j ] = *( tmp + 1 );
-                            im->blue[  row ][ j ] = *( tmp + 2 );
-                        }
-                    }
-                }
-                else if ( config == RRGGBB )
-                {
-                    for ( i = 0; row < im->h && i < rps; i++, row++ )
-                    {
-                        for ( j = 0; j < im->w; j++, tmp++ )
-                            im->red[ row ][ j ] = *tmp;
+        total += st.bytecount[ strip ];
+    }
 
-                        for ( j = 0; j < im->w; j++, tmp++ ) ;
-                        im->green[ row ][ j ] = *tmp;
+    if ( ! err )
+    {
+        flimage_parallel_for( im, nstrips, 1, decode_strips, &st );
 
-                        for ( j = 0; j < im->w; j++, tmp++ )
-                            im->blue[ row ][ j ] = *tmp;
-                    }
-                }
-                else
-                {
-                    M_err( "ReadRGB", "Unknown PlannarConfig %d", config );
-                    return -1;
-                }
-            }
-            else
-            {
-                flimage_error( im, "Unsupported bps=%d", sp->bps[ 0 ] );
-                return -1;
-            }
-        }
-        else
-        {
-            flimage_error( im, "spp=%d unsupported", sp->spp );
-            return -1;
-        }
+        for ( strip = 0; ! err && strip < nstrips; strip++ )
+            if ( ( err = st.error[ strip ] != NULL ) )
+                flimage_error( im, "%s (strip %d)", st.error[ strip ], strip );
     }
 
-    fl_free( tmpbuffer );
+    fl_free( st.data );
+    fl_free( st.error );
+    fl_free( st.bytecount );
+    fl_free( st.start );
 
     if ( find_tag(BitsPerSample)->value[ 0 ] == 1 )
     {
@@ -1307,38 +1737,6 @@ write_pixels( FL_IMAGE * im,
 }
 
 
-/***************************************
- ***************************************/
-
-#if 0
-static int
-PackBitsDecode( char * input,
-                char * output,
-                int    inlen,
-                int    outlen )
-{
-    int b,
-        n;
-
-    for ( n = 0; n < outlen; )
-    {
-        b = *input;
-        if ( b >= 128 )
-            b -= 256;
-
-        if ( b == -128 )
-            ;
-
-        if (b < 0)
-        {
-            b = -b + 1;
-            input++;
-        }
-    }
-}
-#endif
-
-
 /*
  * Local variables:
  * tab-width: 4
@@ -148,8 +148,96 @@ spline_int_interpolate( const int * wx,
 
 /***********************************************************************
  * convert image types
+ *
+ * All conversions work on the pixels as one long row (the matrices are
+ * contiguous) which gets split into pieces done by different threads,
+ * the work per piece is done by the row kernels in image_simd.c.
  ***********************************************************************/
 
+#define CONVERT_GRAIN  ( 1 << 16 )      /* pixels per piece              */
+#define CONVERT_CHUNK  1024             /* pixels per temporary buffer   */
+
+typedef void ( * CONVERT_FUNC )( FL_IMAGE *,
+                                 const void *,
+                                 int,
+                                 int );
+
+typedef struct {
+    FL_IMAGE     * im;
+    CONVERT_FUNC   func;
+    const void   * data;
+} CONVERT_JOB;
+
+
+/***************************************
+ ***************************************/
+
+static void
+convert_job( void * data,
+             int    start,
+             int    end )
+{
+    CONVERT_JOB *job = data;
+
+    job->func( job->im, job->data, start, end );
+}
+
+
+/***************************************
+ * Calls func( im, data, start, end ) for pieces of all the pixels
+ ***************************************/
+
+static void
+convert_pixels( FL_IMAGE     * im,
+                CONVERT_FUNC   func,
+                const void   * data )
+{
+    CONVERT_JOB job;
+
+    job.im   = im;
+    job.func = func;
+    job.data = data;
+
+    flimage_parallel_for( im, im->w * im->h, CONVERT_GRAIN, convert_job,
+                          &job );
+}
+
+
+/***************************************
+ * Returns a table of the colormap as packed pixels, with zeros for all
+ * indices beyond the end of the map
+ ***************************************/
+
+static unsigned int *
+get_packed_lut( FL_IMAGE * im )
+{
+    unsigned int *lut = fl_calloc( FLIMAGE_MAXLUT + 1, sizeof *lut );
+    int i;
+
+    if ( lut )
+        for ( i = 0; i < im->map_len && i < FLIMAGE_MAXLUT; i++ )
+            lut[ i ] = FL_PACK4( im->red_lut[ i ], im->green_lut[ i ],
+                                 im->blue_lut[ i ], 0 );
+
+    return lut;
+}
+
+
+/***************************************
+ * Fills a gray colormap with map_len entries
+ ***************************************/
+
+static void
+gray_colormap( FL_IMAGE * im )
+{
+    int i;
+    float fact = ( FL_PCMAX + 0.001 ) / ( im->map_len - 1.0 );
+
+    for ( i = 0; i < im->map_len; i++ )
+        im->red_lut[ i ] = im->green_lut[ i ] = im->blue_lut[ i ] = i * fact;
+}
+
+
 /***********************************************************************
  * to rgba image
  *********************************************************************{*/
@@ -157,49 +245,76 @@ spline_int_interpolate( const int * wx,
 /***************************************
  ***************************************/
 
-static int
-packed_to_rgba( FL_IMAGE * im )
+static void
+packed_to_rgba_run( FL_IMAGE   * im,
+                    const void * data  FL_UNUSED_ARG,
+                    int          start,
+                    int          end )
 {
-    FL_PACKED *packed = im->packed[ 0 ];
-    unsigned char *r,
-                  *g,
-                  *b,
-                  *a;
-    int i,
-        npix;
+    flimage_unpack_rgba( im->packed[ 0 ] + start,
+                         im->red[   0 ] + start,
+                         im->green[ 0 ] + start,
+                         im->blue[  0 ] + start,
+                         im->alpha[ 0 ] + start,
+                         end - start );
+}
 
-    r = im->red[   0 ];
-    g = im->green[ 0 ];
-    b = im->blue[  0 ];
-    a = im->alpha[ 0 ];
 
-    for ( i = 0, npix = im->w * im->h; i < npix; i++ )
-        FL_UNPACK4( packed[ i ], r[ i ], g[ i ], b[ i ], a[ i ] );
+/***************************************
+ ***************************************/
 
+static int
+packed_to_rgba( FL_IMAGE * im )
+{
+    convert_pixels( im, packed_to_rgba_run, NULL );
     return 0;
 }
 
 
 /***************************************
+ * Also used for 16 bit gray images, 'data' then points to the scale
+ * factor
  ***************************************/
 
-static int
-gray_to_rgba( FL_IMAGE * im )
+static void
+gray_to_rgba_run( FL_IMAGE   * im,
+                  const void * data,
+                  int          start,
+                  int          end )
 {
-    unsigned short *gray = im->gray[ 0 ];
-    unsigned char *r,
-                  *g,
-                  *b;
-    int i,
-        npix;
+    unsigned short tmp[ CONVERT_CHUNK ],
+                   *gray = im->gray[ 0 ];
+    unsigned char *r = im->red[   0 ],
+                  *g = im->green[ 0 ],
+                  *b = im->blue[  0 ];
+    int n;
+
+    for ( ; start < end; start += n )
+    {
+        n = FL_min( end - start, CONVERT_CHUNK );
+
+        if ( data )
+        {
+            flimage_scale_u16( gray + start, tmp, * ( const float * ) data,
+                               n );
+            flimage_u16_to_u8( tmp, r + start, n );
+        }
+        else
+            flimage_u16_to_u8( gray + start, r + start, n );
+
+        memcpy( g + start, r + start, n );
+        memcpy( b + start, r + start, n );
+    }
+}
 
-    r = im->red[   0 ];
-    g = im->green[ 0 ];
-    b = im->blue[  0 ];
 
-    for ( i = 0, npix = im->w * im->h; i < npix; i++ )
-        r[ i ] = g[ i ] = b[ i ] = gray[ i ];
+/***************************************
+ ***************************************/
 
+static int
+gray_to_rgba( FL_IMAGE * im )
+{
+    convert_pixels( im, gray_to_rgba_run, NULL );
     return 0;
 }
 
@@ -210,22 +325,33 @@ gray_to_rgba( FL_IMAGE * im )
 static int
 gray16_to_rgba( FL_IMAGE * im )
 {
-    unsigned short *gray = im->gray[ 0 ];
-    unsigned char *r,
-                  *g,
-                  *b;
     float scale = ( FL_PCMAX + 0.001 ) / im->gray_maxval;
-    int i,
-        npix;
 
-    r = im->red[   0 ];
-    g = im->green[ 0 ];
-    b = im->blue[  0 ];
+    convert_pixels( im, gray_to_rgba_run, &scale );
+    return 0;
+}
+
 
-    for ( i = 0, npix = im->w * im->h; i < npix; i++ )
-        r[ i ] = g[ i ] = b[ i ] = gray[ i ] * scale;
+/***************************************
+ ***************************************/
 
-    return 0;
+static void
+ci_to_rgba_run( FL_IMAGE   * im,
+                const void * data,
+                int          start,
+                int          end )
+{
+    unsigned int tmp[ CONVERT_CHUNK ];
+    int n;
+
+    for ( ; start < end; start += n )
+    {
+        n = FL_min( end - start, CONVERT_CHUNK );
+        flimage_lut_u32( data, im->ci[ 0 ] + start, tmp, n );
+        flimage_unpack_rgba( tmp, im->red[ 0 ] + start,
+                             im->green[ 0 ] + start, im->blue[ 0 ] + start,
+                             NULL, n );
+    }
 }
 
 
@@ -235,25 +361,13 @@ gray16_to_rgba( FL_IMAGE * im )
 static int
 ci_to_rgba( FL_IMAGE * im )
 {
-    unsigned short *ci = im->ci[ 0 ];
-    unsigned char *r,
-                  *g,
-                  *b;
-    int k,
-        i;
+    unsigned int *lut;
 
-    r = im->red[   0 ];
-    g = im->green[ 0 ];
-    b = im->blue[ 0 ];
-
-    for ( i = im->w * im->h; --i >= 0; )
-    {
-        k = ci[ i ];
-        r[ i ] = im->red_lut[   k ];
-        g[ i ] = im->green_lut[ k ];
-        b[ i ] = im->blue_lut[  k ];
-    }
+    if ( ! ( lut = get_packed_lut( im ) ) )
+        return -1;
 
+    convert_pixels( im, ci_to_rgba_run, lut );
+    fl_free( lut );
     return 0;
 }
 
@@ -262,25 +376,43 @@ ci_to_rgba( FL_IMAGE * im )
  *********************************************************************{*/
 
 
+/***************************************
+ ***************************************/
+
+static void
+packed_to_gray_run( FL_IMAGE   * im,
+                    const void * data  FL_UNUSED_ARG,
+                    int          start,
+                    int          end )
+{
+    flimage_packed_to_gray( im->packed[ 0 ] + start, im->gray[ 0 ] + start,
+                            end - start );
+}
+
+
 /***************************************
  ***************************************/
 
 static int
 packed_to_gray( FL_IMAGE * im )
 {
-    FL_PACKED *packed = im->packed[ 0 ];
-    int i,
-        total = im->w * im->h;
-    unsigned short *gray;
+    convert_pixels( im, packed_to_gray_run, NULL );
+    return 0;
+}
 
-    gray = im->ci[ 0 ];
 
-    for ( i = 0; i < total; i++ )
-        gray[ i ] = FL_RGB2GRAY( FL_GETR( packed[ i ] ),
-                                 FL_GETG( packed[ i ] ),
-                                 FL_GETB( packed[ i ] ) );
+/***************************************
+ ***************************************/
 
-    return 0;
+static void
+rgba_to_gray_run( FL_IMAGE   * im,
+                  const void * data  FL_UNUSED_ARG,
+                  int          start,
+                  int          end )
+{
+    flimage_rgb_to_gray( im->red[ 0 ] + start, im->green[ 0 ] + start,
+                         im->blue[ 0 ] + start, im->gray[ 0 ] + start,
+                         end - start );
 }
 
 
@@ -290,23 +422,23 @@ packed_to_gray( FL_IMAGE * im )
 static int
 rgba_to_gray( FL_IMAGE * im )
 {
-    int i,
-        total;
-    unsigned char *r,
-                  *g,
-                  *b;
-    unsigned short *gray;
-
-    gray = im->gray[ 0 ];
+    convert_pixels( im, rgba_to_gray_run, NULL );
+    return 0;
+}
 
-    r = im->red[   0 ];
-    g = im->green[ 0 ];
-    b = im->blue[  0 ];
 
-    for ( i = 0, total = im->w * im->h; i < total; i++ )
-        gray[ i ] = FL_RGB2GRAY( r[ i ], g[ i ], b[ i ] );
+/***************************************
+ * 'data' is the table of the gray values of the colormap entries
+ ***************************************/
 
-    return 0;
+static void
+ci_to_gray_run( FL_IMAGE   * im,
+                const void * data,
+                int          start,
+                int          end )
+{
+    flimage_lut_u16( data, im->ci[ 0 ] + start, im->gray[ 0 ] + start,
+                     end - start );
 }
 
 
@@ -316,15 +448,20 @@ rgba_to_gray( FL_IMAGE * im )
 static int
 ci_to_gray( FL_IMAGE * im )
 {
-    unsigned short *ci = im->ci[ 0 ];
-    unsigned short *gray = im->gray[ 0 ];
+    unsigned short *lut;
     int i;
 
-    for ( i = im->w * im->h; --i >= 0; )
-        gray[i] = FL_RGB2GRAY( im->red_lut[   ci[ i ] ],
-                               im->green_lut[ ci[ i ] ],
-                               im->blue_lut[  ci[ i ] ] );
+    /* one more entry than needed for flimage_lut_u16() */
+
+    if ( ! ( lut = fl_calloc( FLIMAGE_MAXLUT + 1, sizeof *lut ) ) )
+        return -1;
+
+    for ( i = 0; i < im->map_len && i < FLIMAGE_MAXLUT; i++ )
+        lut[ i ] = FL_RGB2GRAY( im->red_lut[ i ], im->green_lut[ i ],
+                                im->blue_lut[ i ] );
 
+    convert_pixels( im, ci_to_gray_run, lut );
+    fl_free( lut );
     return 0;
 }
 
@@ -333,30 +470,43 @@ ci_to_gray( FL_IMAGE * im )
  * Pack an image
  *********************************************************************{*/
 
+/***************************************
+ ***************************************/
+
+static void
+rgba_to_packed_run( FL_IMAGE   * im,
+                    const void * data  FL_UNUSED_ARG,
+                    int          start,
+                    int          end )
+{
+    flimage_pack_rgba( im->red[ 0 ] + start, im->green[ 0 ] + start,
+                       im->blue[ 0 ] + start, im->alpha[ 0 ] + start,
+                       im->packed[ 0 ] + start, end - start );
+}
+
+
 /***************************************
  ***************************************/
 
 static int
 rgba_to_packed( FL_IMAGE * im )
 {
-    int npix, i;
-    FL_PACKED *p;
-    unsigned char *r,
-                  *g,
-                  *b,
-                  *a;
-
-    r = im->red[   0 ];
-    g = im->green[ 0 ];
-    b = im->blue[  0 ];
-    a = im->alpha[ 0 ];
+    convert_pixels( im, rgba_to_packed_run, NULL );
+    return 0;
+}
 
-    p = im->packed[ 0 ];
 
-    for ( i = 0, npix = im->w * im->h; i < npix; i++ )
-        p[ i ] = FL_PACK4( r[ i ], g[ i ], b[ i ], a[ i ] );
+/***************************************
+ ***************************************/
 
-    return 0;
+static void
+ci_to_packed_run( FL_IMAGE   * im,
+                  const void * data,
+                  int          start,
+                  int          end )
+{
+    flimage_lut_u32( data, im->ci[ 0 ] + start, im->packed[ 0 ] + start,
+                     end - start );
 }
 
 
@@ -366,18 +516,13 @@ rgba_to_packed( FL_IMAGE * im )
 static int
 ci_to_packed( FL_IMAGE * im )
 {
-    int i;
-    FL_PACKED *p;
-    unsigned short *ci;
-
-    p = im->packed[ 0 ];
-    ci = im->ci[ 0 ];
+    unsigned int *lut;
 
-    for ( i = im->w * im->h; --i >= 0; )
-        p[ i ] = FL_PACK4( im->red_lut[   ci[ i ] ],
-                           im->green_lut[ ci[ i ] ],
-                           im->blue_lut[  ci[ i ] ], 0 );
+    if ( ! ( lut = get_packed_lut( im ) ) )
+        return -1;
 
+    convert_pixels( im, ci_to_packed_run, lut );
+    fl_free( lut );
     return 0;
 }
 
@@ -415,43 +560,55 @@ packed_to_ci( FL_IMAGE * im )
 }
 
 
+/***************************************
+ * Scales the gray values into the color indices or (if 'data' is NULL)
+ * just copies them
+ ***************************************/
+
+static void
+gray_to_ci_run( FL_IMAGE   * im,
+                const void * data,
+                int          start,
+                int          end )
+{
+    if ( data )
+        flimage_scale_u16( im->gray[ 0 ] + start, im->ci[ 0 ] + start,
+                           * ( const float * ) data, end - start );
+    else
+        memcpy( im->ci[ 0 ] + start, im->gray[ 0 ] + start,
+                ( end - start ) * sizeof **im->ci );
+}
+
+
 /***************************************
  ***************************************/
 
 static int
 gray_to_ci( FL_IMAGE * im )
 {
-    int i;
-    float fact = ( FL_PCMAX + 0.001 ) / ( im->map_len - 1.0 );
     float scale = ( im->map_len - 1.0 ) / 254.999;
 
-    for ( i = 0; i < im->map_len; i++ )
-        im->red_lut[ i ] = im->green_lut[ i ] = im->blue_lut[ i ] = i * fact;
-
-    if ( im->map_len != 256 )
-        for ( i = im->w * im->h; --i >= 0; )
-            im->ci[ 0 ][ i ] = im->gray[ 0 ][ i ] * scale;
-    else
-        for ( i = im->w * im->h; --i >= 0; )
-            im->ci[ 0 ][ i ] = im->gray[ 0 ][ i ];
-
+    gray_colormap( im );
+    convert_pixels( im, gray_to_ci_run, im->map_len != 256 ? &scale : NULL );
     return 0;
 }
 
 
 /***************************************
+ * Scales the values of a 16 bit gray image to 8 bits, 'data' points to
+ * the matrix to receive the result
  ***************************************/
 
 static void
-scale_gray16( unsigned short * g16,
-              unsigned short * g,
-              int              maxval,
-              int              len )
+scale_gray16_run( FL_IMAGE   * im,
+                  const void * data,
+                  int          start,
+                  int          end )
 {
-    float scale = ( FL_PCMAX + 0.001 ) / maxval;
+    unsigned short **out = ( unsigned short ** ) data;
 
-    while ( --len >= 0 )
-        g[ len ] = g16[ len ] * scale;
+    flimage_scale_u16( im->gray[ 0 ] + start, out[ 0 ] + start,
+                       ( FL_PCMAX + 0.001 ) / im->gray_maxval, end - start );
 }
 
 
@@ -461,8 +618,7 @@ scale_gray16( unsigned short * g16,
 static int
 gray16_to_gray( FL_IMAGE * im )
 {
-    scale_gray16( im->gray[ 0 ], im->gray[ 0 ], im->gray_maxval,
-                  im->w * im->h );
+    convert_pixels( im, scale_gray16_run, im->gray );
     return 0;
 }
 
@@ -485,14 +641,8 @@ gray_to_gray16( FL_IMAGE * im )
 static int
 gray16_to_ci( FL_IMAGE * im )
 {
-    int i;
-    float fact = ( FL_PCMAX + 0.001 ) / ( im->map_len - 1.0 );
-
-    for ( i = 0; i < im->map_len; i++ )
-        im->red_lut[ i ] = im->green_lut[ i ] = im->blue_lut[ i ] = i * fact;
-
-    scale_gray16( im->gray[ 0 ], im->ci[ 0 ], im->gray_maxval, im->w * im->h );
-
+    gray_colormap( im );
+    convert_pixels( im, scale_gray16_run, im->ci );
     return 0;
 }
 
@@ -513,58 +663,89 @@ static int dither_threshold = ( 1 << FL_PCBITS ) / 2;
 
 
 /***************************************
- * do floyd-steinberg dithering
+ * Floyd-Steinberg dithering, done in bands of DITHER_BAND rows which
+ * get dithered independently. To have the errors at the start of a band
+ * about right the DITHER_WARMUP rows before it are dithered, too, but
+ * their results are thrown away. The output thus doesn't depend on the
+ * number of threads used.
  ***************************************/
 
-static int
-fs_dither( unsigned short ** mat,
-           int               h,
-           int               w,
-           unsigned short ** mm )
+#define DITHER_BAND    128
+#define DITHER_WARMUP  8
+
+typedef struct {
+    unsigned short ** mat;
+    unsigned short ** mm;
+    int               w,
+                      h;
+    int               lut[ 1 << FL_PCBITS ];
+    int               status;
+} DITHER_JOB;
+
+
+/***************************************
+ ***************************************/
+
+static void
+fs_dither_band( DITHER_JOB * job,
+                int          band )
 {
     unsigned short *m,
                    *ras;
-    int **tmp,
-         *curr,
-         *next = NULL;
-    int i,
+    int *buf,
+        *tmp,
+        *curr,
+        *next;
+    int w = job->w,
+        first = band * DITHER_BAND,
+        last = FL_min( job->h, first + DITHER_BAND ),
+        start = FL_max( 0, first - DITHER_WARMUP ),
+        i,
         j,
         n,
+        v,
         err,
-        dither2,
-        lut[ 1 << FL_PCBITS ];
-    static int x[ 4 ] =  { 0, 15, 240, 255 };
-    static int y[ 4 ] =  { 0,  5, 250, 255 };
+        dither2 = ( 1 << FL_PCBITS ) - 1;
 
-    /* to preserve the errors on the edge, has to get one more row */
+    /* The rows of the band are consecutive, so errors carried past the
+       end of a row end up at the start of the next one (and the other
+       way round). Two rows more are needed for the errors of the last
+       row of the band and one element before the first row. */
 
-    tmp = fl_get_matrix( h + 1, w, sizeof **tmp );
+    if ( ! ( buf = fl_calloc( ( last - start + 2 ) * ( size_t ) w + 1,
+                              sizeof *buf ) ) )
+    {
+        job->status = -1;
+        return;
+    }
 
-    spline_int_interpolate( x, y, 4, 1, lut );
+    tmp = buf + 1;
 
-    for ( ras = mat[ 0 ], curr = tmp[ 0 ], n = h * w; --n >= 0; ras++, curr++ )
-        *curr = lut[ *ras ];
+    for ( ras = job->mat[ start ], curr = tmp, n = ( last - start ) * w;
+          --n >= 0; ras++, curr++ )
+        *curr = job->lut[ *ras ];
 
-    /* because we have the raster in a consecutive array, we got the edge
-     * errors right for free */
+    for ( i = start; i < last; i++ )
+    {
+        curr = tmp + ( i - start ) * w;
 
-    dither2 = ( 1 << FL_PCBITS ) - 1;
+        /* the errors of the very last row go into the row itself */
 
-    for ( i = 0; i < h; i++ )
-    {
-        curr = tmp[ i ];
+        next = i < job->h - 1 ? curr + w : curr;
 
-        /* can't have it run to h 'cause nextrow[j+1] will be wrong */
+        /* results for the warm-up rows belong to the band before */
 
-        if ( i < h - 1 )
-            next = tmp[ i + 1 ];
+        m = i >= first ? job->mm[ i ] : NULL;
 
-        for ( m = mm[ i ], j = 0; j < w; j++, m++ )
+        for ( j = 0; j < w; j++ )
         {
             /* the value of *m depends on how the colormap is assigned */
 
-            err =   curr[ j ]
-                  - ( ( *m = curr[ j ] <= dither_threshold ) ? 0 : dither2 );
+            v = curr[ j ] <= dither_threshold;
+            if ( m )
+                m[ j ] = v;
+
+            err = curr[ j ] - ( v ? 0 : dither2 );
             curr[ j + 1 ] += ( err * 7 ) / 16;
 
             next[ j - 1 ] += ( err * 3 ) / 16;
@@ -573,9 +754,46 @@ fs_dither( unsigned short ** mat,
         }
     }
 
-    fl_free_matrix( tmp );
+    fl_free( buf );
+}
+
 
-    return 0;
+/***************************************
+ ***************************************/
+
+static void
+fs_dither_job( void * data,
+               int    start,
+               int    end )
+{
+    for ( ; start < end; start++ )
+        fs_dither_band( data, start );
+}
+
+
+/***************************************
+ ***************************************/
+
+static int
+fs_dither( FL_IMAGE        * im,
+           unsigned short ** mm )
+{
+    DITHER_JOB job;
+    static int x[ 4 ] =  { 0, 15, 240, 255 };
+    static int y[ 4 ] =  { 0,  5, 250, 255 };
+
+    job.mat    = im->gray;
+    job.mm     = mm;
+    job.w      = im->w;
+    job.h      = im->h;
+    job.status = 0;
+
+    spline_int_interpolate( x, y, 4, 1, job.lut );
+
+    flimage_parallel_for( im, ( im->h + DITHER_BAND - 1 ) / DITHER_BAND, 1,
+                          fs_dither_job, &job );
+
+    return job.status;
 }
 
 
@@ -595,7 +813,7 @@ gray_to_mono( FL_IMAGE * im )
         dither_threshold = ( 1 << FL_PCBITS ) / 2;
 
     if ( dither_method == FS_DITHER )
-        status = fs_dither( im->gray, im->h, im->w, outm );
+        status = fs_dither( im, outm );
     else if ( dither_method == DITHER_THRESHOLD )
     {
         in = im->gray[ 0 ];
@@ -632,7 +850,7 @@ gray16_to_mono( FL_IMAGE * im )
     if ( ! ( gray = fl_get_matrix( im->h, im->w, sizeof **gray ) ) )
         return -1;
 
-    scale_gray16( save[ 0 ], gray[ 0 ], im->gray_maxval, im->w * im->h );
+    convert_pixels( im, scale_gray16_run, gray );
 
     im->gray = gray;
     status = gray_to_mono( im );
@@ -819,8 +1037,14 @@ flimage_convert( FL_IMAGE * image,
 
     image->type = newtype;
 
-    if ( flimage_getmem( image ) < 0 )
+    /* the pixels of the new type get written to (and, when converting
+       to mono, the gray values as an intermediate result) */
+
+    if (    flimage_getmem( image ) < 0
+         || flimage_detach( image, newtype == FL_IMAGE_MONO ?
+                                   newtype | FL_IMAGE_GRAY : newtype ) < 0 )
     {
+        image->type = otype;
         image->error_message( image, "Convert: can't get memory" );
         return -1;
     }
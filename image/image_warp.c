@@ -32,6 +32,7 @@
 #include "flimage.h"
 #include "flimage_int.h"
 #include <stdlib.h>
+#include <string.h>
 
 
 /***************************************
@@ -261,6 +262,355 @@ get_luts( float ** lutx0,
 ( ic < 0 || ic > ( w ) - 1 || ir < 0 || ir > ( h ) - 1 )
 
 
+/* Fast warping. The inverse transform is affine, so the source position
+   changes by the same amount from one output pixel to the next and can
+   be stepped in 16.16 fixed point. To keep the rounding error of the
+   step from adding up, the exact start position is recomputed for each
+   segment of WARP_SEGMENT pixels. Output rows are done in bands by the
+   worker threads */
+
+#define WARP_SEGMENT   256
+#define WARP_BAND      16
+#define WARP_MAXCOORD  16384   /* source coordinates must stay below */
+
+typedef struct {
+    void         ** in[ 3 ];
+    void         ** out[ 3 ];
+    int             nplanes;
+    int             esize;
+    int             w,
+                    h,
+                    nw;
+    double          x0,             /* source position of pixel (0, 0)  */
+                    y0,
+                    dxc,            /* change per output column and row */
+                    dyc,
+                    dxr,
+                    dyr;
+    unsigned int    fill[ 3 ];
+    int             subp;
+} WARP_JOB;
+
+
+/***************************************
+ * Sets n pixels, starting at column k, to the fill color
+ ***************************************/
+
+static void
+fill_run( WARP_JOB * wj,
+          int        r,
+          int        k,
+          int        n )
+{
+    unsigned short *o;
+    int c,
+        i;
+
+    for ( c = 0; c < wj->nplanes; c++ )
+        if ( wj->esize == 2 )
+            for ( o = ( ( unsigned short ** ) wj->out[ c ] )[ r ] + k, i = 0;
+                  i < n; i++ )
+                o[ i ] = wj->fill[ c ];
+        else
+            memset( ( ( unsigned char ** ) wj->out[ c ] )[ r ] + k,
+                    wj->fill[ c ], n );
+}
+
+
+/***************************************
+ * Along an output row the source position moves on a straight line, so
+ * the pixels that come from outside of the image are at the start and
+ * the end of a span
+ ***************************************/
+
+#define Off_image( X, Y )                                             \
+    (    ( X ) <= -65536 || ( Y ) <= -65536                           \
+      || ( X ) >= ( wj->w << 16 ) || ( Y ) >= ( wj->h << 16 ) )
+
+static void
+trim_span( WARP_JOB * wj,
+           int        r,
+           int        c0,
+           int        n,
+           int        X,
+           int        Y,
+           int        DX,
+           int        DY,
+           int      * s,
+           int      * e )
+{
+    *s = 0;
+    while ( *s < n && Off_image( X + *s * DX, Y + *s * DY ) )
+        ( *s )++;
+    fill_run( wj, r, c0, *s );
+
+    *e = n;
+    while ( *e > *s && Off_image( X + ( *e - 1 ) * DX, Y + ( *e - 1 ) * DY ) )
+        ( *e )--;
+    fill_run( wj, r, c0 + *e, n - *e );
+}
+
+
+/***************************************
+ * Nearest neighbour, the position has 0.1 added as in the reference
+ * code, which then truncates (not floors) it
+ ***************************************/
+
+#define NEAREST_COPY( type )                                          \
+    do {                                                              \
+        const type *in = ( ( type ** ) wj->in[ c ] )[ 0 ];            \
+        type *out = ( ( type ** ) wj->out[ c ] )[ r ] + c0;           \
+                                                                      \
+        for ( k = s; k < e; k++ )                                     \
+            out[ k ] = in[ idx[ k ] ];                                \
+    } while ( 0 )
+
+static void
+nearest_span( WARP_JOB * wj,
+              int        r,
+              int        c0,
+              int        n,
+              int        X,
+              int        Y,
+              int        DX,
+              int        DY )
+{
+    int idx[ WARP_SEGMENT ];
+    int s,
+        e,
+        k,
+        c,
+        x,
+        y;
+
+    trim_span( wj, r, c0, n, X, Y, DX, DY, &s, &e );
+
+    for ( x = X + s * DX, y = Y + s * DY, k = s; k < e;
+          k++, x += DX, y += DY )
+        idx[ k ] = ( y < 0 ? 0 : y >> 16 ) * wj->w + ( x < 0 ? 0 : x >> 16 );
+
+    for ( c = 0; c < wj->nplanes; c++ )
+        if ( wj->esize == 2 )
+            NEAREST_COPY( unsigned short );
+        else
+            NEAREST_COPY( unsigned char );
+}
+
+
+/***************************************
+ * Bilinear interpolation of a pixel near the border, where part of the
+ * neighbours are outside and replaced by the fill color. The 2 x 2
+ * neighbourhood is copied and handed to the same code that does the
+ * interior, so the weights are the same.
+ ***************************************/
+
+static void
+bilinear_border( WARP_JOB * wj,
+                 int        r,
+                 int        k,
+                 int        X,
+                 int        Y )
+{
+    int ix = X >> 16,
+        iy = Y >> 16,
+        c,
+        i,
+        x,
+        y;
+    unsigned short s16[ 4 ],
+                   *o16;
+    unsigned char s8[ 4 ],
+                  *o8;
+
+    for ( c = 0; c < wj->nplanes; c++ )
+    {
+        for ( i = 0; i < 4; i++ )
+        {
+            x = ix + ( i & 1 );
+            y = iy + ( i >> 1 );
+
+            if ( x < 0 || y < 0 || x >= wj->w || y >= wj->h )
+                s16[ i ] = s8[ i ] = wj->fill[ c ];
+            else if ( wj->esize == 2 )
+                s16[ i ] = ( ( unsigned short ** ) wj->in[ c ] )[ y ][ x ];
+            else
+                s8[ i ] = ( ( unsigned char ** ) wj->in[ c ] )[ y ][ x ];
+        }
+
+        if ( wj->esize == 2 )
+        {
+            const unsigned short *p = s16;
+
+            o16 = ( ( unsigned short ** ) wj->out[ c ] )[ r ] + k;
+            flimage_bilerp_u16( &p, 2, &o16, 1, X & 0xffff, Y & 0xffff,
+                                0, 0, 1 );
+        }
+        else
+        {
+            const unsigned char *p = s8;
+
+            o8 = ( ( unsigned char ** ) wj->out[ c ] )[ r ] + k;
+            flimage_bilerp_u8( &p, 2, &o8, 1, X & 0xffff, Y & 0xffff,
+                               0, 0, 1 );
+        }
+    }
+}
+
+
+/***************************************
+ * Bilinear interpolation. Between the off-image pixels there are runs
+ * of pixels at the border and, in the middle, one of pixels with all
+ * neighbours inside that is handed to the (SIMD) kernels
+ ***************************************/
+
+#define Interior( X, Y )                                              \
+    (    ( X ) >= 0 && ( X ) < ( ( wj->w - 1 ) << 16 )                \
+      && ( Y ) >= 0 && ( Y ) < ( ( wj->h - 1 ) << 16 ) )
+
+static void
+bilinear_span( WARP_JOB * wj,
+               int        r,
+               int        c0,
+               int        n,
+               int        X,
+               int        Y,
+               int        DX,
+               int        DY )
+{
+    void *ip[ 3 ],
+         *op[ 3 ];
+    int s,
+        e,
+        c;
+
+    trim_span( wj, r, c0, n, X, Y, DX, DY, &s, &e );
+
+    while ( s < e && ! Interior( X + s * DX, Y + s * DY ) )
+    {
+        bilinear_border( wj, r, c0 + s, X + s * DX, Y + s * DY );
+        s++;
+    }
+
+    while ( e > s && ! Interior( X + ( e - 1 ) * DX, Y + ( e - 1 ) * DY ) )
+    {
+        e--;
+        bilinear_border( wj, r, c0 + e, X + e * DX, Y + e * DY );
+    }
+
+    if ( s == e )
+        return;
+
+    for ( c = 0; c < wj->nplanes; c++ )
+    {
+        ip[ c ] = ( ( char ** ) wj->in[ c ] )[ 0 ];
+        op[ c ] = ( ( char ** ) wj->out[ c ] )[ r ] + ( c0 + s ) * wj->esize;
+    }
+
+    if ( wj->esize == 2 )
+        flimage_bilerp_u16( ( const unsigned short * const * ) ip, wj->w,
+                            ( unsigned short * const * ) op, wj->nplanes,
+                            X + s * DX, Y + s * DY, DX, DY, e - s );
+    else
+        flimage_bilerp_u8( ( const unsigned char * const * ) ip, wj->w,
+                           ( unsigned char * const * ) op, wj->nplanes,
+                           X + s * DX, Y + s * DY, DX, DY, e - s );
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+warp_rows( void * data,
+           int    start,
+           int    end )
+{
+    WARP_JOB *wj = data;
+    int DX = FL_nint( wj->dxc * 65536.0 ),
+        DY = FL_nint( wj->dyc * 65536.0 ),
+        r,
+        c0,
+        n;
+    double x,
+           y;
+
+    for ( r = start; r < end; r++ )
+        for ( c0 = 0; c0 < wj->nw; c0 += n )
+        {
+            n = FL_min( WARP_SEGMENT, wj->nw - c0 );
+            x = wj->x0 + c0 * wj->dxc + r * wj->dxr;
+            y = wj->y0 + c0 * wj->dyc + r * wj->dyr;
+
+            if ( wj->subp )
+                bilinear_span( wj, r, c0, n, FL_nint( x * 65536.0 ),
+                               FL_nint( y * 65536.0 ), DX, DY );
+            else
+                nearest_span( wj, r, c0, n, FL_nint( x * 65536.0 ),
+                              FL_nint( y * 65536.0 ), DX, DY );
+        }
+}
+
+
+/***************************************
+ * Returns 0 if the fast code did the job, -1 if it can't be used. That's
+ * the case for huge images (where the fixed point numbers would overflow)
+ * and for planes that aren't in one piece of memory
+ ***************************************/
+
+static int
+fast_warp( WARP_JOB     * wj,
+           int            nh,
+           float          m[ ][ 2 ],
+           int            shift[ ],
+           FL_IMAGE     * im )
+{
+    int c,
+        i;
+
+    if (    wj->w >= WARP_MAXCOORD || wj->h >= WARP_MAXCOORD
+         || wj->nw <= 0 || nh <= 0 )
+        return -1;
+
+    for ( c = 0; c < wj->nplanes; c++ )
+        if ( ( ( char ** ) wj->in[ c ] )[ wj->h - 1 ]
+             != ( ( char ** ) wj->in[ c ] )[ 0 ]
+                + ( long ) ( wj->h - 1 ) * wj->w * wj->esize )
+            return -1;
+
+    wj->dxc = m[ 0 ][ 0 ];
+    wj->dyc = m[ 1 ][ 0 ];
+    wj->dxr = m[ 0 ][ 1 ];
+    wj->dyr = m[ 1 ][ 1 ];
+    wj->x0 = - wj->dxc * shift[ 0 ] - wj->dxr * shift[ 1 ];
+    wj->y0 = - wj->dyc * shift[ 0 ] - wj->dyr * shift[ 1 ];
+
+    if ( ! wj->subp )
+    {
+        wj->x0 += 0.1;
+        wj->y0 += 0.1;
+    }
+
+    /* the source positions of the corners are the extremes */
+
+    for ( i = 0; i < 4; i++ )
+    {
+        int col = i & 1 ? wj->nw : 0,
+            row = i & 2 ? nh : 0;
+
+        if (    FL_abs( wj->x0 + col * wj->dxc + row * wj->dxr )
+                                                            >= WARP_MAXCOORD
+             || FL_abs( wj->y0 + col * wj->dyc + row * wj->dyr )
+                                                            >= WARP_MAXCOORD )
+            return -1;
+    }
+
+    flimage_parallel_for( im, nh, WARP_BAND, warp_rows, wj );
+    im->completed += nh;
+
+    return 0;
+}
+
+
 /***************************************
  * the short array passed in could be grayscale or color index
  ***************************************/
@@ -276,6 +626,7 @@ transform_short( unsigned short ** in,
                  int               shift[ ],
                  unsigned int      fill,
                  int               subp,
+                 int               ref,
                  FL_IMAGE        * im)
 {
     float *lutx[ 2 ],
@@ -287,6 +638,24 @@ transform_short( unsigned short ** in,
     float fir,
         fic;
 
+    if ( ! ref )
+    {
+        WARP_JOB wj;
+
+        wj.in[ 0 ]   = ( void ** ) in;
+        wj.out[ 0 ]  = ( void ** ) out;
+        wj.nplanes   = 1;
+        wj.esize     = sizeof **in;
+        wj.w         = w;
+        wj.h         = h;
+        wj.nw        = nw;
+        wj.fill[ 0 ] = fill;
+        wj.subp      = subp;
+
+        if ( fast_warp( &wj, nh, m, shift, im ) == 0 )
+            return 1;
+    }
+
     if ( get_luts( lutx, lutx + 1, luty, luty + 1, m, shift, nw, nh ) < 0 )
         return -1;
 
@@ -342,6 +711,7 @@ transform_rgb( unsigned char ** or,
                int              shift[ ],
                unsigned int     fill,
                int              subp,
+               int              ref,
                FL_IMAGE       * im )
 {
     float *lutx[ 2 ],
@@ -358,6 +728,30 @@ transform_rgb( unsigned char ** or,
                   fb = FL_GETB( fill );
     int fillc[ 3 ];
 
+    if ( ! ref )
+    {
+        WARP_JOB wj;
+
+        wj.in[ 0 ]   = ( void ** ) or;
+        wj.in[ 1 ]   = ( void ** ) og;
+        wj.in[ 2 ]   = ( void ** ) ob;
+        wj.out[ 0 ]  = ( void ** ) nr;
+        wj.out[ 1 ]  = ( void ** ) ng;
+        wj.out[ 2 ]  = ( void ** ) nb;
+        wj.nplanes   = 3;
+        wj.esize     = 1;
+        wj.w         = w;
+        wj.h         = h;
+        wj.nw        = nw;
+        wj.fill[ 0 ] = fr;
+        wj.fill[ 1 ] = fg;
+        wj.fill[ 2 ] = fb;
+        wj.subp      = subp;
+
+        if ( fast_warp( &wj, nh, m, shift, im ) == 0 )
+            return 1;
+    }
+
     if ( get_luts( lutx, lutx + 1, luty, luty + 1, m, shift, nw, nh ) < 0 )
         return -1;
 
@@ -418,6 +812,7 @@ flimage_warp( FL_IMAGE * im,
               int        option )
 {
     int subp = option & FLIMAGE_SUBPIXEL,
+        ref = option & FLIMAGE_REFERENCE,
         err = 0,
         i;
     int center = ! ( ( option & FLIMAGE_NOCENTER ) == FLIMAGE_NOCENTER );
@@ -546,21 +941,24 @@ flimage_warp( FL_IMAGE * im,
     {
         fill = FL_RGB2GRAY( FL_GETR( fill ), FL_GETG( fill ), FL_GETB( fill ) );
         if ( ! ( err = ( transform_short( im->gray, us, im->w, im->h, nw, nh,
-                                          inv, shift, fill, subp, im) < 0 ) ) )
+                                          inv, shift, fill, subp, ref,
+                                          im ) < 0 ) ) )
             flimage_replace_image( im, nw, nh, us, 0, 0 );
     }
     else if ( FL_IsCI( im->type ) )
     {
         fill = flimage_get_closest_color_from_map( im, fill );
         if ( ! ( err = ( transform_short( im->ci, us, im->w, im->h, nw, nh,
-                                          inv, shift, fill, 0, im ) < 0 ) ) )
+                                          inv, shift, fill, 0, ref,
+                                          im ) < 0 ) ) )
             flimage_replace_image( im, nw, nh, us, 0, 0 );
     }
     else if ( im->type == FL_IMAGE_RGB )
     {
         if ( ! ( err = ( transform_rgb( im->red, im->green, im->blue,
                                         r, g, b, im->w, im->h, nw, nh, inv,
-                                        shift, fill, subp, im ) < 0 ) ) )
+                                        shift, fill, subp, ref,
+                                        im ) < 0 ) ) )
             flimage_replace_image( im, nw, nh, r, g, b );
     }
     else
@@ -410,13 +410,13 @@ XPM_dump( FL_IMAGE * im )
 
     buf = fl_malloc( cpp * ( im->w + 5 ) * sizeof *buf );
 
-    for ( buflen = y = 0; y < im->h; y++, im->completed++ )
+    for ( y = 0; y < im->h; y++, im->completed++ )
     {
         if ( ! ( im->completed & FLIMAGE_REPFREQ ) )
             im->visual_cue( im, "writing xpm" );
 
         buf[ 0 ] = '"';
-        buf[ buflen + 1 ] = '\0';
+        buflen = 1;
         ci = im->ci[ y ];
 
         /* we never write cpp > 2 */
@@ -437,7 +437,7 @@ XPM_dump( FL_IMAGE * im )
 
         buf[ buflen ] = '\0';
 
-        if ( i < im->h - 1 )
+        if ( y < im->h - 1 )
             fprintf( fp, "%s\",\n", buf );
         else
             fprintf( fp, "%s\"\n", buf );
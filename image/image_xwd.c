@@ -292,6 +292,7 @@ XWD_read_pixels( FL_IMAGE * im )
                  gn,
                  bn;
     unsigned char *uc;
+    unsigned short **ras = im->type == FL_IMAGE_CI ? im->ci : im->gray;
     int x,
         y,
         i,
@@ -417,7 +418,7 @@ XWD_read_pixels( FL_IMAGE * im )
                 for ( y = 0; !err && y < im->h; y++ )
                 {
                     for ( x = 0; x < im->w; x++ )
-                        im->ci[ y ][ x ] = getc( fp );
+                        ras[ y ][ x ] = getc( fp );
 
                     for ( ; x < (int)h->bytes_per_line; x++ )
                         getc( fp );
@@ -458,7 +459,7 @@ XWD_read_pixels( FL_IMAGE * im )
                 for ( y = 0; !err && y < im->h; y++ )
                 {
                     for ( x = 0; x < im->w; x++ )
-                        im->ci[ y ][ x ] = get16( fp );
+                        ras[ y ][ x ] = get16( fp );
 
                     for ( ; x < ( int ) h->bytes_per_line; x++ )
                         getc( fp );
@@ -664,12 +665,14 @@ XWD_write_image( FL_IMAGE * im )
     }
     else if ( im->type == FL_IMAGE_CI || im->type == FL_IMAGE_GRAY )
     {
+        unsigned short **ras = im->type == FL_IMAGE_CI ? im->ci : im->gray;
+
         uc = fl_malloc( h->bytes_per_line );
 
         for ( y = 0; y < im->h; y++ )
         {
             for ( x = 0; x < im->w; x++ )
-                uc[ x ] = im->ci[ y ][ x ];
+                uc[ x ] = ras[ y ][ x ];
             fwrite( uc, 1, h->bytes_per_line, fp );
         }
 
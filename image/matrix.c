@@ -21,6 +21,22 @@
  *  Copyright (c) 1998-2002  T.C. Zhao
  *  All rights reserved.
  *
+ * The element before the first row pointer of a matrix tells how the
+ * memory of the matrix was obtained, FL_GET_MATRIX if it belongs to
+ * the matrix, FL_MAKE_MATRIX if it's somebody else's.
+ *
+ * Matrices can be shared (copy-on-write) between images: the tag then
+ * gets replaced by a pointer to a SHARED_MATRIX record, counting the
+ * users of the matrix. The memory is released when the last of them
+ * calls fl_free_matrix(). A view of a part of a shared matrix has row
+ * pointers of its own and keeps the matrix it points into alive. Before
+ * a shared matrix or a view may be written to flimage_detach_matrix()
+ * must be called to get a copy only the caller uses.
+ *
+ * The count of users is changed atomically (where the compiler has the
+ * __atomic builtins), so images sharing a matrix can be detached and
+ * freed in different threads. Sharing a matrix the first time changes
+ * its tag, so that must not happen while another thread uses it.
  */
 
 #ifdef HAVE_CONFIG_H
@@ -32,6 +48,29 @@
 #include "flimage_int.h"
 
 
+typedef struct {
+    int    users;           /* images or views using the matrix     */
+    void * parent;          /* matrix a view points into, or NULL   */
+} SHARED_MATRIX;
+
+/* Tags are small numbers, everything else is a SHARED_MATRIX */
+
+#define Is_tag( p )   ( ( size_t ) ( p ) < 128 )
+
+#ifdef __ATOMIC_ACQ_REL
+#define Add_user( sm )      __atomic_add_fetch( &( sm )->users, 1,       \
+                                                __ATOMIC_RELAXED )
+#define Remove_user( sm )   __atomic_sub_fetch( &( sm )->users, 1,       \
+                                                __ATOMIC_ACQ_REL )
+#define Get_users( sm )     __atomic_load_n( &( sm )->users,             \
+                                             __ATOMIC_ACQUIRE )
+#else
+#define Add_user( sm )      ++( sm )->users
+#define Remove_user( sm )   --( sm )->users
+#define Get_users( sm )     ( sm )->users
+#endif
+
+
 /***************************************
  ***************************************/
 
@@ -97,7 +136,22 @@ fl_free_matrix( void *p )
     if ( ! p )
         return;
 
-    if ( matrix[ -1 ] && matrix[ 0 ] )
+    if ( ! Is_tag( matrix[ -1 ] ) )
+    {
+        SHARED_MATRIX *sm = ( SHARED_MATRIX * ) matrix[ -1 ];
+
+        if ( Remove_user( sm ) > 0 )
+            return;
+
+        if ( sm->parent )
+            fl_free_matrix( sm->parent );
+        else
+            fl_free( matrix[ 0 ] );
+
+        fl_free( sm );
+        fl_free( matrix - 1 );
+    }
+    else if ( matrix[ -1 ] && matrix[ 0 ] )
     {
         if ( matrix[ -1 ] == ( char * ) FL_GET_MATRIX )
             fl_free( matrix[ 0 ] );
@@ -106,6 +160,143 @@ fl_free_matrix( void *p )
 }
 
 
+
+/***************************************
+ * Returns if p is a matrix made by one of the functions above
+ ***************************************/
+
+int
+flimage_is_matrix( void * p )
+{
+    char **matrix = p;
+
+    return    p
+           && (    ! Is_tag( matrix[ -1 ] )
+                || matrix[ -1 ] == ( char * ) FL_GET_MATRIX
+                || matrix[ -1 ] == ( char * ) FL_MAKE_MATRIX );
+}
+
+
+/***************************************
+ * Adds a user to a matrix and returns it, or NULL if the matrix can't
+ * be shared because its memory belongs to somebody else
+ ***************************************/
+
+void *
+flimage_share_matrix( void * p )
+{
+    char **matrix = p;
+    SHARED_MATRIX *sm;
+
+    if ( ! p )
+        return NULL;
+
+    if ( Is_tag( matrix[ -1 ] ) )
+    {
+        if (    matrix[ -1 ] != ( char * ) FL_GET_MATRIX
+             || ! ( sm = fl_malloc( sizeof *sm ) ) )
+            return NULL;
+
+        sm->users = 1;
+        sm->parent = NULL;
+        matrix[ -1 ] = ( char * ) sm;
+    }
+    else
+        sm = ( SHARED_MATRIX * ) matrix[ -1 ];
+
+    Add_user( sm );
+    return p;
+}
+
+
+/***************************************
+ * Returns a matrix of 'nrows' rows, starting at row 'r1' and column
+ * 'c1' of a shareable matrix, without copying. NULL is returned if the
+ * matrix can't be shared.
+ ***************************************/
+
+void *
+flimage_view_matrix( void         * p,
+                     int            r1,
+                     int            c1,
+                     int            nrows,
+                     unsigned int   esize )
+{
+    char **matrix = p,
+         **view;
+    SHARED_MATRIX *sm;
+    int i;
+
+    if ( ! flimage_share_matrix( p ) )
+        return NULL;
+
+    if (    ! ( view = fl_malloc( ( nrows + 1 ) * sizeof *view ) )
+         || ! ( sm = fl_malloc( sizeof *sm ) ) )
+    {
+        fli_safe_free( view );
+        fl_free_matrix( p );
+        return NULL;
+    }
+
+    sm->users = 1;
+    sm->parent = p;
+    view[ 0 ] = ( char * ) sm;
+
+    for ( i = 1; i <= nrows; i++ )
+        view[ i ] = matrix[ r1 + i - 1 ] + c1 * esize;
+
+    return view + 1;
+}
+
+
+/***************************************
+ * Returns if writing to the matrix would change data seen by others
+ ***************************************/
+
+int
+flimage_matrix_is_shared( void * p )
+{
+    char **matrix = p;
+    SHARED_MATRIX *sm;
+
+    if ( ! p || Is_tag( matrix[ -1 ] ) )
+        return 0;
+
+    sm = ( SHARED_MATRIX * ) matrix[ -1 ];
+    return Get_users( sm ) > 1 || sm->parent;
+}
+
+
+/***************************************
+ * Returns a matrix that can be written to without anybody else
+ * noticing: the matrix itself if it isn't shared, otherwise a copy of
+ * it, in which case the caller's use of the original ends. On failure
+ * NULL is returned and the original is left alone.
+ ***************************************/
+
+void *
+flimage_detach_matrix( void         * p,
+                       int            nrows,
+                       int            ncols,
+                       unsigned int   esize )
+{
+    char **matrix = p,
+         **copy;
+    int i;
+
+    if ( ! flimage_matrix_is_shared( p ) )
+        return p;
+
+    if ( ! ( copy = fl_get_matrix( nrows, ncols, esize ) ) )
+        return NULL;
+
+    for ( i = 0; i < nrows; i++ )
+        memcpy( copy[ i ], matrix[ i ], ncols * esize );
+
+    fl_free_matrix( p );
+    return copy;
+}
+
 /*
  * Local variables:
  * tab-width: 4
@@ -26,6 +26,13 @@
  *  Handle input other than the X event queue. Mostly maintanance
  *  here. Actual input/output handling is triggered in the main loop
  *  via fli_watch_io().
+ *
+ *  Where available (Linux) epoll is used to wait for the file
+ *  descriptors. Then each descriptor is registered only once, with
+ *  the union of what all the callbacks for it want, and only the
+ *  callbacks of descriptors that are ready get looked at, so neither
+ *  the number of descriptors nor their values are limited. If epoll
+ *  can't be used select() is used instead.
  */
 
 #ifdef HAVE_CONFIG_H
@@ -34,6 +41,7 @@
 
 #include "include/forms.h"
 #include "flinternal.h"
+#include <string.h>
 #include <sys/types.h>
 
 #ifndef FL_WIN32
@@ -44,6 +52,12 @@
 #include <sys/select.h>
 #endif
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#include <unistd.h>
+#define FLI_USE_EPOLL 1
+#endif
+
 #ifdef __sgi
 #include <bstring.h>
 #endif
@@ -61,6 +75,240 @@ static void add_to_freelist( FLI_IO_REC * io );
 static void clear_freelist( void );
 
 
+#ifdef FLI_USE_EPOLL
+
+/* Per file descriptor data for epoll: the records of all callbacks for
+   the descriptor (linked via their 'fd_next' member) and what epoll has
+   been told to watch for. Descriptors epoll can't deal with (regular
+   files) are, as with select(), always considered to be ready. epoll
+   reports hang-ups and errors whatever it was asked to watch for, so
+   a descriptor that got one is taken out of epoll if its callbacks
+   didn't do anything about it ('hung_up' is set then) and only put
+   back in when the set of callbacks for it changes. */
+
+typedef struct {
+    FLI_IO_REC   * first;
+    unsigned int   events;
+    int            unpollable;
+    int            hung_up;
+} FLI_FD_ENTRY;
+
+#define MAX_EPOLL_EVENTS  64
+
+static int use_epoll = -1;              /* not decided yet */
+static int epoll_fd = -1;
+static FLI_FD_ENTRY *fd_table;
+static int fd_table_size;
+static int num_unpollable;
+
+
+/***************************************
+ * Returns if epoll is to be used, trying to set it up on the first call
+ ***************************************/
+
+static int
+epoll_available( void )
+{
+    if ( use_epoll < 0 )
+        use_epoll = ( epoll_fd = epoll_create1( EPOLL_CLOEXEC ) ) >= 0;
+
+    return use_epoll;
+}
+
+
+/***************************************
+ * Returns the entry for a file descriptor, making the table
+ * larger if necessary
+ ***************************************/
+
+static FLI_FD_ENTRY *
+get_fd_entry( int fd )
+{
+    if ( fd >= fd_table_size )
+    {
+        int n = FL_max( fd + 1, 2 * fd_table_size );
+        FLI_FD_ENTRY *t = fl_realloc( fd_table, n * sizeof *t );
+
+        if ( ! t )
+            return NULL;
+
+        memset( t + fd_table_size, 0,
+                ( n - fd_table_size ) * sizeof *t );
+        fd_table = t;
+        fd_table_size = n;
+    }
+
+    return fd_table + fd;
+}
+
+
+/***************************************
+ * Tells epoll what to watch a file descriptor for after the set of
+ * callbacks for it changed
+ ***************************************/
+
+static void
+update_fd( int fd )
+{
+    FLI_FD_ENTRY *e = fd_table + fd;
+    struct epoll_event ev;
+    FLI_IO_REC *p;
+    unsigned int mask = 0;
+    int op;
+
+    for ( p = e->first; p; p = p->fd_next )
+        mask |= p->mask;
+
+    e->hung_up = 0;
+
+    ev.events  =   ( mask & FL_READ   ? EPOLLIN  : 0 )
+                 | ( mask & FL_WRITE  ? EPOLLOUT : 0 )
+                 | ( mask & FL_EXCEPT ? EPOLLPRI : 0 );
+    ev.data.fd = fd;
+
+    if ( e->unpollable )
+    {
+        if ( ev.events )
+            return;
+        e->unpollable = 0;
+        num_unpollable--;
+    }
+
+    if ( ev.events == e->events )
+        return;
+
+    if ( ! ev.events )
+        op = EPOLL_CTL_DEL;
+    else if ( ! e->events )
+        op = EPOLL_CTL_ADD;
+    else
+        op = EPOLL_CTL_MOD;
+
+    if (    epoll_ctl( epoll_fd, op, fd, &ev ) < 0
+         && op != EPOLL_CTL_DEL )        /* fd may have been closed already */
+    {
+        if ( errno == EPERM )
+        {
+            e->unpollable = 1;
+            num_unpollable++;
+        }
+        else
+            M_err( "update_fd", fli_get_syserror_msg( ) );
+
+        ev.events = 0;
+    }
+
+    e->events = ev.events;
+}
+
+
+/***************************************
+ * Invokes the callbacks for a file descriptor that is ready, 'ready'
+ * being the set of FL_READ, FL_WRITE and FL_EXCEPT that apply. On a
+ * hang-up or error also callbacks that don't wait for any of these
+ * get invoked (once), they'd never learn about it otherwise.
+ ***************************************/
+
+static void
+dispatch_fd( int          fd,
+             unsigned int ready,
+             int          hangup )
+{
+    FLI_IO_REC *p;
+
+    if ( fd < 0 || fd >= fd_table_size )
+        return;
+
+    /* Records removed by a callback keep their 'fd_next' pointer and
+       aren't deallocated before the end of fli_watch_io() */
+
+    for ( p = fd_table[ fd ].first; p; p = p->fd_next )
+    {
+        if ( ! p->callback || p->mask == 0 )
+            continue;
+
+        if ( p->mask & ready & FL_READ )
+            p->callback( p->source, p->data );
+
+        if ( p->mask & ready & FL_WRITE )
+            p->callback( p->source, p->data );
+
+        if ( p->mask & ready & FL_EXCEPT )
+            p->callback( p->source, p->data );
+
+        if ( hangup && ! ( p->mask & ready ) )
+            p->callback( p->source, p->data );
+    }
+}
+
+
+/***************************************
+ * epoll version of the wait, see fli_watch_io()
+ ***************************************/
+
+static void
+epoll_watch( long msec )
+{
+    struct epoll_event ev[ MAX_EPOLL_EVENTS ];
+    unsigned int ready;
+    int nf,
+        i;
+
+    nf = epoll_wait( epoll_fd, ev, MAX_EPOLL_EVENTS,
+                     num_unpollable ? 0 : ( msec < 0 ? -1 : ( int ) msec ) );
+
+    if ( nf < 0 )
+    {
+        if ( errno == EINTR )
+            M_warn( "fli_watch_io", "epoll_wait interrupted by signal" );
+        else
+            M_err( "fli_watch_io", fli_get_syserror_msg( ) );
+
+        return;
+    }
+
+    /* Like select(), report errors and hang-ups as the descriptor being
+       readable (and errors also as writable) */
+
+    for ( i = 0; i < nf; i++ )
+    {
+        int fd = ev[ i ].data.fd,
+            hangup = ev[ i ].events & ( EPOLLHUP | EPOLLERR );
+
+        ready =   ( ev[ i ].events & ( EPOLLIN | EPOLLHUP | EPOLLERR ) ?
+                    FL_READ : 0 )
+                | ( ev[ i ].events & ( EPOLLOUT | EPOLLERR ) ? FL_WRITE : 0 )
+                | ( ev[ i ].events & EPOLLPRI ? FL_EXCEPT : 0 );
+
+        if ( fd < 0 || fd >= fd_table_size )
+            continue;
+
+        if ( hangup )
+            fd_table[ fd ].hung_up = 1;
+
+        dispatch_fd( fd, ready, hangup );
+
+        /* If the callbacks neither removed themselves nor changed what
+           they're waiting for (which resets 'hung_up') epoll would report
+           the hang-up again and again without ever waiting, so stop
+           watching the descriptor until something changes */
+
+        if ( fd_table[ fd ].hung_up && fd_table[ fd ].events )
+        {
+            epoll_ctl( epoll_fd, EPOLL_CTL_DEL, fd, NULL );
+            fd_table[ fd ].events = 0;
+        }
+    }
+
+    if ( num_unpollable )
+        for ( i = 0; i < fd_table_size; i++ )
+            if ( fd_table[ i ].unpollable )
+                dispatch_fd( i, FL_READ | FL_WRITE, 0 );
+}
+
+#endif   /* FLI_USE_EPOLL */
+
+
 /***************************************
  * Collect all the fd_sets so we don't do it inside the
  * critical select inner loop
@@ -72,6 +320,11 @@ collect_fds( void )
     FLI_IO_REC *p;
     int nf = 0;
 
+#ifdef FLI_USE_EPOLL
+    if ( use_epoll > 0 )
+        return;
+#endif
+
     /* Initialize the sets */
 
     FD_ZERO( &st_rfds );
@@ -82,9 +335,9 @@ collect_fds( void )
 
     for ( p = fli_context->io_rec; p; p = p->next )
     {
-        if ( p->source < 0 )
+        if ( p->source < 0 || p->source >= FD_SETSIZE )
         {
-            M_err( "collect_fds", "source < 0\n" );
+            M_err( "collect_fds", "source %d out of range", p->source );
             continue;
         }
 
@@ -119,6 +372,7 @@ fl_add_io_callback( int              fd,
     io_rec = fl_malloc( sizeof *io_rec );
 
     io_rec->next     = fli_context->io_rec;
+    io_rec->fd_next  = NULL;
     io_rec->callback = callback;
     io_rec->data     = data;
     io_rec->source   = fd;
@@ -126,6 +380,24 @@ fl_add_io_callback( int              fd,
 
     fli_context->io_rec = io_rec;
 
+#ifdef FLI_USE_EPOLL
+    if ( epoll_available( ) )
+    {
+        FLI_FD_ENTRY *e;
+
+        if ( fd < 0 || ! ( e = get_fd_entry( fd ) ) )
+        {
+            M_err( "fl_add_io_callback", "Can't watch fd %d", fd );
+            return;
+        }
+
+        io_rec->fd_next = e->first;
+        e->first = io_rec;
+        update_fd( fd );
+        return;
+    }
+#endif
+
     collect_fds( );
 }
 
@@ -162,6 +434,21 @@ fl_remove_io_callback( int            fd,
         else
             fli_context->io_rec = io->next;
 
+#ifdef FLI_USE_EPOLL
+        /* Also take it out of the chain for the file descriptor, but
+           without changing its 'fd_next' (see below) */
+
+        if ( use_epoll > 0 && fd >= 0 && fd < fd_table_size )
+        {
+            FLI_IO_REC **pp = &fd_table[ fd ].first;
+
+            while ( *pp && *pp != io )
+                pp = &( *pp )->fd_next;
+            if ( *pp )
+                *pp = io->fd_next;
+        }
+#endif
+
         /* Caution: the following may look idiotic at first: simply getting
            rid of the structure for the callback would seem to be appropriate.
            But things get interesting if the callback gets removed from within
@@ -177,12 +464,27 @@ fl_remove_io_callback( int            fd,
         add_to_freelist( io );
     }
 
+#ifdef FLI_USE_EPOLL
+    if ( use_epoll > 0 )
+    {
+        if ( fd >= 0 && fd < fd_table_size )
+            update_fd( fd );
+        return;
+    }
+#endif
+
     collect_fds( );
 }
 
 
 /***************************************
- * Watch for activities using select or poll. Timeout is in milli-seconds.
+ * Waits until one of the watched file descriptors (which includes the
+ * connection to the X server and the pipe signals get reported through)
+ * becomes ready or 'msec' milli-seconds have passed and then invokes the
+ * callbacks for the ready file descriptors. A negative 'msec' means
+ * there's no limit on the time to wait, the caller must make sure that
+ * this is only the case when nothing else but new input can require any
+ * action.
  ***************************************/
 
 void
@@ -198,6 +500,12 @@ fli_watch_io( FLI_IO_REC * io_rec,
 
     clear_freelist( );
 
+    /* Requests still sitting in the output buffer might be what's needed
+       to get the next event sent to us */
+
+    if ( fl_display && msec != 0 )
+        XFlush( fl_display );
+
     if ( ! io_rec )
     {
         if ( msec > 0 )
@@ -206,6 +514,15 @@ fli_watch_io( FLI_IO_REC * io_rec,
         return;
     }
 
+#ifdef FLI_USE_EPOLL
+    if ( use_epoll > 0 )
+    {
+        epoll_watch( msec );
+        clear_freelist( );
+        return;
+    }
+#endif
+
     timeout.tv_usec = 1000 * ( msec % 1000 );
     timeout.tv_sec  = msec / 1000;
 
@@ -218,7 +535,8 @@ fli_watch_io( FLI_IO_REC * io_rec,
     /* Now watch it. HP defines rfds to be ints. Althought compiler will
        bark, it is harmless. */
 
-    nf = select( fli_context->num_io, &rfds, &wfds, &efds, &timeout );
+    nf = select( fli_context->num_io, &rfds, &wfds, &efds,
+                 msec < 0 ? NULL : &timeout );
 
     if ( nf < 0 )     /* something is wrong. */
     {
@@ -242,7 +560,10 @@ fli_watch_io( FLI_IO_REC * io_rec,
 
     for ( p = io_rec; p; p = p->next )
     {
-        if ( ! p->callback || p->source < 0 || p->mask == 0 )
+        if (    ! p->callback
+             || p->source < 0
+             || p->source >= FD_SETSIZE
+             || p->mask == 0 )
             continue;
 
         if ( p->mask & FL_READ && FD_ISSET( p->source, &rfds ) )
@@ -267,6 +588,20 @@ fli_is_watched_io( int fd )
 {
     FLI_IO_REC *p;
 
+#ifdef FLI_USE_EPOLL
+    if ( use_epoll > 0 )
+    {
+        if ( fd < 0 || fd >= fd_table_size )
+            return 0;
+
+        for ( p = fd_table[ fd ].first; p; p = p->fd_next )
+            if ( p->mask )
+                return 1;
+
+        return 0;
+    }
+#endif
+
     for ( p = fli_context->io_rec; p; p = p->next )
         if ( p->source == fd && p->mask )
             return 1;
@@ -275,6 +610,29 @@ fli_is_watched_io( int fd )
 }
 
 
+/***************************************
+ * Releases what's still used for watching file descriptors, to be
+ * called from fl_finish() after all callbacks have been removed
+ ***************************************/
+
+void
+fli_free_io( void )
+{
+    clear_freelist( );
+
+#ifdef FLI_USE_EPOLL
+    if ( epoll_fd >= 0 )
+        close( epoll_fd );
+    epoll_fd = -1;
+    use_epoll = -1;
+
+    fli_safe_free( fd_table );
+    fd_table_size = 0;
+    num_unpollable = 0;
+#endif
+}
+
+
 /***************************************
  ***************************************/
 
@@ -1029,6 +1029,7 @@ get_rgb_pixel( FL_COLOR   packed,
     unsigned long pixel;
     static Colormap lastcolormap;
     static XColor *xcolor;
+    static FLI_COLOR_INDEX *xindex;
     static int new_col;
     XColor xc;
 
@@ -1074,8 +1075,14 @@ get_rgb_pixel( FL_COLOR   packed,
             XQueryColors( flx->display, s->colormap, xcolor, max_col );
             lastcolormap = s->colormap;
             new_col = 0;
+
+            fli_free_color_index( xindex );
+            xindex = fli_make_xcolor_index( xcolor, max_col );
         }
 
+        if ( xindex )
+            return xcolor[ fli_lookup_color_index( xindex, r, g, b ) ].pixel;
+
         fli_find_closest_color( r, g, b, xcolor, max_col, &pixel );
         return pixel;
     }
@@ -1192,6 +1199,7 @@ fl_mapcolor( FL_COLOR col,
     static int totalcols;
     static XColor *cur_mapvals[ 6 ],
                   *cur_map;
+    static FLI_COLOR_INDEX *cur_index[ 6 ];
     unsigned long pixel;
 
     /* If requested color is reserved, warn */
@@ -1287,12 +1295,16 @@ fl_mapcolor( FL_COLOR col,
             cur_map[ i ].pixel = i;
 
         XQueryColors( flx->display, fli_map( fl_vmode ), cur_map, totalcols );
+        cur_index[ fl_vmode ] = fli_make_xcolor_index( cur_map, totalcols );
     }
 
     /* Search for the closest match */
 
     cur_map = cur_mapvals[ fl_vmode ];
-    j = fli_find_closest_color( r, g, b, cur_map, totalcols, &pixel );
+    if ( cur_index[ fl_vmode ] )
+        j = fli_lookup_color_index( cur_index[ fl_vmode ], r, g, b );
+    else
+        j = fli_find_closest_color( r, g, b, cur_map, totalcols, &pixel );
 
     if ( j < 0 )
     {
@@ -1760,6 +1772,16 @@ fl_free_colors( FL_COLOR * c,
 
 #define LINEAR_COLOR_DISTANCE  0
 
+/* Correct formula is (.299,.587,.114) */
+
+#if LINEAR_COLOR_DISTANCE
+#define Color_dist( w, d )  ( ( w ) * FL_abs( d ) )
+#else
+#define Color_dist( w, d )  ( ( w ) * ( d ) * ( d ) )
+#endif
+
+static const int color_weight[ 3 ] = { 3, 4, 2 };
+
 int
 fli_find_closest_color( int             r,
                         int             g,
@@ -1782,13 +1804,9 @@ fli_find_closest_color( int             r,
         dg = g - ( ( map[ i ].green >> 8 ) & 0xff );
         db = b - ( ( map[ i ].blue  >> 8 ) & 0xff );
 
-        /* Correct formula is (.299,.587,.114) */
-
-#if LINEAR_COLOR_DISTANCE
-        diff = 3 * FL_abs( dr ) + 4 * FL_abs( dg ) + 2 * FL_abs( db );
-#else
-        diff = 3 * ( dr * dr ) + 4 * ( dg * dg ) + 2 * ( db * db );
-#endif
+        diff =   Color_dist( color_weight[ 0 ], dr )
+               + Color_dist( color_weight[ 1 ], dg )
+               + Color_dist( color_weight[ 2 ], db );
 
         if ( diff < 0 )
             fprintf( stderr, "dr = %d dg = %d db = %d diff = %ld\n",
@@ -1806,6 +1824,293 @@ fli_find_closest_color( int             r,
 }
 
 
+/* An index for finding the closest colors of a colormap quickly when
+ * there are lots of them to look up. It's a k-d tree, stored implicitly:
+ * the node for a range of entries is the one in the middle, with all
+ * entries before it not larger and all after it not smaller in the
+ * component the range was split on. Lookups give the same results as
+ * fli_find_closest_color(), including the lowest index winning when
+ * several entries are at the same distance.
+ */
+
+struct fli_color_index_ {
+    int             len;
+    unsigned char * rgb;        /* components of the entries in tree order */
+    int           * entry;      /* their index in the original map         */
+    unsigned char * axis;       /* component the range was split at        */
+};
+
+
+/***************************************
+ * Exchanges two entries of the (partially built) tree
+ ***************************************/
+
+static void
+swap_entries( FLI_COLOR_INDEX * ci,
+              int               i,
+              int               j )
+{
+    unsigned char t[ 3 ];
+    int e;
+
+    memcpy( t, ci->rgb + 3 * i, 3 );
+    memcpy( ci->rgb + 3 * i, ci->rgb + 3 * j, 3 );
+    memcpy( ci->rgb + 3 * j, t, 3 );
+
+    e = ci->entry[ i ];
+    ci->entry[ i ] = ci->entry[ j ];
+    ci->entry[ j ] = e;
+}
+
+
+/***************************************
+ * Splits the range lo to hi - 1 of entries at the component with the
+ * largest (weighted) spread and continues with both halves
+ ***************************************/
+
+static void
+build_color_tree( FLI_COLOR_INDEX * ci,
+                  int               lo,
+                  int               hi )
+{
+    int mid = ( lo + hi ) / 2,
+        a = 0,
+        best = -1,
+        i,
+        j,
+        l,
+        h,
+        v;
+    unsigned char *p = ci->rgb;
+
+    if ( hi - lo < 2 )
+    {
+        if ( hi > lo )
+            ci->axis[ lo ] = 0;
+        return;
+    }
+
+    for ( i = 0; i < 3; i++ )
+    {
+        int min = 255,
+            max = 0;
+
+        for ( j = lo; j < hi; j++ )
+        {
+            min = FL_min( min, p[ 3 * j + i ] );
+            max = FL_max( max, p[ 3 * j + i ] );
+        }
+
+        if ( Color_dist( color_weight[ i ], max - min ) > best )
+        {
+            best = Color_dist( color_weight[ i ], max - min );
+            a = i;
+        }
+    }
+
+    /* Quickselect for the median of the component */
+
+    for ( l = lo, h = hi - 1; l < h; )
+    {
+        v = p[ 3 * mid + a ];
+        swap_entries( ci, mid, h );
+
+        for ( i = j = l; i < h; i++ )
+            if ( p[ 3 * i + a ] < v )
+                swap_entries( ci, i, j++ );
+
+        swap_entries( ci, j, h );
+
+        if ( j == mid )
+            break;
+        else if ( j < mid )
+            l = j + 1;
+        else
+            h = j - 1;
+    }
+
+    ci->axis[ mid ] = a;
+
+    build_color_tree( ci, lo, mid );
+    build_color_tree( ci, mid + 1, hi );
+}
+
+
+/***************************************
+ * Makes an index for a colormap with 'len' entries, with 8 bit
+ * components. Returns NULL if there's not enough memory
+ ***************************************/
+
+FLI_COLOR_INDEX *
+fli_make_color_index( const int * r,
+                      const int * g,
+                      const int * b,
+                      int         len )
+{
+    FLI_COLOR_INDEX *ci;
+    int i;
+
+    if ( ! ( ci = fl_malloc( sizeof *ci ) ) )
+        return NULL;
+
+    ci->len = FL_max( len, 0 );
+    ci->rgb = fl_malloc( 3 * ci->len + 1 );
+    ci->entry = fl_malloc( ( ci->len + 1 ) * sizeof *ci->entry );
+    ci->axis = fl_malloc( ci->len + 1 );
+
+    if ( ! ci->rgb || ! ci->entry || ! ci->axis )
+    {
+        fli_free_color_index( ci );
+        return NULL;
+    }
+
+    for ( i = 0; i < ci->len; i++ )
+    {
+        ci->rgb[ 3 * i     ] = r[ i ] & 0xff;
+        ci->rgb[ 3 * i + 1 ] = g[ i ] & 0xff;
+        ci->rgb[ 3 * i + 2 ] = b[ i ] & 0xff;
+        ci->entry[ i ] = i;
+    }
+
+    build_color_tree( ci, 0, ci->len );
+
+    return ci;
+}
+
+
+/***************************************
+ * Same, for a colormap as returned by XQueryColors()
+ ***************************************/
+
+FLI_COLOR_INDEX *
+fli_make_xcolor_index( const XColor * map,
+                       int            len )
+{
+    FLI_COLOR_INDEX *ci = NULL;
+    int *rgb,
+        i;
+
+    if ( ! ( rgb = fl_malloc( 3 * ( FL_max( len, 0 ) + 1 ) * sizeof *rgb ) ) )
+        return NULL;
+
+    for ( i = 0; i < len; i++ )
+    {
+        rgb[ i           ] = ( map[ i ].red   >> 8 ) & 0xff;
+        rgb[ i + len     ] = ( map[ i ].green >> 8 ) & 0xff;
+        rgb[ i + 2 * len ] = ( map[ i ].blue  >> 8 ) & 0xff;
+    }
+
+    ci = fli_make_color_index( rgb, rgb + len, rgb + 2 * len, len );
+    fl_free( rgb );
+
+    return ci;
+}
+
+
+/***************************************
+ ***************************************/
+
+void
+fli_free_color_index( FLI_COLOR_INDEX * ci )
+{
+    if ( ! ci )
+        return;
+
+    fl_free( ci->rgb );
+    fl_free( ci->entry );
+    fl_free( ci->axis );
+    fl_free( ci );
+}
+
+
+/***************************************
+ ***************************************/
+
+typedef struct {
+    int  q[ 3 ];
+    long mindiff;
+    int  best;
+} ColorQuery;
+
+
+static void
+search_color_tree( const FLI_COLOR_INDEX * ci,
+                   ColorQuery            * cq,
+                   int                     lo,
+                   int                     hi )
+{
+    const unsigned char *p;
+    int mid,
+        a,
+        d;
+    long diff;
+
+    while ( hi > lo )
+    {
+        mid = ( lo + hi ) / 2;
+        p = ci->rgb + 3 * mid;
+        a = ci->axis[ mid ];
+
+        diff =   Color_dist( color_weight[ 0 ], cq->q[ 0 ] - p[ 0 ] )
+               + Color_dist( color_weight[ 1 ], cq->q[ 1 ] - p[ 1 ] )
+               + Color_dist( color_weight[ 2 ], cq->q[ 2 ] - p[ 2 ] );
+
+        if (    diff < cq->mindiff
+             || ( diff == cq->mindiff && ci->entry[ mid ] < cq->best ) )
+        {
+            cq->mindiff = diff;
+            cq->best = ci->entry[ mid ];
+        }
+
+        /* Search the side the color is on first, then the other one if
+           it could contain entries not farther away than the best one
+           yet (equal distance counts for the lower index) */
+
+        d = cq->q[ a ] - p[ a ];
+
+        if ( d < 0 )
+        {
+            search_color_tree( ci, cq, lo, mid );
+            if ( Color_dist( color_weight[ a ], d ) > cq->mindiff )
+                return;
+            lo = mid + 1;
+        }
+        else
+        {
+            search_color_tree( ci, cq, mid + 1, hi );
+            if ( Color_dist( color_weight[ a ], d ) > cq->mindiff )
+                return;
+            hi = mid;
+        }
+    }
+}
+
+
+/***************************************
+ * Returns the index of the colormap entry closest to the (8 bit)
+ * color r, g, b, or -1 for an empty colormap
+ ***************************************/
+
+int
+fli_lookup_color_index( const FLI_COLOR_INDEX * ci,
+                        int                     r,
+                        int                     g,
+                        int                     b )
+{
+    ColorQuery cq;
+
+    cq.q[ 0 ] = r;
+    cq.q[ 1 ] = g;
+    cq.q[ 2 ] = b;
+    cq.mindiff = 0x7fffffffL;
+    cq.best = -1;
+
+    search_color_tree( ci, &cq, 0, ci->len );
+
+    return cq.best;
+}
+
+
 /*
  * Local variables:
  * tab-width: 4
@@ -239,6 +239,46 @@ FL_OBJECT *fli_find_object_backwards( FL_OBJECT *,
 void fli_insert_object( FL_OBJECT *,
                         FL_OBJECT * );
 
+void fli_get_object_rect( const FL_OBJECT *,
+                          FL_RECT *,
+                          int );
+
+void fli_flush_form_damage( FL_FORM * );
+
+void fli_flush_damage( void );
+
+/* Spatial index of the objects of a form, from objindex.c */
+
+typedef struct fli_obj_index_ FLI_OBJ_INDEX;
+
+typedef struct {
+    FL_OBJECT * obj;
+    FL_RECT     rect;           /* area covered by object and its label */
+    int         order;          /* larger for objects higher up */
+    int         stamp;          /* for internal use */
+    int         pos;
+    int         cx1,
+                cy1,
+                cx2,
+                cy2;
+} FLI_INDEX_ENTRY;
+
+void fli_invalidate_object_index( FL_FORM * );
+
+void fli_add_to_object_index( FL_OBJECT * );
+
+void fli_remove_from_object_index( FL_OBJECT * );
+
+void fli_update_object_index( FL_OBJECT * );
+
+void fli_resync_object_index( FL_FORM * );
+
+void fli_free_object_index( FL_FORM * );
+
+int fli_query_object_index( FL_FORM *,
+                            const FL_RECT *,
+                            FLI_INDEX_ENTRY *** );
+
 void fli_scale_object( FL_OBJECT *,
                        double     ,
                        double );
@@ -488,6 +528,7 @@ typedef struct fli_idle_cb_ {
 
 typedef struct fli_io_event_ {
     struct fli_io_event_ * next;
+    struct fli_io_event_ * fd_next;     /* next one for same fd (epoll) */
     FL_IO_CALLBACK         callback;
     void                 * data;
     unsigned int           mask;
@@ -520,17 +561,20 @@ void fli_remove_all_signal_callbacks( void );
 
 typedef struct fli_timeout_ {
     int                    id;
-    struct fli_timeout_  * next;
-    struct fli_timeout_  * prev;
-    long                   start_sec,
-                           start_usec;
-    long                   ms_to_wait;
+    int                    slot;        /* index in heap, < 0 when expired */
+    struct fli_timeout_  * hnext;       /* next one with same hash value  */
+    struct fli_timeout_  * due_next;    /* next expired one               */
+    long                   sec,         /* expiry time (monotonic clock)  */
+                           usec;
     FL_TIMEOUT_CALLBACK    callback;
     void                 * data;
 } FLI_TIMEOUT_REC;
 
 void fli_remove_all_timeouts( void );
 
+void fli_get_monotonic_time( long *,
+                             long * );
+
 /*
  *  Intenal controls.
  */
@@ -541,7 +585,7 @@ typedef struct fli_context_ {
     FLI_IDLE_REC       * idle_rec;          /* idle callback record   */
     FLI_IO_REC         * io_rec;            /* async IO record        */
     FLI_SIGNAL_REC     * signal_rec;        /* list of app signals    */
-    FLI_TIMEOUT_REC    * timeout_rec;       /* timeout callbacks      */
+    FLI_TIMEOUT_REC    * timeout_rec;       /* next timeout to expire */
     int                  idle_delta;        /* timer resolution       */
     int                  last_event;        /* last event received    */
     long                 mouse_button;      /* push/release record    */
@@ -620,6 +664,8 @@ void fli_init_context( void );
 void fli_watch_io( FLI_IO_REC *,
                    long );
 
+void fli_free_io( void );
+
 int fli_do_shortcut( FL_FORM *,
                      int,
                      FL_Coord,
@@ -829,7 +875,7 @@ void fli_input_cleanup( void );
 
 void fli_sinput_cleanup( void );
 
-void fli_handle_timeouts( long * );
+int fli_handle_timeouts( long * );
 
 #define FL_IS_NONSQRBOX( t ) (    t == FL_SHADOW_BOX          \
                                || t == FL_NO_BOX              \
@@ -934,6 +980,23 @@ int fli_find_closest_color( int,
                             int,
                             unsigned long * );
 
+typedef struct fli_color_index_ FLI_COLOR_INDEX;
+
+FLI_COLOR_INDEX * fli_make_color_index( const int *,
+                                        const int *,
+                                        const int *,
+                                        int );
+
+FLI_COLOR_INDEX * fli_make_xcolor_index( const XColor *,
+                                         int );
+
+void fli_free_color_index( FLI_COLOR_INDEX * );
+
+int fli_lookup_color_index( const FLI_COLOR_INDEX *,
+                            int,
+                            int,
+                            int );
+
 void fli_rgbmask_to_shifts( unsigned long,
                             unsigned int *,
                             unsigned int * );
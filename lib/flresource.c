@@ -1355,6 +1355,8 @@ fl_finish( void )
                                    fli_context->io_rec->mask,
                                    fli_context->io_rec->callback );
 
+    fli_free_io( );
+
     fli_safe_free( fli_context );
 
     /* Close the display */
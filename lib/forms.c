@@ -632,6 +632,8 @@ fli_scale_form( FL_FORM * form,
     form->w = FL_crnd( neww );
     form->h = FL_crnd( newh );
 
+    fli_invalidate_object_index( form );
+
     if ( form->hotx >= 0 || form->hoty >= 0 )
     {
         form->hotx = form->hotx * xsc;
@@ -858,6 +860,50 @@ fl_set_form_dblbuffer( FL_FORM * form,
 }
 
 
+/***************************************
+ * Switches deferred redrawing for a form on or off. With deferred
+ * redrawing objects that need to be redrawn aren't drawn immediately
+ * but the area they cover gets collected and all of them get drawn
+ * together when the main loop is about to wait for new events.
+ ***************************************/
+
+void
+fl_set_form_deferred_redraw( FL_FORM * form,
+                             int       yesno )
+{
+    if ( ! form )
+    {
+        M_err( "fl_set_form_deferred_redraw", "NULL form" );
+        return;
+    }
+
+    yesno = yesno ? 1 : 0;
+
+    if ( form->deferred_redraw == yesno )
+        return;
+
+    /* When switching deferred redrawing off draw what's still waiting for
+       it or, if that's not possible at the moment, make sure everything
+       gets redrawn later. The same is necessary when switching it on for
+       a frozen form since objects already marked for a redraw aren't part
+       of the damage. */
+
+    if ( ! yesno )
+        fli_flush_form_damage( form );
+
+    if ( form->damage || ( yesno && form->frozen ) )
+        form->needs_full_redraw = 1;
+
+    if ( form->damage )
+    {
+        XDestroyRegion( form->damage );
+        form->damage = NULL;
+    }
+
+    form->deferred_redraw = yesno;
+}
+
+
 /***************************************
  * Sets the size of a form
  ***************************************/
@@ -1359,6 +1405,11 @@ fl_show_form_window( FL_FORM * form )
     if ( form->window == None || form->visible != FL_INVISIBLE )
         return form->window;
 
+    /* Objects may have been moved or resized directly while the form
+       was hidden */
+
+    fli_invalidate_object_index( form );
+
     fl_winshow( form->window );
     form->visible = FL_VISIBLE;
     reshape_form( form );
@@ -1581,6 +1632,14 @@ fl_hide_form( FL_FORM * form )
 
     fli_free_flpixmap( form->flpixmap );
 
+    /* Once the form gets shown again it's drawn completely anyway */
+
+    if ( form->damage )
+    {
+        XDestroyRegion( form->damage );
+        form->damage = NULL;
+    }
+
     if ( fli_int.mouseform && fli_int.mouseform->window == form->window )
         fli_int.mouseform = NULL;
 
@@ -1660,6 +1719,8 @@ fl_free_form( FL_FORM * form )
 
     fli_fast_free_object = NULL;
 
+    fli_free_object_index( form );
+
     if ( form->flpixmap )
     {
         fli_free_flpixmap( form->flpixmap );
@@ -2070,6 +2131,8 @@ simple_form_rescale( FL_FORM * form,
     form->w = FL_crnd( form->w_hr );
     form->h = FL_crnd( form->h_hr );
 
+    fli_invalidate_object_index( form );
+
     for ( obj = form->first; obj; obj = obj->next )
         if ( obj->objclass != FL_BEGIN_GROUP && obj->objclass != FL_END_GROUP )
             fli_scale_object( obj, scale, scale );
@@ -777,7 +777,11 @@ fli_handle_idling( XEvent * xev,
     static int within_idle_cb = 0;   /* Flag used to avoid an idle callback
                                         being called from within itself */
 
-    /* Sleep a bit while being on the lookout for async IO events */
+    /* Draw what's waiting for a deferred redraw, then sleep until there's
+       an X event, async IO or a signal, but not longer than 'msec' (if
+       that's not negative) */
+
+    fli_flush_damage( );
 
     fli_watch_io( fli_context->io_rec, msec );
 
@@ -796,7 +800,7 @@ fli_handle_idling( XEvent * xev,
         fli_int.query_age = 0;
         xev->xmotion.time = CurrentTime;
     }
-    else
+    else if ( msec > 0 )
         xev->xmotion.time += msec;
 
     /* FL_UPDATE and automatic handlers as well as idle callbacks get a
@@ -845,6 +849,11 @@ fli_handle_idling( XEvent * xev,
         fli_context->idle_rec->callback( xev, fli_context->idle_rec->data );
         within_idle_cb = 0;
     }
+
+    /* Callbacks invoked above may have changed objects, don't keep them
+       waiting until the next event arrives */
+
+    fli_flush_damage( );
 }
 
 
@@ -861,7 +870,12 @@ get_next_event_or_idle( int        wait_io,
 
     /* Timeouts should be as precise as possible, so check them each time
        round. Since they may dictate how long we're going to wait if there
-       is no event determine how how much time we will have to wait now */
+       is no event determine how how much time we will have to wait now.
+       If there are no automatic objects, no pushed object that may need
+       FL_UPDATE events and no idle callback nothing can happen except on
+       new input or when the next timeout expires, so there's no limit
+       other than that (a negative value) and we don't wake up before
+       there's really something to do. */
 
     if ( ! wait_io )
         msec = SHORT_PAUSE;
@@ -870,10 +884,13 @@ get_next_event_or_idle( int        wait_io,
               || fli_context->idle_rec )
         msec = delta_msec;
     else
-        msec = FL_min( delta_msec * 3, 300 );
+        msec = -1;
 
-    if ( fli_context->timeout_rec )
-        fli_handle_timeouts( &msec );
+    /* A timeout handler may have done something (e.g. queued an object)
+       that has to be dealt with before we go to sleep */
+
+    if ( fli_context->timeout_rec && fli_handle_timeouts( &msec ) )
+        msec = 0;
 
     /* Skip checking for an X event after 10 events, thus giving X events
        a 10:1 priority over async IO, UPDATE events, automatic handlers and
@@ -916,6 +933,19 @@ get_next_event_or_idle( int        wait_io,
     }
     else
     {
+        /* Events already read from the connection don't make it readable
+           anymore, so don't go to sleep when we skipped some of them or
+           when drawing what's waiting for a deferred redraw made a round
+           trip to the server (e.g. to allocate a color) that read events
+           into Xlib's queue. This is only done here: the popup loops only
+           take the events for their own window and would spin while there
+           are queued events for other windows. */
+
+        fli_flush_damage( );
+
+        if ( XQLength( flx->display ) > 0 )
+            msec = 0;
+
         cnt = 0;
         fli_handle_idling( &st_xev, msec, 1 );
     }
@@ -768,6 +768,7 @@ struct FL_OBJECT_ {
     int              group_id;
     int              want_motion;
     int              want_update;
+    void           * objindex;       /* internal use */
 };
 
 
@@ -889,6 +890,9 @@ struct FL_FORM_ {
     void                   ( * pre_attach )( FL_FORM * );
     void                 * attach_data;
     int                    in_redraw;
+    int                    deferred_redraw;  /* redraw from main loop only */
+    Region                 damage;           /* area waiting for redraw */
+    void                 * objindex;         /* internal use */
 };
 
 
@@ -1110,6 +1114,9 @@ FL_EXPORT void fl_redraw_form( FL_FORM * form );
 FL_EXPORT void fl_set_form_dblbuffer( FL_FORM * form,
                                       int       y );
 
+FL_EXPORT void fl_set_form_deferred_redraw( FL_FORM * form,
+                                            int       yes_no );
+
 FL_EXPORT Window fl_prepare_form_window( FL_FORM    * form,
                                          int          place,
                                          int          border,
@@ -1277,6 +1284,9 @@ FL_EXPORT void fl_move_object( FL_OBJECT * obj,
                                FL_Coord    dx,
                                FL_Coord    dy );
 
+FL_EXPORT void fl_notify_object( FL_OBJECT * obj,
+                                 int         cause );
+
 #define fl_set_object_lcolor  fl_set_object_lcol
 #define fl_get_object_lcolor  fl_get_object_lcol
 
@@ -44,26 +44,23 @@ extern FL_OBJECT * fli_handled_parent;     /* defined in  events.c */
 static void redraw( FL_FORM *,
                     int );
 static void lose_focus( FL_OBJECT * );
-static void get_object_rect( const FL_OBJECT * obj,
-                             XRectangle      * rect,
-                             int               extra );
 static XRectangle * get_label_rect( const FL_OBJECT  * obj,
                                     XRectangle       * rect );
-static int objects_intersect( const FL_OBJECT *,
-                              const FL_OBJECT * );
 static void mark_object_for_redraw( FL_OBJECT * );
-static int object_is_under( const FL_OBJECT * );
+static int object_is_under( FL_OBJECT * );
+static FLI_INDEX_ENTRY * index_entry( FL_OBJECT * );
+static int add_damaged( FLI_INDEX_ENTRY * );
+static int mark_objects_on_top( FL_FORM *,
+                                int );
+static void mark_all_above( FL_OBJECT * );
 static void checked_hide_tooltip( FL_OBJECT *,
                                   XEvent    * );
-static int prep_recalc( FL_FORM   * form,
-                        FL_OBJECT * start_obj );
-static void finish_recalc( FL_FORM   * form,
-                           FL_OBJECT * start_obj );
 
 static FL_OBJECT *refocus;
 
-static void **tmp_vdata = NULL;
-static FL_RECT *tmp_rects = NULL;
+static FLI_INDEX_ENTRY **damaged = NULL;
+static int damaged_cnt,
+           damaged_alloc = 0;
 
 #define IS_BUTTON_CLASS( i )   (    i == FL_BUTTON           \
                                  || i == FL_ROUNDBUTTON      \
@@ -316,6 +313,8 @@ fl_add_object( FL_FORM   * form,
             obj->next = end;
             end->prev = obj;
 
+            fli_add_to_object_index( obj );
+
             if ( obj->child )
             {
                 FL_OBJECT * tmp;
@@ -345,6 +344,8 @@ fl_add_object( FL_FORM   * form,
         form->last = obj;
     }
 
+    fli_add_to_object_index( obj );
+
     if ( obj->input && obj->active && ! form->focusobj )
         fl_set_focus_object( form, obj );
 
@@ -447,6 +448,8 @@ fli_insert_object( FL_OBJECT * obj,
     if ( fli_inverted_y )
         obj->y = TRANSLATE_Y( obj, form );
 
+    fli_add_to_object_index( obj );
+
     if ( obj->input && obj->active && ! form->focusobj )
         fl_set_focus_object( form, obj );
 
@@ -574,6 +577,7 @@ fl_delete_object( FL_OBJECT * obj )
     if ( obj->objclass != FL_BEGIN_GROUP && obj->objclass != FL_END_GROUP )
         obj->group_id = 0;
 
+    fli_remove_from_object_index( obj );
     obj->form = NULL;
 
     if ( obj->prev )
@@ -1089,6 +1093,8 @@ fl_set_object_label( FL_OBJECT  * obj,
     obj->label = fl_realloc( obj->label, strlen( label ) + 1 );
     strcpy( obj->label, label );
 
+    fli_update_object_index( obj );
+
     if ( need_show )
         fl_show_object( obj );
     else if ( obj->visible )
@@ -1239,6 +1245,8 @@ fl_set_object_lsize( FL_OBJECT * obj,
             fli_handle_object( o, FL_ATTRIB, 0, 0, 0, NULL, 0 );
         }
 
+    fli_update_object_index( obj );
+
     if ( need_show )
         fl_show_object( obj );
     else if ( obj->visible )
@@ -1305,6 +1313,8 @@ fl_set_object_lstyle( FL_OBJECT * obj,
             fli_handle_object( o, FL_ATTRIB, 0, 0, 0, NULL, 0 );
         }
 
+    fli_update_object_index( obj );
+
     if ( need_show )
         fl_show_object( obj );
     else if ( obj->visible )
@@ -1366,6 +1376,8 @@ fl_set_object_lalign( FL_OBJECT * obj,
     if ( obj->objclass == FL_TABFOLDER )
         fli_set_tab_lalign( obj, align );
 
+    fli_update_object_index( obj );
+
     if ( need_show )
         fl_show_object( obj );
     else if ( obj->visible )
@@ -1512,6 +1524,7 @@ fli_show_object( FL_OBJECT * obj )
         return;
 
     obj->visible = 1;
+    fli_update_object_index( obj );
 
     if ( obj->child )
     {
@@ -1616,7 +1629,7 @@ fli_hide_and_get_region( FL_OBJECT * obj,
     if ( obj->objclass == FL_CANVAS || obj->objclass == FL_GLCANVAS )
         fli_hide_canvas( obj );
 
-    get_object_rect( obj, &xrect, 0 );
+    fli_get_object_rect( obj, &xrect, 0 );
 
     XUnionRectWithRegion( &xrect, *reg, *reg );
 
@@ -1980,6 +1993,50 @@ fl_get_focus_object( FL_FORM * form )
    Searching in forms
 -----------------------------------------------------------------------*/
 
+/***************************************
+ * Returns if an object is of type 'find' (and is able to
+ * receive events at all)
+ ***************************************/
+
+static int
+is_found( FL_OBJECT * obj,
+          int         find,
+          FL_Coord    mx,
+          FL_Coord    my )
+{
+    if (    obj->objclass == FL_BEGIN_GROUP
+         || obj->objclass == FL_END_GROUP
+         || ! obj->visible
+         || ! (    obj->active
+                || ( obj->posthandle && ! obj->active )
+                || ( obj->tooltip && *obj->tooltip && ! obj->active ) ) )
+        return 0;
+
+    switch ( find )
+    {
+        case FLI_FIND_INPUT :
+            return obj->input && obj->active;
+
+        case FLI_FIND_AUTOMATIC :
+            return obj->automatic;
+
+        case FLI_FIND_RETURN :
+            return obj->type == FL_RETURN_BUTTON;
+
+        case FLI_FIND_MOUSE :
+            return    mx >= obj->x
+                   && mx <= obj->x + obj->w
+                   && my >= obj->y
+                   && my <= obj->y + obj->h;
+
+        case FLI_FIND_KEYSPECIAL :
+            return obj->wantkey & FL_KEY_SPECIAL;
+    }
+
+    return 0;
+}
+
+
 /***************************************
  * Returns an object of type 'find' in a form, starting at 'obj'.
  * If the function does not return an object the event that
@@ -1994,37 +2051,9 @@ fli_find_object( FL_OBJECT * obj,
                  FL_Coord    mx,
                  FL_Coord    my )
 {
-    while ( obj )
-    {
-        if (    obj->objclass != FL_BEGIN_GROUP
-             && obj->objclass != FL_END_GROUP
-             && obj->visible
-             && (     obj->active
-                  || ( obj->posthandle && ! obj->active )
-                  || ( obj->tooltip && *obj->tooltip && ! obj->active ) ) )
-        {
-            if ( find == FLI_FIND_INPUT && obj->input && obj->active )
-                return obj;
-
-            if ( find == FLI_FIND_AUTOMATIC && obj->automatic )
-                return obj;
-
-            if ( find == FLI_FIND_RETURN && obj->type == FL_RETURN_BUTTON )
-                return obj;
-
-            if (    find == FLI_FIND_MOUSE
-                 && mx >= obj->x
-                 && mx <= obj->x + obj->w
-                 && my >= obj->y
-                 && my <= obj->y + obj->h )
-                return obj;
-
-            if ( find == FLI_FIND_KEYSPECIAL && obj->wantkey & FL_KEY_SPECIAL )
-                return obj;
-        }
-
-        obj = obj->next;
-    }
+    for ( ; obj; obj = obj->next )
+        if ( is_found( obj, find, mx, my ) )
+            return obj;
 
     return NULL;
 }
@@ -2041,29 +2070,8 @@ fli_find_object_backwards( FL_OBJECT * obj,
                            FL_Coord    my )
 {
     for ( ; obj; obj = obj->prev )
-        if (    obj->objclass != FL_BEGIN_GROUP
-             && obj->objclass != FL_END_GROUP
-             && obj->visible
-             && (     obj->active
-                  || ( obj->posthandle && ! obj->active )
-                  || ( obj->tooltip && *obj->tooltip && ! obj->active ) ) )
-        {
-            if ( find == FLI_FIND_INPUT && obj->input && obj->active )
-                return obj;
-
-            if ( find == FLI_FIND_AUTOMATIC && obj->automatic )
-                return obj;
-
-            if (    find == FLI_FIND_MOUSE
-                 && mx >= obj->x
-                 && mx <= obj->x + obj->w
-                 && my >= obj->y
-                 && my <= obj->y + obj->h )
-                return obj;
-
-            if ( find == FLI_FIND_KEYSPECIAL && obj->wantkey & FL_KEY_SPECIAL )
-                return obj;
-        }
+        if ( find != FLI_FIND_RETURN && is_found( obj, find, mx, my ) )
+            return obj;
 
     return NULL;
 }
@@ -2084,7 +2092,9 @@ fli_find_first( FL_FORM  * form,
 
 
 /***************************************
- * Returns the last object of the type find
+ * Returns the last object of the type find. When looking for the object
+ * under the mouse only the objects the spatial index of the form finds
+ * at the mouse position need to be tested.
  ***************************************/
 
 FL_OBJECT *
@@ -2096,6 +2106,27 @@ fli_find_last( FL_FORM * form,
     FL_OBJECT *last,
               *obj;
 
+    if ( find == FLI_FIND_MOUSE )
+    {
+        FLI_INDEX_ENTRY **hits,
+                        *hit = NULL;
+        FL_RECT rect;
+        int n;
+
+        rect.x = mx;
+        rect.y = my;
+        rect.width = rect.height = 1;
+
+        n = fli_query_object_index( form, &rect, &hits );
+
+        while ( n-- > 0 )
+            if (    ( ! hit || hits[ n ]->order > hit->order )
+                 && is_found( hits[ n ]->obj, find, mx, my ) )
+                hit = hits[ n ];
+
+        return hit ? hit->obj : NULL;
+    }
+
     last = obj = fli_find_first( form, find, mx, my );
 
     while ( obj )
@@ -2125,7 +2156,7 @@ is_object_clipped( FL_OBJECT * obj )
     if ( ! fl_is_global_clipped( ) )
         return 0;
 
-    get_object_rect( obj, &obj_rect, 1 );
+    fli_get_object_rect( obj, &obj_rect, 1 );
 
     xc = fli_intersect_rects( &obj_rect, fli_get_global_clip_rect( ) );
 
@@ -2166,6 +2197,22 @@ mark_object_for_redraw( FL_OBJECT * obj )
     for ( o = obj->child; o; o = o->nc )
         mark_object_for_redraw( o );
 
+    /* With deferred redrawing only the area of the object gets added to
+       the damage of the form, the objects on top of it are found when the
+       damage gets repaired */
+
+    if ( obj->form->deferred_redraw )
+    {
+        FL_RECT rect;
+
+        if ( ! obj->form->damage )
+            obj->form->damage = XCreateRegion( );
+
+        fli_get_object_rect( obj, &rect, 0 );
+        XUnionRectWithRegion( &rect, obj->form->damage, obj->form->damage );
+        return;
+    }
+
     /* If an object is marked as being under another object we have to find
        the object(s) it is beneath and also mark them for a redraw. For the
        special case that the object to be redraw is the first object of
@@ -2173,49 +2220,44 @@ mark_object_for_redraw( FL_OBJECT * obj )
        if the other object are on top of it, they all are. */
 
     if ( obj == bg_object( obj->form ) )
-    {
-        for ( o = obj->next; o; o = o->next )
-        {
-            if (    ! o->visible
-                 || ( o->parent && ! o->parent->visible )
-                 || o->objclass == FL_BEGIN_GROUP
-                 || o->objclass == FL_END_GROUP )
-                continue;
-
-            obj->redraw = 1;
-        }
-    }
+        mark_all_above( obj );
     else if ( obj->is_under )
     {
-        /* If it hasn't been done yet pre-calculate the sizes of all
-           objects possibly concerned */
+        FLI_INDEX_ENTRY *entry = index_entry( obj );
+        int start = damaged_cnt;
 
-        int need_finish = prep_recalc( obj->form, obj );
-        int cnt = 0;
+        /* The list of objects to be drawn is only used temporarily here,
+           it might be in use for repairing the damage of another form. If
+           it can't be extended just mark all objects that come later. */
 
-        for ( o = obj->next; o; o = o->next )
-        {
-            if (    o->redraw
-                 || ! o->visible
-                 || ( o->parent && ! o->parent->visible )
-                 || o->objclass == FL_BEGIN_GROUP
-                 || o->objclass == FL_END_GROUP )
-                continue;
+        if (    entry
+             && (    add_damaged( entry ) < 0
+                  || mark_objects_on_top( obj->form, start ) < 0 ) )
+            mark_all_above( obj );
 
-            if ( objects_intersect( obj, o ) )
-            {
-                mark_object_for_redraw( o );
+        damaged_cnt = start;
+    }
+}
 
-                /* Since we know how many objects are on top of our object
-                   we can stop if all of them have been marked for redraw. */
 
-                if ( ++cnt >= obj->is_under )
-                    break;
-            }
-        }
+/***************************************
+ * Marks all objects drawn after the given one for a redraw
+ ***************************************/
 
-        if ( need_finish )
-            finish_recalc( obj->form, obj );
+static void
+mark_all_above( FL_OBJECT * obj )
+{
+    FL_OBJECT *o;
+
+    for ( o = obj->next; o; o = o->next )
+    {
+        if (    ! o->visible
+             || ( o->parent && ! o->parent->visible )
+             || o->objclass == FL_BEGIN_GROUP
+             || o->objclass == FL_END_GROUP )
+            continue;
+
+        o->redraw = 1;
     }
 }
 
@@ -2238,18 +2280,10 @@ fl_redraw_object( FL_OBJECT * obj )
 
     if ( obj->objclass == FL_BEGIN_GROUP )
     {
-        FL_OBJECT *o = obj->next;
-
-        /* If it hasn't been done yet pre-calculate the sizes of all
-            objects possibly concerned */
-
-        int need_finish = prep_recalc( o->form, o );
+        FL_OBJECT *o;
 
-        for ( ; o && o->objclass != FL_END_GROUP; o = o->next )
+        for ( o = obj->next; o && o->objclass != FL_END_GROUP; o = o->next )
             mark_object_for_redraw( o );
-
-        if ( need_finish )
-            finish_recalc( obj->form, obj->next ); 
     }
     else
         mark_object_for_redraw( obj );
@@ -2259,37 +2293,39 @@ fl_redraw_object( FL_OBJECT * obj )
 
 
 /***************************************
- * Function to test if the areas of two objects (including their labels if
- * they're outside the object) intersect
+ * Draws a single object and its label
  ***************************************/
 
-static int
-objects_intersect( const FL_OBJECT * obj1,
-                   const FL_OBJECT * obj2 )
+static void
+draw_object( FL_OBJECT * obj )
 {
-    if ( tmp_vdata )
-    {
-        FL_RECT *r1 = obj1->u_vdata,
-                *r2 = obj2->u_vdata;
+    /* Set up a pixmap for the object (does nothing if the form already
+       has a pixmap we're drawing to) */
 
-        return    r1->x + r1->width  > r2->x
-               && r2->x + r2->width  > r1->x
-               && r1->y + r1->height > r2->y
-               && r2->y + r2->height > r1->y;
+    fli_create_object_pixmap( obj );
 
-    }
-    else
+    /* Don't allow free objects to draw outside of their boxes. */
+
+    if ( obj->objclass == FL_FREE )
     {
-        FL_RECT r1, r2;
+        fl_set_clipping( obj->x, obj->y, obj->w, obj->h );
+        fl_set_text_clipping( obj->x, obj->y, obj->w, obj->h );
+    }
 
-        get_object_rect( obj1, &r1, 0 );
-        get_object_rect( obj2, &r2, 0 );
+    fli_handle_object( obj, FL_DRAW, 0, 0, 0, NULL, 0 );
 
-        return    r1.x + r1.width  > r2.x
-               && r2.x + r2.width  > r2.x
-               && r1.y + r1.height > r2.y
-               && r2.y + r2.height > r1.y;
+    if ( obj->objclass == FL_FREE )
+    {
+        fl_unset_clipping( );
+        fl_unset_text_clipping( );
     }
+
+    /* Copy the objects pixmap to the form window (does nothing if the
+       form has a pixmap we're drawing to since then we've drawn to it) */
+
+    fli_show_object_pixmap( obj );
+
+    fli_handle_object( obj, FL_DRAWLABEL, 0, 0, 0, NULL, 0 );
 }
 
 
@@ -2299,7 +2335,8 @@ objects_intersect( const FL_OBJECT * obj1,
  * objects while, with 'draw_all' being unset (when getting call from e.g.
  * fl_redraw_object() or fl_unfreeze_form()), only draws those objects that
  * are marked for needing a redraw (and all objects as well that would be
- * obscured by that because they're "higher up").
+ * obscured by that because they're "higher up"). For forms with deferred
+ * redrawing the latter is left to fli_flush_form_damage().
  ***************************************/
 
 static void
@@ -2313,6 +2350,9 @@ redraw( FL_FORM * form,
     if ( ! FORM_IS_UPDATABLE( form ) || ( form->in_redraw & IN_REDRAW ) )
         return;
 
+    if ( form->deferred_redraw && ! draw_all && ! form->needs_full_redraw )
+        return;
+
     form->in_redraw |= IN_REDRAW;
 
     /* Remember when we're asked to do a full redraw - we might leave without
@@ -2330,59 +2370,240 @@ redraw( FL_FORM * form,
 
     for ( obj = bg_object( form ); obj; obj = obj->next )
     {
-        int needs_redraw = obj->redraw;
-
-        obj->redraw = 0;
-
         /* Only draw objects that are visible and, unless we're asked to draw
            all objects, are marked for a redraw and are within the current
            clipping area */
 
         if (    ! obj->visible
-             || ! ( needs_redraw || form->needs_full_redraw )
+             || ! ( obj->redraw || form->needs_full_redraw )
              || obj->objclass == FL_BEGIN_GROUP
-             || obj->objclass == FL_END_GROUP
-             || is_object_clipped( obj ) )
+             || obj->objclass == FL_END_GROUP )
+        {
+            obj->redraw = 0;
             continue;
+        }
 
-        /* Set up a pixmap for the object (does nothing if the form already
-           has a pixmap we're drawing to) */
-
-        fli_create_object_pixmap( obj );
-
-        /* Don't allow free objects to draw outside of their boxes. */
+        /* With deferred redrawing objects outside of the clipping area
+           keep their mark, they're still part of the form's damage */
 
-        if ( obj->objclass == FL_FREE )
+        if ( is_object_clipped( obj ) )
         {
-            fl_set_clipping( obj->x, obj->y, obj->w, obj->h );
-            fl_set_text_clipping( obj->x, obj->y, obj->w, obj->h );
+            if ( ! form->deferred_redraw )
+                obj->redraw = 0;
+            continue;
         }
 
-        fli_handle_object( obj, FL_DRAW, 0, 0, 0, NULL, 0 );
+        obj->redraw = 0;
+        draw_object( obj );
+    }
+
+    /* Copy the forms pixmap to its window (if double buffering is on) */
+
+    fli_show_form_pixmap( form );
+
+    /* After drawing everything nothing is left to be done for the damage */
+
+    if ( form->needs_full_redraw && form->damage && ! fl_is_global_clipped( ) )
+    {
+        XDestroyRegion( form->damage );
+        form->damage = NULL;
+    }
+
+    form->needs_full_redraw = 0;
+    form->in_redraw &= ~ IN_REDRAW;
+}
+
+
+/***************************************
+ * Helper for fli_flush_form_damage(), sorts index entries by the
+ * position of the objects in the form
+ ***************************************/
+
+static int
+cmp_entry_order( const void * a,
+                 const void * b )
+{
+    const FLI_INDEX_ENTRY *ea = * ( FLI_INDEX_ENTRY * const * ) a,
+                          *eb = * ( FLI_INDEX_ENTRY * const * ) b;
+
+    return ea->order - eb->order;
+}
+
+
+/***************************************
+ * Returns if an object found in the form's spatial index is to be drawn
+ * (like in redraw() a first object without a box never is)
+ ***************************************/
+
+static int
+is_drawable( FL_OBJECT * obj )
+{
+    return    obj->visible
+           && ! ( obj->parent && ! obj->parent->visible )
+           && ( obj == bg_object( obj->form ) || obj != obj->form->first );
+}
+
+
+/***************************************
+ * Appends an entry to the list of objects to be (re)drawn
+ * and marks the object for redraw. Returns -1 if the list
+ * can't be extended.
+ ***************************************/
+
+static int
+add_damaged( FLI_INDEX_ENTRY * entry )
+{
+    if ( damaged_cnt == damaged_alloc )
+    {
+        int alloc = damaged_alloc ? 2 * damaged_alloc : 64;
+        FLI_INDEX_ENTRY **tmp = fl_realloc( damaged, alloc * sizeof *tmp );
 
-        if ( obj->objclass == FL_FREE )
+        if ( ! tmp )
         {
-            fl_unset_clipping( );
-            fl_unset_text_clipping( );
+            M_err( "add_damaged", "Running out of memory" );
+            return -1;
         }
 
-        /* Copy the objects pixmap to the form window (does nothing if the
-           form has a pixmap we're drawing to since then we've drawn to it) */
+        damaged = tmp;
+        damaged_alloc = alloc;
+    }
+
+    entry->obj->redraw = 1;
+    damaged[ damaged_cnt++ ] = entry;
+
+    return 0;
+}
+
+
+/***************************************
+ * Adds all objects on top of those in the list of objects to be drawn,
+ * starting at position 'start', to that list (this includes objects on
+ * top of those that get added while doing so). The children of objects
+ * added also get drawn. Returns -1 if the list can't be extended.
+ ***************************************/
+
+static int
+mark_objects_on_top( FL_FORM * form,
+                     int       start )
+{
+    FLI_INDEX_ENTRY **hits;
+    FL_OBJECT *o;
+    int i,
+        j,
+        n;
+
+    for ( i = start; i < damaged_cnt; i++ )
+    {
+        n = fli_query_object_index( form, &damaged[ i ]->rect, &hits );
 
-        fli_show_object_pixmap( obj );
+        for ( j = 0; j < n; j++ )
+            if (    ! hits[ j ]->obj->redraw
+                 && hits[ j ]->order > damaged[ i ]->order
+                 && is_drawable( hits[ j ]->obj )
+                 && add_damaged( hits[ j ] ) < 0 )
+                return -1;
 
-        fli_handle_object( obj, FL_DRAWLABEL, 0, 0, 0, NULL, 0 );
+        for ( o = damaged[ i ]->obj->child; o; o = o->nc )
+            if (    o->objindex
+                 && ! o->redraw
+                 && is_drawable( o )
+                 && add_damaged( o->objindex ) < 0 )
+                return -1;
     }
 
-    /* Copy the forms pixmap to its window (if double buffering is on) */
+    return 0;
+}
+
+
+/***************************************
+ * Repairs the damage of a form with deferred redrawing: the objects
+ * marked for a redraw are looked up via the spatial index of the form
+ * within the damaged area, then all objects on top of them, and finally
+ * all of them get drawn, from the bottom up.
+ ***************************************/
+
+void
+fli_flush_form_damage( FL_FORM * form )
+{
+    FLI_INDEX_ENTRY **hits;
+    FL_RECT box;
+    int n,
+        i,
+        j;
+
+    if (    ! form->damage
+         || ! FORM_IS_UPDATABLE( form )
+         || ( form->in_redraw & IN_REDRAW ) )
+        return;
+
+    XClipBox( form->damage, &box );
+    XDestroyRegion( form->damage );
+    form->damage = NULL;
+
+    damaged_cnt = 0;
+    n = fli_query_object_index( form, &box, &hits );
+
+    for ( j = 0; j < n; j++ )
+    {
+        if ( ! hits[ j ]->obj->redraw )
+            continue;
+
+        if ( ! is_drawable( hits[ j ]->obj ) )
+            hits[ j ]->obj->redraw = 0;
+        else if ( add_damaged( hits[ j ] ) < 0 )
+            break;
+    }
+
+    /* Objects on top of one to be drawn also must be drawn. If the list
+       of them can't be set up redraw the whole form right away. */
+
+    if ( j < n || mark_objects_on_top( form, 0 ) < 0 )
+    {
+        damaged_cnt = 0;
+        redraw( form, 1 );
+        return;
+    }
+
+    if ( ! damaged_cnt )
+        return;
+
+    qsort( damaged, damaged_cnt, sizeof *damaged, cmp_entry_order );
+
+    form->in_redraw |= IN_REDRAW;
+
+    fli_set_form_window( form );
+    fli_create_form_pixmap( form );
+
+    for ( i = 0; i < damaged_cnt; i++ )
+    {
+        FL_OBJECT *obj = damaged[ i ]->obj;
+
+        obj->redraw = 0;
+        if ( ! is_object_clipped( obj ) )
+            draw_object( obj );
+    }
 
     fli_show_form_pixmap( form );
 
-    form->needs_full_redraw = 0;
     form->in_redraw &= ~ IN_REDRAW;
 }
 
 
+/***************************************
+ * Repairs the damage of all visible forms, called from the main loop
+ ***************************************/
+
+void
+fli_flush_damage( void )
+{
+    int i;
+
+    for ( i = 0; i < fli_int.formnumb; i++ )
+        if ( fli_int.forms[ i ]->damage )
+            fli_flush_form_damage( fli_int.forms[ i ] );
+}
+
+
 /***************************************
  * Exported function for drawing a form
  ***************************************/
@@ -2771,6 +2992,19 @@ fli_handle_object( FL_OBJECT * obj,
     }
     else
         handle_object( obj, event, mx, my, key, xev, 1 );
+
+    /* The entry in the spatial index of the form must be updated when the
+       object got moved or resized (that's also how code that changed the
+       geometry of the object directly tells us, see fli_notify_object()).
+       Composite objects may also rearrange their child objects on their
+       own when getting drawn. Unchanged entries cost just a comparison. */
+
+    if (    obj->form
+         && (    event == FL_RESIZED
+              || event == FL_ATTRIB
+              || event == FL_MOVEORIGIN
+              || ( event == FL_DRAW && obj->child ) ) )
+        fli_update_object_index( obj );
 }
 
 
@@ -2855,6 +3089,7 @@ fl_set_object_bw( FL_OBJECT * obj,
             {
                 obj->bw = bw;
                 fli_handle_object( obj, FL_ATTRIB, 0, 0, 0, NULL, 0 );
+                fli_update_object_index( obj );
                 mark_object_for_redraw( obj );
             }
 
@@ -2869,6 +3104,7 @@ fl_set_object_bw( FL_OBJECT * obj,
         if ( obj->objclass == FL_TABFOLDER )
             fli_set_tab_bw( obj, bw );
 
+        fli_update_object_index( obj );
         fl_redraw_object( obj );
     }
 }
@@ -3122,20 +3358,39 @@ fl_call_object_callback( FL_OBJECT * obj )
 }
 
 
+/***************************************
+ * Returns the entry for an object in the spatial index of its form,
+ * (re)building the index or renumbering its entries if necessary
+ ***************************************/
+
+static FLI_INDEX_ENTRY *
+index_entry( FL_OBJECT * obj )
+{
+    FLI_INDEX_ENTRY **hits;
+    FL_RECT none = { 0, 0, 0, 0 };
+
+    fli_query_object_index( obj->form, &none, &hits );
+    return obj->objindex;
+}
+
+
 /***************************************
  * Function to test if an object is (at least partially) hidden by any of
  * its successors in the forms list of objects (objects are always sorted in
  * a way that objects earlier in the list are drawn under those following
  * it). We don't need to look at objects that have a parent since for
  * them the tests for the parent objects will do. It returns the number
- * of objects that are "over" the object.
+ * of objects that are "over" the object. Only objects the spatial index
+ * of the form finds within the area of the object need to be checked.
  ***************************************/
 
 static int
-object_is_under( const FL_OBJECT * obj )
+object_is_under( FL_OBJECT * obj )
 {
-    FL_OBJECT *o;
+    FLI_INDEX_ENTRY *entry,
+                    **hits;
     int cnt = 0;
+    int n;
 
     /* The first object of a form is always below all others */
 
@@ -3143,111 +3398,21 @@ object_is_under( const FL_OBJECT * obj )
         return 1;
 
     if (    obj->parent
-         || obj->objclass == FL_BEGIN_GROUP 
-         || obj->objclass == FL_END_GROUP )
+         || obj->objclass == FL_BEGIN_GROUP
+         || obj->objclass == FL_END_GROUP
+         || ! ( entry = index_entry( obj ) ) )
         return 0;
 
-    for ( o = obj->next; o; o = o->next )
-    {
-        if (    o->parent
-             || o->objclass == FL_BEGIN_GROUP 
-             || o->objclass == FL_END_GROUP )
-            continue;
+    n = fli_query_object_index( obj->form, &entry->rect, &hits );
 
-        if ( objects_intersect( obj, o ) )
+    while ( n-- > 0 )
+        if ( hits[ n ]->order > entry->order && ! hits[ n ]->obj->parent )
             cnt++;
-    }
 
     return cnt;
 }
 
 
-/***************************************
- * Helper function for fli_recalc_intersections() and other functions -
- * without this is a O(N^2) operation with respect to the recalculations
- * of the N object bounding boxes. Here we use that the 'u_vdata' pointers
- * of the objects don't get used during fli_recalc_intersections() and
- * replace them all by pointers to pre-calculated bounding boxes, thus
- * reducing the number of recalculations to N (in objects_intersect() it
- * gets checked if 'tmp_vdata' is non-NULL and then uses the pre-calculated
- * bounding boxes).
- ***************************************/
-
-static int
-prep_recalc( FL_FORM   * form,
-             FL_OBJECT * start_obj )
-{
-    FL_OBJECT *obj;
-    int cnt = 0;
-    int i = 0;
-
-    if ( ! form || tmp_vdata )
-        return 0;
-
-    if ( ! start_obj )
-        start_obj = bg_object( form );
-
-    /* Count how many objects the form contains */
-
-    for ( obj = start_obj; obj; obj = obj->next )
-        cnt++;
-
-    if ( cnt < 2 )
-        return 0;
-
-    /* Get memory for temporary storing the 'u_vdata' pointers of all objects
-       and as many FL_RECT's */
-
-    if ( ( tmp_vdata = fl_malloc( cnt * sizeof *tmp_vdata ) ) )
-    {
-        if ( ! ( tmp_rects = fl_malloc( cnt * sizeof *tmp_rects ) ) )
-        {
-            fli_safe_free( tmp_vdata );
-            return 0;
-        }
-    }
-    else
-        return 0;
-
-    /* Save the 'u_vdata' pointers and replace them by pointers to the
-       bounding box rectangles */
-
-    for ( obj = start_obj; obj; obj = obj->next )
-    {
-        tmp_vdata[ i ] = obj->u_vdata;
-        obj->u_vdata = tmp_rects + i;
-        get_object_rect( obj, tmp_rects + i++, 0 );
-    }
-
-    return 1;
-}
-
-
-/***************************************
- * Another helper function for fli_recalc_intersections() - to be called when
- * it's finished, restoring all objects 'u_vdata' pointers and getting rid
- * of allocated memory.
- ***************************************/
-
-static void
-finish_recalc( FL_FORM   * form,
-               FL_OBJECT * start_obj )
-{
-    FL_OBJECT *obj;
-    int i = 0;
-
-    if ( ! tmp_vdata )
-        return;
-
-    for ( obj = start_obj ? start_obj : bg_object( form ); obj;
-          obj = obj->next )
-        obj->u_vdata = tmp_vdata[ i++ ];
-
-    fli_safe_free( tmp_rects );
-    fli_safe_free( tmp_vdata );
-}
-   
-
 /***************************************
  * Rechecks for all objects of a form if they are
  * partially or fully hidden by another object
@@ -3268,10 +3433,12 @@ fli_recalc_intersections( FL_FORM * form )
     if ( fl_current_form || ! form || ( form && form->frozen ) )
         return;
 
-    prep_recalc( form, NULL );
+    /* Objects may have been moved or resized directly */
+
+    fli_resync_object_index( form );
+
     for ( obj = bg_object( form ); obj && obj->next; obj = obj->next )
         obj->is_under = object_is_under( obj );
-    finish_recalc( form, NULL );
 }
 
 
@@ -3374,6 +3541,7 @@ fl_set_object_position( FL_OBJECT * obj,
     }
 
     fli_handle_object( obj, FL_MOVEORIGIN, 0, 0, 0, NULL, 0 );
+    fli_update_object_index( obj );
 
     if ( need_show )
         fl_show_object( obj );
@@ -3476,6 +3644,8 @@ fl_set_object_size( FL_OBJECT * obj,
     if ( obj->child )
         fli_composite_has_been_resized( obj );
 
+    fli_update_object_index( obj );
+
     if ( need_show )
         fl_show_object( obj );
 }
@@ -3526,7 +3696,7 @@ fl_get_object_bbox( FL_OBJECT * obj,
 {
     XRectangle rect;
 
-    get_object_rect( obj, &rect, 0 );
+    fli_get_object_rect( obj, &rect, 0 );
 
     *x = rect.x;
     if ( ! fli_inverted_y || ! obj->form )
@@ -3595,10 +3765,10 @@ get_label_rect( const FL_OBJECT * obj,
  * Returns the area covered by the object and its label via a FL_RECT
  ***************************************/
 
-static void
-get_object_rect( const FL_OBJECT * obj,
-                 FL_RECT         * rect,
-                 int               extra )
+void
+fli_get_object_rect( const FL_OBJECT * obj,
+                     FL_RECT         * rect,
+                     int               extra )
 {
     if (    obj->objclass == FL_FRAME
          || obj->objclass == FL_LABELFRAME
@@ -3800,6 +3970,10 @@ fl_set_object_return( FL_OBJECT    * obj,
 
 
 /***************************************
+ * Tells an object (and the library) about a change of one of its
+ * attributes (FL_ATTRIB) or of its geometry (FL_RESIZED or
+ * FL_MOVEORIGIN) that was made by writing to its members directly.
+ * Must be called after changing x, y, w or h that way.
  ***************************************/
 
 void
@@ -3816,6 +3990,19 @@ fli_notify_object( FL_OBJECT * obj,
 }
 
 
+/***************************************
+ * Public version of fli_notify_object() for programs that change
+ * an object's members directly
+ ***************************************/
+
+void
+fl_notify_object( FL_OBJECT * obj,
+                  int         cause )
+{
+    fli_notify_object( obj, cause );
+}
+
+
 /***************************************
  * Sets the visibility flag for an object and all its children
  * without inducing a redraw. Used e.g. in browser and multi-
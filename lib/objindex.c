@@ -0,0 +1,541 @@
+/*
+ *  This file is part of the XForms library package.
+ *
+ *  XForms is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1, or
+ *  (at your option) any later version.
+ *
+ *  XForms is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with XForms.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * \file objindex.c
+ *
+ *  Spatial index of the objects of a form. The area covered by each
+ *  object (including a label outside of it) gets stored in a uniform
+ *  grid of square cells spanning the form, so the objects within a
+ *  rectangle can be found without looking at all objects of the form.
+ *  Objects (partially) outside of the form are kept in the cells at
+ *  its border.
+ *
+ *  The index is created when it's needed for the first time. After that
+ *  it's kept up to date while objects get added, removed, moved or
+ *  resized and only gets rebuilt completely when the form changes its
+ *  size or gets shown or when a lot of objects got added.
+ *
+ *  Code changing the x, y, w or h members of an object directly instead
+ *  of using the library's functions must afterwards tell the library by
+ *  calling fl_notify_object() with FL_RESIZED, else the object will be
+ *  looked for at its old place (until the form is shown the next time
+ *  or the intersections of its objects get recalculated).
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <limits.h>
+#include "include/forms.h"
+#include "flinternal.h"
+
+
+#define MIN_CELL_SIZE    16
+#define MIN_CELL_COUNT   1024
+
+typedef struct {
+    FLI_INDEX_ENTRY ** entries;
+    int                n;
+    int                alloc;
+} CELL;
+
+struct fli_obj_index_ {
+    int                dirty;          /* needs to be rebuilt */
+    int                order_dirty;    /* objects need to be renumbered */
+    int                max_order;
+    int                cell_size;
+    int                ncols,
+                       nrows;
+    CELL             * cells;
+    FLI_INDEX_ENTRY ** entries;        /* one for each object */
+    int                nentries;
+    int                alloc;
+    int                built_for;      /* number of entries when built */
+    FLI_INDEX_ENTRY ** result;         /* result of the last query */
+    int                stamp;          /* number of the current query */
+};
+
+
+/***************************************
+ * Returns the range of cells a rectangle falls into
+ ***************************************/
+
+static void
+get_cell_range( FLI_OBJ_INDEX * idx,
+                const FL_RECT * rect,
+                int           * cx1,
+                int           * cy1,
+                int           * cx2,
+                int           * cy2 )
+{
+    int x2 = rect->x + rect->width  - 1,
+        y2 = rect->y + rect->height - 1;
+
+    *cx1 = rect->x < 0 ? 0 : FL_min( rect->x / idx->cell_size, idx->ncols - 1 );
+    *cy1 = rect->y < 0 ? 0 : FL_min( rect->y / idx->cell_size, idx->nrows - 1 );
+    *cx2 = x2 < 0 ? 0 : FL_min( x2 / idx->cell_size, idx->ncols - 1 );
+    *cy2 = y2 < 0 ? 0 : FL_min( y2 / idx->cell_size, idx->nrows - 1 );
+}
+
+
+/***************************************
+ * Stores an entry in all cells covered by its rectangle
+ ***************************************/
+
+static void
+add_to_cells( FLI_OBJ_INDEX   * idx,
+              FLI_INDEX_ENTRY * e )
+{
+    int x,
+        y;
+
+    get_cell_range( idx, &e->rect, &e->cx1, &e->cy1, &e->cx2, &e->cy2 );
+
+    for ( y = e->cy1; y <= e->cy2; y++ )
+        for ( x = e->cx1; x <= e->cx2; x++ )
+        {
+            CELL *cell = idx->cells + y * idx->ncols + x;
+
+            if ( cell->n == cell->alloc )
+            {
+                cell->alloc = cell->alloc ? 2 * cell->alloc : 4;
+                cell->entries = fl_realloc( cell->entries,
+                                            cell->alloc
+                                            * sizeof *cell->entries );
+            }
+
+            cell->entries[ cell->n++ ] = e;
+        }
+}
+
+
+/***************************************
+ * Removes an entry from all cells it's stored in
+ ***************************************/
+
+static void
+remove_from_cells( FLI_OBJ_INDEX   * idx,
+                   FLI_INDEX_ENTRY * e )
+{
+    int x,
+        y,
+        i;
+
+    for ( y = e->cy1; y <= e->cy2; y++ )
+        for ( x = e->cx1; x <= e->cx2; x++ )
+        {
+            CELL *cell = idx->cells + y * idx->ncols + x;
+
+            for ( i = 0; i < cell->n; i++ )
+                if ( cell->entries[ i ] == e )
+                {
+                    cell->entries[ i ] = cell->entries[ --cell->n ];
+                    break;
+                }
+        }
+}
+
+
+/***************************************
+ * Creates a new entry for an object (without adding it to the cells)
+ ***************************************/
+
+static FLI_INDEX_ENTRY *
+new_entry( FLI_OBJ_INDEX * idx,
+           FL_OBJECT     * obj )
+{
+    FLI_INDEX_ENTRY *e = fl_malloc( sizeof *e );
+
+    if ( idx->nentries == idx->alloc )
+    {
+        idx->alloc = idx->alloc ? 2 * idx->alloc : 64;
+        idx->entries = fl_realloc( idx->entries,
+                                   idx->alloc * sizeof *idx->entries );
+        idx->result  = fl_realloc( idx->result,
+                                   idx->alloc * sizeof *idx->result );
+    }
+
+    e->obj   = obj;
+    e->stamp = 0;
+    e->pos   = idx->nentries;
+    fli_get_object_rect( obj, &e->rect, 0 );
+
+    idx->entries[ idx->nentries++ ] = e;
+    obj->objindex = e;
+
+    return e;
+}
+
+
+/***************************************
+ * Throws away the contents of the index
+ ***************************************/
+
+static void
+clear_index( FLI_OBJ_INDEX * idx )
+{
+    int i;
+
+    for ( i = 0; i < idx->ncols * idx->nrows; i++ )
+        fl_free( idx->cells[ i ].entries );
+
+    for ( i = 0; i < idx->nentries; i++ )
+    {
+        idx->entries[ i ]->obj->objindex = NULL;
+        fl_free( idx->entries[ i ] );
+    }
+
+    fli_safe_free( idx->cells );
+    fli_safe_free( idx->entries );
+    fli_safe_free( idx->result );
+    idx->ncols = idx->nrows = idx->nentries = idx->alloc = 0;
+}
+
+
+/***************************************
+ * Numbers the objects of the form in the order they're drawn
+ ***************************************/
+
+static void
+renumber( FLI_OBJ_INDEX * idx,
+          FL_FORM       * form )
+{
+    FL_OBJECT *obj;
+    int order = 0;
+
+    for ( obj = form->first; obj; obj = obj->next, order++ )
+        if ( obj->objindex )
+            ( ( FLI_INDEX_ENTRY * ) obj->objindex )->order = order;
+
+    idx->max_order   = order;
+    idx->order_dirty = 0;
+}
+
+
+/***************************************
+ * Creates the index anew from the objects of the form. The cells are
+ * made about as large as the average object (so most objects only are
+ * in a few cells) but not so small that there are a lot more cells
+ * than objects.
+ ***************************************/
+
+static void
+build_index( FLI_OBJ_INDEX * idx,
+             FL_FORM       * form )
+{
+    FL_OBJECT *obj;
+    long size = 0;
+    int i;
+
+    clear_index( idx );
+
+    for ( obj = form->first; obj; obj = obj->next )
+        if ( obj->objclass != FL_BEGIN_GROUP && obj->objclass != FL_END_GROUP )
+        {
+            FLI_INDEX_ENTRY *e = new_entry( idx, obj );
+
+            size += FL_max( e->rect.width, e->rect.height );
+        }
+
+    renumber( idx, form );
+
+    idx->built_for = idx->nentries;
+    idx->stamp     = 0;
+    idx->cell_size = idx->nentries ?
+                     FL_max( size / idx->nentries, MIN_CELL_SIZE ) :
+                     MIN_CELL_SIZE;
+
+    while ( 1 )
+    {
+        idx->ncols = FL_max( ( form->w + idx->cell_size - 1 ) / idx->cell_size,
+                             1 );
+        idx->nrows = FL_max( ( form->h + idx->cell_size - 1 ) / idx->cell_size,
+                             1 );
+
+        if (    idx->ncols * idx->nrows
+             <= FL_max( MIN_CELL_COUNT, 4 * idx->nentries ) )
+            break;
+
+        idx->cell_size *= 2;
+    }
+
+    idx->cells = fl_calloc( idx->ncols * idx->nrows, sizeof *idx->cells );
+
+    for ( i = 0; i < idx->nentries; i++ )
+        add_to_cells( idx, idx->entries[ i ] );
+
+    idx->dirty = 0;
+}
+
+
+/***************************************
+ * Returns the index of a form, (re)building it if necessary
+ ***************************************/
+
+static FLI_OBJ_INDEX *
+get_index( FL_FORM * form )
+{
+    FLI_OBJ_INDEX *idx = form->objindex;
+
+    if ( ! idx )
+    {
+        idx = form->objindex = fl_calloc( 1, sizeof *idx );
+        idx->dirty = 1;
+    }
+
+    if ( idx->dirty )
+        build_index( idx, form );
+    else if ( idx->order_dirty )
+        renumber( idx, form );
+
+    return idx;
+}
+
+
+/***************************************
+ * To be called when the area all objects cover may have changed, e.g.
+ * because the form got resized
+ ***************************************/
+
+void
+fli_invalidate_object_index( FL_FORM * form )
+{
+    if ( form && form->objindex )
+        ( ( FLI_OBJ_INDEX * ) form->objindex )->dirty = 1;
+}
+
+
+/***************************************
+ * To be called after an object has been linked into its form
+ ***************************************/
+
+void
+fli_add_to_object_index( FL_OBJECT * obj )
+{
+    FLI_OBJ_INDEX *idx = obj->form ? obj->form->objindex : NULL;
+    FLI_INDEX_ENTRY *e;
+
+    if (    ! idx
+         || obj->objclass == FL_BEGIN_GROUP
+         || obj->objclass == FL_END_GROUP )
+        return;
+
+    e = new_entry( idx, obj );
+
+    /* Objects appended to the form are on top of all others, for objects
+       inserted somewhere else all objects must be renumbered */
+
+    if ( obj->next )
+        idx->order_dirty = 1;
+    else
+        e->order = idx->max_order++;
+
+    /* If the index was built for a lot fewer objects the cells may have
+       become too crowded, then it's time to start anew */
+
+    if ( idx->dirty || idx->nentries > 2 * idx->built_for + 64 )
+    {
+        idx->dirty = 1;
+        e->cx1 = e->cy1 = 0;
+        e->cx2 = e->cy2 = -1;
+    }
+    else
+        add_to_cells( idx, e );
+}
+
+
+/***************************************
+ * To be called before an object gets unlinked from its form
+ ***************************************/
+
+void
+fli_remove_from_object_index( FL_OBJECT * obj )
+{
+    FLI_INDEX_ENTRY *e = obj->objindex;
+    FLI_OBJ_INDEX *idx;
+
+    if ( ! e || ! obj->form || ! ( idx = obj->form->objindex ) )
+        return;
+
+    remove_from_cells( idx, e );
+
+    idx->entries[ e->pos ] = idx->entries[ --idx->nentries ];
+    idx->entries[ e->pos ]->pos = e->pos;
+
+    fl_free( e );
+    obj->objindex = NULL;
+}
+
+
+/***************************************
+ * Moves an entry to the cells for the area its object covers now (if
+ * that has changed)
+ ***************************************/
+
+static void
+update_entry( FLI_OBJ_INDEX   * idx,
+              FLI_INDEX_ENTRY * e )
+{
+    FL_RECT rect;
+
+    fli_get_object_rect( e->obj, &rect, 0 );
+
+    if (    rect.x      == e->rect.x
+         && rect.y      == e->rect.y
+         && rect.width  == e->rect.width
+         && rect.height == e->rect.height )
+        return;
+
+    remove_from_cells( idx, e );
+    e->rect = rect;
+    add_to_cells( idx, e );
+}
+
+
+/***************************************
+ * To be called when the area covered by an object (or its child objects)
+ * may have changed
+ ***************************************/
+
+void
+fli_update_object_index( FL_OBJECT * obj )
+{
+    FLI_INDEX_ENTRY *e = obj->objindex;
+    FLI_OBJ_INDEX *idx;
+    FL_OBJECT *child;
+
+    for ( child = obj->child; child; child = child->nc )
+        fli_update_object_index( child );
+
+    if ( ! e || ! obj->form || ! ( idx = obj->form->objindex ) || idx->dirty )
+        return;
+
+    update_entry( idx, e );
+}
+
+
+/***************************************
+ * Brings the entries of all objects of the form up to date. To be
+ * called where objects may have been moved or resized by writing to
+ * their x, y, w and h members without the library being told about it
+ * (via fl_notify_object())
+ ***************************************/
+
+void
+fli_resync_object_index( FL_FORM * form )
+{
+    FLI_OBJ_INDEX *idx;
+    int i;
+
+    if ( ! form || ! ( idx = form->objindex ) || idx->dirty )
+        return;
+
+    for ( i = 0; i < idx->nentries; i++ )
+        update_entry( idx, idx->entries[ i ] );
+}
+
+
+/***************************************
+ ***************************************/
+
+void
+fli_free_object_index( FL_FORM * form )
+{
+    if ( ! form || ! form->objindex )
+        return;
+
+    clear_index( form->objindex );
+    fli_safe_free( form->objindex );
+}
+
+
+/***************************************
+ * Finds all objects of the form (whether visible or not) that intersect
+ * with a rectangle. Returns their number and, via 'result', an array of
+ * pointers to their entries in the index (in no particular order). The
+ * array remains valid until the next query or change of the form.
+ ***************************************/
+
+int
+fli_query_object_index( FL_FORM            * form,
+                        const FL_RECT      * rect,
+                        FLI_INDEX_ENTRY  *** result )
+{
+    FLI_OBJ_INDEX *idx = get_index( form );
+    int cx1,
+        cy1,
+        cx2,
+        cy2;
+    int x,
+        y,
+        i;
+    int cnt = 0;
+
+    *result = idx->result;
+
+    if ( ! idx->nentries || rect->width <= 0 || rect->height <= 0 )
+        return 0;
+
+    /* Each query gets a new number, and entries already looked at during
+       the query get marked with it since objects can be in several cells */
+
+    if ( idx->stamp == INT_MAX )
+    {
+        for ( i = 0; i < idx->nentries; i++ )
+            idx->entries[ i ]->stamp = 0;
+        idx->stamp = 0;
+    }
+
+    idx->stamp++;
+
+    get_cell_range( idx, rect, &cx1, &cy1, &cx2, &cy2 );
+
+    for ( y = cy1; y <= cy2; y++ )
+        for ( x = cx1; x <= cx2; x++ )
+        {
+            CELL *cell = idx->cells + y * idx->ncols + x;
+
+            for ( i = 0; i < cell->n; i++ )
+            {
+                FLI_INDEX_ENTRY *e = cell->entries[ i ];
+
+                if ( e->stamp == idx->stamp )
+                    continue;
+
+                e->stamp = idx->stamp;
+
+                if (    e->rect.x + e->rect.width  > rect->x
+                     && rect->x + rect->width      > e->rect.x
+                     && e->rect.y + e->rect.height > rect->y
+                     && rect->y + rect->height     > e->rect.y )
+                    idx->result[ cnt++ ] = e;
+            }
+        }
+
+    return cnt;
+}
+
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -3406,7 +3406,6 @@ popup_interaction( FL_POPUP * popup )
     FL_POPUP *p;
     FL_POPUP_ENTRY *e = NULL;
     XEvent ev;
-    int timer_cnt = 0;
 
     ev.xmotion.time = 0;                  /* for fli_handle_idling() */
 
@@ -3418,22 +3417,16 @@ popup_interaction( FL_POPUP * popup )
             fli_handle_timeouts( &msec );
 
         /* Check for new event for the popup window, if there's none deal
-           with idle tasks */
+           with idle tasks (which waits for the next event to arrive) */
 
         if ( ! XCheckWindowEvent( flx->display, popup->win, popup->event_mask,
                                   &ev ) )
         {
-            if ( timer_cnt++ % 10 == 0 )
-            {
-                timer_cnt = 0;
-                fli_handle_idling( &ev, msec, 1 );
-                fl_winset( popup->win );
-            }
-
+            fli_handle_idling( &ev, msec, 1 );
+            fl_winset( popup->win );
             continue;
         }
 
-        timer_cnt = 0;
         fli_int.query_age++;
 
         switch ( ev.type )
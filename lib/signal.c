@@ -36,9 +36,89 @@
 #include <stdlib.h>
 #include <signal.h>
 
+#ifndef FL_WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
 
 void ( * fli_handle_signal )( void ) = NULL;   /* also needed in handling.c */
 
+/* Pipe a byte gets written to for each caught signal. Its read end is
+   watched like any other input, so a signal that arrives just before
+   the main loop goes to sleep still wakes it up at once */
+
+static int sig_pipe[ 2 ] = { -1, -1 };
+
+
+/***************************************
+ * IO callback for the pipe, just empties it - the signals themselves
+ * get dealt with when the main loop calls handle_signal()
+ ***************************************/
+
+static void
+clear_signal_pipe( int    fd,
+                   void * data  FL_UNUSED_ARG )
+{
+#ifndef FL_WIN32
+    char buf[ 64 ];
+
+    while ( read( fd, buf, sizeof buf ) > 0 )
+        /* empty */ ;
+#endif
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+open_signal_pipe( void )
+{
+#ifndef FL_WIN32
+    int i;
+
+    if ( sig_pipe[ 0 ] >= 0 )
+        return;
+
+    if ( pipe( sig_pipe ) < 0 )
+    {
+        M_err( "open_signal_pipe", fli_get_syserror_msg( ) );
+        sig_pipe[ 0 ] = sig_pipe[ 1 ] = -1;
+        return;
+    }
+
+    for ( i = 0; i < 2; i++ )
+    {
+        fcntl( sig_pipe[ i ], F_SETFL,
+               fcntl( sig_pipe[ i ], F_GETFL ) | O_NONBLOCK );
+        fcntl( sig_pipe[ i ], F_SETFD, FD_CLOEXEC );
+    }
+
+    fl_add_io_callback( sig_pipe[ 0 ], FL_READ, clear_signal_pipe, NULL );
+#endif
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+close_signal_pipe( void )
+{
+#ifndef FL_WIN32
+    if ( sig_pipe[ 0 ] < 0 )
+        return;
+
+    if ( fli_is_watched_io( sig_pipe[ 0 ] ) )
+        fl_remove_io_callback( sig_pipe[ 0 ], FL_READ, clear_signal_pipe );
+
+    close( sig_pipe[ 0 ] );
+    close( sig_pipe[ 1 ] );
+    sig_pipe[ 0 ] = sig_pipe[ 1 ] = -1;
+#endif
+}
+
 
 /***************************************
  ***************************************/
@@ -107,6 +187,8 @@ fl_add_signal_callback( int                 s,
     if ( ! fli_handle_signal )
         fli_handle_signal = handle_signal;
 
+    open_signal_pipe( );
+
     while ( rec && rec->signum != s )
         rec = rec->next;
 
@@ -210,6 +292,19 @@ fl_signal_caught( int s )
 
     rec->caught++;
 
+#ifndef FL_WIN32
+    /* Wake up the main loop, write() is safe to use in a signal handler */
+
+    if ( sig_pipe[ 1 ] >= 0 )
+    {
+        int save_errno = errno;
+        ssize_t n = write( sig_pipe[ 1 ], "", 1 );
+
+        ( void ) n;
+        errno = save_errno;
+    }
+#endif
+
 #if ! defined HAVE_SIGACTION
     if ( ! sig_direct && ! IsDangerous( s ) )
         signal( s, default_signal_handler );
@@ -237,6 +332,8 @@ fli_remove_all_signal_callbacks( void )
 {
     while ( fli_context->signal_rec )
         fl_remove_signal_callback( fli_context->signal_rec->signum );
+
+    close_signal_pipe( );
 }
 
 
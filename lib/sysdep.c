@@ -235,6 +235,31 @@ fl_gettime( long * sec,
 }
 
 
+/*************************************************************
+ * Like fl_gettime(), but for a clock that only ever advances
+ * steadily, i.e. isn't affected by changes of the system time.
+ * Only differences of the values returned are meaningful.
+ ************************************************************/
+
+void
+fli_get_monotonic_time( long * sec,
+                        long * usec )
+{
+#if defined HAVE_CLOCK_GETTIME && defined CLOCK_MONOTONIC
+    struct timespec ts;
+
+    if ( clock_gettime( CLOCK_MONOTONIC, &ts ) == 0 )
+    {
+        *sec  = ts.tv_sec;
+        *usec = ts.tv_nsec / 1000;
+        return;
+    }
+#endif
+
+    fl_gettime( sec, usec );
+}
+
+
 /***************************************
  ***************************************/
 
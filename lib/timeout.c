@@ -24,6 +24,14 @@
  *  All rights reserved.
  *
  * Check timeout
+ *
+ * Pending timeouts are kept in a binary heap ordered by their expiry
+ * times, so the next one to expire is always at the top. Expiry times
+ * are absolute times of a monotonic clock, so changes of the system
+ * time neither make timeouts expire early nor delay them. To find a
+ * timeout by its ID (for fl_remove_timeout()) there's also a hash table.
+ * Adding and removing a timeout thus takes O(log n) time and checking
+ * for expired timeouts doesn't depend on the number of timeouts at all.
  */
 
 #ifdef HAVE_CONFIG_H
@@ -34,73 +42,249 @@
 #include "flinternal.h"
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <time.h>
 #include <ctype.h>
 #include <sys/types.h>
 
 long msec0 = 0;
 
+static FLI_TIMEOUT_REC **heap;
+static int heap_size,
+           heap_alloc;
+
+static FLI_TIMEOUT_REC **id_hash;
+static int hash_size,                /* always a power of 2 */
+           hash_count;
+
+#define HASH( id )  ( ( unsigned int ) ( id ) & ( hash_size - 1 ) )
+
+#define EARLIER( a, b )   (    ( a )->sec < ( b )->sec               \
+                            || (    ( a )->sec == ( b )->sec         \
+                                 && ( a )->usec < ( b )->usec ) )
+
 
 /***************************************
  ***************************************/
 
-int
-fl_add_timeout( long                  msec,
-                FL_TIMEOUT_CALLBACK   callback,
-                void                * data )
+static void
+set_slot( int               i,
+          FLI_TIMEOUT_REC * rec )
+{
+    heap[ i ] = rec;
+    rec->slot = i;
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+sift_up( int i )
+{
+    FLI_TIMEOUT_REC *rec = heap[ i ];
+
+    while ( i > 0 && EARLIER( rec, heap[ ( i - 1 ) / 2 ] ) )
+    {
+        set_slot( i, heap[ ( i - 1 ) / 2 ] );
+        i = ( i - 1 ) / 2;
+    }
+
+    set_slot( i, rec );
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+sift_down( int i )
+{
+    FLI_TIMEOUT_REC *rec = heap[ i ];
+    int c;
+
+    while ( ( c = 2 * i + 1 ) < heap_size )
+    {
+        if ( c + 1 < heap_size && EARLIER( heap[ c + 1 ], heap[ c ] ) )
+            c++;
+
+        if ( ! EARLIER( heap[ c ], rec ) )
+            break;
+
+        set_slot( i, heap[ c ] );
+        i = c;
+    }
+
+    set_slot( i, rec );
+}
+
+
+/***************************************
+ * Removes a timeout from the heap
+ ***************************************/
+
+static void
+heap_remove( FLI_TIMEOUT_REC * rec )
+{
+    FLI_TIMEOUT_REC *moved;
+    int i = rec->slot;
+
+    /* Fill the hole with the last element and move that to where it
+       belongs (either up or down) */
+
+    if ( i != --heap_size )
+    {
+        moved = heap[ heap_size ];
+        set_slot( i, moved );
+        sift_up( i );
+        sift_down( moved->slot );
+    }
+
+    rec->slot = -1;
+    fli_context->timeout_rec = heap_size ? heap[ 0 ] : NULL;
+}
+
+
+/***************************************
+ ***************************************/
+
+static FLI_TIMEOUT_REC *
+hash_find( int id )
 {
     FLI_TIMEOUT_REC *rec;
-    static int id = 1;
 
-    rec = fl_malloc( sizeof *rec );
-    fl_gettime( &rec->start_sec, &rec->start_usec );
+    if ( ! hash_size )
+        return NULL;
 
-    rec->id         = id;
-    rec->ms_to_wait = FL_max( msec, 0 );
-    rec->callback   = callback;
-    rec->data       = data;
-    rec->prev       = NULL;
+    for ( rec = id_hash[ HASH( id ) ]; rec && rec->id != id; rec = rec->hnext )
+        /* empty */ ;
 
-    /* Make it the start of the (doubly) linked list */
+    return rec;
+}
 
-    rec->next = fli_context->timeout_rec;
-    if ( fli_context->timeout_rec )
-        fli_context->timeout_rec->prev = rec;
-    fli_context->timeout_rec = rec;
 
-    /* Deal with wrap around of IDs- rather unlikely to happen but if it does
-       it's not a 100% safe way to do it, we can only bet on the chance that
-       the timeouts with the re-used numbers have expired a long time ago... */
+/***************************************
+ ***************************************/
 
-    if ( id++ <= 0 )
-        id = 1;
+static int
+hash_insert( FLI_TIMEOUT_REC * rec )
+{
+    /* Keep the chains short by doubling the size of the table whenever
+       there are more entries than slots */
 
-    return rec->id;
+    if ( hash_count >= hash_size )
+    {
+        int n = hash_size ? 2 * hash_size : 64,
+            i;
+        FLI_TIMEOUT_REC **t = fl_calloc( n, sizeof *t ),
+                        *r,
+                        *next;
+
+        if ( ! t )
+            return -1;
+
+        for ( i = 0; i < hash_size; i++ )
+            for ( r = id_hash[ i ]; r; r = next )
+            {
+                next = r->hnext;
+                r->hnext = t[ ( unsigned int ) r->id & ( n - 1 ) ];
+                t[ ( unsigned int ) r->id & ( n - 1 ) ] = r;
+            }
+
+        fli_safe_free( id_hash );
+        id_hash = t;
+        hash_size = n;
+    }
+
+    rec->hnext = id_hash[ HASH( rec->id ) ];
+    id_hash[ HASH( rec->id ) ] = rec;
+    hash_count++;
+
+    return 0;
 }
 
 
 /***************************************
- * Internal function for remving a timeout - remove
- * it from the (doubly) linked list and free memory
  ***************************************/
 
 static void
-remove_timeout( FLI_TIMEOUT_REC * rec )
+hash_remove( FLI_TIMEOUT_REC * rec )
 {
-    if ( rec == fli_context->timeout_rec )
+    FLI_TIMEOUT_REC **p = id_hash + HASH( rec->id );
+
+    while ( *p != rec )
+        p = &( *p )->hnext;
+
+    *p = rec->hnext;
+    hash_count--;
+}
+
+
+/***************************************
+ ***************************************/
+
+int
+fl_add_timeout( long                  msec,
+                FL_TIMEOUT_CALLBACK   callback,
+                void                * data )
+{
+    FLI_TIMEOUT_REC *rec;
+    static int id = 1;
+
+    if ( heap_size == heap_alloc )
+    {
+        int n = heap_alloc ? 2 * heap_alloc : 64;
+        FLI_TIMEOUT_REC **h = fl_realloc( heap, n * sizeof *h );
+
+        if ( ! h )
+        {
+            M_err( "fl_add_timeout", "Running out of memory" );
+            return 0;
+        }
+
+        heap = h;
+        heap_alloc = n;
+    }
+
+    if ( ! ( rec = fl_malloc( sizeof *rec ) ) )
     {
-        fli_context->timeout_rec = rec->next;
-        if ( rec->next )
-            fli_context->timeout_rec->prev = NULL;
+        M_err( "fl_add_timeout", "Running out of memory" );
+        return 0;
     }
-    else
+
+    /* Deal with wrap around of IDs - skip those still in use */
+
+    while ( hash_find( id ) )
+        id = id < INT_MAX ? id + 1 : 1;
+
+    rec->id       = id;
+    rec->callback = callback;
+    rec->data     = data;
+
+    if ( hash_insert( rec ) < 0 )
+    {
+        M_err( "fl_add_timeout", "Running out of memory" );
+        fl_free( rec );
+        return 0;
+    }
+
+    id = id < INT_MAX ? id + 1 : 1;
+
+    msec = FL_max( msec, 0 );
+    fli_get_monotonic_time( &rec->sec, &rec->usec );
+    rec->sec  += msec / 1000;
+    rec->usec += 1000 * ( msec % 1000 );
+    if ( rec->usec >= 1000000 )
     {
-        rec->prev->next = rec->next;
-        if ( rec->next )
-            rec->next->prev = rec->prev;
+        rec->sec++;
+        rec->usec -= 1000000;
     }
 
-    fl_free( rec );
+    set_slot( heap_size++, rec );
+    sift_up( rec->slot );
+    fli_context->timeout_rec = heap[ 0 ];
+
+    return rec->id;
 }
 
 
@@ -111,15 +295,26 @@ remove_timeout( FLI_TIMEOUT_REC * rec )
 void
 fl_remove_timeout( int id )
 {
-    FLI_TIMEOUT_REC *rec = fli_context->timeout_rec;
+    FLI_TIMEOUT_REC *rec = hash_find( id );
 
-    while ( rec && rec->id != id )
-        rec = rec->next;
+    if ( ! rec )
+    {
+        M_err( "fl_remove_timeout", "ID %d not found", id );
+        return;
+    }
+
+    hash_remove( rec );
 
-    if ( rec )
-        remove_timeout( rec );
+    /* If it already expired fli_handle_timeouts() is about to deal with
+       it and also deletes it, just tell it not to invoke the handler */
+
+    if ( rec->slot < 0 )
+        rec->slot = -2;
     else
-        M_err( "fl_remove_timeout", "ID %d not found", id );
+    {
+        heap_remove( rec );
+        fl_free( rec );
+    }
 }
 
 
@@ -127,49 +322,79 @@ fl_remove_timeout( int id )
  * Function that periodically gets called to deal with expired
  * timeouts, invoking their handlers and removing them. Via the
  * argument the time until the next timeout expires gets returned
- * (if this is earlier than the original value).
+ * (if this is earlier than the original value or that is negative,
+ * i.e. stands for no limit). Returns the number of handlers invoked.
  ***************************************/
 
-void
+int
 fli_handle_timeouts( long * msec )
 {
-    FLI_TIMEOUT_REC *rec,
-                    *next;
-    long sec = 0,
-         usec,
-         elapsed,
-         diff;
+    FLI_TIMEOUT_REC now,
+                    *rec,
+                    *due = NULL,
+                    **last = &due;
+    long diff;
+    int count = 0;
 
-    if ( ! fli_context->timeout_rec )
-        return;
+    if ( ! heap_size )
+        return 0;
 
-    fl_gettime( &sec, &usec );
+    fli_get_monotonic_time( &now.sec, &now.usec );
 
-    /* Loop over all candidates, dealing with those that expired and
-       removing them, while also keeping looking for the time the next
-       one is going to expire */
+    /* First take all expired timeouts out of the heap, so timeouts added
+       by the handlers can't get invoked before the next round (and thus
+       can't keep us running in circles) */
 
-    for ( rec = fli_context->timeout_rec; rec; rec = next )
+    while ( heap_size && ! EARLIER( &now, heap[ 0 ] ) )
     {
-        next = rec->next;
+        rec = heap[ 0 ];
+        heap_remove( rec );
+        rec->due_next = NULL;
+        *last = rec;
+        last = &rec->due_next;
+    }
 
-        elapsed =   1000 * ( sec - rec->start_sec )
-                  + ( usec - rec->start_usec ) / 1000;
-        diff = rec->ms_to_wait - elapsed;
+    /* Now invoke their handlers (unless one of the handlers removed
+       one of the following timeouts) */
 
-        if ( diff <= 0 )
+    for ( rec = due; rec; rec = due )
+    {
+        due = rec->due_next;
+
+        if ( rec->slot == -1 )
         {
+            hash_remove( rec );
+
             if ( rec->callback )
             {
                 rec->callback( rec->id, rec->data );
-                fl_gettime( &sec, &usec );
+                count++;
             }
-
-            remove_timeout( rec );
         }
-        else
-            *msec = FL_min( *msec, diff );
+
+        fl_free( rec );
     }
+
+    if ( ! heap_size )
+        return count;
+
+    if ( count )
+        fli_get_monotonic_time( &now.sec, &now.usec );
+
+    /* Round up so we don't wake up too early */
+
+    diff = heap[ 0 ]->usec - now.usec;
+    if ( diff < 0 )
+        diff = 1000 * ( heap[ 0 ]->sec - now.sec - 1 ) + ( diff + 1000999 ) / 1000;
+    else
+        diff = 1000 * ( heap[ 0 ]->sec - now.sec ) + ( diff + 999 ) / 1000;
+
+    diff = FL_max( diff, 0 );
+
+    if ( *msec < 0 || diff < *msec )
+        *msec = diff;
+
+    return count;
 }
 
 
@@ -179,8 +404,31 @@ fli_handle_timeouts( long * msec )
 void
 fli_remove_all_timeouts( void )
 {
-    while ( fli_context->timeout_rec )
-        fl_remove_timeout( fli_context->timeout_rec->id );
+    FLI_TIMEOUT_REC *rec,
+                    *next;
+    int i;
+
+    /* Timeouts that already expired but whose handlers haven't been
+       invoked yet get deleted by fli_handle_timeouts() */
+
+    for ( i = 0; i < hash_size; i++ )
+        for ( rec = id_hash[ i ]; rec; rec = next )
+        {
+            next = rec->hnext;
+
+            if ( rec->slot < 0 )
+                rec->slot = -2;
+            else
+                fl_free( rec );
+        }
+
+    fli_safe_free( id_hash );
+    fli_safe_free( heap );
+    hash_size = hash_count = 0;
+    heap_size = heap_alloc = 0;
+
+    if ( fli_context )
+        fli_context->timeout_rec = NULL;
 }
 
 
@@ -1102,9 +1102,8 @@ static int
 pup_interact( PopUP * m )
 {
     XEvent ev;
-    int val       = 0,
-        done      = 0,
-        timer_cnt = 0;
+    int val  = 0,
+        done = 0;
     MenuItem *item;
 
     m->event_mask |= KeyPressMask;
@@ -1146,16 +1145,13 @@ pup_interact( PopUP * m )
                 break;
             }
 
-            if ( timer_cnt++ % 10 == 0 )
-            {
-                timer_cnt = 0;
-                fli_handle_idling( &ev, msec, 1 );
-                fl_winset( m->win );
-            }
+            /* Deal with idle tasks while waiting for the next event */
+
+            fli_handle_idling( &ev, msec, 1 );
+            fl_winset( m->win );
             continue;
         }
 
-        timer_cnt = 0;
         fli_int.query_age++;
 
         switch ( ev.type )